@@ -0,0 +1,233 @@
+#!/bin/bash
+#
+#Benchmarks dd-parallel against itself (across block sizes, depths, and backends) and against the system dd.
+#Each configuration copies a file made by mktest, and the copy is checked with cktest. Results are CSV (and/or JSON): wall-clock time, throughput, CPU time, and peak memory use, one row per run.
+#Run it from the top of the source tree after building (make bench does both). Run bench.sh --help for the options.
+
+set -u
+
+size=1G
+profile=serial
+dir=
+use_loop=
+block_sizes='128K 1M 8M'
+depths='2 8 32'
+worker_counts='4'
+backends='threads io_uring striped auto adaptive dd'
+runs=1
+csv_path=
+json_path=
+drop_caches=
+keep=
+bin_dir="${BIN_DIR:-bin}"
+
+usage() {
+	cat <<USAGE
+Usage: $0 [options]
+  --size SIZE          Size of the test file, in mktest's units (default $size)
+  --profile NAME       What the test file is full of; any of mktest's profiles (mktest --help lists them; default $profile)
+  --dir DIR            Where to make the test files (default /dev/shm if it exists, so the devices don't dominate; otherwise \$TMPDIR or /tmp)
+  --loop               Copy between loop devices backed by files in DIR, rather than between the files themselves (Linux; needs root)
+  --block-sizes LIST   Block sizes to try (default "$block_sizes")
+  --depths LIST        Pipeline depths to try with the threads and io_uring backends (default "$depths")
+  --workers LIST       Worker counts to try with the striped backend (default "$worker_counts")
+  --backends LIST      Any of: threads io_uring striped auto adaptive dd (default "$backends")
+                       auto is dd-parallel with no options (so it may copy with the kernel); dd is the system dd, as a baseline
+  --runs N             Run each configuration N times (default $runs)
+  --csv FILE           Write results to FILE as CSV
+  --json FILE          Write results to FILE as JSON
+                       With neither, CSV goes to standard output.
+  --drop-caches        Flush and drop the page cache before each run (needs root on Linux; uses purge on macOS)
+  --keep               Don't delete the test files afterward
+USAGE
+}
+
+while [[ $# -gt 0 ]]; do
+	case "$1" in
+		--size) size="$2"; shift 2 ;;
+		--profile) profile="$2"; shift 2 ;;
+		--dir) dir="$2"; shift 2 ;;
+		--loop) use_loop=yes; shift ;;
+		--block-sizes) block_sizes="$2"; shift 2 ;;
+		--depths) depths="$2"; shift 2 ;;
+		--workers) worker_counts="$2"; shift 2 ;;
+		--backends) backends="$2"; shift 2 ;;
+		--runs) runs="$2"; shift 2 ;;
+		--csv) csv_path="$2"; shift 2 ;;
+		--json) json_path="$2"; shift 2 ;;
+		--drop-caches) drop_caches=yes; shift ;;
+		--keep) keep=yes; shift ;;
+		--help) usage; exit 0 ;;
+		*) echo "bench.sh: unrecognized option $1" >&2; usage >&2; exit 64 ;;
+	esac
+done
+
+for tool in dd-parallel mktest cktest runstat; do
+	if [[ ! -x "$bin_dir/$tool" ]]; then
+		echo "bench.sh: $bin_dir/$tool is missing; run make all bin/runstat (or make bench) first" >&2
+		exit 69
+	fi
+done
+
+if [[ -z "$dir" ]]; then
+	if [[ -d /dev/shm && -w /dev/shm ]]; then
+		dir=/dev/shm
+	else
+		dir="${TMPDIR:-/tmp}"
+	fi
+fi
+work_dir="$(mktemp -d "$dir/dd-parallel-bench.XXXXXX")" || exit 73
+input_file="$work_dir/input"
+output_file="$work_dir/output"
+input_loop=
+output_loop=
+
+cleanup() {
+	[[ -n "$input_loop" ]] && losetup -d "$input_loop"
+	[[ -n "$output_loop" ]] && losetup -d "$output_loop"
+	if [[ -z "$keep" ]]; then
+		rm -rf "$work_dir"
+	else
+		echo "bench.sh: test files are in $work_dir" >&2
+	fi
+}
+trap cleanup EXIT
+
+#Converts a size like 128K or 4M to bytes, for dd, which doesn't agree with itself across platforms on suffixes.
+size_in_bytes() {
+	local number="${1%[KkMmGg]}"
+	case "$1" in
+		*[Kk]) echo $((number * 1024)) ;;
+		*[Mm]) echo $((number * 1024 * 1024)) ;;
+		*[Gg]) echo $((number * 1024 * 1024 * 1024)) ;;
+		*) echo "$number" ;;
+	esac
+}
+
+echo "bench.sh: making a $size $profile test file in $work_dir" >&2
+"$bin_dir/mktest" --profile "$profile" "$size" "$input_file" >/dev/null || exit 70
+input_bytes="$(wc -c <"$input_file" | tr -d ' ')"
+source_path="$input_file"
+destination_path="$output_file"
+if [[ -n "$use_loop" ]]; then
+	if [[ "$(uname)" != Linux ]]; then
+		echo "bench.sh: --loop is only supported on Linux" >&2
+		exit 64
+	fi
+	truncate -s "$input_bytes" "$output_file" || exit 73
+	input_loop="$(losetup --find --show "$input_file")" || exit 71
+	output_loop="$(losetup --find --show "$output_file")" || exit 71
+	source_path="$input_loop"
+	destination_path="$output_loop"
+fi
+
+drop_page_cache() {
+	sync
+	if [[ "$(uname)" == Linux ]]; then
+		echo 3 >/proc/sys/vm/drop_caches 2>/dev/null || echo "bench.sh: couldn't drop the page cache (not root?)" >&2
+	else
+		purge 2>/dev/null || echo "bench.sh: couldn't purge the disk cache" >&2
+	fi
+}
+
+results=()
+#Fields: tool backend block_size depth workers run
+record_run() {
+	local tool="$1" backend="$2" block_size="$3" depth="$4" workers="$5" run="$6"
+	shift 6
+	local stats_file="$work_dir/stats" stderr_file="$work_dir/stderr"
+
+	[[ -z "$use_loop" ]] && rm -f "$destination_path"
+	[[ -n "$drop_caches" ]] && drop_page_cache
+	"$bin_dir/runstat" "$stats_file" "$@" >/dev/null 2>"$stderr_file"
+	local wall user system rss status
+	read -r wall user system rss status <"$stats_file"
+
+	if grep -q 'falling back\|not available' "$stderr_file"; then
+		echo "bench.sh: $backend didn't run as asked ($(head -n 1 "$stderr_file")); not recording it" >&2
+		return 1
+	fi
+	if [[ "$status" != 0 ]]; then
+		echo "bench.sh: $tool $backend exited with status $status: $(head -n 1 "$stderr_file")" >&2
+	fi
+
+	local verified=no
+	if "$bin_dir/cktest" --profile "$profile" "$destination_path" >/dev/null 2>"$work_dir/cktest-stderr"; then
+		verified=yes
+	fi
+	local throughput
+	throughput="$(awk -v bytes="$input_bytes" -v seconds="$wall" 'BEGIN { printf "%.0f", (seconds > 0 ? bytes / seconds : 0) }')"
+	results+=("$tool,$backend,$block_size,$depth,$workers,$run,$input_bytes,$wall,$user,$system,$rss,$throughput,$verified,$status")
+	echo "bench.sh: $tool $backend bs=${block_size:--} depth=${depth:--} workers=${workers:--} run $run: $(awk -v t="$throughput" 'BEGIN { printf "%.1f MiB/sec", t / 1048576 }'), verified=$verified" >&2
+}
+
+dd_parallel="$bin_dir/dd-parallel"
+for backend in $backends; do
+	for ((run = 1; run <= runs; ++run)); do
+		case "$backend" in
+			threads|io_uring)
+				for block_size in $block_sizes; do
+					for depth in $depths; do
+						record_run dd-parallel "$backend" "$(size_in_bytes "$block_size")" "$depth" '' "$run" \
+							"$dd_parallel" --no-kernel-copy --backend "$backend" --block-size "$block_size" --depth "$depth" "$source_path" "$destination_path" || continue 4
+					done
+				done
+				;;
+			striped)
+				for block_size in $block_sizes; do
+					for workers in $worker_counts; do
+						record_run dd-parallel striped "$(size_in_bytes "$block_size")" '' "$workers" "$run" \
+							"$dd_parallel" --no-kernel-copy --workers "$workers" --block-size "$block_size" "$source_path" "$destination_path" || continue 4
+					done
+				done
+				;;
+			auto)
+				record_run dd-parallel auto '' '' '' "$run" "$dd_parallel" "$source_path" "$destination_path"
+				;;
+			adaptive)
+				record_run dd-parallel adaptive '' '' '' "$run" "$dd_parallel" --no-kernel-copy --adaptive "$source_path" "$destination_path"
+				;;
+			dd)
+				for block_size in $block_sizes; do
+					record_run dd dd "$(size_in_bytes "$block_size")" '' '' "$run" \
+						dd if="$source_path" of="$destination_path" bs="$(size_in_bytes "$block_size")"
+				done
+				;;
+			*)
+				echo "bench.sh: unknown backend $backend" >&2
+				exit 64
+				;;
+		esac
+	done
+done
+
+csv_header='tool,backend,block_size,depth,workers,run,bytes,wall_seconds,user_seconds,system_seconds,peak_rss_bytes,bytes_per_second,verified,exit_status'
+write_csv() {
+	echo "$csv_header"
+	printf '%s\n' "${results[@]}"
+}
+write_json() {
+	printf '%s\n' "${results[@]}" | awk -F, -v header="$csv_header" '
+		BEGIN { numFields = split(header, names, ","); print "[" }
+		{
+			printf "%s\t{", (NR > 1 ? ",\n" : "")
+			for (i = 1; i <= numFields; ++i) {
+				value = $i
+				#Strings get quoted; numbers (including empty ones, which become null) do not.
+				if (value == "") value = "null"
+				else if (value !~ /^-?[0-9.]+$/) value = "\"" value "\""
+				printf "%s\"%s\": %s", (i > 1 ? ", " : ""), names[i], value
+			}
+			printf "}"
+		}
+		END { print "\n]" }
+	'
+}
+if [[ ${#results[@]} -eq 0 ]]; then
+	echo "bench.sh: nothing was recorded" >&2
+	exit 1
+fi
+[[ -n "$csv_path" ]] && write_csv >"$csv_path"
+[[ -n "$json_path" ]] && write_json >"$json_path"
+[[ -z "$csv_path" && -z "$json_path" ]] && write_csv
+exit 0
@@ -0,0 +1,22 @@
+//
+//  block_utils.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef block_utils_h
+#define block_utils_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+//Scans over whole blocks of data. These work a vector register at a time, so they keep up with the devices rather than becoming the bottleneck.
+
+///True if every byte of the block is zero.
+bool blockIsAllZero(void const *_Nonnull const block, size_t const length);
+///Returns the offset of the first byte that differs between a and b, or length if they're identical.
+size_t blockFirstDifference(void const *_Nonnull const a, void const *_Nonnull const b, size_t const length);
+
+#endif /* block_utils_h */
@@ -7,11 +7,16 @@
 //
 
 //This tool consumes a test file generated by mktest, and verifies that the 1-MiB chunks in the file are in the expected order.
+//Every byte of every mebibyte is compared against a fresh copy of what mktest would have written there (see test_patterns.h), on a pool of threads, so checking keeps up with the device. A file (or device) is read with pread at each thread's own offsets; a pipe is read in turn. Mebibytes that are wrong are described at the end as a map of what was found where, so a copy that put things in the wrong place reads as one line rather than thousands.
 
 #include "formatting_utils.h"
+#include "test_patterns.h"
+#include "block_utils.h"
 
-//For htonl
+//For ntohl
 #include <arpa/inet.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
 
 #if SHOW_DEBUG_LOGGING
 #	define LOG(...) fprintf(stderr, __VA_ARGS__)
@@ -22,6 +27,11 @@
 #define MILLIONS(a,b,c) a##b##c
 //See dd-parallel-posix/main.c for why this number was chosen. (If that file has a different value, please file a bug report or submit a patch.)
 static const size_t kBufferSize = MILLIONS(1,048,576);
+enum { kBufferAlignment = 4096 };
+//The ASCII serial number at the start of each mebibyte.
+enum { kHeaderSize = 16 };
+//How many lines of the map to print before just counting the rest.
+enum { kMaxMapLines = 50 };
 
 typedef double time_fractional_t;
 typedef unsigned int UnsignedInt32;
@@ -30,24 +40,100 @@ static time_fractional_t timeWithFraction(void);
 
 static time_fractional_t copyStartedTime, copyFinishedTime;
 static unsigned long long _Atomic totalAmountCopied = 0;
-static UnsignedInt32 _Atomic serialNumber = 0; //By definition, is equal to totalAmountCopied / kBufferSize.
-static unsigned long failureCount = 0;
-enum { maxFailureCount = 20 };
 static int inputFD;
-static void *buffer;
+static enum test_profile profile = profile_serial;
+
+//A file or device has a known number of mebibytes, which the threads read wherever they like. A pipe is read one mebibyte at a time, under readLock, by whichever thread is free.
+static bool inputIsSeekable = false;
+static unsigned long long numBlocksInInput = 0;
+static unsigned long long _Atomic nextPosition = 0;
+static unsigned long long _Atomic numBlocksChecked = 0;
+static pthread_mutex_t readLock = PTHREAD_MUTEX_INITIALIZER;
+static bool _Atomic stopping = false;
+static int _Atomic readError = 0;
+
+enum mismatch_kind {
+	//Holds an intact copy of another mebibyte.
+	mismatch_misplaced,
+	//Holds a mebibyte, numbered at both ends, that differs from what mktest wrote.
+	mismatch_damaged,
+	mismatch_zeros,
+	mismatch_unrecognizable,
+	//The input ended partway through this mebibyte.
+	mismatch_short,
+};
+struct mismatch {
+	unsigned long long position;
+	unsigned long long found;
+	//For a damaged mebibyte, the offset of the first byte that's wrong; for a short one, how much of it there is.
+	size_t offset;
+	enum mismatch_kind kind;
+};
+
+struct checker {
+	pthread_t thread;
+	void *_Nullable buffer;
+	void *_Nullable expected;
+	struct mismatch *_Nullable mismatches;
+	size_t numMismatches, mismatchesCapacity;
+	bool outOfMemory;
+};
 
 static void logProgress(bool const isFinal);
 static void handleSIGINFO(int const signal);
 static bool pathIsHyphen(char const *const arg);
-static bool checkBuffer(void *buf, UnsignedInt32 serialNumber);
+static void printUsage(FILE *_Nonnull const file, char const *_Nonnull const argv0);
+static void *_Nullable checker_main(void *_Nonnull const arg);
+static int compareMismatches(void const *_Nonnull const a, void const *_Nonnull const b);
+static unsigned long long printMap(struct mismatch const *_Nullable const mismatches, size_t const numMismatches);
 
 int main(int argc, const char * argv[]) {
-	//TEMP FIXME Need actual argument handling here
-	inputFD = pathIsHyphen(argv[1]) ? STDOUT_FILENO : open(argv[1], O_RDONLY);
+	unsigned int numThreads = 0;
+	int argIdx = 1;
+	for (; argIdx < argc && argv[argIdx][0] == '-' && argv[argIdx][1] == '-'; ++argIdx) {
+		char const *_Nonnull const arg = argv[argIdx];
+		if (strcmp(arg, "--help") == 0) {
+			printUsage(stdout, argv[0]);
+			return EXIT_SUCCESS;
+		} else if (strcmp(arg, "--profile") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			if (! test_patterns_profileNamed(argv[argIdx], &profile)) {
+				fprintf(stderr, "cktest: unknown profile %s\n", argv[argIdx]);
+				goto usageError;
+			}
+		} else if (strcmp(arg, "--threads") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			numThreads = (unsigned int)strtoul(argv[argIdx], NULL, 10);
+			if (numThreads == 0) goto usageError;
+		} else {
+			goto usageError;
+		}
+	}
+	if (argc - argIdx != 1) goto usageError;
+
+	inputFD = pathIsHyphen(argv[argIdx]) ? STDIN_FILENO : open(argv[argIdx], O_RDONLY);
 	if (inputFD < 0) return EX_NOINPUT;
+	struct stat sb;
+	if (fstat(inputFD, &sb) == 0 && (S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode))) {
+		//A block device's st_size is 0, but it can tell us its size by seeking to the end.
+		off_t const inputSize = lseek(inputFD, 0, SEEK_END);
+		if (inputSize >= 0) {
+			inputIsSeekable = true;
+			numBlocksInInput = (inputSize + kBufferSize - 1) / kBufferSize;
+		}
+	}
 
-	buffer = malloc(kBufferSize);
-	if (buffer == NULL) return EX_OSERR;
+	if (numThreads == 0) {
+		long const numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+		numThreads = numCPUs > 1 ? (unsigned int)numCPUs : 1;
+	}
+	if (! test_patterns_prepare(profile)) return EX_OSERR;
+	struct checker *_Nullable const checkers = calloc(numThreads, sizeof(struct checker));
+	if (checkers == NULL) return EX_OSERR;
+	for (unsigned int i = 0; i < numThreads; ++i) {
+		if (posix_memalign(&checkers[i].buffer, kBufferAlignment, kBufferSize) != 0) return EX_OSERR;
+		if (posix_memalign(&checkers[i].expected, kBufferAlignment, kBufferSize) != 0) return EX_OSERR;
+	}
 
 	struct sigaction onSIGINFO = {
 		.sa_handler = handleSIGINFO,
@@ -60,76 +146,247 @@ int main(int argc, const char * argv[]) {
 
 	copyStartedTime = timeWithFraction();
 
-	ssize_t amtRead = read(inputFD, buffer, kBufferSize);
-	while (amtRead > 0) {
-		bool passed = checkBuffer(buffer, serialNumber);
-		if (! passed) {
-			++failureCount;
-			if (failureCount >= maxFailureCount) {
-				fprintf(stderr, "Reached the limit of %u failures; bailing\n", maxFailureCount);
-				status = EXIT_FAILURE;
-				break;
-			}
-		}
+	unsigned int numThreadsStarted = 0;
+	for (; numThreadsStarted < numThreads; ++numThreadsStarted) {
+		if (pthread_create(&checkers[numThreadsStarted].thread, /*attr*/ NULL, checker_main, &checkers[numThreadsStarted]) != 0) break;
+	}
+	if (numThreadsStarted == 0) return EX_OSERR;
 
-		++serialNumber;
-		totalAmountCopied += amtRead;
+	size_t numMismatches = 0;
+	bool outOfMemory = false;
+	for (unsigned int i = 0; i < numThreadsStarted; ++i) {
+		pthread_join(checkers[i].thread, /*retval*/ NULL);
+		numMismatches += checkers[i].numMismatches;
+		outOfMemory = outOfMemory || checkers[i].outOfMemory;
+	}
+
+	copyFinishedTime = timeWithFraction();
 
-		amtRead = read(inputFD, buffer, kBufferSize);
+	//Each thread only knows about the mebibytes it checked. Put them all together, in order, to make the map.
+	struct mismatch *_Nullable const mismatches = numMismatches > 0 ? malloc(numMismatches * sizeof(struct mismatch)) : NULL;
+	if (numMismatches > 0 && mismatches == NULL) outOfMemory = true;
+	size_t numCollected = 0;
+	for (unsigned int i = 0; i < numThreads; ++i) {
+		if (mismatches != NULL && checkers[i].numMismatches > 0) {
+			memcpy(mismatches + numCollected, checkers[i].mismatches, checkers[i].numMismatches * sizeof(struct mismatch));
+			numCollected += checkers[i].numMismatches;
+		}
+		free(checkers[i].mismatches);
+		free(checkers[i].buffer);
+		free(checkers[i].expected);
 	}
+	free(checkers);
 
-	free(buffer);
+	if (mismatches != NULL) {
+		qsort(mismatches, numCollected, sizeof(struct mismatch), compareMismatches);
+		unsigned long long const numWrong = printMap(mismatches, numCollected);
+		fprintf(stderr, "%'llu of %'llu mebibytes are wrong\n", numWrong, (unsigned long long)numBlocksChecked);
+		free(mismatches);
+		status = EXIT_FAILURE;
+	}
+	if (outOfMemory) {
+		fprintf(stderr, "Ran out of memory keeping track of wrong mebibytes; the map is incomplete\n");
+		status = EXIT_FAILURE;
+	}
+	if (readError != 0) {
+		fprintf(stderr, "Read failed: %s\n", strerror(readError));
+		status = EX_IOERR;
+	}
 
-	copyFinishedTime = timeWithFraction();
 	logProgress(true);
 
 	return status;
+
+usageError:
+	printUsage(stderr, argv[0]);
+	return EX_USAGE;
+}
+
+static void printUsage(FILE *_Nonnull const file, char const *_Nonnull const argv0) {
+	fprintf(file,
+		"Usage: %s [options] in-file\n"
+		"Checks that in-file (or - for standard input) holds the test data mktest writes, and describes any mebibytes that are wrong.\n"
+		"Options:\n"
+		"  --profile NAME   The profile mktest was given:\n",
+		argv0);
+	test_patterns_printProfiles(file);
+	fprintf(file,
+		"  --threads N      Check with N threads (default: one per CPU)\n");
 }
 
 static bool pathIsHyphen(char const *const arg) {
 	return arg[0] == '-' && arg[1] == '\0';
 }
-static unsigned long long parseSize(char const *arg) {
-	unsigned long long wholePart = strtoull(arg, (char **)&arg, 10);
-	unsigned long long decimalPart = 0ULL;
-	if (*arg == '.') {
-		++arg;
-		decimalPart = strtoull(arg, (char **)&arg, 10);
-	}
-	switch (*arg) {
-		case 'p':
-		case 'P':
-			wholePart *= 1024;
-		case 'e':
-		case 'E':
-			wholePart *= 1024;
-		case 't':
-		case 'T':
-			wholePart *= 1024;
-		case 'g':
-		case 'G':
-			wholePart *= 1024;
-		case 'm':
-		case 'M':
-			wholePart *= 1024;
-		case 'k':
-		case 'K':
-			wholePart *= 1024;
-	}
-	//TODO: Implement decimalPart
-	return wholePart;
+
+#pragma mark Checking
+
+///Reads up to a mebibyte at position (for a file) or the next mebibyte (for a pipe, setting *outPosition). Returns how much was read, which is 0 at the end of the input, or -1 on failure.
+static ssize_t readBlock(void *_Nonnull const buf, unsigned long long *_Nonnull const outPosition) {
+	size_t amtRead = 0;
+	if (inputIsSeekable) {
+		unsigned long long const position = nextPosition++;
+		if (position >= numBlocksInInput) return 0;
+		*outPosition = position;
+		while (amtRead < kBufferSize) {
+			ssize_t const thisRead = pread(inputFD, (unsigned char *)buf + amtRead, kBufferSize - amtRead, position * kBufferSize + amtRead);
+			if (thisRead < 0) {
+				if (errno == EINTR) continue;
+				return -1;
+			}
+			if (thisRead == 0) break;
+			amtRead += thisRead;
+		}
+	} else {
+		//The position has to be taken under the lock too, or two threads could read their mebibytes in the opposite order from their positions.
+		pthread_mutex_lock(&readLock);
+		*outPosition = nextPosition++;
+		while (amtRead < kBufferSize) {
+			ssize_t const thisRead = read(inputFD, (unsigned char *)buf + amtRead, kBufferSize - amtRead);
+			if (thisRead < 0) {
+				if (errno == EINTR) continue;
+				pthread_mutex_unlock(&readLock);
+				return -1;
+			}
+			if (thisRead == 0) break;
+			amtRead += thisRead;
+		}
+		pthread_mutex_unlock(&readLock);
+	}
+	return amtRead;
+}
+
+static void checker_addMismatch(struct checker *_Nonnull const checker, struct mismatch const mismatch) {
+	if (checker->numMismatches == checker->mismatchesCapacity) {
+		size_t const newCapacity = checker->mismatchesCapacity > 0 ? checker->mismatchesCapacity * 2 : 64;
+		struct mismatch *_Nullable const newMismatches = realloc(checker->mismatches, newCapacity * sizeof(struct mismatch));
+		if (newMismatches == NULL) {
+			checker->outOfMemory = true;
+			return;
+		}
+		checker->mismatches = newMismatches;
+		checker->mismatchesCapacity = newCapacity;
+	}
+	checker->mismatches[checker->numMismatches++] = mismatch;
+}
+
+///Compares the mebibyte in the checker's buffer, which is length bytes long, against what mktest wrote at position, and if it's wrong, works out what it is instead.
+static void checker_checkBlock(struct checker *_Nonnull const checker, unsigned long long const position, size_t const length) {
+	unsigned char const *_Nonnull const buf = checker->buffer;
+	test_patterns_fillBlock(checker->expected, kBufferSize, (UnsignedInt32)position, profile);
+	if (length < kBufferSize) {
+		checker_addMismatch(checker, (struct mismatch){ .position = position, .found = position, .offset = length, .kind = mismatch_short });
+		return;
+	}
+	size_t const difference = blockFirstDifference(buf, checker->expected, kBufferSize);
+	if (difference == kBufferSize) return;
+
+	struct mismatch mismatch = { .position = position, .found = position, .offset = difference, .kind = mismatch_damaged };
+	if (blockIsAllZero(buf, kBufferSize)) {
+		mismatch.kind = mismatch_zeros;
+	} else {
+		//Each mebibyte says which one it is at both ends. If it's the right one by either, it's a damaged copy; if it's another one by the number at the end, it's that one, and the number at the start had better agree.
+		UnsignedInt32 tail;
+		memcpy(&tail, buf + kBufferSize - sizeof(tail), sizeof(tail));
+		UnsignedInt32 const foundSerial = ntohl(tail);
+		bool const isThisBlock = foundSerial == (UnsignedInt32)position || difference >= kHeaderSize;
+		if (! isThisBlock) {
+			test_patterns_fillBlock(checker->expected, kBufferSize, foundSerial, profile);
+			size_t const foundDifference = blockFirstDifference(buf, checker->expected, kBufferSize);
+			mismatch.found = foundSerial;
+			mismatch.offset = foundDifference;
+			if (foundDifference == kBufferSize) {
+				mismatch.kind = mismatch_misplaced;
+			} else if (foundDifference < kHeaderSize) {
+				mismatch.kind = mismatch_unrecognizable;
+				mismatch.found = position;
+			}
+		}
+	}
+	checker_addMismatch(checker, mismatch);
+}
+
+static void *_Nullable checker_main(void *_Nonnull const arg) {
+	pthread_setname_self("Checker thread");
+	struct checker *_Nonnull const checker = arg;
+	while (! stopping) {
+		unsigned long long position = 0;
+		ssize_t const amtRead = readBlock(checker->buffer, &position);
+		if (amtRead < 0) {
+			int expectedError = 0;
+			atomic_compare_exchange_strong(&readError, &expectedError, errno);
+			stopping = true;
+			break;
+		}
+		if (amtRead == 0) break;
+		checker_checkBlock(checker, position, amtRead);
+		++numBlocksChecked;
+		totalAmountCopied += amtRead;
+	}
+	return NULL;
+}
+
+#pragma mark Reporting
+
+static int compareMismatches(void const *_Nonnull const a, void const *_Nonnull const b) {
+	unsigned long long const positionA = ((struct mismatch const *)a)->position;
+	unsigned long long const positionB = ((struct mismatch const *)b)->position;
+	return positionA < positionB ? -1 : positionA > positionB;
 }
 
-static bool checkBuffer(void *buf, UnsignedInt32 serialNumber) {
-	enum { maxIdx = kBufferSize / sizeof(UnsignedInt32) - 1 };
-	char *const str = buf;
-	register UnsignedInt32 *buf32 = buf;
-	register UnsignedInt32 expectedValue = htonl(serialNumber);
-	if (buf32[maxIdx] != expectedValue) {
-		fprintf(stderr, "Mebibyte #%'u is wrong: expected %'u, found %s\n", serialNumber, serialNumber, str);
-		return false;
+///Prints a line for each run of wrong mebibytes: neighbors that all hold zeros, or that hold neighboring mebibytes shifted by the same amount, are one run. Returns how many mebibytes are wrong.
+static unsigned long long printMap(struct mismatch const *_Nullable const mismatches, size_t const numMismatches) {
+	unsigned int numLines = 0;
+	unsigned long long numRunsNotPrinted = 0;
+	for (size_t start = 0; start < numMismatches; ) {
+		struct mismatch const *_Nonnull const first = &mismatches[start];
+		size_t end = start + 1;
+		//Damaged and short mebibytes each get a line of their own, since each has its own offset.
+		bool const canRun = first->kind != mismatch_damaged && first->kind != mismatch_short;
+		while (canRun && end < numMismatches) {
+			struct mismatch const *_Nonnull const next = &mismatches[end];
+			unsigned long long const distance = end - start;
+			if (next->kind != first->kind || next->position != first->position + distance || next->found != first->found + distance) break;
+			++end;
+		}
+		struct mismatch const *_Nonnull const last = &mismatches[end - 1];
+		start = end;
+
+		if (numLines == kMaxMapLines) {
+			++numRunsNotPrinted;
+			continue;
+		}
+		++numLines;
+		if (first == last) {
+			fprintf(stderr, "Mebibyte #%'llu ", first->position);
+		} else {
+			fprintf(stderr, "Mebibytes #%'llu–#%'llu ", first->position, last->position);
+		}
+		switch (first->kind) {
+			case mismatch_misplaced:
+				if (first == last) {
+					fprintf(stderr, "holds #%'llu\n", first->found);
+				} else {
+					fprintf(stderr, "hold #%'llu–#%'llu\n", first->found, last->found);
+				}
+				break;
+			case mismatch_damaged:
+				fprintf(stderr, "holds a damaged copy of #%'llu (first difference at byte %'zu)\n", first->found, first->offset);
+				break;
+			case mismatch_zeros:
+				fprintf(stderr, first == last ? "holds only zeros\n" : "hold only zeros\n");
+				break;
+			case mismatch_unrecognizable:
+				fprintf(stderr, first == last ? "holds something unrecognizable\n" : "hold something unrecognizable\n");
+				break;
+			case mismatch_short:
+				fprintf(stderr, "is cut short after %'zu bytes\n", first->offset);
+				break;
+		}
+	}
+	if (numRunsNotPrinted > 0) {
+		fprintf(stderr, "…and %'llu more runs of wrong mebibytes\n", numRunsNotPrinted);
 	}
-	return true;
+	return numMismatches;
 }
 
 #pragma mark -
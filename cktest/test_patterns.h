@@ -0,0 +1,38 @@
+//
+//  test_patterns.h
+//  dd-parallel-posix/mktest
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef test_patterns_h
+#define test_patterns_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+//What mktest fills each mebibyte of a test file with, and cktest expects to find there. Every profile starts each mebibyte with its serial number in ASCII (16 bytes) and ends it with the serial number as a big-endian 32-bit number; in between is whatever the profile says. Everything about a mebibyte's contents follows from the profile and its serial number, so cktest can make another copy to compare against.
+
+enum test_profile {
+	profile_serial,
+	profile_zeros,
+	profile_sparse,
+	profile_text,
+	profile_random,
+	profile_duplicates,
+	profile_mixed,
+};
+
+///Looks up a profile by the name the --profile option takes. Returns false if there's no such profile.
+bool test_patterns_profileNamed(char const *_Nonnull const name, enum test_profile *_Nonnull const outProfile);
+///Lists the profiles and what they fill mebibytes with, for usage messages.
+void test_patterns_printProfiles(FILE *_Nonnull const file);
+
+///Sets up whatever the profile needs before any mebibytes are filled, from any thread. Returns false if there isn't enough memory.
+bool test_patterns_prepare(enum test_profile const profile);
+///Fills a mebibyte of length bytes (a multiple of 128) for the profile, and numbers it. Safe to call from several threads at once.
+void test_patterns_fillBlock(void *_Nonnull const buf, size_t const length, unsigned int const serialNumber, enum test_profile const profile);
+
+#endif /* test_patterns_h */
@@ -10,7 +10,27 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
 #include "formatting_utils.h"
+#include "buffer_ring.h"
+#include "extent_tracker.h"
+#include "journal.h"
+#include "block_utils.h"
+#include "digests.h"
+#include "tuner.h"
+#include "progress.h"
+#include "latency.h"
+#include "rate_limiter.h"
+#include "compression.h"
+#include "image_index.h"
+#include "image_restore.h"
+#include "block_store.h"
+#include "rescue_map.h"
+#include "placement.h"
+#include "mapped_input.h"
 
 struct test_case {
 	char test_name[16];
@@ -27,8 +47,28 @@ static char const *const test_interval_1min(void);
 static char const *const test_interval_1hr(void);
 static char const *const test_interval_1day(void);
 static char const *const test_interval_1d1h1m1s(void);
+static char const *const test_ring_fifo(void);
+static char const *const test_ring_fan_out(void);
+static char const *const test_tracker_out_of_order(void);
+static char const *const test_journal_resume(void);
+static char const *const test_zero_detection(void);
+static char const *const test_first_difference(void);
+static char const *const test_xxh64_vectors(void);
+static char const *const test_sha256_vectors(void);
+static char const *const test_tuner_simulated(void);
+static char const *const test_progress_rates(void);
+static char const *const test_latency_percentiles(void);
+static char const *const test_rate_limit_fixed(void);
+static char const *const test_rate_limit_thermal(void);
+static char const *const test_compression_round_trip(void);
+static char const *const test_compression_damage(void);
+static char const *const test_image_restore_range(void);
+static char const *const test_block_store_round_trip(void);
+static char const *const test_rescue_map_ranges(void);
+static char const *const test_cpu_list_parse(void);
+static char const *const test_mapped_input_windows(void);
 
-enum { num_all_cases = 4 + 5 + 1 };
+enum { num_all_cases = 4 + 5 + 1 + 2 + 1 + 1 + 2 + 2 + 1 + 2 + 2 + 2 + 1 + 1 + 1 + 1 + 1 };
 static struct test_case const all_cases[num_all_cases] = {
 	{ "bytes_20_bytes", test_bytecount_20bytes, },
 	{ "bytes_1_KiB", test_bytecount_1KiB, },
@@ -42,6 +82,37 @@ static struct test_case const all_cases[num_all_cases] = {
 	{ "interval_d", test_interval_1day, },
 
 	{ "interval_dhms", test_interval_1d1h1m1s, },
+
+	{ "ring_fifo", test_ring_fifo, },
+	{ "ring_fan_out", test_ring_fan_out, },
+	{ "tracker_gaps", test_tracker_out_of_order, },
+	{ "journal_resume", test_journal_resume, },
+	{ "zero_blocks", test_zero_detection, },
+	{ "block_diff", test_first_difference, },
+
+	{ "xxh64", test_xxh64_vectors, },
+	{ "sha256", test_sha256_vectors, },
+
+	{ "tuner", test_tuner_simulated, },
+
+	{ "progress_rates", test_progress_rates, },
+	{ "latency_pctl", test_latency_percentiles, },
+
+	{ "rate_fixed", test_rate_limit_fixed, },
+	{ "rate_thermal", test_rate_limit_thermal, },
+
+	{ "compress_trip", test_compression_round_trip, },
+	{ "compress_damage", test_compression_damage, },
+
+	{ "restore_range", test_image_restore_range, },
+
+	{ "block_store", test_block_store_round_trip, },
+
+	{ "rescue_map", test_rescue_map_ranges, },
+
+	{ "cpu_list", test_cpu_list_parse, },
+
+	{ "mapped_input", test_mapped_input_windows, },
 };
 
 #define ASCII_BKSP "\x08"
@@ -177,3 +248,788 @@ static char const *const test_interval_1d1h1m1s(void) {
 	if (! rightStr) return "Incorrect string generated";
 	return NULL;
 }
+
+static char const *const test_ring_fifo(void) {
+	enum { depth = 4, bufferSize = 16 };
+	struct buffer_ring *const ring = ring_create(depth, bufferSize, sizeof(void *));
+	if (ring == NULL) return "Could not create ring";
+	char const *failure = NULL;
+	for (unsigned int i = 0; i < depth; ++i) {
+		struct ring_slot *const slot = ring_acquireEmptySlot(ring);
+		if (slot == NULL) { failure = "Ran out of empty slots too soon"; goto done; }
+		snprintf(slot->buffer, bufferSize, "%u", i);
+		slot->length = i;
+		ring_publishFilledSlot(ring);
+	}
+	ring_close(ring);
+	for (unsigned int i = 0; i < depth; ++i) {
+		struct ring_slot *const slot = ring_acquireFilledSlot(ring);
+		char expectedStr[bufferSize];
+		snprintf(expectedStr, bufferSize, "%u", i);
+		if (slot == NULL) { failure = "Ran out of filled slots too soon"; goto done; }
+		if (slot->length != i || 0 != strcmp(slot->buffer, expectedStr)) { failure = "Slots came out of order"; goto done; }
+		ring_releaseSlot(ring);
+	}
+	if (ring_acquireFilledSlot(ring) != NULL) failure = "Closed ring returned an extra slot";
+done:
+	ring_destroy(ring);
+	return failure;
+}
+
+enum { fanOutDepth = 4, fanOutNumSlots = 2000, fanOutNumConsumers = 3 };
+struct fan_out_consumer {
+	struct buffer_ring *ring;
+	unsigned int consumerIdx;
+	unsigned int numFreed;
+	char const *failure;
+};
+static void *fan_out_consumer_main(void *const arg) {
+	struct fan_out_consumer *const consumer = arg;
+	for (unsigned int i = 0; i < fanOutNumSlots; ++i) {
+		struct ring_slot *const slot = ring_acquireFilledSlotForConsumer(consumer->ring, consumer->consumerIdx);
+		if (slot == NULL) { consumer->failure = "Ran out of filled slots too soon"; return NULL; }
+		//The last consumer is slow, so the others get ahead of it, and the producer has to wait for it before reusing anything.
+		if (consumer->consumerIdx == fanOutNumConsumers - 1 && i % 64 == 0) usleep(1000);
+		if (slot->length != i || *(unsigned int *)slot->buffer != i) { consumer->failure = "A slot was out of order or reused too soon"; return NULL; }
+		if (ring_releaseSlotForConsumer(consumer->ring, consumer->consumerIdx)) ++consumer->numFreed;
+	}
+	if (ring_acquireFilledSlotForConsumer(consumer->ring, consumer->consumerIdx) != NULL) consumer->failure = "Closed ring returned an extra slot";
+	return NULL;
+}
+static char const *const test_ring_fan_out(void) {
+	struct buffer_ring *const ring = ring_create(fanOutDepth, sizeof(unsigned int), sizeof(void *));
+	if (ring == NULL) return "Could not create ring";
+	ring_setNumConsumers(ring, fanOutNumConsumers);
+	struct fan_out_consumer consumers[fanOutNumConsumers] = { 0 };
+	pthread_t threads[fanOutNumConsumers];
+	for (unsigned int i = 0; i < fanOutNumConsumers; ++i) {
+		consumers[i].ring = ring;
+		consumers[i].consumerIdx = i;
+		pthread_create(&threads[i], NULL, fan_out_consumer_main, &consumers[i]);
+	}
+	char const *failure = NULL;
+	for (unsigned int i = 0; i < fanOutNumSlots; ++i) {
+		struct ring_slot *const slot = ring_acquireEmptySlot(ring);
+		if (slot == NULL) { failure = "Ran out of empty slots"; break; }
+		if (ring_readGeneration(ring) - ring_consumerGeneration(ring, fanOutNumConsumers - 1) >= fanOutDepth) { failure = "Got ahead of the slowest consumer by more than the depth"; break; }
+		*(unsigned int *)slot->buffer = i;
+		slot->length = i;
+		ring_publishFilledSlot(ring);
+	}
+	ring_close(ring);
+	unsigned int numFreed = 0;
+	for (unsigned int i = 0; i < fanOutNumConsumers; ++i) {
+		pthread_join(threads[i], NULL);
+		if (failure == NULL) failure = consumers[i].failure;
+		numFreed += consumers[i].numFreed;
+	}
+	if (failure == NULL && numFreed != fanOutNumSlots) failure = "Slots weren't each freed exactly once";
+	if (failure == NULL && ring_writeGeneration(ring) != fanOutNumSlots) failure = "Write generation doesn't count every slot";
+	ring_destroy(ring);
+	return failure;
+}
+static char const *const test_tracker_out_of_order(void) {
+	struct extent_tracker *const tracker = tracker_create(0, 8);
+	if (tracker == NULL) return "Could not create tracker";
+	char const *failure = NULL;
+	tracker_markComplete(tracker, 2);
+	tracker_markComplete(tracker, 1);
+	if (tracker_contiguousCount(tracker) != 0) { failure = "Counted past a gap"; goto done; }
+	tracker_markComplete(tracker, 0);
+	if (tracker_contiguousCount(tracker) != 3) { failure = "Didn't close the gap"; goto done; }
+	tracker_markComplete(tracker, 10);
+	tracker_markComplete(tracker, 3);
+	if (tracker_contiguousCount(tracker) != 4) { failure = "Incorrect count after filling the gap"; goto done; }
+	if (! tracker_waitForRoom(tracker, 11)) { failure = "Extent within the window had no room"; goto done; }
+done:
+	tracker_destroy(tracker);
+	return failure;
+}
+
+///Replaces the file at path with contents. Returns false if it can't.
+static bool writeTestFile(char const *_Nonnull const path, char const *_Nonnull const contents) {
+	FILE *_Nullable const file = fopen(path, "w");
+	if (file == NULL) return false;
+	bool const written = fputs(contents, file) >= 0;
+	return fclose(file) == 0 && written;
+}
+
+static char const *const test_journal_resume(void) {
+	enum { kTestInputSize = 8 * 1048576, kTestExtentSize = 1048576 };
+	char directoryPath[] = "/tmp/dd-parallel-test-journal-XXXXXX";
+	if (mkdtemp(directoryPath) == NULL) return "Could not create journal directory";
+	char journalPath[sizeof(directoryPath) + 16];
+	snprintf(journalPath, sizeof(journalPath), "%s/journal", directoryPath);
+	char const *_Nullable failure = NULL;
+	char const *_Nullable openError = NULL;
+	unsigned long long resumeOffset = 1;
+
+	//A new journal starts from the beginning, and is left behind by a copy that doesn't finish.
+	struct journal *_Nullable journal = journal_open(journalPath, /*resume*/ false, kTestInputSize, kTestExtentSize, &resumeOffset, &openError);
+	if (journal == NULL) failure = openError;
+	else if (resumeOffset != 0) failure = "A new journal didn't start from 0";
+	if (journal != NULL) journal_close(journal, /*copyFinished*/ false);
+	if (failure == NULL && access(journalPath, F_OK) != 0) failure = "An unfinished copy's journal was deleted";
+	//Without --resume, an existing journal is an error, so an earlier copy's progress isn't thrown away.
+	if (failure == NULL && journal_open(journalPath, /*resume*/ false, kTestInputSize, kTestExtentSize, &resumeOffset, &openError) != NULL) failure = "Opened an existing journal without resuming";
+
+	//A checkpoint cut off by a crash, with no newline, doesn't count, even if it's further along.
+	if (failure == NULL && ! writeTestFile(journalPath, "dd-parallel journal 1\ninput-size 8388608 extent-size 1048576\ncheckpoint 1048576\ncheckpoint 3145728\ncheckpoint 71303")) failure = "Could not write journal";
+	if (failure == NULL) {
+		journal = journal_open(journalPath, /*resume*/ true, kTestInputSize, kTestExtentSize, &resumeOffset, &openError);
+		if (journal == NULL) failure = openError;
+		else if (resumeOffset != 3 * kTestExtentSize) failure = "Didn't resume from the last whole checkpoint";
+		if (journal != NULL) journal_close(journal, /*copyFinished*/ false);
+	}
+
+	//A journal for a different input, or different extents, can't be resumed from.
+	if (failure == NULL && journal_open(journalPath, /*resume*/ true, kTestInputSize + 1, kTestExtentSize, &resumeOffset, &openError) != NULL) failure = "Resumed from a journal for a different input size";
+	if (failure == NULL && resumeOffset != 0) failure = "A journal that couldn't be resumed from gave a resume offset";
+	if (failure == NULL && journal_open(journalPath, /*resume*/ true, kTestInputSize, kTestExtentSize * 2, &resumeOffset, &openError) != NULL) failure = "Resumed from a journal for a different extent size";
+	//Nor can something that isn't a journal, or one whose header was cut off.
+	if (failure == NULL && ! writeTestFile(journalPath, "checkpoint 1048576\n")) failure = "Could not write journal";
+	if (failure == NULL && journal_open(journalPath, /*resume*/ true, kTestInputSize, kTestExtentSize, &resumeOffset, &openError) != NULL) failure = "Resumed from something that isn't a journal";
+	if (failure == NULL && ! writeTestFile(journalPath, "dd-parallel journal 1\ninput-size 8388608 ext")) failure = "Could not write journal";
+	if (failure == NULL && journal_open(journalPath, /*resume*/ true, kTestInputSize, kTestExtentSize, &resumeOffset, &openError) != NULL) failure = "Resumed from a journal without a header";
+
+	//Resuming a copy that never started starts a new journal, which goes away once the copy finishes.
+	if (failure == NULL && unlink(journalPath) != 0) failure = "Could not delete journal";
+	if (failure == NULL) {
+		journal = journal_open(journalPath, /*resume*/ true, kTestInputSize, kTestExtentSize, &resumeOffset, &openError);
+		if (journal == NULL) failure = openError;
+		else if (resumeOffset != 0) failure = "A new journal didn't start from 0";
+		if (journal != NULL) journal_close(journal, /*copyFinished*/ true);
+		if (failure == NULL && access(journalPath, F_OK) == 0) failure = "A finished copy's journal wasn't deleted";
+	}
+
+	//A journal that can't be created is an error, not a crash.
+	char missingPath[sizeof(directoryPath) + 32];
+	snprintf(missingPath, sizeof(missingPath), "%s/missing/journal", directoryPath);
+	if (failure == NULL && journal_open(missingPath, /*resume*/ true, kTestInputSize, kTestExtentSize, &resumeOffset, &openError) != NULL) failure = "Created a journal in a directory that doesn't exist";
+	if (failure == NULL && openError == NULL) failure = "A journal that couldn't be opened didn't say why";
+
+	unlink(journalPath);
+	rmdir(directoryPath);
+	return failure;
+}
+static char const *const test_zero_detection(void) {
+	//Odd length, so every part of the scan (whole strides, single vectors, and leftover bytes) gets exercised.
+	enum { length = 4096 + 48 + 7 };
+	unsigned char block[length] = { 0 };
+	if (! blockIsAllZero(block, length)) return "Zero block was not detected";
+	if (! blockIsAllZero(block, 0)) return "Empty block was not considered zero";
+	size_t const positionsToTry[] = { 0, 1000, 4096, 4096 + 40, length - 1 };
+	for (unsigned int i = 0; i < sizeof(positionsToTry) / sizeof(positionsToTry[0]); ++i) {
+		block[positionsToTry[i]] = 0x80;
+		bool const isZero = blockIsAllZero(block, length);
+		block[positionsToTry[i]] = 0;
+		if (isZero) return "Non-zero byte was missed";
+	}
+	return NULL;
+}
+static char const *const test_first_difference(void) {
+	enum { length = 4096 + 48 + 7 };
+	unsigned char a[length], b[length];
+	for (size_t i = 0; i < length; ++i) a[i] = b[i] = (unsigned char)(i * 7);
+	if (blockFirstDifference(a, b, length) != length) return "Identical blocks were reported as different";
+	size_t const positionsToTry[] = { 0, 1000, 4096, 4096 + 40, length - 1 };
+	for (unsigned int i = 0; i < sizeof(positionsToTry) / sizeof(positionsToTry[0]); ++i) {
+		b[positionsToTry[i]] ^= 0x01;
+		size_t const difference = blockFirstDifference(a, b, length);
+		b[positionsToTry[i]] ^= 0x01;
+		if (difference != positionsToTry[i]) return "Wrong position for the first difference";
+	}
+	return NULL;
+}
+static char const *const test_xxh64_vectors(void) {
+	if (xxh64("", 0, 0) != 0xEF46DB3751D8E999ULL) return "Wrong digest for empty input";
+	if (xxh64("abc", 3, 0) != 0x44BC2CF5AD770999ULL) return "Wrong digest for \"abc\"";
+	//Feeding it in pieces that don't line up with its 32-byte stripes must give the same answer as all at once.
+	enum { length = 1000 };
+	unsigned char bytes[length];
+	for (size_t i = 0; i < length; ++i) bytes[i] = (unsigned char)(i * 13 + 5);
+	struct xxh64_state state;
+	xxh64_init(&state, 42);
+	xxh64_update(&state, bytes, 7);
+	xxh64_update(&state, bytes + 7, 100);
+	xxh64_update(&state, bytes + 107, length - 107);
+	if (xxh64_digest(&state) != xxh64(bytes, length, 42)) return "Streaming digest differs from one-shot digest";
+	return NULL;
+}
+static char const *const test_sha256_vectors(void) {
+	static unsigned char const abcDigest[sha256_digestLength] = {
+		0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+		0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+	};
+	//Two blocks' worth after padding, from FIPS 180-2.
+	static unsigned char const twoBlockDigest[sha256_digestLength] = {
+		0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+		0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1,
+	};
+	unsigned char digest[sha256_digestLength];
+	struct sha256_state state;
+	sha256_init(&state);
+	sha256_update(&state, "abc", 3);
+	sha256_final(&state, digest);
+	if (memcmp(digest, abcDigest, sha256_digestLength) != 0) return "Wrong digest for \"abc\"";
+
+	char const *const twoBlockInput = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	sha256_init(&state);
+	sha256_update(&state, twoBlockInput, 20);
+	sha256_update(&state, twoBlockInput + 20, strlen(twoBlockInput) - 20);
+	sha256_final(&state, digest);
+	if (memcmp(digest, twoBlockDigest, sha256_digestLength) != 0) return "Wrong digest for two-block input";
+	return NULL;
+}
+
+//A pretend device for the tuner to tune: every block costs a fixed latency, plus its length at a bandwidth that drops off for blocks bigger than some size.
+struct simulated_device {
+	double latencySeconds;
+	size_t fastBlockSizeLimit;
+	double fastBytesPerSecond, slowBytesPerSecond;
+};
+///Copies through the tuner for numSeconds of pretend time, starting at *now, one block at a time.
+static void simulateCopy(struct tuner *_Nonnull const tuner, struct simulated_device const device, double *_Nonnull const now, double const numSeconds) {
+	double const endTime = *now + numSeconds;
+	while (*now < endTime) {
+		struct tuner_setting const setting = tuner_settingForNextBlock(tuner);
+		double const bytesPerSecond = setting.blockSize <= device.fastBlockSizeLimit ? device.fastBytesPerSecond : device.slowBytesPerSecond;
+		*now += device.latencySeconds + setting.blockSize / bytesPerSecond;
+		tuner_blockWritten(tuner, setting.blockSize, *now);
+	}
+}
+static char const *const test_tuner_simulated(void) {
+	struct tuner *_Nullable const tuner = tuner_create(8, 0);
+	if (tuner == NULL) return "Could not create tuner";
+	char const *_Nullable failure = NULL;
+	double now = 0.0;
+
+	//Small blocks lose to the latency; blocks past 1 MiB lose to the bandwidth.
+	struct simulated_device device = { 0.0005, 1048576, 1e9, 4e8 };
+	simulateCopy(tuner, device, &now, 20.0);
+	if (tuner_currentSetting(tuner).blockSize != 1048576) {
+		failure = "Did not settle on the fastest block size";
+		goto done;
+	}
+
+	//Now the latency dominates, so bigger is better. Each re-evaluation can only move one step, so give it several.
+	device = (struct simulated_device){ 0.005, 1048576, 1e9, 2e9 };
+	simulateCopy(tuner, device, &now, 200.0);
+	if (tuner_currentSetting(tuner).blockSize <= 1048576) {
+		failure = "Did not move to a bigger block size when the device changed";
+		goto done;
+	}
+
+done:
+	tuner_destroy(tuner);
+	return failure;
+}
+
+static bool roughlyEqual(double const a, double const b) {
+	return a > b * 0.99 && a < b * 1.01;
+}
+static char const *const test_progress_rates(void) {
+	struct progress *_Nullable const progress = progress_create();
+	if (progress == NULL) return "Could not create progress tracker";
+	char const *_Nullable failure = NULL;
+	unsigned long long _Atomic total = 0;
+	progress_begin(progress, &total, 0.0);
+
+	//100 MB/sec for a minute, then 50 MB/sec for another, sampled often enough to wrap around the ring several times over.
+	double now = 0.0;
+	while (now < 120.0) {
+		now += 0.005;
+		total += now <= 60.0 ? 500000 : 250000;
+		progress_recordSample(progress, now, total);
+	}
+	struct progress_rates rates = progress_rates(progress, now, total);
+	if (! roughlyEqual(rates.current, 50e6)) {
+		failure = "Wrong current rate";
+		goto done;
+	}
+	if (! roughlyEqual(rates.windowed, 50e6) || ! roughlyEqual(rates.windowSeconds, kProgressWindowSeconds)) {
+		failure = "Wrong windowed rate";
+		goto done;
+	}
+	if (! roughlyEqual(rates.overall, 75e6)) {
+		failure = "Wrong overall rate";
+		goto done;
+	}
+
+	//Early on, the window reaches back to the start.
+	progress_begin(progress, &total, 100.0);
+	total = 0;
+	for (now = 100.0; now < 105.0; now += 0.5) {
+		progress_recordSample(progress, now, total);
+		total += 1000000;
+	}
+	rates = progress_rates(progress, now, total);
+	if (! roughlyEqual(rates.windowed, 2e6) || ! roughlyEqual(rates.windowSeconds, 5.0)) {
+		failure = "Wrong windowed rate before the window filled";
+		goto done;
+	}
+
+done:
+	progress_destroy(progress);
+	return failure;
+}
+
+static char const *const test_latency_percentiles(void) {
+	static struct latency_histogram histogram;
+	if (latency_percentile(&histogram, 50.0) != 0) return "Empty histogram has a nonzero median";
+
+	//Small values each get a bucket of their own.
+	for (unsigned long long ns = 1; ns <= 20; ++ns) latency_record(&histogram, ns);
+	if (latency_percentile(&histogram, 50.0) != 10) return "Wrong median of small values";
+	if (latency_percentile(&histogram, 100.0) != 20) return "Wrong maximum of small values";
+
+	//Larger ones are only known to within a bucket, which is at most 1/16 of the value wide.
+	static struct latency_histogram microseconds;
+	for (unsigned long long us = 1; us <= 1000; ++us) latency_record(&microseconds, us * 1000);
+	if (latency_count(&microseconds) != 1000) return "Wrong count";
+	unsigned long long const median = latency_percentile(&microseconds, 50.0);
+	if (median < 500000 || median > 500000 + 500000 / 16) return "Median is outside its bucket";
+	unsigned long long const p99 = latency_percentile(&microseconds, 99.0);
+	if (p99 < 990000 || p99 > 1000000) return "p99 is outside its bucket";
+	if (latency_percentile(&microseconds, 99.9) != 1000000) return "p99.9 of the top bucket should be the maximum";
+	return NULL;
+}
+
+static char const *const test_rate_limit_fixed(void) {
+	struct rate_limiter *_Nullable const limiter = rate_limiter_create(100e6, false);
+	if (limiter == NULL) return "Could not create rate limiter";
+	//An infinitely fast device, so the limiter is the only thing slowing the writes down.
+	double now = 0.0;
+	unsigned long long written = 0;
+	while (now < 60.0) {
+		now += rate_limiter_delayForWrite(limiter, 1048576, now);
+		written += 1048576;
+	}
+	rate_limiter_destroy(limiter);
+	double const bytesPerSecond = written / now;
+	if (bytesPerSecond < 98e6 || bytesPerSecond > 102e6) return "Rate was not held to the limit";
+	return NULL;
+}
+
+//A pretend SSD that overheats: writing faster than it can shed heat warms it up, and once it's too hot, it throttles itself until it has cooled off by half. It cools off more slowly than it heats up.
+struct simulated_ssd {
+	double heat;
+	bool throttled;
+};
+enum { kSSDFastBytesPerSecond = 500000000, kSSDThrottledBytesPerSecond = 100000000, kSSDSustainableBytesPerSecond = 250000000 };
+static double const kSSDMaximumHeat = 250e6 * 60.0, kSSDCoolingFactor = 0.3;
+///Writes a block to the pretend SSD, after waiting delay seconds first, and advances *now by however long that all took.
+static void simulateSSDWrite(struct simulated_ssd *_Nonnull const ssd, size_t const length, double const delay, double *_Nonnull const now) {
+	double const deviceBytesPerSecond = ssd->throttled ? kSSDThrottledBytesPerSecond : kSSDFastBytesPerSecond;
+	double const writeSeconds = length / deviceBytesPerSecond;
+	double const bytesPerSecond = length / (delay + writeSeconds);
+	double const heatRate = bytesPerSecond > kSSDSustainableBytesPerSecond ? bytesPerSecond - kSSDSustainableBytesPerSecond : (bytesPerSecond - kSSDSustainableBytesPerSecond) * kSSDCoolingFactor;
+	ssd->heat += heatRate * (delay + writeSeconds);
+	if (ssd->heat < 0.0) ssd->heat = 0.0;
+	if (ssd->heat >= kSSDMaximumHeat) ssd->throttled = true;
+	else if (ssd->heat <= kSSDMaximumHeat / 2.0) ssd->throttled = false;
+	*now += delay + writeSeconds;
+}
+///Writes to a pretend SSD for numSeconds of pretend time, through limiter if it's not NULL. Returns the number of bytes written.
+static unsigned long long simulateLongCopy(struct rate_limiter *_Nullable const limiter, double const numSeconds) {
+	struct simulated_ssd ssd = { 0 };
+	double now = 0.0;
+	unsigned long long written = 0;
+	while (now < numSeconds) {
+		double const delay = limiter != NULL ? rate_limiter_delayForWrite(limiter, 1048576, now) : 0.0;
+		simulateSSDWrite(&ssd, 1048576, delay, &now);
+		written += 1048576;
+	}
+	return written;
+}
+static char const *const test_rate_limit_thermal(void) {
+	struct rate_limiter *_Nullable const limiter = rate_limiter_create(0.0, true);
+	if (limiter == NULL) return "Could not create rate limiter";
+	double const numSeconds = 30.0 * 60.0;
+	unsigned long long const flatOut = simulateLongCopy(NULL, numSeconds);
+	unsigned long long const limited = simulateLongCopy(limiter, numSeconds);
+	double const limit = rate_limiter_currentLimit(limiter);
+	rate_limiter_destroy(limiter);
+	if (limit == 0.0) return "Never set a limit";
+	if (limited < flatOut * 1.15) return "Limiting didn't beat running flat out";
+	return NULL;
+}
+
+enum { kTestCompressionBlockSize = 256 * 1024, kTestCompressionNumBlocks = 6 };
+///Fills blocks with, in order: zeros, text, noise, text, noise, and a short block of text, like the end of a file.
+static void makeCompressionTestData(unsigned char *_Nonnull const data, size_t *_Nonnull const outLengths) {
+	unsigned long long noise = 0x9E3779B97F4A7C15ULL;
+	for (unsigned int block = 0; block < kTestCompressionNumBlocks; ++block) {
+		unsigned char *_Nonnull const bytes = data + block * kTestCompressionBlockSize;
+		outLengths[block] = block == kTestCompressionNumBlocks - 1 ? 1000 : kTestCompressionBlockSize;
+		for (size_t i = 0; i < outLengths[block]; ++i) {
+			if (block == 0) {
+				bytes[i] = 0;
+			} else if (block % 2 == 1) {
+				bytes[i] = "All work and no play makes Jack a dull boy.\n"[i % 44];
+			} else {
+				noise ^= noise << 13;
+				noise ^= noise >> 7;
+				noise ^= noise << 17;
+				bytes[i] = (unsigned char)(noise >> 24);
+			}
+		}
+	}
+}
+///Compresses the test data into image, frame after frame (without the image header or end frame). Returns the image's length, or 0 on failure.
+static size_t compressTestData(unsigned char const *_Nonnull const data, size_t const *_Nonnull const lengths, unsigned char *_Nonnull const image) {
+	char const *_Nullable error = NULL;
+	struct compression *_Nullable const compressor = compression_create(false, 3, kTestCompressionNumBlocks, kTestCompressionBlockSize, &error);
+	if (compressor == NULL) return 0;
+	for (unsigned int block = 0; block < kTestCompressionNumBlocks; ++block) {
+		compression_submitBlock(compressor, data + block * kTestCompressionBlockSize, lengths[block]);
+	}
+	size_t imageLength = 0;
+	for (unsigned int block = 0; block < kTestCompressionNumBlocks; ++block) {
+		struct compression_output output;
+		if (! compression_finishBlock(compressor, &output, &error)) {
+			compression_destroy(compressor);
+			return 0;
+		}
+		memcpy(image + imageLength, output.bytes, output.length);
+		imageLength += output.length;
+		if (output.moreLength > 0) memcpy(image + imageLength, output.moreBytes, output.moreLength);
+		imageLength += output.moreLength;
+	}
+	compression_destroy(compressor);
+	return imageLength;
+}
+
+static char const *const test_compression_round_trip(void) {
+	static unsigned char data[kTestCompressionNumBlocks * kTestCompressionBlockSize];
+	static unsigned char image[kTestCompressionNumBlocks * (kCompressionFrameHeaderSize + kTestCompressionBlockSize)];
+	size_t lengths[kTestCompressionNumBlocks];
+	makeCompressionTestData(data, lengths);
+	size_t const imageLength = compressTestData(data, lengths, image);
+	if (imageLength == 0) return "Could not compress";
+
+	char const *_Nullable error = NULL;
+	struct compression *_Nullable const decompressor = compression_create(true, 3, kTestCompressionNumBlocks, kTestCompressionBlockSize, &error);
+	if (decompressor == NULL) return "Could not create decompressor";
+	char const *_Nullable failure = NULL;
+	size_t offset = 0;
+	for (unsigned int block = 0; block < kTestCompressionNumBlocks && failure == NULL; ++block) {
+		size_t storedLength, originalLength;
+		bool isEnd;
+		if (offset + kCompressionFrameHeaderSize > imageLength || ! compression_parseFrameHeader(image + offset, kTestCompressionBlockSize, &storedLength, &originalLength, &isEnd) || isEnd) {
+			failure = "Frame header was invalid";
+		} else if (originalLength != lengths[block]) {
+			failure = "Frame had the wrong original length";
+		} else if (block == 0 && storedLength != 0) {
+			failure = "Zeros were stored";
+		} else if (block % 2 == 0 && block > 0 && storedLength != originalLength) {
+			failure = "Noise wasn't stored as is";
+#if EXISTS_ZLIB
+		} else if (block % 2 == 1 && storedLength * 10 > originalLength) {
+			failure = "Text didn't compress";
+#endif
+		} else {
+			compression_submitBlock(decompressor, image + offset, kCompressionFrameHeaderSize + storedLength);
+			offset += kCompressionFrameHeaderSize + storedLength;
+		}
+	}
+	for (unsigned int block = 0; block < kTestCompressionNumBlocks && failure == NULL; ++block) {
+		struct compression_output output;
+		if (! compression_finishBlock(decompressor, &output, &error)) failure = error;
+		else if (output.length != lengths[block] || memcmp(output.bytes, data + block * kTestCompressionBlockSize, output.length) != 0) failure = "Decompressed data doesn't match the original";
+	}
+	compression_destroy(decompressor);
+	if (failure == NULL && offset != imageLength) failure = "Image has data after the last frame";
+	return failure;
+}
+
+static char const *const test_compression_damage(void) {
+	static unsigned char data[kTestCompressionNumBlocks * kTestCompressionBlockSize];
+	static unsigned char image[kTestCompressionNumBlocks * (kCompressionFrameHeaderSize + kTestCompressionBlockSize)];
+	size_t lengths[kTestCompressionNumBlocks];
+	makeCompressionTestData(data, lengths);
+	if (compressTestData(data, lengths, image) == 0) return "Could not compress";
+
+	//The third frame is noise, stored as is, right after the zeros (header only) and the text.
+	size_t storedLength, originalLength;
+	bool isEnd;
+	size_t offset = kCompressionFrameHeaderSize;
+	if (! compression_parseFrameHeader(image + offset, kTestCompressionBlockSize, &storedLength, &originalLength, &isEnd)) return "Frame header was invalid";
+	offset += kCompressionFrameHeaderSize + storedLength;
+	if (! compression_parseFrameHeader(image + offset, kTestCompressionBlockSize, &storedLength, &originalLength, &isEnd)) return "Frame header was invalid";
+	image[offset + kCompressionFrameHeaderSize + storedLength / 2] ^= 0x10;
+
+	char const *_Nullable error = NULL;
+	struct compression *_Nullable const decompressor = compression_create(true, 1, 1, kTestCompressionBlockSize, &error);
+	if (decompressor == NULL) return "Could not create decompressor";
+	compression_submitBlock(decompressor, image + offset, kCompressionFrameHeaderSize + storedLength);
+	struct compression_output output;
+	bool const decompressed = compression_finishBlock(decompressor, &output, &error);
+	compression_destroy(decompressor);
+	if (decompressed) return "Damaged frame was decompressed without complaint";
+	return NULL;
+}
+
+static char const *const test_image_restore_range(void) {
+	static unsigned char data[kTestCompressionNumBlocks * kTestCompressionBlockSize];
+	static unsigned char frames[kTestCompressionNumBlocks * (kCompressionFrameHeaderSize + kTestCompressionBlockSize)];
+	static unsigned char restored[kTestCompressionNumBlocks * kTestCompressionBlockSize];
+	size_t lengths[kTestCompressionNumBlocks];
+	makeCompressionTestData(data, lengths);
+	size_t const framesLength = compressTestData(data, lengths, frames);
+	if (framesLength == 0) return "Could not compress";
+	unsigned long long totalLength = 0;
+	for (unsigned int block = 0; block < kTestCompressionNumBlocks; ++block) totalLength += lengths[block];
+
+	//Lay the image out the way dd-parallel --compress does: header, frames, end frame, index.
+	struct image_index *_Nullable const writingIndex = image_index_create(kTestCompressionBlockSize);
+	if (writingIndex == NULL) return "Could not create index";
+	unsigned char header[kCompressionImageHeaderSize], endFrame[kCompressionEndFrameSize];
+	compression_makeImageHeader(header, kTestCompressionBlockSize);
+	compression_makeEndFrame(endFrame, totalLength);
+	size_t offset = 0;
+	for (unsigned int block = 0; block < kTestCompressionNumBlocks; ++block) {
+		size_t storedLength, originalLength;
+		bool isEnd;
+		if (! compression_parseFrameHeader(frames + offset, kTestCompressionBlockSize, &storedLength, &originalLength, &isEnd)) {
+			image_index_destroy(writingIndex);
+			return "Frame header was invalid";
+		}
+		image_index_addFrame(writingIndex, sizeof(header) + offset, frames + offset);
+		offset += kCompressionFrameHeaderSize + storedLength;
+	}
+	size_t indexLength = 0;
+	void const *_Nullable const indexBytes = image_index_finish(writingIndex, sizeof(header) + framesLength + sizeof(endFrame), totalLength, &indexLength);
+	FILE *_Nullable const imageFile = tmpfile();
+	FILE *_Nullable const outputFile = tmpfile();
+	char const *_Nullable failure = NULL;
+	if (indexBytes == NULL) failure = "Could not finish index";
+	else if (imageFile == NULL || outputFile == NULL) failure = "Could not create temporary files";
+	else if (fwrite(header, sizeof(header), 1, imageFile) != 1 || fwrite(frames, framesLength, 1, imageFile) != 1 || fwrite(endFrame, sizeof(endFrame), 1, imageFile) != 1 || fwrite(indexBytes, indexLength, 1, imageFile) != 1 || fflush(imageFile) != 0) failure = "Could not write image";
+	image_index_destroy(writingIndex);
+
+	//A range that starts partway into the zeros and ends partway into the short last block.
+	unsigned long long const rangeStart = 1000, rangeLength = totalLength - rangeStart - 10;
+	struct image_index *_Nullable index = NULL;
+	if (failure == NULL) {
+		index = image_index_open(fileno(imageFile), sizeof(header) + framesLength + sizeof(endFrame) + indexLength, &failure);
+	}
+	if (index != NULL) {
+		if (image_index_numFrames(index) != kTestCompressionNumBlocks || image_index_totalLength(index) != totalLength) failure = "Index read back wrong";
+		unsigned long long _Atomic amountRestored = 0;
+		if (failure == NULL) failure = image_restoreRange(fileno(imageFile), index, fileno(outputFile), rangeStart, rangeLength, 3, &amountRestored);
+		if (failure == NULL && amountRestored != rangeLength) failure = "Restored the wrong amount";
+		image_index_destroy(index);
+	}
+	if (failure == NULL) {
+		if (pread(fileno(outputFile), restored, sizeof(restored), 0) != (ssize_t)(rangeStart + rangeLength)) failure = "Output is the wrong length";
+		else if (memcmp(restored + rangeStart, data + rangeStart, rangeLength) != 0) failure = "Restored data doesn't match the original";
+	}
+	if (imageFile != NULL) fclose(imageFile);
+	if (outputFile != NULL) fclose(outputFile);
+	return failure;
+}
+
+static int removeStoreEntry(char const *_Nonnull const path, struct stat const *_Nonnull const sb, int const type, struct FTW *_Nonnull const ftw) {
+	return remove(path);
+}
+static char const *const test_block_store_round_trip(void) {
+	static unsigned char data[kTestCompressionNumBlocks * kTestCompressionBlockSize];
+	static unsigned char restored[kTestCompressionNumBlocks * kTestCompressionBlockSize];
+	size_t lengths[kTestCompressionNumBlocks];
+	makeCompressionTestData(data, lengths);
+	char storePath[] = "/tmp/dd-parallel-test-store-XXXXXX";
+	if (mkdtemp(storePath) == NULL) return "Could not create store directory";
+
+	//Store the blocks, and write a recipe for them.
+	char const *_Nullable failure = NULL;
+	FILE *_Nullable const recipeFile = tmpfile();
+	if (recipeFile == NULL) return "Could not create recipe file";
+	unsigned char header[kBlockRecipeHeaderSize], trailer[kBlockRecipeTrailerSize];
+	block_recipe_makeHeader(header, kTestCompressionBlockSize);
+	fwrite(header, sizeof(header), 1, recipeFile);
+	struct block_store *_Nullable store = block_store_create(storePath, /*restoring*/ false, 3, kTestCompressionNumBlocks, &failure);
+	if (store == NULL) {
+		fclose(recipeFile);
+		return failure;
+	}
+	unsigned long long totalLength = 0;
+	for (unsigned int block = 0; block < kTestCompressionNumBlocks; ++block) {
+		block_store_submitBlock(store, data + block * kTestCompressionBlockSize, lengths[block], /*digest*/ NULL);
+		totalLength += lengths[block];
+	}
+	for (unsigned int block = 0; block < kTestCompressionNumBlocks && failure == NULL; ++block) {
+		unsigned char digest[kBlockStoreDigestLength];
+		static unsigned char const zeroDigest[kBlockStoreDigestLength] = { 0 };
+		if (! block_store_finishBlock(store, digest, &failure)) break;
+		if ((block == 0) != (memcmp(digest, zeroDigest, sizeof(digest)) == 0)) failure = "Only the block of zeros should have a digest of zeros";
+		fwrite(digest, sizeof(digest), 1, recipeFile);
+	}
+	block_store_destroy(store);
+	block_recipe_makeTrailer(trailer, totalLength);
+	fwrite(trailer, sizeof(trailer), 1, recipeFile);
+	if (failure == NULL && (fflush(recipeFile) != 0 || fseek(recipeFile, 0, SEEK_SET) != 0)) failure = "Could not write recipe";
+
+	//Read the recipe back, and get the blocks back out of the store.
+	struct block_recipe *_Nullable recipe = NULL;
+	if (failure == NULL) {
+		lseek(fileno(recipeFile), 0, SEEK_SET);
+		recipe = block_recipe_read(fileno(recipeFile), &failure);
+	}
+	if (recipe != NULL) {
+		if (block_recipe_numBlocks(recipe) != kTestCompressionNumBlocks || block_recipe_totalLength(recipe) != totalLength) failure = "Recipe read back wrong";
+		store = failure == NULL ? block_store_create(storePath, /*restoring*/ true, 3, kTestCompressionNumBlocks, &failure) : NULL;
+		if (store != NULL) {
+			memset(restored, 0xa5, sizeof(restored));
+			for (unsigned int block = 0; block < kTestCompressionNumBlocks; ++block) {
+				block_store_submitBlock(store, restored + block * kTestCompressionBlockSize, lengths[block], block_recipe_digest(recipe, block));
+			}
+			for (unsigned int block = 0; block < kTestCompressionNumBlocks && failure == NULL; ++block) {
+				block_store_finishBlock(store, /*outDigest*/ NULL, &failure);
+			}
+			block_store_destroy(store);
+			if (failure == NULL && memcmp(restored, data, (kTestCompressionNumBlocks - 1) * kTestCompressionBlockSize + lengths[kTestCompressionNumBlocks - 1]) != 0) failure = "Restored data doesn't match the original";
+		}
+		block_recipe_destroy(recipe);
+	}
+	fclose(recipeFile);
+
+	nftw(storePath, removeStoreEntry, 4, FTW_DEPTH | FTW_PHYS);
+	return failure;
+}
+
+static char const *const test_rescue_map_ranges(void) {
+	enum { kTestInputSize = 1000 };
+	char directoryPath[] = "/tmp/dd-parallel-test-rescue-XXXXXX";
+	if (mkdtemp(directoryPath) == NULL) return "Could not create map directory";
+	char mapPath[sizeof(directoryPath) + 8];
+	snprintf(mapPath, sizeof(mapPath), "%s/map", directoryPath);
+
+	//Out of order, overlapping, and touching ranges should come out as three.
+	bool existed = true;
+	char const *_Nullable failure = NULL;
+	struct rescue_map *_Nullable map = rescue_map_open(mapPath, kTestInputSize, &existed, &failure);
+	if (map == NULL) {
+		rmdir(directoryPath);
+		return failure;
+	}
+	if (existed) failure = "A new map shouldn't have existed";
+	rescue_map_addBadRange(map, 100, 10);
+	rescue_map_addBadRange(map, 300, 10);
+	rescue_map_addBadRange(map, 105, 20);
+	rescue_map_addBadRange(map, 125, 5);
+	rescue_map_addBadRange(map, 50, 10);
+	rescue_map_addBadRange(map, 290, 15);
+	if (failure == NULL && (rescue_map_numBadRanges(map) != 3 || rescue_map_amountBad(map) != 10 + 30 + 20)) failure = "Ranges weren't combined";
+	//As if the first pass had only gotten to 200: everything from there on is bad when the map is read back.
+	if (failure == NULL) rescue_map_save(map, /*outputFD*/ -1, 200, &failure);
+	rescue_map_destroy(map);
+	map = failure == NULL ? rescue_map_open(mapPath, kTestInputSize, &existed, &failure) : NULL;
+	if (map != NULL && failure == NULL && (! existed || rescue_map_numBadRanges(map) != 3 || rescue_map_amountBad(map) != 10 + 30 + (kTestInputSize - 200))) failure = "Map read back wrong";
+
+	//With an input that reads fine, the second pass gets everything.
+	FILE *_Nullable const inputFile = tmpfile();
+	FILE *_Nullable const outputFile = tmpfile();
+	unsigned char input[kTestInputSize], output[kTestInputSize];
+	for (unsigned int i = 0; i < kTestInputSize; ++i) input[i] = (unsigned char)(i * 7 + 1);
+	if (map != NULL && failure == NULL) {
+		if (inputFile == NULL || outputFile == NULL || pwrite(fileno(inputFile), input, sizeof(input), 0) != sizeof(input)) {
+			failure = "Could not create temporary files";
+		} else {
+			//An output that can't be written stops the pass, and everything it didn't get to stays in the map.
+			unsigned long long _Atomic amountRecovered = 0;
+			int const unwritableFD = open("/dev/null", O_RDONLY);
+			if (unwritableFD < 0) failure = "Could not open /dev/null";
+			else if (rescue_map_retry(map, fileno(inputFile), unwritableFD, 64, 16, /*alignment*/ 0, 3, &amountRecovered) == NULL) failure = "Second pass didn't fail to write";
+			else if (rescue_map_numBadRanges(map) != 3 || rescue_map_amountBad(map) != 10 + 30 + (kTestInputSize - 200)) failure = "Failed second pass lost ranges";
+			if (unwritableFD >= 0) close(unwritableFD);
+			amountRecovered = 0;
+			if (failure == NULL) failure = rescue_map_retry(map, fileno(inputFile), fileno(outputFile), 64, 16, /*alignment*/ 0, 3, &amountRecovered);
+			if (failure == NULL && (amountRecovered != 10 + 30 + (kTestInputSize - 200) || rescue_map_numBadRanges(map) != 0)) failure = "Second pass didn't recover everything";
+			memset(output, 0, sizeof(output));
+			if (failure == NULL && pread(fileno(outputFile), output, sizeof(output), 0) != sizeof(output)) failure = "Output is the wrong length";
+			if (failure == NULL && (memcmp(output + 50, input + 50, 10) != 0 || memcmp(output + 100, input + 100, 30) != 0 || memcmp(output + 200, input + 200, kTestInputSize - 200) != 0)) failure = "Recovered data doesn't match the input";
+		}
+	}
+	if (map != NULL) {
+		rescue_map_remove(map);
+		rescue_map_destroy(map);
+	}
+	if (inputFile != NULL) fclose(inputFile);
+	if (outputFile != NULL) fclose(outputFile);
+	unlink(mapPath);
+	rmdir(directoryPath);
+	return failure;
+}
+
+static char const *const test_cpu_list_parse(void) {
+	struct cpu_list list;
+	if (! cpu_list_parse("0-3,8,10-11\n", &list)) return "Couldn't parse a list in sysfs's format";
+	if (cpu_list_count(&list) != 7) return "Wrong number of CPUs in list";
+	char description[64];
+	cpu_list_copyDescription(description, &list, sizeof(description));
+	if (strcmp(description, "0-3,8,10-11") != 0) return "List described wrong";
+	if (! cpu_list_parse("1023", &list) || cpu_list_count(&list) != 1) return "Couldn't parse the highest CPU";
+
+	static char const *_Nonnull const kMalformed[] = { "", "1024", "3-1", "0,", ",0", "0-", "a", "0 1", "-1" };
+	for (unsigned int i = 0; i < sizeof(kMalformed) / sizeof(*kMalformed); ++i) {
+		if (cpu_list_parse(kMalformed[i], &list)) return "Parsed a malformed list";
+	}
+	return NULL;
+}
+
+static char const *const test_mapped_input_windows(void) {
+	//Two whole windows and part of a third, mostly hole, with a marker at the start of each window and at the very end.
+	enum { kTestFileSize = 2 * kMappedInputWindowSize + 5000, kStartOffset = 4096 + 100 };
+	FILE *_Nullable const file = tmpfile();
+	if (file == NULL) return "Could not create temporary file";
+	int const fd = fileno(file);
+	char const *_Nullable failure = NULL;
+	unsigned long long const markerOffsets[] = { kStartOffset, kMappedInputWindowSize, 2 * kMappedInputWindowSize, kTestFileSize - 1 };
+	enum { kNumMarkers = sizeof(markerOffsets) / sizeof(*markerOffsets) };
+	if (ftruncate(fd, kTestFileSize) != 0) failure = "Could not extend temporary file";
+	for (unsigned int i = 0; failure == NULL && i < kNumMarkers; ++i) {
+		unsigned char const marker = (unsigned char)(0xA0 + i);
+		if (pwrite(fd, &marker, 1, markerOffsets[i]) != 1) failure = "Could not write to temporary file";
+	}
+
+	struct mapped_input *_Nullable const input = failure == NULL ? mapped_input_create(fd, kStartOffset) : NULL;
+	if (failure == NULL && input == NULL) failure = "Could not map file";
+	//Hand out the file in blocks, the way the reader does, and release each one once it's been checked, the way the writers do.
+	enum { kBlockSize = 1024 * 1024 };
+	unsigned long long offset = kStartOffset;
+	unsigned int numMarkersFound = 0;
+	while (failure == NULL) {
+		size_t length = kBlockSize;
+		unsigned char const *_Nullable const bytes = mapped_input_bytes(input, offset, &length);
+		if (bytes == NULL) break;
+		if (length == 0 || length > kBlockSize || offset + length > kTestFileSize) failure = "Block length is wrong";
+		if (failure == NULL && ! mapped_input_fault(input, bytes, length)) failure = "Could not fault in a block";
+		for (unsigned int i = 0; failure == NULL && i < kNumMarkers; ++i) {
+			if (markerOffsets[i] >= offset && markerOffsets[i] < offset + length) {
+				if (bytes[markerOffsets[i] - offset] != 0xA0 + i) failure = "Mapped data doesn't match the file";
+				++numMarkersFound;
+			}
+		}
+		mapped_input_release(input, length);
+		offset += length;
+	}
+	if (failure == NULL && (offset != kTestFileSize || numMarkersFound != kNumMarkers)) failure = "Didn't get all of the file";
+	if (failure == NULL) {
+		//Released windows are only dropped from memory, not from the mapping; reading them again gets the file's data back.
+		size_t length = 1;
+		unsigned char const *_Nullable const bytes = mapped_input_bytes(input, kStartOffset, &length);
+		if (bytes == NULL || *bytes != 0xA0) failure = "Released window doesn't read back";
+	}
+	if (failure == NULL) {
+		//Pages past the end of a file that's gotten shorter can't be read; faulting them in should say so rather than crash.
+		size_t length = kTestFileSize - 2 * kMappedInputWindowSize;
+		unsigned char const *_Nullable const bytes = mapped_input_bytes(input, 2 * kMappedInputWindowSize, &length);
+		if (bytes == NULL || ftruncate(fd, kMappedInputWindowSize) != 0) failure = "Could not shorten temporary file";
+		else if (mapped_input_fault(input, bytes, length)) failure = "Faulted in pages past the end of the file";
+	}
+	if (input != NULL) mapped_input_destroy(input);
+	if (failure == NULL && mapped_input_create(fd, kTestFileSize) != NULL) failure = "Mapped an empty range";
+	fclose(file);
+	return failure;
+}
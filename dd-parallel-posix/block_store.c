@@ -0,0 +1,443 @@
+//
+//  block_store.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "block_store.h"
+#include "block_utils.h"
+#include "formatting_utils.h"
+#include "byte_order.h"
+#include "worker_pool.h"
+
+#include <inttypes.h>
+#include <sys/stat.h>
+
+static unsigned char const kRecipeMagic[4] = { 'd', 'd', 'p', 'r' };
+static unsigned char const kRecipeTrailerMagic[4] = { 'd', 'd', 'p', 'e' };
+enum { kRecipeFormatVersion = 1 };
+//A recipe is read in pieces of this size; it grows from there.
+enum { kRecipeReadSize = 1024 * 1024 };
+
+enum {
+	errorMaxLength = 255,
+	errorCapacity,
+};
+
+#pragma mark Recipes
+
+void block_recipe_makeHeader(void *_Nonnull const header, size_t const blockSize) {
+	unsigned char *_Nonnull const bytes = header;
+	memcpy(bytes, kRecipeMagic, sizeof(kRecipeMagic));
+	putBigEndian32(bytes + 4, kRecipeFormatVersion);
+	putBigEndian32(bytes + 8, (uint32_t)blockSize);
+	putBigEndian32(bytes + 12, 0);
+}
+void block_recipe_makeTrailer(void *_Nonnull const trailer, unsigned long long const totalLength) {
+	unsigned char *_Nonnull const bytes = trailer;
+	memcpy(bytes, kRecipeTrailerMagic, sizeof(kRecipeTrailerMagic));
+	putBigEndian32(bytes + 4, 0);
+	putBigEndian64(bytes + 8, totalLength);
+}
+
+struct block_recipe {
+	//The whole recipe, header and trailer included.
+	unsigned char *_Nonnull bytes;
+	size_t blockSize;
+	unsigned long long numBlocks;
+	unsigned long long totalLength;
+};
+
+struct block_recipe *_Nullable block_recipe_read(int const fd, char const *_Nullable *_Nonnull const outError) {
+	unsigned char *_Nullable bytes = NULL;
+	size_t length = 0, capacity = 0;
+	while (true) {
+		if (capacity - length < kRecipeReadSize) {
+			unsigned char *_Nullable const newBytes = realloc(bytes, capacity + kRecipeReadSize);
+			if (newBytes == NULL) {
+				free(bytes);
+				*outError = "Could not allocate memory for the recipe";
+				return NULL;
+			}
+			bytes = newBytes;
+			capacity += kRecipeReadSize;
+		}
+		ssize_t const amtRead = read(fd, bytes + length, capacity - length);
+		if (amtRead < 0) {
+			if (errno == EINTR) continue;
+			free(bytes);
+			*outError = strerror(errno);
+			return NULL;
+		}
+		if (amtRead == 0) break;
+		length += amtRead;
+	}
+
+	if (length < kBlockRecipeHeaderSize || memcmp(bytes, kRecipeMagic, sizeof(kRecipeMagic)) != 0) {
+		free(bytes);
+		*outError = "it isn't a block store recipe";
+		return NULL;
+	}
+	if (getBigEndian32(bytes + 4) != kRecipeFormatVersion) {
+		free(bytes);
+		*outError = "the recipe is in a format this version can't read";
+		return NULL;
+	}
+	size_t const blockSize = getBigEndian32(bytes + 8);
+	unsigned char const *_Nonnull const trailer = bytes + length - kBlockRecipeTrailerSize;
+	if (length < kBlockRecipeHeaderSize + kBlockRecipeTrailerSize || memcmp(trailer, kRecipeTrailerMagic, sizeof(kRecipeTrailerMagic)) != 0) {
+		free(bytes);
+		*outError = "the recipe ends before its trailer; it was cut short";
+		return NULL;
+	}
+	unsigned long long const totalLength = getBigEndian64(trailer + 8);
+	size_t const digestsLength = length - kBlockRecipeHeaderSize - kBlockRecipeTrailerSize;
+	unsigned long long const numBlocks = digestsLength / kBlockStoreDigestLength;
+	//Every block but the last is a whole block.
+	bool const makesSense = blockSize > 0 && digestsLength % kBlockStoreDigestLength == 0 && numBlocks == totalLength / blockSize + (totalLength % blockSize != 0);
+	if (! makesSense) {
+		free(bytes);
+		*outError = "the recipe is damaged (its blocks don't add up to the length its trailer says)";
+		return NULL;
+	}
+
+	struct block_recipe *_Nullable const recipe = calloc(1, sizeof(struct block_recipe));
+	if (recipe == NULL) {
+		free(bytes);
+		*outError = "Could not allocate memory for the recipe";
+		return NULL;
+	}
+	recipe->bytes = bytes;
+	recipe->blockSize = blockSize;
+	recipe->numBlocks = numBlocks;
+	recipe->totalLength = totalLength;
+	return recipe;
+}
+void block_recipe_destroy(struct block_recipe *_Nonnull const recipe) {
+	free(recipe->bytes);
+	free(recipe);
+}
+
+size_t block_recipe_blockSize(struct block_recipe const *_Nonnull const recipe) {
+	return recipe->blockSize;
+}
+unsigned long long block_recipe_numBlocks(struct block_recipe const *_Nonnull const recipe) {
+	return recipe->numBlocks;
+}
+unsigned long long block_recipe_totalLength(struct block_recipe const *_Nonnull const recipe) {
+	return recipe->totalLength;
+}
+unsigned char const *_Nonnull block_recipe_digest(struct block_recipe const *_Nonnull const recipe, unsigned long long const blockNumber) {
+	return recipe->bytes + kBlockRecipeHeaderSize + blockNumber * kBlockStoreDigestLength;
+}
+
+#pragma mark The pool
+
+enum block_outcome {
+	//Stored for the first time, or read back.
+	outcome_transferred,
+	//Already in the store, so not written again.
+	outcome_alreadyStored,
+	outcome_zeros,
+	numOutcomes
+};
+
+struct block_store_block {
+	void *_Nullable bytes;
+	size_t length;
+	unsigned char digest[kBlockStoreDigestLength];
+	enum block_outcome outcome;
+	bool failed;
+	char errorBuffer[errorCapacity];
+};
+
+struct block_store {
+	char *_Nonnull path;
+	bool restoring;
+	struct block_store_block *_Nonnull blocks;
+
+	//The pool's threads work on these. Each thread has room for a block's path, and the path of the temporary file it's written to before being renamed into place.
+	struct worker_pool *_Nullable pool;
+	size_t pathCapacity;
+	char *_Nonnull paths;
+	char *_Nonnull temporaryPaths;
+
+	//Only the thread finishing blocks touches these.
+	unsigned long long numBlocksByOutcome[numOutcomes];
+	unsigned long long numBytesByOutcome[numOutcomes];
+	char errorBuffer[errorCapacity];
+};
+
+static bool digestIsZeros(unsigned char const *_Nonnull const digest) {
+	return blockIsAllZero(digest, kBlockStoreDigestLength);
+}
+
+///Writes the path of the block with this digest, and returns the length of the path of the directory it's in.
+static size_t block_store_copyBlockPath(struct block_store const *_Nonnull const store, unsigned char const *_Nonnull const digest, char *_Nonnull const dst, size_t const dstCapacity) {
+	static char const hexDigits[] = "0123456789abcdef";
+	char hex[kBlockStoreDigestLength * 2 + 1];
+	for (unsigned int i = 0; i < kBlockStoreDigestLength; ++i) {
+		hex[i * 2] = hexDigits[digest[i] >> 4];
+		hex[i * 2 + 1] = hexDigits[digest[i] & 0xf];
+	}
+	hex[sizeof(hex) - 1] = '\0';
+	snprintf(dst, dstCapacity, "%s/%.2s/%s", store->path, hex, hex + 2);
+	return strlen(store->path) + 3;
+}
+
+static void block_fail(struct block_store_block *_Nonnull const block, char const *_Nonnull const what, char const *_Nonnull const path, int const errorNumber) {
+	int const prefixLength = snprintf(block->errorBuffer, errorCapacity, "%s %s: ", what, path);
+	if (prefixLength >= 0 && prefixLength < errorCapacity) {
+		copyErrorDescription(block->errorBuffer + prefixLength, errorNumber, errorCapacity - prefixLength);
+	}
+	block->failed = true;
+}
+
+///Makes sure an entry just created in or renamed into the directory at path (only its first length characters, if it's a longer path) will still be there after a crash.
+static bool syncDirectory(char const *_Nonnull const path, size_t const length, char *_Nonnull const buffer, size_t const capacity) {
+	snprintf(buffer, capacity, "%.*s", (int)length, path);
+	int const fd = open(buffer, O_RDONLY);
+	if (fd < 0) return false;
+	bool const synced = fsync(fd) == 0;
+	int const syncError = errno;
+	close(fd);
+	errno = syncError;
+	return synced;
+}
+
+///Hashes the block, and stores it if the store doesn't have it already. The block is written to a temporary file and then renamed into place, so a block in the store is always complete, even if another dd-parallel is storing the same block at the same time.
+static void block_store_putBlock(struct block_store *_Nonnull const store, struct block_store_block *_Nonnull const block, char *_Nonnull const path, char *_Nonnull const temporaryPath, size_t const pathCapacity) {
+	if (blockIsAllZero(block->bytes, block->length)) {
+		memset(block->digest, 0, sizeof(block->digest));
+		block->outcome = outcome_zeros;
+		return;
+	}
+	struct sha256_state state;
+	sha256_init(&state);
+	sha256_update(&state, block->bytes, block->length);
+	sha256_final(&state, block->digest);
+	size_t const directoryLength = block_store_copyBlockPath(store, block->digest, path, pathCapacity);
+
+	struct stat sb;
+	if (stat(path, &sb) == 0 && (unsigned long long)sb.st_size == block->length) {
+		block->outcome = outcome_alreadyStored;
+		return;
+	}
+	block->outcome = outcome_transferred;
+
+	//The temporary file goes in the same directory as the block, so renaming it is atomic.
+	snprintf(temporaryPath, pathCapacity, "%.*s/.new-XXXXXX", (int)directoryLength, path);
+	int fd = mkstemp(temporaryPath);
+	if (fd < 0 && errno == ENOENT) {
+		//The first block to go in each directory makes it.
+		snprintf(temporaryPath, pathCapacity, "%.*s", (int)directoryLength, path);
+		if (mkdir(temporaryPath, 0755) < 0 && errno != EEXIST) {
+			block_fail(block, "couldn't create", temporaryPath, errno);
+			return;
+		}
+		//Otherwise the directory, and every block renamed into it, could be lost with the store's own directory.
+		if (! syncDirectory(store->path, strlen(store->path), temporaryPath, pathCapacity)) {
+			block_fail(block, "couldn't sync", store->path, errno);
+			return;
+		}
+		snprintf(temporaryPath, pathCapacity, "%.*s/.new-XXXXXX", (int)directoryLength, path);
+		fd = mkstemp(temporaryPath);
+	}
+	if (fd < 0) {
+		block_fail(block, "couldn't create a block in", store->path, errno);
+		return;
+	}
+	fchmod(fd, 0644);
+	size_t amtWritten = 0;
+	bool written = true;
+	while (written && amtWritten < block->length) {
+		ssize_t const thisWrite = write(fd, (unsigned char const *)block->bytes + amtWritten, block->length - amtWritten);
+		if (thisWrite < 0 && errno == EINTR) continue;
+		written = thisWrite >= 0;
+		if (written) amtWritten += thisWrite;
+	}
+	//Recipes will count on this block being there, so make sure it is before the recipe says so.
+	if (written) written = fsync(fd) == 0;
+	int const writeError = errno;
+	close(fd);
+	if (! written) {
+		block_fail(block, "couldn't write", temporaryPath, writeError);
+		unlink(temporaryPath);
+		return;
+	}
+	if (rename(temporaryPath, path) < 0) {
+		block_fail(block, "couldn't store", path, errno);
+		unlink(temporaryPath);
+		return;
+	}
+	//The block's data is on the disk, but until its directory is, the name that finds it may not be.
+	if (! syncDirectory(path, directoryLength, temporaryPath, pathCapacity)) block_fail(block, "couldn't sync", temporaryPath, errno);
+}
+
+///Reads the block with the submitted digest into the submitted buffer, and checks that it is what it's supposed to be.
+static void block_store_getBlock(struct block_store *_Nonnull const store, struct block_store_block *_Nonnull const block, char *_Nonnull const path, size_t const pathCapacity) {
+	if (digestIsZeros(block->digest)) {
+		memset(block->bytes, 0, block->length);
+		block->outcome = outcome_zeros;
+		return;
+	}
+	block->outcome = outcome_transferred;
+	block_store_copyBlockPath(store, block->digest, path, pathCapacity);
+	int const fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		block_fail(block, errno == ENOENT ? "the store is missing block" : "couldn't open", path, errno);
+		return;
+	}
+	struct stat sb;
+	bool const rightSize = fstat(fd, &sb) == 0 && (unsigned long long)sb.st_size == block->length;
+	size_t amtRead = 0;
+	while (rightSize && amtRead < block->length) {
+		ssize_t const thisRead = pread(fd, (unsigned char *)block->bytes + amtRead, block->length - amtRead, amtRead);
+		if (thisRead < 0 && errno == EINTR) continue;
+		if (thisRead <= 0) break;
+		amtRead += thisRead;
+	}
+	int const readError = errno;
+	close(fd);
+	if (! rightSize) {
+		snprintf(block->errorBuffer, errorCapacity, "block %s in the store is the wrong size", path);
+		block->failed = true;
+		return;
+	}
+	if (amtRead < block->length) {
+		block_fail(block, "couldn't read", path, readError);
+		return;
+	}
+	unsigned char digest[kBlockStoreDigestLength];
+	struct sha256_state state;
+	sha256_init(&state);
+	sha256_update(&state, block->bytes, block->length);
+	sha256_final(&state, digest);
+	if (memcmp(digest, block->digest, sizeof(digest)) != 0) {
+		snprintf(block->errorBuffer, errorCapacity, "block %s in the store is damaged (its data doesn't match its name)", path);
+		block->failed = true;
+	}
+}
+
+static void block_store_work(void *_Nonnull const context, unsigned int const threadIndex, unsigned int const blockIndex) {
+	struct block_store *_Nonnull const store = context;
+	struct block_store_block *_Nonnull const block = &store->blocks[blockIndex];
+	char *_Nonnull const path = store->paths + threadIndex * store->pathCapacity;
+	char *_Nonnull const temporaryPath = store->temporaryPaths + threadIndex * store->pathCapacity;
+	if (store->restoring) {
+		block_store_getBlock(store, block, path, store->pathCapacity);
+	} else {
+		block_store_putBlock(store, block, path, temporaryPath, store->pathCapacity);
+	}
+}
+
+static void block_store_free(struct block_store *_Nonnull const store) {
+	if (store->pool != NULL) worker_pool_destroy(store->pool);
+	free(store->blocks);
+	free(store->paths);
+	free(store->temporaryPaths);
+	free(store->path);
+	free(store);
+}
+
+struct block_store *_Nullable block_store_create(char const *_Nonnull const path, bool const restoring, unsigned int const numThreads, unsigned int const maxBlocksInFlight, char const *_Nullable *_Nonnull const outError) {
+	*outError = NULL;
+	if (! restoring && mkdir(path, 0755) < 0 && errno != EEXIST) {
+		*outError = strerror(errno);
+		return NULL;
+	}
+	struct stat sb;
+	if (stat(path, &sb) < 0) {
+		*outError = strerror(errno);
+		return NULL;
+	}
+	if (! S_ISDIR(sb.st_mode)) {
+		*outError = "a block store has to be a directory";
+		return NULL;
+	}
+
+	struct block_store *_Nullable const store = calloc(1, sizeof(struct block_store));
+	if (store == NULL) {
+		*outError = "Could not allocate block store buffers";
+		return NULL;
+	}
+	store->restoring = restoring;
+	store->path = strdup(path);
+	store->blocks = calloc(maxBlocksInFlight, sizeof(struct block_store_block));
+	store->pathCapacity = strlen(path) + kBlockStoreDigestLength * 2 + 16;
+	store->paths = calloc(numThreads, store->pathCapacity);
+	store->temporaryPaths = calloc(numThreads, store->pathCapacity);
+	if (store->path == NULL || store->blocks == NULL || store->paths == NULL || store->temporaryPaths == NULL) {
+		*outError = "Could not allocate block store buffers";
+		block_store_free(store);
+		return NULL;
+	}
+
+	store->pool = worker_pool_create(numThreads, maxBlocksInFlight, store, block_store_work, restoring ? "Block restoring thread" : "Block storing thread", /*inOrderWork*/ NULL, /*inOrderThreadName*/ NULL);
+	if (store->pool == NULL) {
+		*outError = "Could not start block store threads";
+		block_store_free(store);
+		return NULL;
+	}
+	return store;
+}
+void block_store_stop(struct block_store *_Nonnull const store) {
+	worker_pool_stop(store->pool);
+}
+void block_store_destroy(struct block_store *_Nonnull const store) {
+	block_store_stop(store);
+	block_store_free(store);
+}
+
+void block_store_submitBlock(struct block_store *_Nonnull const store, void *_Nonnull const bytes, size_t const length, unsigned char const *_Nullable const digest) {
+	struct block_store_block *_Nonnull const block = &store->blocks[worker_pool_reserve(store->pool)];
+	block->bytes = bytes;
+	block->length = length;
+	if (digest != NULL) memcpy(block->digest, digest, sizeof(block->digest));
+	block->failed = false;
+	worker_pool_submit(store->pool);
+}
+bool block_store_finishBlock(struct block_store *_Nonnull const store, unsigned char *_Nullable const outDigest, char const *_Nullable *_Nonnull const outError) {
+	unsigned int blockIndex = 0;
+	if (! worker_pool_waitForNext(store->pool, &blockIndex)) {
+		*outError = "no block to finish";
+		return false;
+	}
+	struct block_store_block *_Nonnull const block = &store->blocks[blockIndex];
+	//Once it's finished, the block can be reused, so take everything we need from it first.
+	bool const failed = block->failed;
+	if (failed) strlcpy(store->errorBuffer, block->errorBuffer, errorCapacity);
+	if (outDigest != NULL) memcpy(outDigest, block->digest, kBlockStoreDigestLength);
+	enum block_outcome const outcome = block->outcome;
+	size_t const length = block->length;
+	worker_pool_finish(store->pool);
+
+	if (failed) {
+		*outError = store->errorBuffer;
+		return false;
+	}
+	++store->numBlocksByOutcome[outcome];
+	store->numBytesByOutcome[outcome] += length;
+	return true;
+}
+
+void block_store_printReport(struct block_store const *_Nonnull const store, FILE *_Nonnull const file) {
+	enum { phraseCapacity = 64 };
+	char phrases[numOutcomes][phraseCapacity];
+	for (unsigned int i = 0; i < numOutcomes; ++i) {
+		copyByteCountPhrase(phrases[i], store->numBytesByOutcome[i], phraseCapacity);
+	}
+	unsigned long long const *_Nonnull const numBlocks = store->numBlocksByOutcome;
+	if (store->restoring) {
+		fprintf(file, "Read %llu block%s (%s) from the store; %llu (%s) %s all zeros\n",
+			numBlocks[outcome_transferred], numBlocks[outcome_transferred] == 1 ? "" : "s", phrases[outcome_transferred],
+			numBlocks[outcome_zeros], phrases[outcome_zeros], numBlocks[outcome_zeros] == 1 ? "was" : "were");
+	} else {
+		fprintf(file, "Stored %llu new block%s (%s); %llu (%s) %s already in the store, and %llu (%s) %s all zeros\n",
+			numBlocks[outcome_transferred], numBlocks[outcome_transferred] == 1 ? "" : "s", phrases[outcome_transferred],
+			numBlocks[outcome_alreadyStored], phrases[outcome_alreadyStored], numBlocks[outcome_alreadyStored] == 1 ? "was" : "were",
+			numBlocks[outcome_zeros], phrases[outcome_zeros], numBlocks[outcome_zeros] == 1 ? "was" : "were");
+	}
+}
@@ -0,0 +1,62 @@
+//
+//  block_store.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef block_store_h
+#define block_store_h
+
+#include "digests.h"
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+//A block store is a directory of blocks named for their SHA-256 digests, which any number of images can share: images of machines built from the same OS image mostly have the same blocks, and each of those only needs to be stored (and written) once. A block whose digest is 0123abcd… is in the file 01/23abcd… under the store's directory. Blocks of zeros aren't stored at all.
+//An image in a store is a recipe: a header, then the digest of each block in order, then a trailer. The header is the magic “ddpr”, then the format version (1), the block size, and a reserved 0, each 32 bits. A block of zeros has a digest of all zeros. The trailer is the magic “ddpe”, a reserved 0 (32 bits), and the total length of the image (64 bits); a recipe without one was cut short. Every block but the last is a whole block. All numbers are big-endian.
+//A recipe takes 32 bytes per block (32 MiB per TiB, with 1 MiB blocks).
+
+enum {
+	kBlockStoreDigestLength = sha256_digestLength,
+	kBlockRecipeHeaderSize = 16,
+	kBlockRecipeTrailerSize = 16,
+};
+
+///Writes the header of a recipe with blocks of blockSize bytes into header, which has room for kBlockRecipeHeaderSize bytes.
+void block_recipe_makeHeader(void *_Nonnull const header, size_t const blockSize);
+///Writes the trailer (kBlockRecipeTrailerSize bytes) of a recipe for totalLength bytes of data.
+void block_recipe_makeTrailer(void *_Nonnull const trailer, unsigned long long const totalLength);
+
+struct block_recipe;
+///Reads a whole recipe from fd, which may be a pipe, and checks that it's complete. Returns NULL, with *outError set, if it can't be read or isn't a recipe this version can read.
+struct block_recipe *_Nullable block_recipe_read(int const fd, char const *_Nullable *_Nonnull const outError);
+void block_recipe_destroy(struct block_recipe *_Nonnull const recipe);
+size_t block_recipe_blockSize(struct block_recipe const *_Nonnull const recipe);
+unsigned long long block_recipe_numBlocks(struct block_recipe const *_Nonnull const recipe);
+unsigned long long block_recipe_totalLength(struct block_recipe const *_Nonnull const recipe);
+///Gets the digest of block number blockNumber (which must be less than the number of blocks).
+unsigned char const *_Nonnull block_recipe_digest(struct block_recipe const *_Nonnull const recipe, unsigned long long const blockNumber);
+
+//Putting blocks into a store, or getting them back out, happens on a pool of threads, so hashing (or reading back) several blocks at once keeps up with the devices. Blocks are submitted by one thread (the reader) and finished, in the same order, by another (the writer), just as with a manifest.
+
+struct block_store;
+
+///Opens the store in the directory at path, with numThreads threads. Up to maxBlocksInFlight blocks may have been submitted and not yet finished. If restoring is false, blocks go into the store, and the directory is created if need be; otherwise they come out of it. Returns NULL on failure, with *outError set to a description of the problem.
+struct block_store *_Nullable block_store_create(char const *_Nonnull const path, bool const restoring, unsigned int const numThreads, unsigned int const maxBlocksInFlight, char const *_Nullable *_Nonnull const outError);
+///Stops the threads, abandoning any blocks submitted and not finished. Call this before the memory those blocks are in goes away; after it, only block_store_printReport and block_store_destroy may be called.
+void block_store_stop(struct block_store *_Nonnull const store);
+///Stops the threads, if they haven't been already, and frees everything.
+void block_store_destroy(struct block_store *_Nonnull const store);
+
+///Hands a block to the threads. When storing, bytes is length bytes of data, to be hashed and stored if the store doesn't have it already, and digest is NULL. When restoring, the block with this digest gets read into bytes, which has room for length bytes (the length of the block). The bytes must not change (or be looked at, when restoring) until block_store_finishBlock has returned for this block.
+void block_store_submitBlock(struct block_store *_Nonnull const store, void *_Nonnull const bytes, size_t const length, unsigned char const *_Nullable const digest);
+///Waits for the oldest unfinished block to be done. When storing, gets its digest into outDigest, which has room for kBlockStoreDigestLength bytes. Returns false, with *outError set, if the block couldn't be stored or restored.
+bool block_store_finishBlock(struct block_store *_Nonnull const store, unsigned char *_Nullable const outDigest, char const *_Nullable *_Nonnull const outError);
+
+///Writes a description of how many blocks were new to the store, already in it, or zeros. Only call this once the writer is done.
+void block_store_printReport(struct block_store const *_Nonnull const store, FILE *_Nonnull const file);
+
+#endif /* block_store_h */
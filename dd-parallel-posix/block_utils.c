@@ -0,0 +1,73 @@
+//
+//  block_utils.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "block_utils.h"
+
+#include <stdint.h>
+#include <string.h>
+
+//Both Clang and GCC understand vector types, and lower them to whatever the target has (SSE, NEON), or to plain integer operations if it has nothing. 16 bytes is what every 64-bit target we build for has as a baseline.
+typedef uint64_t vector_u64 __attribute__((vector_size(16)));
+enum {
+	kVectorSize = sizeof(vector_u64),
+	kVectorsPerStride = 8,
+	kStrideSize = kVectorSize * kVectorsPerStride,
+};
+
+static inline vector_u64 loadVector(unsigned char const *_Nonnull const bytes) {
+	//memcpy is how we ask for an unaligned load without breaking aliasing rules; it compiles down to a single instruction.
+	vector_u64 vector;
+	memcpy(&vector, bytes, kVectorSize);
+	return vector;
+}
+static inline bool vectorIsZero(vector_u64 const vector) {
+	return (vector[0] | vector[1]) == 0;
+}
+
+bool blockIsAllZero(void const *_Nonnull const block, size_t const length) {
+	unsigned char const *_Nonnull bytes = block;
+	unsigned char const *_Nonnull const end = bytes + length;
+
+	//OR a whole stride together and only test the result, so the loop body is loads and ORs with a single branch.
+	for (; end - bytes >= kStrideSize; bytes += kStrideSize) {
+		vector_u64 accumulator = loadVector(bytes);
+		for (unsigned int i = 1; i < kVectorsPerStride; ++i) {
+			accumulator |= loadVector(bytes + i * kVectorSize);
+		}
+		if (! vectorIsZero(accumulator)) return false;
+	}
+	for (; end - bytes >= kVectorSize; bytes += kVectorSize) {
+		if (! vectorIsZero(loadVector(bytes))) return false;
+	}
+	for (; bytes < end; ++bytes) {
+		if (*bytes != 0) return false;
+	}
+	return true;
+}
+
+size_t blockFirstDifference(void const *_Nonnull const a, void const *_Nonnull const b, size_t const length) {
+	unsigned char const *_Nonnull const aBytes = a;
+	unsigned char const *_Nonnull const bBytes = b;
+	size_t offset = 0;
+
+	//Same trick as blockIsAllZero, on the XOR of the two blocks. Once a stride has a difference in it, the byte loop below finds exactly where.
+	for (; length - offset >= kStrideSize; offset += kStrideSize) {
+		vector_u64 accumulator = loadVector(aBytes + offset) ^ loadVector(bBytes + offset);
+		for (unsigned int i = 1; i < kVectorsPerStride; ++i) {
+			accumulator |= loadVector(aBytes + offset + i * kVectorSize) ^ loadVector(bBytes + offset + i * kVectorSize);
+		}
+		if (! vectorIsZero(accumulator)) break;
+	}
+	for (; length - offset >= kVectorSize; offset += kVectorSize) {
+		if (! vectorIsZero(loadVector(aBytes + offset) ^ loadVector(bBytes + offset))) break;
+	}
+	for (; offset < length; ++offset) {
+		if (aBytes[offset] != bBytes[offset]) break;
+	}
+	return offset;
+}
@@ -0,0 +1,217 @@
+//
+//  buffer_ring.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "buffer_ring.h"
+#include "latency.h"
+#include "placement.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+struct ring_consumer {
+	//The number of slots this consumer has released. Only ever written by this consumer.
+	unsigned long _Atomic generation;
+	struct latency_histogram *_Nullable waits;
+};
+
+struct buffer_ring {
+	unsigned int depth;
+	//The most slots that may be full at once. Normally the same as depth.
+	unsigned int _Atomic depthLimit;
+	size_t bufferSize;
+	struct ring_slot *_Nonnull slots;
+	//All of the slots' buffers are in one mapping (see placement_allocate).
+	void *_Nullable memory;
+	size_t mappedLength;
+
+	//The read generation is the number of slots published by the producer; the write generation is the number of slots released by the consumer. Each is only ever written by its own side.
+	//The difference between them is the number of slots currently full. When it's equal to the depth limit, the producer has to wait; when it's zero, the consumer has to wait.
+	//With more than one consumer, each has a generation of its own, which it waits on instead, and the write generation is the number of slots that all of them have released.
+	unsigned long _Atomic readGeneration;
+	unsigned long _Atomic writeGeneration;
+	unsigned int numConsumers;
+	struct ring_consumer consumers[kRingMaximumConsumers];
+	//With more than one consumer, how many of them have yet to release each slot. Whichever releases a slot last advances the write generation. Each consumer releases slots in order, so the last release of a slot always comes after the last release of the one before it, and slots are freed in order.
+	unsigned int _Atomic *_Nonnull references;
+	bool _Atomic closed;
+	bool _Atomic cancelled;
+
+	//The lock and conditions are only used for sleeping. A side sets its waiting flag before checking one last time whether it really needs to sleep; the other side checks the flag after advancing its generation, so a wakeup can't fall between the check and the wait.
+	pthread_mutex_t lock;
+	pthread_cond_t slotFreed;
+	pthread_cond_t slotFilled;
+	//Any number of consumers may be asleep at once, so they all wait on the same condition and all get woken.
+	bool _Atomic producerWaiting;
+	unsigned int _Atomic numConsumersWaiting;
+	struct latency_histogram *_Nullable producerWaits;
+};
+
+struct buffer_ring *_Nullable ring_create(unsigned int const depth, size_t const bufferSize, size_t const alignment) {
+	return ring_createOnCPUs(depth, bufferSize, alignment, /*cpus*/ NULL);
+}
+struct buffer_ring *_Nullable ring_createOnCPUs(unsigned int const depth, size_t const bufferSize, size_t const alignment, struct cpu_list const *_Nullable const cpus) {
+	if (depth == 0) return NULL;
+
+	struct buffer_ring *_Nullable const ring = calloc(1, sizeof(struct buffer_ring));
+	if (ring == NULL) return NULL;
+	ring->depth = depth;
+	ring->depthLimit = depth;
+	ring->bufferSize = bufferSize;
+	ring->numConsumers = 1;
+	pthread_mutex_init(&ring->lock, /*attr*/ NULL);
+	pthread_cond_init(&ring->slotFreed, /*attr*/ NULL);
+	pthread_cond_init(&ring->slotFilled, /*attr*/ NULL);
+	ring->slots = calloc(depth, sizeof(struct ring_slot));
+	ring->references = calloc(depth, sizeof(*ring->references));
+	if (ring->slots == NULL || ring->references == NULL) {
+		ring_destroy(ring);
+		return NULL;
+	}
+	if (bufferSize == 0) return ring;
+	//The mapping starts on a huge page boundary, so spacing the buffers a multiple of alignment apart aligns every one of them.
+	size_t const bufferStride = (bufferSize + alignment - 1) / alignment * alignment;
+	if (depth > SIZE_MAX / bufferStride) {
+		ring_destroy(ring);
+		return NULL;
+	}
+	ring->memory = placement_allocate(depth * bufferStride, cpus, &ring->mappedLength);
+	if (ring->memory == NULL) {
+		ring_destroy(ring);
+		return NULL;
+	}
+	for (unsigned int i = 0; i < depth; ++i) {
+		ring->slots[i].buffer = (unsigned char *)ring->memory + i * bufferStride;
+	}
+	return ring;
+}
+void ring_destroy(struct buffer_ring *_Nonnull const ring) {
+	if (ring->memory != NULL) placement_free(ring->memory, ring->mappedLength);
+	free(ring->slots);
+	free(ring->references);
+	pthread_cond_destroy(&ring->slotFilled);
+	pthread_cond_destroy(&ring->slotFreed);
+	pthread_mutex_destroy(&ring->lock);
+	free(ring);
+}
+
+void const *_Nullable ring_slotData(struct ring_slot const *_Nonnull const slot) {
+	return slot->externalData != NULL ? slot->externalData : slot->buffer;
+}
+
+unsigned int ring_depth(struct buffer_ring const *_Nonnull const ring) {
+	return ring->depth;
+}
+size_t ring_bufferSize(struct buffer_ring const *_Nonnull const ring) {
+	return ring->bufferSize;
+}
+void ring_setDepthLimit(struct buffer_ring *_Nonnull const ring, unsigned int const depthLimit) {
+	ring->depthLimit = depthLimit < 1 ? 1 : depthLimit > ring->depth ? ring->depth : depthLimit;
+}
+void ring_setNumConsumers(struct buffer_ring *_Nonnull const ring, unsigned int const numConsumers) {
+	ring->numConsumers = numConsumers < 1 ? 1 : numConsumers > kRingMaximumConsumers ? kRingMaximumConsumers : numConsumers;
+}
+void ring_setWaitHistograms(struct buffer_ring *_Nonnull const ring, struct latency_histogram *_Nullable const producerWaits, struct latency_histogram *_Nullable const consumerWaits) {
+	ring->producerWaits = producerWaits;
+	ring->consumers[0].waits = consumerWaits;
+}
+void ring_setConsumerWaitHistogram(struct buffer_ring *_Nonnull const ring, unsigned int const consumerIdx, struct latency_histogram *_Nullable const consumerWaits) {
+	ring->consumers[consumerIdx].waits = consumerWaits;
+}
+unsigned long ring_readGeneration(struct buffer_ring const *_Nonnull const ring) {
+	return ring->readGeneration;
+}
+unsigned long ring_writeGeneration(struct buffer_ring const *_Nonnull const ring) {
+	return ring->writeGeneration;
+}
+unsigned long ring_consumerGeneration(struct buffer_ring const *_Nonnull const ring, unsigned int const consumerIdx) {
+	return ring->consumers[consumerIdx].generation;
+}
+
+static bool ring_producerMustWait(struct buffer_ring *_Nonnull const ring) {
+	return ring->readGeneration - ring->writeGeneration >= ring->depthLimit && ! ring->cancelled;
+}
+static bool ring_consumerMustWait(struct buffer_ring *_Nonnull const ring, struct ring_consumer *_Nonnull const consumer) {
+	return consumer->generation == ring->readGeneration && ! ring->closed;
+}
+///Wakes the other side if it's asleep (or about to be). Call after changing anything the other side waits on.
+static void ring_wake(struct buffer_ring *_Nonnull const ring, bool const otherSideWaiting, pthread_cond_t *_Nonnull const condition) {
+	if (otherSideWaiting) {
+		pthread_mutex_lock(&ring->lock);
+		pthread_cond_broadcast(condition);
+		pthread_mutex_unlock(&ring->lock);
+	}
+}
+
+#pragma mark Producer
+
+struct ring_slot *_Nullable ring_acquireEmptySlot(struct buffer_ring *_Nonnull const ring) {
+	if (ring_producerMustWait(ring)) {
+		unsigned long long const waitStartedTime = latency_now();
+		pthread_mutex_lock(&ring->lock);
+		ring->producerWaiting = true;
+		while (ring_producerMustWait(ring)) {
+			pthread_cond_wait(&ring->slotFreed, &ring->lock);
+		}
+		ring->producerWaiting = false;
+		pthread_mutex_unlock(&ring->lock);
+		if (ring->producerWaits != NULL) latency_recordSince(ring->producerWaits, waitStartedTime);
+	}
+	if (ring->cancelled) return NULL;
+
+	return &ring->slots[ring->readGeneration % ring->depth];
+}
+void ring_publishFilledSlot(struct buffer_ring *_Nonnull const ring) {
+	if (ring->numConsumers > 1) ring->references[ring->readGeneration % ring->depth] = ring->numConsumers;
+	++ring->readGeneration;
+	ring_wake(ring, ring->numConsumersWaiting > 0, &ring->slotFilled);
+}
+void ring_close(struct buffer_ring *_Nonnull const ring) {
+	ring->closed = true;
+	ring_wake(ring, ring->numConsumersWaiting > 0, &ring->slotFilled);
+}
+
+#pragma mark Consumer
+
+struct ring_slot *_Nullable ring_acquireFilledSlot(struct buffer_ring *_Nonnull const ring) {
+	return ring_acquireFilledSlotForConsumer(ring, 0);
+}
+void ring_releaseSlot(struct buffer_ring *_Nonnull const ring) {
+	ring_releaseSlotForConsumer(ring, 0);
+}
+struct ring_slot *_Nullable ring_acquireFilledSlotForConsumer(struct buffer_ring *_Nonnull const ring, unsigned int const consumerIdx) {
+	struct ring_consumer *_Nonnull const consumer = &ring->consumers[consumerIdx];
+	if (ring_consumerMustWait(ring, consumer)) {
+		unsigned long long const waitStartedTime = latency_now();
+		pthread_mutex_lock(&ring->lock);
+		++ring->numConsumersWaiting;
+		while (ring_consumerMustWait(ring, consumer)) {
+			pthread_cond_wait(&ring->slotFilled, &ring->lock);
+		}
+		--ring->numConsumersWaiting;
+		pthread_mutex_unlock(&ring->lock);
+		if (consumer->waits != NULL) latency_recordSince(consumer->waits, waitStartedTime);
+	}
+	if (consumer->generation == ring->readGeneration) return NULL;
+
+	return &ring->slots[consumer->generation % ring->depth];
+}
+bool ring_releaseSlotForConsumer(struct buffer_ring *_Nonnull const ring, unsigned int const consumerIdx) {
+	struct ring_consumer *_Nonnull const consumer = &ring->consumers[consumerIdx];
+	unsigned long const slotIdx = consumer->generation % ring->depth;
+	++consumer->generation;
+	if (ring->numConsumers > 1 && atomic_fetch_sub(&ring->references[slotIdx], 1) != 1) return false;
+	++ring->writeGeneration;
+	ring_wake(ring, ring->producerWaiting, &ring->slotFreed);
+	return true;
+}
+void ring_cancel(struct buffer_ring *_Nonnull const ring) {
+	ring->cancelled = true;
+	ring_wake(ring, ring->producerWaiting, &ring->slotFreed);
+}
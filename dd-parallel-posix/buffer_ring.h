@@ -0,0 +1,86 @@
+//
+//  buffer_ring.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef buffer_ring_h
+#define buffer_ring_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+struct latency_histogram;
+struct cpu_list;
+
+//A buffer ring is a fixed set of equally-sized buffers passed from one producer thread (the reader) to one consumer thread (the writer) in order.
+//Handing a slot across is lock-free: each side only advances its own generation counter. A side only takes the lock when it has run out of slots and needs to sleep until the other side produces or frees one.
+//A ring can also have several consumers (one writer per output), each of which gets every slot, in order, at its own pace. A slot is only freed for the producer once every consumer has released it, so the slowest consumer can fall as far as the depth behind the fastest; any further and the producer, and so everyone else, waits for it.
+
+enum { kRingMaximumConsumers = 32 };
+
+struct ring_slot {
+	///NULL if the ring was created without buffers.
+	void *_Nullable buffer;
+	///Where the data is, if not in the buffer: the producer can point this at data that's already in memory (such as a mapping of the input) instead of copying it into the buffer. It has to stay there until every consumer has released the slot. NULL means the data is in the buffer; the producer should set it back to NULL whenever it fills the buffer.
+	void const *_Nullable externalData;
+	///How much data the producer put in this buffer.
+	size_t length;
+	///If true, this slot stands for length bytes of zeros (which may be more than the buffer could hold), and the buffer's contents are meaningless.
+	bool isHole;
+	///If true (along with isHole), the zeros stand in for data that couldn't be read.
+	bool isUnread;
+};
+
+struct buffer_ring;
+
+///Each buffer's address is a multiple of alignment, which must be a power of two, a multiple of sizeof(void *), and no more than 2 MiB. The buffers are all allocated together, on huge pages and locked into memory where possible (see placement_allocate). A bufferSize of 0 makes a ring with no buffers, for a producer that only ever passes along data that's somewhere else (see ring_slot.externalData). Returns NULL if the buffers could not be allocated.
+struct buffer_ring *_Nullable ring_create(unsigned int const depth, size_t const bufferSize, size_t const alignment);
+///The same as ring_create, but the buffers' memory comes from the NUMA node that the CPUs are on.
+struct buffer_ring *_Nullable ring_createOnCPUs(unsigned int const depth, size_t const bufferSize, size_t const alignment, struct cpu_list const *_Nullable const cpus);
+void ring_destroy(struct buffer_ring *_Nonnull const ring);
+
+unsigned int ring_depth(struct buffer_ring const *_Nonnull const ring);
+///Where a filled slot's data is: its externalData, if it has any, and otherwise its buffer.
+void const *_Nullable ring_slotData(struct ring_slot const *_Nonnull const slot);
+size_t ring_bufferSize(struct buffer_ring const *_Nonnull const ring);
+///Limits how many slots may be full at once, to anywhere from 1 to the ring's depth. The buffers beyond the limit stay allocated, so the limit can be raised again later. Only the producer should call this; lowering it doesn't take back slots that are already full.
+void ring_setDepthLimit(struct buffer_ring *_Nonnull const ring, unsigned int const depthLimit);
+///Sets how many consumers the ring has, from 1 (the default) to kRingMaximumConsumers. Call before either side starts.
+void ring_setNumConsumers(struct buffer_ring *_Nonnull const ring, unsigned int const numConsumers);
+///Records how long each side spends asleep waiting for the other: the producer for a free slot, in producerWaits, and the consumer for a filled one, in consumerWaits. Acquiring a slot without having to wait records nothing. Either may be NULL. Call before either side starts.
+void ring_setWaitHistograms(struct buffer_ring *_Nonnull const ring, struct latency_histogram *_Nullable const producerWaits, struct latency_histogram *_Nullable const consumerWaits);
+///The same as ring_setWaitHistograms, for the consumer at consumerIdx. ring_setWaitHistograms sets consumer 0's.
+void ring_setConsumerWaitHistogram(struct buffer_ring *_Nonnull const ring, unsigned int const consumerIdx, struct latency_histogram *_Nullable const consumerWaits);
+///The number of slots the producer has published so far.
+unsigned long ring_readGeneration(struct buffer_ring const *_Nonnull const ring);
+///The number of slots the consumer has released so far. With more than one consumer, the number every consumer has released.
+unsigned long ring_writeGeneration(struct buffer_ring const *_Nonnull const ring);
+///The number of slots the consumer at consumerIdx has released so far.
+unsigned long ring_consumerGeneration(struct buffer_ring const *_Nonnull const ring, unsigned int const consumerIdx);
+
+#pragma mark Producer
+
+///Blocks until a slot is free, then returns it. Returns NULL if the consumer has cancelled the ring.
+struct ring_slot *_Nullable ring_acquireEmptySlot(struct buffer_ring *_Nonnull const ring);
+///Hands the slot most recently returned by ring_acquireEmptySlot to the consumer.
+void ring_publishFilledSlot(struct buffer_ring *_Nonnull const ring);
+///Tells the consumer no more slots are coming. Slots already published will still be delivered.
+void ring_close(struct buffer_ring *_Nonnull const ring);
+
+#pragma mark Consumer
+
+///Blocks until a slot has been published, then returns it. Returns NULL once the producer has closed the ring and every published slot has been consumed.
+struct ring_slot *_Nullable ring_acquireFilledSlot(struct buffer_ring *_Nonnull const ring);
+///Returns the slot most recently returned by ring_acquireFilledSlot to the producer.
+void ring_releaseSlot(struct buffer_ring *_Nonnull const ring);
+///The same as ring_acquireFilledSlot and ring_releaseSlot, for the consumer at consumerIdx, when there's more than one. ring_acquireFilledSlot and ring_releaseSlot are consumer 0's. Each consumer must only be used from one thread.
+struct ring_slot *_Nullable ring_acquireFilledSlotForConsumer(struct buffer_ring *_Nonnull const ring, unsigned int const consumerIdx);
+///Returns true if this consumer was the last one holding the slot, so the producer can have it back.
+bool ring_releaseSlotForConsumer(struct buffer_ring *_Nonnull const ring, unsigned int const consumerIdx);
+///Tells the producer to stop (e.g., because a write failed). Any blocked or future ring_acquireEmptySlot returns NULL.
+void ring_cancel(struct buffer_ring *_Nonnull const ring);
+
+#endif /* buffer_ring_h */
@@ -0,0 +1,29 @@
+//
+//  byte_order.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef byte_order_h
+#define byte_order_h
+
+#include <stdint.h>
+
+//The file formats (compressed images, their indexes, and block store recipes) store every number big-endian, whatever the machine's own byte order, and not necessarily aligned.
+
+static inline void putBigEndian32(unsigned char *_Nonnull const dst, uint32_t const value) {
+	for (unsigned int i = 0; i < 4; ++i) dst[i] = (unsigned char)(value >> (24 - i * 8));
+}
+static inline void putBigEndian64(unsigned char *_Nonnull const dst, uint64_t const value) {
+	for (unsigned int i = 0; i < 8; ++i) dst[i] = (unsigned char)(value >> (56 - i * 8));
+}
+static inline uint32_t getBigEndian32(unsigned char const *_Nonnull const src) {
+	return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
+}
+static inline uint64_t getBigEndian64(unsigned char const *_Nonnull const src) {
+	return ((uint64_t)getBigEndian32(src) << 32) | getBigEndian32(src + 4);
+}
+
+#endif /* byte_order_h */
@@ -0,0 +1,414 @@
+//
+//  compression.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "compression.h"
+#include "digests.h"
+#include "block_utils.h"
+#include "formatting_utils.h"
+#include "byte_order.h"
+#include "worker_pool.h"
+
+#include <inttypes.h>
+#if EXISTS_ZLIB
+#	include <zlib.h>
+#endif
+
+static unsigned char const kImageMagic[4] = { 'd', 'd', 'p', 'z' };
+enum { kFormatVersion = 1 };
+
+enum frame_method {
+	method_stored = 0,
+	method_deflate = 1,
+	method_zeros = 2,
+	method_end = 0xff,
+};
+
+#if EXISTS_ZLIB
+//Level 1 is several times faster than the default, and still gets most of the way there on the kinds of data that compress at all (empty file-system space, logs, databases). The point is to keep up with the devices.
+enum { kDeflateLevel = 1 };
+//A deflated block is only kept if it's at most this fraction of the original; otherwise it's stored as is, and doesn't cost anything to read back.
+static double const kWorthwhileFraction = 0.95;
+//Once a thread has found a block that doesn't compress, it tries a sample of this much of the next one first, and stores the block as is without compressing the rest if the sample doesn't compress to kSampleWorthwhileFraction. Data that doesn't compress (video, encrypted volumes, archives) tends to come in long runs, and this way it costs a few percent of the work of deflating it.
+enum { kSampleSize = 64 * 1024 };
+static double const kSampleWorthwhileFraction = 0.9;
+#endif
+
+void compression_makeImageHeader(void *_Nonnull const header, size_t const blockSize) {
+	unsigned char *_Nonnull const bytes = header;
+	memcpy(bytes, kImageMagic, sizeof(kImageMagic));
+	putBigEndian32(bytes + 4, kFormatVersion);
+	putBigEndian32(bytes + 8, (uint32_t)blockSize);
+	putBigEndian32(bytes + 12, 0);
+}
+bool compression_parseImageHeader(void const *_Nonnull const header, size_t *_Nonnull const outBlockSize) {
+	unsigned char const *_Nonnull const bytes = header;
+	if (memcmp(bytes, kImageMagic, sizeof(kImageMagic)) != 0 || getBigEndian32(bytes + 4) != kFormatVersion) return false;
+	uint32_t const blockSize = getBigEndian32(bytes + 8);
+	if (blockSize == 0) return false;
+	*outBlockSize = blockSize;
+	return true;
+}
+
+static void makeFrameHeader(unsigned char *_Nonnull const header, enum frame_method const method, size_t const storedLength, size_t const originalLength, uint64_t const digest) {
+	header[0] = method;
+	header[1] = header[2] = header[3] = 0;
+	putBigEndian32(header + 4, (uint32_t)storedLength);
+	putBigEndian32(header + 8, (uint32_t)originalLength);
+	putBigEndian64(header + 12, digest);
+}
+bool compression_parseFrameHeader(void const *_Nonnull const header, size_t const blockSize, size_t *_Nonnull const outStoredLength, size_t *_Nonnull const outOriginalLength, bool *_Nonnull const outIsEnd) {
+	unsigned char const *_Nonnull const bytes = header;
+	size_t const storedLength = getBigEndian32(bytes + 4), originalLength = getBigEndian32(bytes + 8);
+	bool valid;
+	switch (bytes[0]) {
+		case method_stored:
+			valid = storedLength == originalLength && originalLength <= blockSize;
+			break;
+		case method_deflate:
+			valid = storedLength <= blockSize && originalLength <= blockSize;
+			break;
+		case method_zeros:
+			valid = storedLength == 0 && originalLength <= blockSize;
+			break;
+		case method_end:
+			valid = storedLength == kCompressionEndFrameSize - kCompressionFrameHeaderSize && originalLength == 0;
+			break;
+		default:
+			valid = false;
+			break;
+	}
+	if (! valid) return false;
+	*outStoredLength = storedLength;
+	*outOriginalLength = originalLength;
+	*outIsEnd = bytes[0] == method_end;
+	return true;
+}
+void compression_makeEndFrame(void *_Nonnull const frame, unsigned long long const totalLength) {
+	unsigned char *_Nonnull const bytes = frame;
+	makeFrameHeader(bytes, method_end, kCompressionEndFrameSize - kCompressionFrameHeaderSize, 0, 0);
+	putBigEndian64(bytes + kCompressionFrameHeaderSize, totalLength);
+}
+unsigned long long compression_endFrameTotalLength(void const *_Nonnull const storedData) {
+	return getBigEndian64(storedData);
+}
+
+#pragma mark The pool
+
+struct compression_block {
+	void const *_Nullable input;
+	size_t inputLength;
+	//For a compressor, the frame header followed by the deflated data, if any; for a decompressor, the decompressed data.
+	unsigned char *_Nonnull outputBuffer;
+	struct compression_output output;
+	enum frame_method method;
+	char const *_Nullable error;
+};
+
+struct compression {
+	bool decompress;
+	size_t blockSize;
+	unsigned int maxBlocksInFlight;
+	struct compression_block *_Nonnull blocks;
+	//What a zeros frame decompresses to.
+	void *_Nullable zeros;
+
+	//The pool's threads work on these; each has a worker of its own.
+	struct worker_pool *_Nullable pool;
+	unsigned int numWorkers;
+	struct compression_worker *_Nonnull workers;
+
+	//Only the thread finishing blocks touches these.
+	unsigned long long originalBytes;
+	unsigned long long imageBytes;
+	unsigned long long numFramesByMethod[3];
+};
+
+//Each thread has its own streams, since setting one up costs far more than resetting it, and a sample buffer.
+struct compression_worker {
+#if EXISTS_ZLIB
+	z_stream stream;
+	bool streamReady;
+#endif
+	unsigned char *_Nullable sampleBuffer;
+	bool lastBlockWasIncompressible;
+	//Whether compression_worker_init succeeded.
+	bool ready;
+};
+
+#if EXISTS_ZLIB
+///Deflates length bytes into at most capacity bytes at dst. Returns how many bytes it took, or 0 if they didn't fit (which means it wasn't worth it).
+static size_t compression_deflate(struct compression_worker *_Nonnull const worker, void const *_Nonnull const bytes, size_t const length, unsigned char *_Nonnull const dst, size_t const capacity) {
+	if (deflateReset(&worker->stream) != Z_OK) return 0;
+	worker->stream.next_in = (Bytef *)bytes;
+	worker->stream.avail_in = (uInt)length;
+	worker->stream.next_out = dst;
+	worker->stream.avail_out = (uInt)capacity;
+	if (deflate(&worker->stream, Z_FINISH) != Z_STREAM_END) return 0;
+	return capacity - worker->stream.avail_out;
+}
+#endif
+
+static void compression_compressBlock(struct compression *_Nonnull const compression, struct compression_worker *_Nonnull const worker, struct compression_block *_Nonnull const block) {
+	unsigned char *_Nonnull const header = block->outputBuffer;
+	size_t const length = block->inputLength;
+	block->output = (struct compression_output){ .bytes = header, .length = kCompressionFrameHeaderSize, .originalLength = length };
+	if (blockIsAllZero(block->input, length)) {
+		block->method = method_zeros;
+		makeFrameHeader(header, method_zeros, 0, length, 0);
+		return;
+	}
+
+	uint64_t const digest = xxh64(block->input, length, 0);
+	size_t deflatedLength = 0;
+#if EXISTS_ZLIB
+	bool worthTrying = true;
+	if (worker->lastBlockWasIncompressible && length >= kSampleSize * 2) {
+		//Sample from the middle, away from any headers at the start of the block.
+		size_t const sampleStart = (length - kSampleSize) / 2;
+		size_t const sampleCapacity = (size_t)(kSampleSize * kSampleWorthwhileFraction);
+		worthTrying = compression_deflate(worker, block->input + sampleStart, kSampleSize, worker->sampleBuffer, sampleCapacity) > 0;
+	}
+	if (worthTrying) {
+		deflatedLength = compression_deflate(worker, block->input, length, header + kCompressionFrameHeaderSize, (size_t)(length * kWorthwhileFraction));
+	}
+	worker->lastBlockWasIncompressible = deflatedLength == 0;
+#endif
+	if (deflatedLength > 0) {
+		block->method = method_deflate;
+		makeFrameHeader(header, method_deflate, deflatedLength, length, digest);
+		block->output.length += deflatedLength;
+	} else {
+		block->method = method_stored;
+		makeFrameHeader(header, method_stored, length, length, digest);
+		block->output.moreBytes = block->input;
+		block->output.moreLength = length;
+	}
+}
+
+///Decompresses a whole frame, header included, into outputBuffer (blockSize bytes), unless its data can be used where it is. Returns NULL on success, with *outBytes pointing to the original data; otherwise, a description of what's wrong with the frame.
+static char const *_Nullable compression_decodeFrame(struct compression_worker *_Nonnull const worker, unsigned char const *_Nonnull const frame, size_t const blockSize, void const *_Nonnull const zeros, unsigned char *_Nonnull const outputBuffer, void const *_Nullable *_Nonnull const outBytes) {
+	unsigned char const *_Nonnull const storedData = frame + kCompressionFrameHeaderSize;
+	size_t const originalLength = getBigEndian32(frame + 8);
+	uint64_t const digest = getBigEndian64(frame + 12);
+
+	switch (frame[0]) {
+		case method_zeros:
+			*outBytes = zeros;
+			return NULL;
+		case method_stored:
+			*outBytes = storedData;
+			break;
+		case method_deflate:
+#if EXISTS_ZLIB
+			if (inflateReset(&worker->stream) != Z_OK) return "couldn't start decompressing a frame";
+			worker->stream.next_in = (Bytef *)storedData;
+			worker->stream.avail_in = getBigEndian32(frame + 4);
+			worker->stream.next_out = outputBuffer;
+			worker->stream.avail_out = (uInt)blockSize;
+			if (inflate(&worker->stream, Z_FINISH) != Z_STREAM_END || worker->stream.total_out != originalLength) {
+				return "a frame's compressed data is damaged";
+			}
+			*outBytes = outputBuffer;
+			break;
+#else
+			return "the image has compressed frames, and this dd-parallel was built without zlib";
+#endif
+		default:
+			return "a frame has an unknown compression method";
+	}
+	if (xxh64(*outBytes, originalLength, 0) != digest) return "a frame's data doesn't match its checksum";
+	return NULL;
+}
+
+static void compression_decompressBlock(struct compression *_Nonnull const compression, struct compression_worker *_Nonnull const worker, struct compression_block *_Nonnull const block) {
+	unsigned char const *_Nonnull const header = block->input;
+	size_t const originalLength = getBigEndian32(header + 8);
+	block->method = header[0];
+	block->output = (struct compression_output){ .length = originalLength, .originalLength = originalLength };
+	void const *_Nullable bytes = NULL;
+	block->error = compression_decodeFrame(worker, header, compression->blockSize, compression->zeros, block->outputBuffer, &bytes);
+	if (block->error == NULL) block->output.bytes = bytes;
+}
+
+///Sets up a thread's zlib stream and sample buffer. Returns false if it can't.
+static bool compression_worker_init(struct compression_worker *_Nonnull const worker, bool const decompress) {
+#if EXISTS_ZLIB
+	//Raw deflate (negative window bits), with the default window and memory use.
+	worker->streamReady = (decompress ? inflateInit2(&worker->stream, -15) : deflateInit2(&worker->stream, kDeflateLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)) == Z_OK;
+	if (! decompress) worker->sampleBuffer = malloc(kSampleSize);
+	worker->ready = worker->streamReady && (decompress || worker->sampleBuffer != NULL);
+#else
+	worker->ready = true;
+#endif
+	return worker->ready;
+}
+static void compression_worker_free(struct compression_worker *_Nonnull const worker, bool const decompress) {
+#if EXISTS_ZLIB
+	if (worker->streamReady) {
+		if (decompress) inflateEnd(&worker->stream);
+		else deflateEnd(&worker->stream);
+	}
+#endif
+	free(worker->sampleBuffer);
+}
+
+static void compression_work(void *_Nonnull const context, unsigned int const threadIndex, unsigned int const blockIndex) {
+	struct compression *_Nonnull const compression = context;
+	struct compression_worker *_Nonnull const worker = &compression->workers[threadIndex];
+	struct compression_block *_Nonnull const block = &compression->blocks[blockIndex];
+	if (! worker->ready) {
+		block->error = "couldn't set up zlib";
+	} else if (compression->decompress) {
+		compression_decompressBlock(compression, worker, block);
+	} else {
+		compression_compressBlock(compression, worker, block);
+	}
+}
+
+static void compression_free(struct compression *_Nonnull const compression) {
+	for (unsigned int i = 0; compression->blocks != NULL && i < compression->maxBlocksInFlight; ++i) {
+		free(compression->blocks[i].outputBuffer);
+	}
+	if (compression->pool != NULL) worker_pool_destroy(compression->pool);
+	for (unsigned int i = 0; compression->workers != NULL && i < compression->numWorkers; ++i) {
+		compression_worker_free(&compression->workers[i], compression->decompress);
+	}
+	free(compression->workers);
+	free(compression->blocks);
+	free(compression->zeros);
+	free(compression);
+}
+
+struct compression *_Nullable compression_create(bool const decompress, unsigned int const numThreads, unsigned int const maxBlocksInFlight, size_t const blockSize, char const *_Nullable *_Nonnull const outError) {
+	*outError = NULL;
+	struct compression *_Nullable const compression = calloc(1, sizeof(struct compression));
+	if (compression == NULL) {
+		*outError = "Could not allocate compression buffers";
+		return NULL;
+	}
+	compression->decompress = decompress;
+	compression->blockSize = blockSize;
+	compression->maxBlocksInFlight = maxBlocksInFlight;
+	compression->blocks = calloc(maxBlocksInFlight, sizeof(struct compression_block));
+	compression->workers = calloc(numThreads, sizeof(struct compression_worker));
+	if (decompress) compression->zeros = calloc(1, blockSize);
+	bool allocated = compression->blocks != NULL && compression->workers != NULL && (compression->zeros != NULL || ! decompress);
+	for (unsigned int i = 0; allocated && i < maxBlocksInFlight; ++i) {
+		//A compressed block only gets kept if it's smaller than the original, so this is enough either way.
+		compression->blocks[i].outputBuffer = malloc(kCompressionFrameHeaderSize + blockSize);
+		allocated = compression->blocks[i].outputBuffer != NULL;
+	}
+	if (! allocated) {
+		*outError = "Could not allocate compression buffers";
+		compression_free(compression);
+		return NULL;
+	}
+
+	//A worker that couldn't be set up fails the blocks it gets.
+	for (; compression->numWorkers < numThreads; ++compression->numWorkers) {
+		compression_worker_init(&compression->workers[compression->numWorkers], decompress);
+	}
+	compression->pool = worker_pool_create(numThreads, maxBlocksInFlight, compression, compression_work, decompress ? "Decompression thread" : "Compression thread", /*inOrderWork*/ NULL, /*inOrderThreadName*/ NULL);
+	if (compression->pool == NULL) {
+		*outError = decompress ? "Could not start decompression threads" : "Could not start compression threads";
+		compression_free(compression);
+		return NULL;
+	}
+	return compression;
+}
+void compression_stop(struct compression *_Nonnull const compression) {
+	worker_pool_stop(compression->pool);
+}
+void compression_destroy(struct compression *_Nonnull const compression) {
+	compression_stop(compression);
+	compression_free(compression);
+}
+
+void compression_submitBlock(struct compression *_Nonnull const compression, void const *_Nonnull const bytes, size_t const length) {
+	struct compression_block *_Nonnull const block = &compression->blocks[worker_pool_reserve(compression->pool)];
+	block->input = bytes;
+	block->inputLength = length;
+	block->error = NULL;
+	worker_pool_submit(compression->pool);
+}
+bool compression_finishBlock(struct compression *_Nonnull const compression, struct compression_output *_Nonnull const outOutput, char const *_Nullable *_Nonnull const outError) {
+	unsigned int blockIndex = 0;
+	if (! worker_pool_waitForNext(compression->pool, &blockIndex)) {
+		*outError = "no block to finish";
+		return false;
+	}
+	struct compression_block *_Nonnull const block = &compression->blocks[blockIndex];
+	//Once it's finished, the block can be reused, so take everything we need from it first.
+	char const *_Nullable const error = block->error;
+	struct compression_output const output = block->output;
+	size_t const imageLength = compression->decompress ? block->inputLength : output.length + output.moreLength;
+	enum frame_method const method = block->method;
+	worker_pool_finish(compression->pool);
+
+	if (error != NULL) {
+		*outError = error;
+		return false;
+	}
+	*outOutput = output;
+	compression->originalBytes += output.originalLength;
+	compression->imageBytes += imageLength;
+	if (method < sizeof(compression->numFramesByMethod) / sizeof(*compression->numFramesByMethod)) ++compression->numFramesByMethod[method];
+	return true;
+}
+
+#pragma mark Decoding one frame at a time
+
+struct compression_decoder {
+	struct compression_worker worker;
+	size_t blockSize;
+	void *_Nonnull zeros;
+	unsigned char *_Nonnull outputBuffer;
+};
+
+struct compression_decoder *_Nullable compression_decoder_create(size_t const blockSize) {
+	struct compression_decoder *_Nullable const decoder = calloc(1, sizeof(struct compression_decoder));
+	if (decoder == NULL) return NULL;
+	decoder->blockSize = blockSize;
+	decoder->zeros = calloc(1, blockSize);
+	decoder->outputBuffer = malloc(blockSize);
+	bool const workerReady = compression_worker_init(&decoder->worker, /*decompress*/ true);
+	if (decoder->zeros == NULL || decoder->outputBuffer == NULL || ! workerReady) {
+		compression_decoder_destroy(decoder);
+		return NULL;
+	}
+	return decoder;
+}
+void compression_decoder_destroy(struct compression_decoder *_Nonnull const decoder) {
+	compression_worker_free(&decoder->worker, /*decompress*/ true);
+	free(decoder->zeros);
+	free(decoder->outputBuffer);
+	free(decoder);
+}
+
+void const *_Nullable compression_decoder_decodeFrame(struct compression_decoder *_Nonnull const decoder, void const *_Nonnull const frame, char const *_Nullable *_Nonnull const outError) {
+	void const *_Nullable bytes = NULL;
+	*outError = compression_decodeFrame(&decoder->worker, frame, decoder->blockSize, decoder->zeros, decoder->outputBuffer, &bytes);
+	return *outError == NULL ? bytes : NULL;
+}
+
+void compression_printReport(struct compression const *_Nonnull const compression, FILE *_Nonnull const file) {
+	enum { phraseCapacity = 64 };
+	char originalPhrase[phraseCapacity], imagePhrase[phraseCapacity];
+	copyByteCountPhrase(originalPhrase, compression->originalBytes, phraseCapacity);
+	copyByteCountPhrase(imagePhrase, compression->imageBytes, phraseCapacity);
+	double const percentage = compression->originalBytes > 0 ? compression->imageBytes * 100.0 / compression->originalBytes : 0.0;
+	if (compression->decompress) {
+		fprintf(file, "Decompressed %s of image into %s", imagePhrase, originalPhrase);
+	} else {
+		fprintf(file, "Compressed %s into %s of image (%.1f%%)", originalPhrase, imagePhrase, percentage);
+	}
+	fprintf(file, ": %llu block%s deflated, %llu stored as is, %llu all zeros\n",
+		compression->numFramesByMethod[method_deflate], compression->numFramesByMethod[method_deflate] == 1 ? "" : "s",
+		compression->numFramesByMethod[method_stored],
+		compression->numFramesByMethod[method_zeros]);
+}
@@ -0,0 +1,78 @@
+//
+//  compression.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef compression_h
+#define compression_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+//A compressed image is a header, then a series of frames, each of which stands for one block of the original data. Every frame is compressed on its own, so a pool of threads can work on several at once, and the copy doesn't wait on one core.
+//The image header is the magic “ddpz”, then the format version (1), the block size, and a reserved 0, each 32 bits. A frame header is the method (one byte), three reserved 0 bytes, the stored length and the original length (32 bits each), and XXH64 of the original data (64 bits); the stored data follows it. All numbers are big-endian.
+//Methods:
+//	stored: the original data, as is. Used for blocks that don't compress, so they don't cost a decompression either.
+//	deflate: raw deflate (no zlib or gzip wrapper).
+//	zeros: original length bytes of zeros. Nothing is stored, and the digest is 0.
+//	end: the last frame. It stores the total original length (64 bits) and nothing else; an image without one was cut short.
+//Only the compressing side needs zlib to be thorough about it: an image can always be read back without zlib so long as none of its frames are deflated.
+
+enum {
+	kCompressionImageHeaderSize = 16,
+	kCompressionFrameHeaderSize = 20,
+	kCompressionEndFrameSize = kCompressionFrameHeaderSize + 8,
+};
+
+///Writes the header of an image with blocks of blockSize bytes into header, which has room for kCompressionImageHeaderSize bytes.
+void compression_makeImageHeader(void *_Nonnull const header, size_t const blockSize);
+///Returns true if header, of kCompressionImageHeaderSize bytes, is the header of a compressed image this version can read, and gets the image's block size.
+bool compression_parseImageHeader(void const *_Nonnull const header, size_t *_Nonnull const outBlockSize);
+///For reading an image: parses the frame header at header (kCompressionFrameHeaderSize bytes). Returns false if it isn't a valid frame header for an image with blocks of blockSize bytes. Otherwise gets how many bytes are stored after the header, how many bytes of the original data the frame stands for, and whether this is the end frame.
+bool compression_parseFrameHeader(void const *_Nonnull const header, size_t const blockSize, size_t *_Nonnull const outStoredLength, size_t *_Nonnull const outOriginalLength, bool *_Nonnull const outIsEnd);
+///Writes the end frame (kCompressionEndFrameSize bytes) of an image of totalLength bytes of original data.
+void compression_makeEndFrame(void *_Nonnull const frame, unsigned long long const totalLength);
+///Gets the total length from the data stored in an end frame.
+unsigned long long compression_endFrameTotalLength(void const *_Nonnull const storedData);
+
+//A compressor turns blocks into frames; a decompressor turns frames back into blocks. Either way, the work happens on a pool of threads. Blocks are submitted by one thread (the reader) and finished, in the same order, by another (the writer), just as with a manifest.
+
+struct compression;
+
+///Creates a compressor (or, if decompress is true, a decompressor) for blocks of up to blockSize bytes, with numThreads threads. Up to maxBlocksInFlight blocks may have been submitted and not yet finished. Returns NULL on failure, with *outError set to a description of the problem.
+struct compression *_Nullable compression_create(bool const decompress, unsigned int const numThreads, unsigned int const maxBlocksInFlight, size_t const blockSize, char const *_Nullable *_Nonnull const outError);
+///Stops the threads, abandoning any blocks submitted and not finished. Call this before the memory those blocks are in goes away; after it, only compression_printReport and compression_destroy may be called.
+void compression_stop(struct compression *_Nonnull const compression);
+///Stops the threads, if they haven't been already, and frees everything.
+void compression_destroy(struct compression *_Nonnull const compression);
+
+///Hands a block to the threads. For a compressor, bytes is a block of the original data; for a decompressor, it's a whole frame, header included, that compression_parseFrameHeader has vouched for (and not the end frame). The bytes must not change until compression_finishBlock has returned for this block and its output has been written.
+void compression_submitBlock(struct compression *_Nonnull const compression, void const *_Nonnull const bytes, size_t const length);
+
+///What to write for a finished block: length bytes at bytes, then moreLength bytes at moreBytes, if any. (A frame stored as is comes in two parts, so the data doesn't have to be copied next to its header.)
+struct compression_output {
+	void const *_Nonnull bytes;
+	size_t length;
+	void const *_Nullable moreBytes;
+	size_t moreLength;
+	///How many bytes of the original data this is.
+	size_t originalLength;
+};
+///Waits for the oldest unfinished block to be done, and gets what to write for it. The output stays valid until maxBlocksInFlight more blocks have been submitted. Returns false, with *outError set, if the block couldn't be decompressed (the image is damaged).
+bool compression_finishBlock(struct compression *_Nonnull const compression, struct compression_output *_Nonnull const outOutput, char const *_Nullable *_Nonnull const outError);
+
+//For decompressing frames one at a time, in any order, on the caller's own thread, as when restoring part of an image (see image_index.h).
+struct compression_decoder;
+struct compression_decoder *_Nullable compression_decoder_create(size_t const blockSize);
+void compression_decoder_destroy(struct compression_decoder *_Nonnull const decoder);
+///Decompresses a whole frame, header included, that compression_parseFrameHeader has vouched for (and not the end frame). Returns the original data, which stays valid until the next call (or as long as frame, if it was stored as is); or NULL, with *outError set, if the frame is damaged.
+void const *_Nullable compression_decoder_decodeFrame(struct compression_decoder *_Nonnull const decoder, void const *_Nonnull const frame, char const *_Nullable *_Nonnull const outError);
+
+///Writes a description of how much the data compressed, and how many blocks went each way. Only call this once the writer is done.
+void compression_printReport(struct compression const *_Nonnull const compression, FILE *_Nonnull const file);
+
+#endif /* compression_h */
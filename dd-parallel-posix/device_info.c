@@ -0,0 +1,94 @@
+//
+//  device_info.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "device_info.h"
+
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#if __linux__
+#	include <linux/fs.h>
+#elif __APPLE__
+#	include <sys/disk.h>
+#endif
+
+enum { kMinimumLogicalBlockSize = 512 };
+
+size_t deviceLogicalBlockSize(int const fd) {
+	struct stat sb;
+	if (fstat(fd, &sb) != 0) return kMinimumLogicalBlockSize;
+
+	size_t blockSize = 0;
+	if (S_ISBLK(sb.st_mode) || S_ISCHR(sb.st_mode)) {
+#if __linux__
+		int sectorSize = 0;
+		if (ioctl(fd, BLKSSZGET, &sectorSize) == 0) blockSize = sectorSize;
+#elif __APPLE__
+		uint32_t sectorSize = 0;
+		if (ioctl(fd, DKIOCGETBLOCKSIZE, &sectorSize) == 0) blockSize = sectorSize;
+#endif
+	} else {
+		blockSize = sb.st_blksize;
+	}
+	return blockSize > kMinimumLogicalBlockSize ? blockSize : kMinimumLogicalBlockSize;
+}
+
+bool deviceSize(int const fd, unsigned long long *_Nonnull const outSize) {
+	struct stat sb;
+	if (fstat(fd, &sb) != 0) return false;
+	if (S_ISREG(sb.st_mode)) {
+		*outSize = sb.st_size;
+		return true;
+	}
+	if (S_ISBLK(sb.st_mode) || S_ISCHR(sb.st_mode)) {
+#if __linux__
+		unsigned long long size = 0;
+		if (ioctl(fd, BLKGETSIZE64, &size) == 0) {
+			*outSize = size;
+			return true;
+		}
+#elif __APPLE__
+		//Raw disks (rdisk) are character devices on macOS.
+		uint32_t blockSize = 0;
+		uint64_t blockCount = 0;
+		if (ioctl(fd, DKIOCGETBLOCKSIZE, &blockSize) == 0 && ioctl(fd, DKIOCGETBLOCKCOUNT, &blockCount) == 0) {
+			*outSize = (unsigned long long)blockSize * blockCount;
+			return true;
+		}
+#endif
+	}
+	return false;
+}
+bool isRegularFile(int const fd) {
+	struct stat sb;
+	return fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode);
+}
+
+bool setDirectIO(int const fd, bool const enabled) {
+#if EXISTS_O_DIRECT
+	int const flags = fcntl(fd, F_GETFL);
+	if (flags < 0) return false;
+	int const newFlags = enabled ? flags | O_DIRECT : flags & ~O_DIRECT;
+	return newFlags == flags || fcntl(fd, F_SETFL, newFlags) == 0;
+#elif EXISTS_F_NOCACHE
+	return fcntl(fd, F_NOCACHE, enabled) == 0;
+#else
+	return false;
+#endif
+}
+
+bool dropCachedPages(int const fd) {
+	//Pages that haven't been written yet can't be dropped, and a read-only descriptor can still be synced.
+	fsync(fd);
+#if EXISTS_POSIX_FADVISE
+	return posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+#elif EXISTS_F_NOCACHE
+	return fcntl(fd, F_NOCACHE, 1) == 0;
+#else
+	return false;
+#endif
+}
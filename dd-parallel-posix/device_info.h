@@ -0,0 +1,29 @@
+//
+//  device_info.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef device_info_h
+#define device_info_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+///The size, in bytes, that reads and writes on this file must be aligned to for direct (uncached) I/O. For a device, this is its logical sector size; for a regular file, the file-system's preferred block size.
+size_t deviceLogicalBlockSize(int const fd);
+
+///Gets the size of a regular file or block device. Returns false for anything else (pipes, character devices), whose size can't be known ahead of time.
+bool deviceSize(int const fd, unsigned long long *_Nonnull const outSize);
+///True if fd is a regular file, as opposed to a device, pipe, etc.
+bool isRegularFile(int const fd);
+
+///Turns direct I/O on or off for an open file. Returns false if the file-system doesn't support it (or there's no such thing on this platform).
+bool setDirectIO(int const fd, bool const enabled);
+
+///Gets any of this file's data that's sitting in the page cache out of it, so that the next reads come from the device itself. Dirty pages are written out first. Returns false if that can't be done here; on macOS, this turns on F_NOCACHE instead, which only keeps future reads from being served from the cache.
+bool dropCachedPages(int const fd);
+
+#endif /* device_info_h */
@@ -0,0 +1,237 @@
+//
+//  digests.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "digests.h"
+
+#include <string.h>
+
+//Both algorithms are defined in terms of a particular byte order (XXH64 little-endian, SHA-256 big-endian). Assembling the words byte by byte gets that right on any host; compilers recognize the pattern and emit a single load (plus a byte swap where needed).
+static inline uint64_t readLE64(unsigned char const *_Nonnull const p) {
+	return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 | (uint64_t)p[3] << 24
+		| (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+static inline uint32_t readLE32(unsigned char const *_Nonnull const p) {
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+static inline uint32_t readBE32(unsigned char const *_Nonnull const p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+static inline uint64_t rotateLeft64(uint64_t const x, unsigned const bits) {
+	return (x << bits) | (x >> (64 - bits));
+}
+static inline uint32_t rotateRight32(uint32_t const x, unsigned const bits) {
+	return (x >> bits) | (x << (32 - bits));
+}
+
+#pragma mark XXH64
+
+static uint64_t const kXXHPrime1 = 0x9E3779B185EBCA87ULL;
+static uint64_t const kXXHPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static uint64_t const kXXHPrime3 = 0x165667B19E3779F9ULL;
+static uint64_t const kXXHPrime4 = 0x85EBCA77C2B2AE63ULL;
+static uint64_t const kXXHPrime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t xxh64_round(uint64_t accumulator, uint64_t const input) {
+	accumulator += input * kXXHPrime2;
+	accumulator = rotateLeft64(accumulator, 31);
+	return accumulator * kXXHPrime1;
+}
+static inline uint64_t xxh64_mergeRound(uint64_t accumulator, uint64_t const value) {
+	accumulator ^= xxh64_round(0, value);
+	return accumulator * kXXHPrime1 + kXXHPrime4;
+}
+///Consumes one 32-byte stripe.
+static inline void xxh64_consumeStripe(uint64_t accumulators[_Nonnull 4], unsigned char const *_Nonnull const stripe) {
+	accumulators[0] = xxh64_round(accumulators[0], readLE64(stripe));
+	accumulators[1] = xxh64_round(accumulators[1], readLE64(stripe + 8));
+	accumulators[2] = xxh64_round(accumulators[2], readLE64(stripe + 16));
+	accumulators[3] = xxh64_round(accumulators[3], readLE64(stripe + 24));
+}
+
+void xxh64_init(struct xxh64_state *_Nonnull const state, uint64_t const seed) {
+	*state = (struct xxh64_state){
+		.accumulators = {
+			seed + kXXHPrime1 + kXXHPrime2,
+			seed + kXXHPrime2,
+			seed,
+			seed - kXXHPrime1,
+		},
+		.seed = seed,
+	};
+}
+void xxh64_update(struct xxh64_state *_Nonnull const state, void const *_Nonnull const bytes, size_t const length) {
+	unsigned char const *_Nonnull input = bytes;
+	unsigned char const *_Nonnull const end = input + length;
+	state->totalLength += length;
+
+	if (state->pendingLength > 0) {
+		size_t const amountToFill = sizeof(state->pending) - state->pendingLength;
+		if (length < amountToFill) {
+			memcpy(state->pending + state->pendingLength, input, length);
+			state->pendingLength += length;
+			return;
+		}
+		memcpy(state->pending + state->pendingLength, input, amountToFill);
+		xxh64_consumeStripe(state->accumulators, state->pending);
+		input += amountToFill;
+		state->pendingLength = 0;
+	}
+	for (; end - input >= 32; input += 32) {
+		xxh64_consumeStripe(state->accumulators, input);
+	}
+	memcpy(state->pending, input, end - input);
+	state->pendingLength = end - input;
+}
+uint64_t xxh64_digest(struct xxh64_state const *_Nonnull const state) {
+	uint64_t const *_Nonnull const v = state->accumulators;
+	uint64_t hash;
+	if (state->totalLength >= 32) {
+		hash = rotateLeft64(v[0], 1) + rotateLeft64(v[1], 7) + rotateLeft64(v[2], 12) + rotateLeft64(v[3], 18);
+		hash = xxh64_mergeRound(hash, v[0]);
+		hash = xxh64_mergeRound(hash, v[1]);
+		hash = xxh64_mergeRound(hash, v[2]);
+		hash = xxh64_mergeRound(hash, v[3]);
+	} else {
+		hash = state->seed + kXXHPrime5;
+	}
+	hash += state->totalLength;
+
+	unsigned char const *_Nonnull p = state->pending;
+	unsigned char const *_Nonnull const end = p + state->pendingLength;
+	for (; end - p >= 8; p += 8) {
+		hash ^= xxh64_round(0, readLE64(p));
+		hash = rotateLeft64(hash, 27) * kXXHPrime1 + kXXHPrime4;
+	}
+	if (end - p >= 4) {
+		hash ^= (uint64_t)readLE32(p) * kXXHPrime1;
+		hash = rotateLeft64(hash, 23) * kXXHPrime2 + kXXHPrime3;
+		p += 4;
+	}
+	for (; p < end; ++p) {
+		hash ^= *p * kXXHPrime5;
+		hash = rotateLeft64(hash, 11) * kXXHPrime1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= kXXHPrime2;
+	hash ^= hash >> 29;
+	hash *= kXXHPrime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+uint64_t xxh64(void const *_Nonnull const bytes, size_t const length, uint64_t const seed) {
+	struct xxh64_state state;
+	xxh64_init(&state, seed);
+	xxh64_update(&state, bytes, length);
+	return xxh64_digest(&state);
+}
+
+#pragma mark SHA-256
+
+static uint32_t const kSHA256RoundConstants[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void sha256_consumeBlock(uint32_t hash[_Nonnull 8], unsigned char const *_Nonnull const block) {
+	uint32_t schedule[64];
+	for (unsigned i = 0; i < 16; ++i) {
+		schedule[i] = readBE32(block + i * 4);
+	}
+	for (unsigned i = 16; i < 64; ++i) {
+		uint32_t const s0 = rotateRight32(schedule[i - 15], 7) ^ rotateRight32(schedule[i - 15], 18) ^ (schedule[i - 15] >> 3);
+		uint32_t const s1 = rotateRight32(schedule[i - 2], 17) ^ rotateRight32(schedule[i - 2], 19) ^ (schedule[i - 2] >> 10);
+		schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+	}
+
+	uint32_t a = hash[0], b = hash[1], c = hash[2], d = hash[3], e = hash[4], f = hash[5], g = hash[6], h = hash[7];
+	for (unsigned i = 0; i < 64; ++i) {
+		uint32_t const S1 = rotateRight32(e, 6) ^ rotateRight32(e, 11) ^ rotateRight32(e, 25);
+		uint32_t const choice = (e & f) ^ (~e & g);
+		uint32_t const temp1 = h + S1 + choice + kSHA256RoundConstants[i] + schedule[i];
+		uint32_t const S0 = rotateRight32(a, 2) ^ rotateRight32(a, 13) ^ rotateRight32(a, 22);
+		uint32_t const majority = (a & b) ^ (a & c) ^ (b & c);
+		uint32_t const temp2 = S0 + majority;
+		h = g;
+		g = f;
+		f = e;
+		e = d + temp1;
+		d = c;
+		c = b;
+		b = a;
+		a = temp1 + temp2;
+	}
+	hash[0] += a;
+	hash[1] += b;
+	hash[2] += c;
+	hash[3] += d;
+	hash[4] += e;
+	hash[5] += f;
+	hash[6] += g;
+	hash[7] += h;
+}
+
+void sha256_init(struct sha256_state *_Nonnull const state) {
+	*state = (struct sha256_state){
+		.hash = {
+			0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+		},
+	};
+}
+void sha256_update(struct sha256_state *_Nonnull const state, void const *_Nonnull const bytes, size_t const length) {
+	unsigned char const *_Nonnull input = bytes;
+	unsigned char const *_Nonnull const end = input + length;
+	state->totalLength += length;
+
+	if (state->pendingLength > 0) {
+		size_t const amountToFill = sizeof(state->pending) - state->pendingLength;
+		if (length < amountToFill) {
+			memcpy(state->pending + state->pendingLength, input, length);
+			state->pendingLength += length;
+			return;
+		}
+		memcpy(state->pending + state->pendingLength, input, amountToFill);
+		sha256_consumeBlock(state->hash, state->pending);
+		input += amountToFill;
+		state->pendingLength = 0;
+	}
+	for (; end - input >= 64; input += 64) {
+		sha256_consumeBlock(state->hash, input);
+	}
+	memcpy(state->pending, input, end - input);
+	state->pendingLength = end - input;
+}
+void sha256_final(struct sha256_state *_Nonnull const state, unsigned char outDigest[_Nonnull sha256_digestLength]) {
+	uint64_t const totalBits = state->totalLength * 8;
+
+	//Pad with a 1 bit, then zeros up to 8 bytes short of a block boundary, then the length in bits.
+	state->pending[state->pendingLength++] = 0x80;
+	if (state->pendingLength > 56) {
+		memset(state->pending + state->pendingLength, 0, 64 - state->pendingLength);
+		sha256_consumeBlock(state->hash, state->pending);
+		state->pendingLength = 0;
+	}
+	memset(state->pending + state->pendingLength, 0, 56 - state->pendingLength);
+	for (unsigned i = 0; i < 8; ++i) {
+		state->pending[56 + i] = (unsigned char)(totalBits >> (56 - i * 8));
+	}
+	sha256_consumeBlock(state->hash, state->pending);
+
+	for (unsigned i = 0; i < 8; ++i) {
+		outDigest[i * 4 + 0] = (unsigned char)(state->hash[i] >> 24);
+		outDigest[i * 4 + 1] = (unsigned char)(state->hash[i] >> 16);
+		outDigest[i * 4 + 2] = (unsigned char)(state->hash[i] >> 8);
+		outDigest[i * 4 + 3] = (unsigned char)(state->hash[i]);
+	}
+}
@@ -0,0 +1,50 @@
+//
+//  digests.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef digests_h
+#define digests_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//Streaming implementations of the hash functions used for manifests, so the POSIX build doesn't need a crypto library.
+//XXH64 is the fast one: it runs at memory speed, so hashing every block costs next to nothing. SHA-256 is much slower, but it's what other tools can check against.
+
+#pragma mark XXH64
+
+struct xxh64_state {
+	uint64_t accumulators[4];
+	uint64_t totalLength;
+	unsigned char pending[32];
+	size_t pendingLength;
+	uint64_t seed;
+};
+
+void xxh64_init(struct xxh64_state *_Nonnull const state, uint64_t const seed);
+void xxh64_update(struct xxh64_state *_Nonnull const state, void const *_Nonnull const bytes, size_t const length);
+uint64_t xxh64_digest(struct xxh64_state const *_Nonnull const state);
+///One-shot convenience for a single buffer.
+uint64_t xxh64(void const *_Nonnull const bytes, size_t const length, uint64_t const seed);
+
+#pragma mark SHA-256
+
+enum { sha256_digestLength = 32 };
+
+struct sha256_state {
+	uint32_t hash[8];
+	uint64_t totalLength;
+	unsigned char pending[64];
+	size_t pendingLength;
+};
+
+void sha256_init(struct sha256_state *_Nonnull const state);
+void sha256_update(struct sha256_state *_Nonnull const state, void const *_Nonnull const bytes, size_t const length);
+void sha256_final(struct sha256_state *_Nonnull const state, unsigned char outDigest[_Nonnull sha256_digestLength]);
+
+#endif /* digests_h */
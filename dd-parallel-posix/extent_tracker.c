@@ -0,0 +1,81 @@
+//
+//  extent_tracker.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "extent_tracker.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+struct extent_tracker {
+	pthread_mutex_t lock;
+	pthread_cond_t windowMoved;
+	unsigned long long contiguousCount;
+	unsigned int windowSize;
+	bool cancelled;
+	//One flag per extent in the window, indexed by extent number modulo windowSize. The flag for contiguousCount itself is always false.
+	bool *_Nonnull completed;
+};
+
+struct extent_tracker *_Nullable tracker_create(unsigned long long const firstExtent, unsigned int const windowSize) {
+	struct extent_tracker *_Nullable const tracker = calloc(1, sizeof(struct extent_tracker));
+	if (tracker == NULL) return NULL;
+	tracker->completed = calloc(windowSize, sizeof(bool));
+	if (tracker->completed == NULL) {
+		free(tracker);
+		return NULL;
+	}
+	tracker->contiguousCount = firstExtent;
+	tracker->windowSize = windowSize;
+	pthread_mutex_init(&tracker->lock, /*attr*/ NULL);
+	pthread_cond_init(&tracker->windowMoved, /*attr*/ NULL);
+	return tracker;
+}
+void tracker_destroy(struct extent_tracker *_Nonnull const tracker) {
+	pthread_cond_destroy(&tracker->windowMoved);
+	pthread_mutex_destroy(&tracker->lock);
+	free(tracker->completed);
+	free(tracker);
+}
+
+bool tracker_waitForRoom(struct extent_tracker *_Nonnull const tracker, unsigned long long const extentIdx) {
+	pthread_mutex_lock(&tracker->lock);
+	while (extentIdx >= tracker->contiguousCount + tracker->windowSize && ! tracker->cancelled) {
+		pthread_cond_wait(&tracker->windowMoved, &tracker->lock);
+	}
+	bool const hasRoom = ! tracker->cancelled;
+	pthread_mutex_unlock(&tracker->lock);
+	return hasRoom;
+}
+void tracker_markComplete(struct extent_tracker *_Nonnull const tracker, unsigned long long const extentIdx) {
+	pthread_mutex_lock(&tracker->lock);
+	if (extentIdx >= tracker->contiguousCount) {
+		tracker->completed[extentIdx % tracker->windowSize] = true;
+	}
+	unsigned long long const oldCount = tracker->contiguousCount;
+	while (tracker->completed[tracker->contiguousCount % tracker->windowSize]) {
+		tracker->completed[tracker->contiguousCount % tracker->windowSize] = false;
+		++tracker->contiguousCount;
+	}
+	if (tracker->contiguousCount != oldCount) {
+		pthread_cond_broadcast(&tracker->windowMoved);
+	}
+	pthread_mutex_unlock(&tracker->lock);
+}
+void tracker_cancel(struct extent_tracker *_Nonnull const tracker) {
+	pthread_mutex_lock(&tracker->lock);
+	tracker->cancelled = true;
+	pthread_cond_broadcast(&tracker->windowMoved);
+	pthread_mutex_unlock(&tracker->lock);
+}
+
+unsigned long long tracker_contiguousCount(struct extent_tracker *_Nonnull const tracker) {
+	pthread_mutex_lock(&tracker->lock);
+	unsigned long long const count = tracker->contiguousCount;
+	pthread_mutex_unlock(&tracker->lock);
+	return count;
+}
@@ -0,0 +1,34 @@
+//
+//  extent_tracker.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef extent_tracker_h
+#define extent_tracker_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+//An extent tracker keeps track of which extents (numbered from 0) have been completed when they can complete out of order, so we know how much of the output is done without any gaps.
+//It only remembers a window of extents past the first incomplete one. A worker that wants to start an extent beyond that window has to wait for the stragglers to catch up, which also bounds how far out of order the output can get.
+
+struct extent_tracker;
+
+///firstExtent is the lowest extent that isn't done yet (normally 0). windowSize is the number of extents, starting from the lowest incomplete one, that may be in progress or complete-but-not-contiguous at once.
+struct extent_tracker *_Nullable tracker_create(unsigned long long const firstExtent, unsigned int const windowSize);
+void tracker_destroy(struct extent_tracker *_Nonnull const tracker);
+
+///Blocks until extentIdx is within the window. Returns false if the tracker has been cancelled.
+bool tracker_waitForRoom(struct extent_tracker *_Nonnull const tracker, unsigned long long const extentIdx);
+///Records that an extent is done. The extent must be within the window.
+void tracker_markComplete(struct extent_tracker *_Nonnull const tracker, unsigned long long const extentIdx);
+///Wakes every waiting worker and makes tracker_waitForRoom return false from now on.
+void tracker_cancel(struct extent_tracker *_Nonnull const tracker);
+
+///Every extent below this number is done.
+unsigned long long tracker_contiguousCount(struct extent_tracker *_Nonnull const tracker);
+
+#endif /* extent_tracker_h */
@@ -93,3 +93,7 @@ size_t copyIntervalPhrase(char *const _Nonnull dst, double const numSeconds, siz
 
 	return totalLen;
 }
+///Like strerror_r, but with the same behavior everywhere. (With _GNU_SOURCE, glibc's strerror_r may return a static string and leave dst untouched.)
+size_t copyErrorDescription(char *const _Nonnull dst, int const errorNumber, size_t const dstCapacity) {
+	return snprintf(dst, dstCapacity, "%s", strerror(errorNumber));
+}
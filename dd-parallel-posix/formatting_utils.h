@@ -14,5 +14,6 @@
 
 size_t copyByteCountPhrase(char *const _Nonnull dst, unsigned long long const numBytes, size_t const dstCapacity);
 size_t copyIntervalPhrase(char *const _Nonnull dst, double const numSeconds, size_t const dstCapacity);
+size_t copyErrorDescription(char *const _Nonnull dst, int const errorNumber, size_t const dstCapacity);
 
 #endif /* formatting_utils_h */
@@ -0,0 +1,147 @@
+//
+//  image_index.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "image_index.h"
+#include "byte_order.h"
+
+#include <inttypes.h>
+#include <sys/mman.h>
+
+static unsigned char const kIndexMagic[4] = { 'd', 'd', 'p', 'i' };
+enum { kIndexFormatVersion = 1 };
+//Room for this many entries to start with; it doubles from there.
+enum { kInitialCapacity = 1024 };
+
+struct image_index {
+	size_t blockSize;
+	unsigned long long numFrames;
+
+	//When writing: the entries so far, in a buffer with room for the trailer after them.
+	unsigned char *_Nullable entries;
+	size_t entriesLength;
+	size_t capacity;
+
+	//When reading: the mapping the entries are in, which starts at a page boundary at or before them.
+	void *_Nullable mapping;
+	size_t mappingLength;
+	unsigned char const *_Nullable mappedEntries;
+	unsigned long long totalLength;
+};
+
+struct image_index *_Nullable image_index_create(size_t const blockSize) {
+	struct image_index *_Nullable const index = calloc(1, sizeof(struct image_index));
+	if (index == NULL) return NULL;
+	index->blockSize = blockSize;
+	return index;
+}
+void image_index_destroy(struct image_index *_Nonnull const index) {
+	if (index->mapping != NULL) munmap(index->mapping, index->mappingLength);
+	free(index->entries);
+	free(index);
+}
+
+///Makes sure there's room for length more bytes after the entries.
+static bool image_index_reserve(struct image_index *_Nonnull const index, size_t const length) {
+	if (index->entriesLength + length <= index->capacity) return true;
+	size_t newCapacity = index->capacity > 0 ? index->capacity * 2 : kInitialCapacity * kImageIndexEntrySize + kImageIndexTrailerSize;
+	if (newCapacity < index->entriesLength + length) newCapacity = index->entriesLength + length;
+	unsigned char *_Nullable const newEntries = realloc(index->entries, newCapacity);
+	if (newEntries == NULL) return false;
+	index->entries = newEntries;
+	index->capacity = newCapacity;
+	return true;
+}
+
+bool image_index_addFrame(struct image_index *_Nonnull const index, unsigned long long const offset, void const *_Nonnull const frameHeader) {
+	if (! image_index_reserve(index, kImageIndexEntrySize)) return false;
+	unsigned char *_Nonnull const entry = index->entries + index->entriesLength;
+	putBigEndian64(entry, offset);
+	memcpy(entry + 8, frameHeader, kCompressionFrameHeaderSize);
+	index->entriesLength += kImageIndexEntrySize;
+	++index->numFrames;
+	return true;
+}
+
+void const *_Nullable image_index_finish(struct image_index *_Nonnull const index, unsigned long long const indexOffset, unsigned long long const totalLength, size_t *_Nonnull const outLength) {
+	if (! image_index_reserve(index, kImageIndexTrailerSize)) return NULL;
+	unsigned char *_Nonnull const trailer = index->entries + index->entriesLength;
+	memcpy(trailer, kIndexMagic, sizeof(kIndexMagic));
+	putBigEndian32(trailer + 4, kIndexFormatVersion);
+	putBigEndian32(trailer + 8, (uint32_t)index->blockSize);
+	putBigEndian32(trailer + 12, 0);
+	putBigEndian64(trailer + 16, index->numFrames);
+	putBigEndian64(trailer + 24, indexOffset);
+	putBigEndian64(trailer + 32, totalLength);
+	*outLength = index->entriesLength + kImageIndexTrailerSize;
+	return index->entries;
+}
+
+struct image_index *_Nullable image_index_open(int const fd, unsigned long long const imageSize, char const *_Nullable *_Nonnull const outError) {
+	unsigned char trailer[kImageIndexTrailerSize];
+	if (imageSize < kCompressionImageHeaderSize + kCompressionEndFrameSize + sizeof(trailer) || pread(fd, trailer, sizeof(trailer), imageSize - sizeof(trailer)) != sizeof(trailer) || memcmp(trailer, kIndexMagic, sizeof(kIndexMagic)) != 0) {
+		*outError = "the image has no index";
+		return NULL;
+	}
+	if (getBigEndian32(trailer + 4) != kIndexFormatVersion) {
+		*outError = "the image's index is in a format this version can't read";
+		return NULL;
+	}
+	size_t const blockSize = getBigEndian32(trailer + 8);
+	unsigned long long const numFrames = getBigEndian64(trailer + 16);
+	unsigned long long const indexOffset = getBigEndian64(trailer + 24);
+	unsigned long long const totalLength = getBigEndian64(trailer + 32);
+	unsigned long long const indexEnd = imageSize - sizeof(trailer);
+	//Every frame but the last is a whole block, and the entries fill the space between the index's offset and the trailer.
+	bool const makesSense = blockSize > 0
+		&& indexOffset >= kCompressionImageHeaderSize && indexOffset <= indexEnd
+		&& numFrames == (indexEnd - indexOffset) / kImageIndexEntrySize && (indexEnd - indexOffset) % kImageIndexEntrySize == 0
+		&& numFrames == totalLength / blockSize + (totalLength % blockSize != 0);
+	if (! makesSense) {
+		*outError = "the image's index is damaged";
+		return NULL;
+	}
+
+	struct image_index *_Nullable const index = image_index_create(blockSize);
+	if (index == NULL) {
+		*outError = "Could not allocate the image's index";
+		return NULL;
+	}
+	index->numFrames = numFrames;
+	index->totalLength = totalLength;
+	if (numFrames > 0) {
+		unsigned long long const pageSize = sysconf(_SC_PAGESIZE);
+		unsigned long long const mappingStart = indexOffset / pageSize * pageSize;
+		index->mappingLength = indexEnd - mappingStart;
+		index->mapping = mmap(NULL, index->mappingLength, PROT_READ, MAP_SHARED, fd, mappingStart);
+		if (index->mapping == MAP_FAILED) {
+			index->mapping = NULL;
+			image_index_destroy(index);
+			*outError = "Could not map the image's index into memory";
+			return NULL;
+		}
+		//A restore jumps around the index, so reading ahead would only fetch entries it doesn't need.
+		madvise(index->mapping, index->mappingLength, MADV_RANDOM);
+		index->mappedEntries = (unsigned char const *)index->mapping + (indexOffset - mappingStart);
+	}
+	return index;
+}
+
+size_t image_index_blockSize(struct image_index const *_Nonnull const index) {
+	return index->blockSize;
+}
+unsigned long long image_index_numFrames(struct image_index const *_Nonnull const index) {
+	return index->numFrames;
+}
+unsigned long long image_index_totalLength(struct image_index const *_Nonnull const index) {
+	return index->totalLength;
+}
+unsigned long long image_index_frameOffset(struct image_index const *_Nonnull const index, unsigned long long const frameNumber, void const *_Nullable *_Nonnull const outHeader) {
+	unsigned char const *_Nonnull const entry = index->mappedEntries + frameNumber * kImageIndexEntrySize;
+	*outHeader = entry + 8;
+	return getBigEndian64(entry);
+}
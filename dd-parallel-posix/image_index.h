@@ -0,0 +1,46 @@
+//
+//  image_index.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef image_index_h
+#define image_index_h
+
+#include "compression.h"
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+//The index at the end of a compressed image (see compression.h) says where every frame is, so part of the image can be restored without reading the rest. It comes after the end frame, so anything reading the image from the start stops before it.
+//The index is an entry for each frame, in order: the frame's offset in the image (64 bits), then a copy of its header. After it comes the trailer, which is the last thing in the image: the magic “ddpi”, the format version (1), the block size, and a reserved 0, each 32 bits; then the number of frames, the offset of the index in the image, and the total original length, each 64 bits. All numbers are big-endian.
+//Every frame but the last stands for a whole block, so frame n holds the original data from n × the block size on. With 1 MiB blocks, the index comes to 28 MiB per TiB; it's mapped into memory, so only the parts that are needed get read.
+
+enum {
+	kImageIndexEntrySize = 8 + kCompressionFrameHeaderSize,
+	kImageIndexTrailerSize = 40,
+};
+
+struct image_index;
+
+///For writing an image: creates an empty index of frames of blocks of blockSize bytes. Returns NULL if it can't be allocated.
+struct image_index *_Nullable image_index_create(size_t const blockSize);
+///Adds the frame with this header, which is going at offset in the image. Frames must be added in order. Returns false if there's no memory for it.
+bool image_index_addFrame(struct image_index *_Nonnull const index, unsigned long long const offset, void const *_Nonnull const frameHeader);
+///Gets the index, followed by its trailer, ready to be written at indexOffset in the image (right after the end frame). Returns NULL if there's no memory for the trailer.
+void const *_Nullable image_index_finish(struct image_index *_Nonnull const index, unsigned long long const indexOffset, unsigned long long const totalLength, size_t *_Nonnull const outLength);
+
+///For reading an image: maps the index of the image of imageSize bytes open on fd. Returns NULL, with *outError set, if the image doesn't have an index or its index doesn't make sense.
+struct image_index *_Nullable image_index_open(int const fd, unsigned long long const imageSize, char const *_Nullable *_Nonnull const outError);
+void image_index_destroy(struct image_index *_Nonnull const index);
+
+size_t image_index_blockSize(struct image_index const *_Nonnull const index);
+unsigned long long image_index_numFrames(struct image_index const *_Nonnull const index);
+///How much original data the image holds, as the trailer says.
+unsigned long long image_index_totalLength(struct image_index const *_Nonnull const index);
+///Returns where frame number frameNumber (which must be less than the number of frames) starts in the image, and gets the copy of its header in the index.
+unsigned long long image_index_frameOffset(struct image_index const *_Nonnull const index, unsigned long long const frameNumber, void const *_Nullable *_Nonnull const outHeader);
+
+#endif /* image_index_h */
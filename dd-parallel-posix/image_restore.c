@@ -0,0 +1,169 @@
+//
+//  image_restore.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "image_restore.h"
+#include "formatting_utils.h"
+
+#include <stdatomic.h>
+
+enum {
+	errorMaxLength = 255,
+	errorCapacity,
+};
+static char errorBuffer[errorCapacity] = { 0 };
+
+struct restore_job {
+	int imageFD, outputFD;
+	struct image_index const *_Nonnull index;
+	size_t blockSize;
+	unsigned long long rangeStart, rangeEnd;
+	unsigned long long endFrame;
+
+	unsigned long long _Atomic nextFrame;
+	unsigned long long _Atomic *_Nonnull totalAmountRestored;
+
+	pthread_mutex_t failureLock;
+	char const *_Nullable failure;
+};
+
+///Records the first thing that went wrong, and stops the workers taking any more frames.
+static void job_fail(struct restore_job *_Nonnull const job, char const *_Nullable const description, int const errorNumber) {
+	pthread_mutex_lock(&job->failureLock);
+	if (job->failure == NULL) {
+		if (description != NULL) {
+			strlcpy(errorBuffer, description, errorCapacity);
+		} else {
+			copyErrorDescription(errorBuffer, errorNumber, errorCapacity);
+		}
+		job->failure = errorBuffer;
+	}
+	pthread_mutex_unlock(&job->failureLock);
+	job->nextFrame = job->endFrame;
+}
+
+///Restores frame number frameNumber's part of the range. Returns false if it failed (and has said why).
+static bool restore_frame(struct restore_job *_Nonnull const job, struct compression_decoder *_Nonnull const decoder, unsigned char *_Nonnull const frame, unsigned long long const frameNumber) {
+	void const *_Nullable indexedHeader = NULL;
+	unsigned long long const frameOffset = image_index_frameOffset(job->index, frameNumber, &indexedHeader);
+	unsigned long long const frameStart = frameNumber * job->blockSize;
+	unsigned long long const remainingLength = image_index_totalLength(job->index) - frameStart;
+	size_t const expectedLength = remainingLength < job->blockSize ? remainingLength : job->blockSize;
+	size_t storedLength = 0, originalLength = 0;
+	bool isEnd = false;
+	if (! compression_parseFrameHeader(indexedHeader, job->blockSize, &storedLength, &originalLength, &isEnd) || isEnd || originalLength != expectedLength) {
+		job_fail(job, "the image's index is damaged", 0);
+		return false;
+	}
+
+	//A frame with nothing stored after its header (all zeros) can be decoded from the index's copy of the header, without reading the image at all.
+	void const *_Nonnull frameToDecode = indexedHeader;
+	if (storedLength > 0) {
+		size_t const frameLength = kCompressionFrameHeaderSize + storedLength;
+		size_t amtRead = 0;
+		while (amtRead < frameLength) {
+			ssize_t const thisRead = pread(job->imageFD, frame + amtRead, frameLength - amtRead, frameOffset + amtRead);
+			if (thisRead < 0) {
+				if (errno == EINTR) continue;
+				job_fail(job, NULL, errno);
+				return false;
+			}
+			if (thisRead == 0) {
+				job_fail(job, "the image is shorter than its index says", 0);
+				return false;
+			}
+			amtRead += thisRead;
+		}
+		if (memcmp(frame, indexedHeader, kCompressionFrameHeaderSize) != 0) {
+			job_fail(job, "a frame in the image doesn't match the image's index", 0);
+			return false;
+		}
+		frameToDecode = frame;
+	}
+	char const *_Nullable decodeError = NULL;
+	unsigned char const *_Nullable const data = compression_decoder_decodeFrame(decoder, frameToDecode, &decodeError);
+	if (data == NULL) {
+		job_fail(job, decodeError, 0);
+		return false;
+	}
+
+	//Only the part of the frame that's in the range gets written.
+	unsigned long long const sliceStart = frameStart > job->rangeStart ? frameStart : job->rangeStart;
+	unsigned long long const sliceEnd = frameStart + originalLength < job->rangeEnd ? frameStart + originalLength : job->rangeEnd;
+	size_t amtWritten = 0;
+	while (sliceStart + amtWritten < sliceEnd) {
+		ssize_t const thisWrite = pwrite(job->outputFD, data + (sliceStart - frameStart) + amtWritten, sliceEnd - sliceStart - amtWritten, sliceStart + amtWritten);
+		if (thisWrite < 0) {
+			if (errno == EINTR) continue;
+			job_fail(job, NULL, errno);
+			return false;
+		}
+		amtWritten += thisWrite;
+		*job->totalAmountRestored += thisWrite;
+	}
+	return true;
+}
+
+static void *restore_worker_main(void *_Nonnull const arg) {
+	pthread_setname_self("Restore worker");
+	struct restore_job *_Nonnull const job = arg;
+	struct compression_decoder *_Nullable const decoder = compression_decoder_create(job->blockSize);
+	unsigned char *_Nullable const frame = malloc(kCompressionFrameHeaderSize + job->blockSize);
+	if (decoder == NULL || frame == NULL) {
+		job_fail(job, "Could not allocate restore buffers", 0);
+	} else {
+		unsigned long long frameNumber;
+		while ((frameNumber = job->nextFrame++) < job->endFrame) {
+			if (! restore_frame(job, decoder, frame, frameNumber)) break;
+		}
+	}
+	if (decoder != NULL) compression_decoder_destroy(decoder);
+	free(frame);
+	return NULL;
+}
+
+char const *_Nullable image_restoreRange(int const imageFD, struct image_index const *_Nonnull const index, int const outputFD, unsigned long long const offset, unsigned long long const length, unsigned int const numWorkers, unsigned long long _Atomic *_Nonnull const totalAmountRestored) {
+	size_t const blockSize = image_index_blockSize(index);
+	if (offset > image_index_totalLength(index) || length > image_index_totalLength(index) - offset) {
+		return "the range goes past the end of the image's data";
+	}
+	struct restore_job job = {
+		.imageFD = imageFD,
+		.outputFD = outputFD,
+		.index = index,
+		.blockSize = blockSize,
+		.rangeStart = offset,
+		.rangeEnd = offset + length,
+		.endFrame = (offset + length + blockSize - 1) / blockSize,
+		.nextFrame = offset / blockSize,
+		.totalAmountRestored = totalAmountRestored,
+	};
+	pthread_mutex_init(&job.failureLock, /*attr*/ NULL);
+
+	pthread_t *_Nullable const workers = calloc(numWorkers, sizeof(pthread_t));
+	if (workers == NULL) {
+		job.failure = "Could not allocate worker threads";
+		goto cleanup;
+	}
+	unsigned int numWorkersStarted = 0;
+	for (; numWorkersStarted < numWorkers; ++numWorkersStarted) {
+		int const createError = pthread_create(&workers[numWorkersStarted], /*attr*/ NULL, restore_worker_main, &job);
+		if (createError != 0) {
+			//As long as some workers got started, they can do the job between them.
+			if (numWorkersStarted == 0) job_fail(&job, NULL, createError);
+			break;
+		}
+	}
+	for (unsigned int i = 0; i < numWorkersStarted; ++i) {
+		pthread_join(workers[i], /*retval*/ NULL);
+	}
+	free(workers);
+
+cleanup:
+	pthread_mutex_destroy(&job.failureLock);
+	return job.failure;
+}
@@ -0,0 +1,22 @@
+//
+//  image_restore.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef image_restore_h
+#define image_restore_h
+
+#include "image_index.h"
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+//Restores part of a compressed image's original data, going straight to the frames that hold it by way of the image's index. Like the striped backend, several worker threads each take one frame at a time, reading it with pread, decompressing it, and writing it with pwrite at its own offset, so a restore from a fast device isn't held to one stream of requests or one core.
+
+///Restores length bytes of the original data, starting at offset, from the image open on imageFD to the same place in outputFD, with numWorkers threads. Returns NULL on success, or a description of the first problem. *totalAmountRestored counts every byte written.
+char const *_Nullable image_restoreRange(int const imageFD, struct image_index const *_Nonnull const index, int const outputFD, unsigned long long const offset, unsigned long long const length, unsigned int const numWorkers, unsigned long long _Atomic *_Nonnull const totalAmountRestored);
+
+#endif /* image_restore_h */
@@ -0,0 +1,207 @@
+//
+//  journal.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "journal.h"
+#include "formatting_utils.h"
+
+#include <sys/stat.h>
+
+static char const *const kJournalSignature = "dd-parallel journal 1\n";
+
+enum {
+	errorMaxLength = 255,
+	errorCapacity,
+};
+static char errorBuffer[errorCapacity] = { 0 };
+
+struct journal {
+	char *_Nonnull path;
+	int fd;
+	unsigned long long inputSize;
+	size_t extentSize;
+	unsigned long long lastCheckpoint;
+
+	int outputFD;
+	unsigned int intervalSeconds;
+	unsigned long long (*_Nullable durableLength)(void);
+	pthread_t checkpointThread;
+	bool checkpointing;
+	bool stopRequested;
+	bool checkpointFailed;
+	pthread_mutex_t lock;
+	pthread_cond_t stopCondition;
+};
+
+///Makes sure everything written to fd so far is on the disk itself, not just in the drive's cache.
+static bool syncToDisk(int const fd) {
+#ifdef F_FULLFSYNC
+	//On macOS, fsync only gets the data as far as the drive.
+	if (fcntl(fd, F_FULLFSYNC) == 0) return true;
+#endif
+	return fsync(fd) == 0;
+}
+
+static bool journal_append(struct journal *_Nonnull const journal, char const *_Nonnull const line) {
+	size_t const length = strlen(line);
+	size_t offset = 0;
+	while (offset < length) {
+		ssize_t const amtWritten = write(journal->fd, line + offset, length - offset);
+		if (amtWritten < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		offset += amtWritten;
+	}
+	return syncToDisk(journal->fd);
+}
+
+///Reads an existing journal and finds its last complete checkpoint. Returns false, with errorBuffer filled in, if it isn't a journal or it's for a different copy.
+static bool journal_readLastCheckpoint(struct journal *_Nonnull const journal, FILE *_Nonnull const file) {
+	char line[256];
+	if (fgets(line, sizeof(line), file) == NULL || strcmp(line, kJournalSignature) != 0) {
+		strlcpy(errorBuffer, "not a dd-parallel journal", errorCapacity);
+		return false;
+	}
+	unsigned long long journaledInputSize = 0, journaledExtentSize = 0;
+	if (fgets(line, sizeof(line), file) == NULL || sscanf(line, "input-size %llu extent-size %llu", &journaledInputSize, &journaledExtentSize) != 2) {
+		strlcpy(errorBuffer, "journal has no header", errorCapacity);
+		return false;
+	}
+	if (journaledInputSize != journal->inputSize || journaledExtentSize != journal->extentSize) {
+		snprintf(errorBuffer, errorCapacity, "journal is for a different copy (input size %llu, extent size %llu)", journaledInputSize, journaledExtentSize);
+		return false;
+	}
+	while (fgets(line, sizeof(line), file) != NULL) {
+		unsigned long long checkpoint = 0;
+		//A line without its newline was cut off by a crash, so it doesn't count.
+		if (strchr(line, '\n') != NULL && sscanf(line, "checkpoint %llu", &checkpoint) == 1 && checkpoint > journal->lastCheckpoint) {
+			journal->lastCheckpoint = checkpoint;
+		}
+	}
+	return true;
+}
+
+struct journal *_Nullable journal_open(char const *_Nonnull const path, bool const resume, unsigned long long const inputSize, size_t const extentSize, unsigned long long *_Nonnull const outResumeOffset, char const *_Nullable *_Nonnull const outError) {
+	*outResumeOffset = 0;
+	*outError = NULL;
+	struct journal *_Nullable const journal = calloc(1, sizeof(struct journal));
+	if (journal == NULL) {
+		*outError = "Could not allocate journal";
+		return NULL;
+	}
+	journal->path = strdup(path);
+	journal->inputSize = inputSize;
+	journal->extentSize = extentSize;
+	pthread_mutex_init(&journal->lock, /*attr*/ NULL);
+	pthread_cond_init(&journal->stopCondition, /*attr*/ NULL);
+
+	journal->fd = open(path, O_RDWR | O_APPEND | O_CREAT | (resume ? 0 : O_EXCL), 0644);
+	if (journal->fd < 0) {
+		if (errno == EEXIST) {
+			strlcpy(errorBuffer, "journal already exists (pass --resume to continue that copy, or delete it to start over)", errorCapacity);
+		} else {
+			copyErrorDescription(errorBuffer, errno, errorCapacity);
+		}
+		goto fail;
+	}
+
+	struct stat sb;
+	if (fstat(journal->fd, &sb) == 0 && sb.st_size > 0) {
+		FILE *_Nullable const file = fdopen(dup(journal->fd), "r");
+		if (file == NULL) {
+			copyErrorDescription(errorBuffer, errno, errorCapacity);
+			goto fail;
+		}
+		bool const readOK = journal_readLastCheckpoint(journal, file);
+		fclose(file);
+		if (! readOK) goto fail;
+		*outResumeOffset = journal->lastCheckpoint;
+	} else {
+		char header[256];
+		snprintf(header, sizeof(header), "%sinput-size %llu extent-size %llu\n", kJournalSignature, inputSize, (unsigned long long)extentSize);
+		if (! journal_append(journal, header)) {
+			copyErrorDescription(errorBuffer, errno, errorCapacity);
+			goto fail;
+		}
+	}
+	return journal;
+
+fail:
+	*outError = errorBuffer;
+	if (journal->fd >= 0) close(journal->fd);
+	pthread_cond_destroy(&journal->stopCondition);
+	pthread_mutex_destroy(&journal->lock);
+	free(journal->path);
+	free(journal);
+	return NULL;
+}
+
+///Syncs the output and records a checkpoint for whatever had been written before the sync.
+static bool journal_checkpoint(struct journal *_Nonnull const journal) {
+	//Take the length first: everything written before this point will be covered by the sync.
+	unsigned long long length = journal->durableLength();
+	if (length != journal->inputSize) {
+		length -= length % journal->extentSize;
+	}
+	if (length <= journal->lastCheckpoint) return true;
+	if (! syncToDisk(journal->outputFD)) return false;
+
+	char line[64];
+	snprintf(line, sizeof(line), "checkpoint %llu\n", length);
+	if (! journal_append(journal, line)) return false;
+	journal->lastCheckpoint = length;
+	return true;
+}
+
+static void *_Nullable journal_checkpoint_thread_main(void *_Nonnull const arg) {
+	pthread_setname_self("Journal checkpoint thread");
+	struct journal *_Nonnull const journal = arg;
+	pthread_mutex_lock(&journal->lock);
+	while (! journal->stopRequested) {
+		struct timespec wakeTime;
+		clock_gettime(CLOCK_REALTIME, &wakeTime);
+		wakeTime.tv_sec += journal->intervalSeconds;
+		while (! journal->stopRequested && pthread_cond_timedwait(&journal->stopCondition, &journal->lock, &wakeTime) != ETIMEDOUT);
+		if (! journal_checkpoint(journal)) {
+			journal->checkpointFailed = true;
+		}
+	}
+	pthread_mutex_unlock(&journal->lock);
+	return NULL;
+}
+
+bool journal_startCheckpointing(struct journal *_Nonnull const journal, int const outputFD, unsigned int const intervalSeconds, unsigned long long (*_Nonnull const durableLength)(void)) {
+	journal->outputFD = outputFD;
+	journal->intervalSeconds = intervalSeconds;
+	journal->durableLength = durableLength;
+	journal->stopRequested = false;
+	journal->checkpointing = pthread_create(&journal->checkpointThread, /*attr*/ NULL, journal_checkpoint_thread_main, journal) == 0;
+	return journal->checkpointing;
+}
+bool journal_stopCheckpointing(struct journal *_Nonnull const journal) {
+	if (! journal->checkpointing) return false;
+	pthread_mutex_lock(&journal->lock);
+	journal->stopRequested = true;
+	pthread_cond_signal(&journal->stopCondition);
+	pthread_mutex_unlock(&journal->lock);
+	pthread_join(journal->checkpointThread, /*retval*/ NULL);
+	journal->checkpointing = false;
+	return ! journal->checkpointFailed;
+}
+
+void journal_close(struct journal *_Nonnull const journal, bool const copyFinished) {
+	if (journal->checkpointing) journal_stopCheckpointing(journal);
+	close(journal->fd);
+	if (copyFinished) {
+		unlink(journal->path);
+	}
+	pthread_cond_destroy(&journal->stopCondition);
+	pthread_mutex_destroy(&journal->lock);
+	free(journal->path);
+	free(journal);
+}
@@ -0,0 +1,37 @@
+//
+//  journal.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef journal_h
+#define journal_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+//A journal is a small file recording how much of the output, from the start, is known to be written and synced to disk, so that a copy that dies partway through can pick up where it left off rather than starting over.
+//It's a text file that only ever gets appended to, so a crash in the middle of a checkpoint can at worst leave a partial last line, which is ignored. It looks like this:
+//	dd-parallel journal 1
+//	input-size 4000787030016 extent-size 1048576
+//	checkpoint 1073741824
+//	checkpoint 2147483648
+//The checkpoints are always a whole number of extents (except at the end of the input), so a resumed copy starts at the first extent that wasn't completely written.
+
+struct journal;
+
+///Opens the journal at path. If resume is false, the journal must not already exist, and a new one is created. If resume is true and the journal exists, it must be for an input of the same size and the same extent size; *outResumeOffset is set to its last checkpoint. (If it doesn't exist, a new one is created and *outResumeOffset is 0.)
+///inputSize is 0 if not known. Returns NULL on failure, with *outError set to a description of the problem.
+struct journal *_Nullable journal_open(char const *_Nonnull const path, bool const resume, unsigned long long const inputSize, size_t const extentSize, unsigned long long *_Nonnull const outResumeOffset, char const *_Nullable *_Nonnull const outError);
+
+///Starts a thread that, every intervalSeconds, syncs outputFD and then records how much of the output had been written before the sync. durableLength is called to find that out; it must return a length that only ever increases, and count from the start of the output (not from the resume offset).
+bool journal_startCheckpointing(struct journal *_Nonnull const journal, int const outputFD, unsigned int const intervalSeconds, unsigned long long (*_Nonnull const durableLength)(void));
+///Stops the checkpointing thread, after one last checkpoint. Returns false if that checkpoint couldn't be recorded.
+bool journal_stopCheckpointing(struct journal *_Nonnull const journal);
+
+///Closes the journal. If the copy finished, the journal is deleted, since there's nothing left to resume; otherwise it's left for a later --resume.
+void journal_close(struct journal *_Nonnull const journal, bool const copyFinished);
+
+#endif /* journal_h */
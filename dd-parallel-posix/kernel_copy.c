@@ -0,0 +1,97 @@
+//
+//  kernel_copy.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "kernel_copy.h"
+#include "device_info.h"
+#include "formatting_utils.h"
+
+#include <sys/ioctl.h>
+#if EXISTS_FICLONE
+#	include <linux/fs.h>
+#endif
+
+#define MILLIONS(a,b,c) a##b##c
+//copy_file_range can copy the whole file in one call, but then we couldn't report progress until it was done. This is big enough that the per-call overhead disappears.
+static const size_t kCopyFileRangeChunkSize = 64 * MILLIONS(1,048,576);
+
+enum {
+	errorMaxLength = 255,
+	errorCapacity,
+};
+static char errorBuffer[errorCapacity] = { 0 };
+
+#if EXISTS_COPY_FILE_RANGE
+///These are the errors with which copy_file_range says “not for these files”, as opposed to “something went wrong”.
+static bool errorMeansUnsupported(int const errorNumber) {
+	switch (errorNumber) {
+		case EXDEV:
+		case EINVAL:
+		case ENOSYS:
+		case EOPNOTSUPP:
+		case EBADF:
+		case ETXTBSY:
+		case EPERM:
+			return true;
+		default:
+			return false;
+	}
+}
+#endif
+
+char const *_Nullable kernel_copy(int const inputFD, int const outputFD, unsigned long long const inputSize, unsigned long long _Atomic *_Nonnull const totalAmountCopied, char const *_Nullable *_Nonnull const outMethodName, bool *_Nonnull const outUnsupported) {
+	*outUnsupported = true;
+	*outMethodName = NULL;
+	//A regular file with size 0 might really be empty, or it might be something like a procfs file that only generates its contents when read. Either way, there's nothing to gain here.
+	if (inputSize == 0 || ! isRegularFile(inputFD) || ! isRegularFile(outputFD)) return NULL;
+
+#if EXISTS_FICLONE
+	//A clone covers the whole file, so it's only equivalent to copying if we're copying the whole file.
+	if (lseek(inputFD, 0, SEEK_CUR) == 0 && lseek(outputFD, 0, SEEK_CUR) == 0) {
+		if (ioctl(outputFD, FICLONE, inputFD) == 0) {
+			*outUnsupported = false;
+			*outMethodName = "reflink";
+			*totalAmountCopied += inputSize;
+			lseek(inputFD, inputSize, SEEK_SET);
+			lseek(outputFD, inputSize, SEEK_SET);
+			return NULL;
+		}
+	}
+#endif
+
+#if EXISTS_COPY_FILE_RANGE
+	unsigned long long amountCopied = 0;
+	while (amountCopied < inputSize) {
+		size_t const remaining = inputSize - amountCopied;
+		ssize_t const thisCopy = copy_file_range(inputFD, /*inputOffset*/ NULL, outputFD, /*outputOffset*/ NULL, remaining < kCopyFileRangeChunkSize ? remaining : kCopyFileRangeChunkSize, /*flags*/ 0);
+		if (thisCopy < 0) {
+			if (errno == EINTR) continue;
+			if (amountCopied == 0 && errorMeansUnsupported(errno)) return NULL;
+			*outUnsupported = false;
+			copyErrorDescription(errorBuffer, errno, errorCapacity);
+			return errorBuffer;
+		}
+		if (thisCopy == 0) {
+			//Either the file got shorter since we checked its size, or this file-system doesn't really do copy_file_range (some report success while copying nothing).
+			break;
+		}
+		*outUnsupported = false;
+		*outMethodName = "copy_file_range";
+		amountCopied += thisCopy;
+		*totalAmountCopied += thisCopy;
+	}
+#endif
+	return NULL;
+}
+
+void kernel_preallocate(int const outputFD, unsigned long long const size) {
+#if EXISTS_FALLOCATE
+	if (size > 0 && isRegularFile(outputFD)) {
+		fallocate(outputFD, /*mode*/ 0, lseek(outputFD, 0, SEEK_CUR), size);
+	}
+#endif
+}
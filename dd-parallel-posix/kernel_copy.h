@@ -0,0 +1,25 @@
+//
+//  kernel_copy.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef kernel_copy_h
+#define kernel_copy_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+//When both files are regular files, the kernel can often copy between them without the data ever passing through our buffers: on a copy-on-write file-system (btrfs, XFS) by sharing the input's blocks with the output (a reflink), or otherwise with copy_file_range, which may be offloaded to the file-system or the storage itself.
+
+///Copies inputSize bytes from the current position of inputFD to the current position of outputFD, adding to *totalAmountCopied as it goes. Returns NULL on success, or a description of the error.
+///If the kernel can't do this copy (different file-systems, unsupported file-system, old kernel, not regular files), sets *outUnsupported and returns NULL without having copied anything, so the caller can fall back to copying it ourselves.
+///*outMethodName is set to a short description of how the copy was done.
+char const *_Nullable kernel_copy(int const inputFD, int const outputFD, unsigned long long const inputSize, unsigned long long _Atomic *_Nonnull const totalAmountCopied, char const *_Nullable *_Nonnull const outMethodName, bool *_Nonnull const outUnsupported);
+
+///Tells the file-system how big the output is going to be, so it can allocate it up front (and in as few pieces as possible) rather than learning the size a megabyte at a time. Only does anything for regular files. Failure is harmless, so there's no error result.
+void kernel_preallocate(int const outputFD, unsigned long long const size);
+
+#endif /* kernel_copy_h */
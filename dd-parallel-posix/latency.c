@@ -0,0 +1,98 @@
+//
+//  latency.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "latency.h"
+
+#include <stdatomic.h>
+
+static unsigned int latency_bucketForValue(unsigned long long const value) {
+	if (value < kLatencyExactBuckets) return (unsigned int)value;
+	unsigned int const highestBit = 63 - __builtin_clzll(value);
+	//The four bits below the highest one pick the sub-bucket.
+	unsigned int const subBucket = (value >> (highestBit - 4)) & (kLatencySubBucketsPerPowerOfTwo - 1);
+	return kLatencyExactBuckets + (highestBit - 5) * kLatencySubBucketsPerPowerOfTwo + subBucket;
+}
+///The largest value that goes in a bucket.
+static unsigned long long latency_bucketUpperBound(unsigned int const bucket) {
+	if (bucket < kLatencyExactBuckets) return bucket;
+	unsigned int const highestBit = (bucket - kLatencyExactBuckets) / kLatencySubBucketsPerPowerOfTwo + 5;
+	unsigned long long const subBucket = (bucket - kLatencyExactBuckets) % kLatencySubBucketsPerPowerOfTwo;
+	unsigned long long const width = 1ULL << (highestBit - 4);
+	return ((kLatencySubBucketsPerPowerOfTwo + subBucket) << (highestBit - 4)) + (width - 1);
+}
+
+//Only one thread records, so there's no need for a locked add: nobody else's increment can get lost between the load and the store.
+static void latency_add(unsigned long long _Atomic *_Nonnull const counter, unsigned long long const amount) {
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+void latency_record(struct latency_histogram *_Nonnull const histogram, unsigned long long const nanoseconds) {
+	latency_add(&histogram->counts[latency_bucketForValue(nanoseconds)], 1);
+	latency_add(&histogram->totalNanoseconds, nanoseconds);
+	if (nanoseconds > atomic_load_explicit(&histogram->maximumNanoseconds, memory_order_relaxed)) {
+		atomic_store_explicit(&histogram->maximumNanoseconds, nanoseconds, memory_order_relaxed);
+	}
+	//The count goes last, so a reader never sees more values than the buckets hold.
+	atomic_store_explicit(&histogram->count, atomic_load_explicit(&histogram->count, memory_order_relaxed) + 1, memory_order_release);
+}
+
+unsigned long long latency_count(struct latency_histogram const *_Nonnull const histogram) {
+	return atomic_load_explicit(&histogram->count, memory_order_acquire);
+}
+
+unsigned long long latency_percentile(struct latency_histogram const *_Nonnull const histogram, double const percentile) {
+	unsigned long long const count = latency_count(histogram);
+	if (count == 0) return 0;
+	unsigned long long const maximum = atomic_load_explicit(&histogram->maximumNanoseconds, memory_order_relaxed);
+	//The rank of the value we want, counting from 1.
+	unsigned long long rank = (unsigned long long)(count * (percentile / 100.0) + 0.5);
+	if (rank < 1) rank = 1;
+	if (rank > count) rank = count;
+
+	unsigned long long seen = 0;
+	for (unsigned int bucket = 0; bucket < kLatencyNumBuckets; ++bucket) {
+		seen += atomic_load_explicit(&histogram->counts[bucket], memory_order_relaxed);
+		if (seen >= rank) {
+			unsigned long long const upperBound = latency_bucketUpperBound(bucket);
+			return upperBound < maximum ? upperBound : maximum;
+		}
+	}
+	return maximum;
+}
+
+///Writes a duration in whichever unit keeps it to a few digits, such as “850 ns”, “31.2 us”, or “1.20 s”.
+static void latency_copyDurationPhrase(char *_Nonnull const dst, unsigned long long const nanoseconds, size_t const dstCapacity) {
+	static char const *_Nonnull const unitNames[] = { "ns", "us", "ms", "s" };
+	double value = nanoseconds;
+	unsigned int unitIdx = 0;
+	while (value >= 1000.0 && unitIdx < sizeof(unitNames) / sizeof(*unitNames) - 1) {
+		value /= 1000.0;
+		++unitIdx;
+	}
+	int const precision = unitIdx == 0 || value >= 100.0 ? 0 : value >= 10.0 ? 1 : 2;
+	snprintf(dst, dstCapacity, "%.*f %s", precision, value, unitNames[unitIdx]);
+}
+
+void latency_printHeader(FILE *_Nonnull const file) {
+	fprintf(file, "%-16s %10s %10s %10s %10s %10s %10s\n", "Latency", "count", "p50", "p99", "p99.9", "max", "total");
+}
+void latency_printRow(FILE *_Nonnull const file, char const *_Nonnull const name, struct latency_histogram const *_Nonnull const histogram) {
+	unsigned long long const count = latency_count(histogram);
+	if (count == 0) {
+		fprintf(file, "%-16s %10d %10s %10s %10s %10s %10s\n", name, 0, "-", "-", "-", "-", "-");
+		return;
+	}
+	enum { phraseCapacity = 32 };
+	char p50[phraseCapacity], p99[phraseCapacity], p999[phraseCapacity], maximum[phraseCapacity], total[phraseCapacity];
+	latency_copyDurationPhrase(p50, latency_percentile(histogram, 50.0), phraseCapacity);
+	latency_copyDurationPhrase(p99, latency_percentile(histogram, 99.0), phraseCapacity);
+	latency_copyDurationPhrase(p999, latency_percentile(histogram, 99.9), phraseCapacity);
+	latency_copyDurationPhrase(maximum, atomic_load_explicit(&histogram->maximumNanoseconds, memory_order_relaxed), phraseCapacity);
+	latency_copyDurationPhrase(total, atomic_load_explicit(&histogram->totalNanoseconds, memory_order_relaxed), phraseCapacity);
+	fprintf(file, "%-16s %10llu %10s %10s %10s %10s %10s\n", name, count, p50, p99, p999, maximum, total);
+}
@@ -0,0 +1,57 @@
+//
+//  latency.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef latency_h
+#define latency_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+//A latency histogram counts how long something took, in nanoseconds, in logarithmic buckets: each power of two is split into 16 linear sub-buckets, so any value is known to within about 6%, from 1 ns up to centuries, in a fixed 8 KiB. (This is the scheme HdrHistogram uses.)
+//Recording is a few plain loads and stores, with no locks and no read-modify-write atomics, so it's cheap enough to leave on all the time. The catch is that only one thread may record into a given histogram; any thread may read it, and gets a result that may be a value or two behind.
+
+enum {
+	kLatencyExactBuckets = 32,
+	kLatencySubBucketsPerPowerOfTwo = 16,
+	//Values up to 31 get a bucket each; each power of two from 32 up to 2^63 gets 16.
+	kLatencyNumBuckets = kLatencyExactBuckets + (64 - 5) * kLatencySubBucketsPerPowerOfTwo,
+};
+
+//Allocate these statically or on the stack (zeroed), and treat the insides as private.
+struct latency_histogram {
+	unsigned long long _Atomic counts[kLatencyNumBuckets];
+	unsigned long long _Atomic count;
+	unsigned long long _Atomic totalNanoseconds;
+	unsigned long long _Atomic maximumNanoseconds;
+};
+
+///Nanoseconds since whatever CLOCK_THEGOODONE counts from; subtract two of these to get a latency.
+static inline unsigned long long latency_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_THEGOODONE, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+///Adds a value to the histogram. Only one thread may record into any given histogram.
+void latency_record(struct latency_histogram *_Nonnull const histogram, unsigned long long const nanoseconds);
+///Records the time from startNanoseconds (from latency_now) until now.
+static inline void latency_recordSince(struct latency_histogram *_Nonnull const histogram, unsigned long long const startNanoseconds) {
+	latency_record(histogram, latency_now() - startNanoseconds);
+}
+
+unsigned long long latency_count(struct latency_histogram const *_Nonnull const histogram);
+///The value that percentile percent of the recorded values are at or below (e.g., 99.9), rounded up to the top of its bucket (but never above the maximum). 0 if nothing has been recorded.
+unsigned long long latency_percentile(struct latency_histogram const *_Nonnull const histogram, double const percentile);
+
+///Prints a header line for a table of histograms, then (with latency_printRow) one line for each.
+void latency_printHeader(FILE *_Nonnull const file);
+///Prints the count, p50, p99, p99.9, maximum, and total of a histogram, labeled with name.
+void latency_printRow(FILE *_Nonnull const file, char const *_Nonnull const name, struct latency_histogram const *_Nonnull const histogram);
+
+#endif /* latency_h */
@@ -12,6 +12,29 @@
 //*** For system header includes, see prefix-*.h. The Xcode project uses prefix-Darwin.h, and the Makefile automatically selects one based on the output of uname.
 
 #include "formatting_utils.h"
+#include "buffer_ring.h"
+#include "uring_copy.h"
+#include "device_info.h"
+#include "striped_copy.h"
+#include "kernel_copy.h"
+#include "block_utils.h"
+#include "journal.h"
+#include "manifest.h"
+#include "verify.h"
+#include "tuner.h"
+#include "progress.h"
+#include "latency.h"
+#include "rate_limiter.h"
+#include "compression.h"
+#include "image_index.h"
+#include "image_restore.h"
+#include "block_store.h"
+#include "rescue_map.h"
+#include "placement.h"
+#include "mapped_input.h"
+
+#include <sys/stat.h>
+#include <math.h>
 
 #if SHOW_DEBUG_LOGGING
 #	define LOG(...) fprintf(stderr, __VA_ARGS__)
@@ -27,21 +50,133 @@ static time_fractional_t timeWithFraction(void);
 //https://lists.apple.com/archives/filesystem-dev/2012/Feb/msg00015.html suggests that the optimal chunk size is somewhere between 128 KiB (USB packet size) and 1 MiB.
 //I've tested 128 KiB, 1 MiB, and 10 MiB (which is what I used to use in an earlier version of this code and had previously been using with dd) and couldn't detect a statistically significant difference. I'd need to graph out the copying speed over time to properly correlate the difference, and it might still be within the margin of error.
 //Absent any conclusive reason to do otherwise, I'm going with the upper bound of the range that (presumably) Apple file-systems engineer gave.
-static const size_t kBufferSize = MILLIONS(1,048,576);
+//The best size for a particular pair of devices can be measured during the copy with --adaptive (see tuner.h), or by trying sizes with --block-size (see bench.sh).
+static const size_t kDefaultBufferSize = MILLIONS(1,048,576);
+//--block-size can change it, within these limits. The lower limit is the biggest logical sector size around (so direct I/O can still work); the upper one is just sanity.
+static const size_t kMinimumBufferSize = 4096, kMaximumBufferSize = 256 * MILLIONS(1,048,576);
+
+//How many buffers the reader may fill ahead of the writer. More buffers let the reader keep going through a slow write (and vice versa) at the cost of bufferSize of memory each.
+enum { kDefaultPipelineDepth = 8, kMaximumPipelineDepth = 1024 };
+enum { kMaximumStripedWorkers = 256 };
+
+static size_t bufferSize = kDefaultBufferSize;
 
 static time_fractional_t copyStartedTime, copyFinishedTime;
 static unsigned long long _Atomic totalAmountCopied = 0;
-static int inputFD, outputFD;
-static void *buffer0, *buffer1;
-static bool _Atomic buffer0Dirty = true, buffer1Dirty = true; //true when there is data here that has not been written. Set to false by the writer and set to true again by the writer. When both are false, the writer thread exits.
-static size_t _Atomic buffer0Len = 1, buffer1Len = 1; //How much data was most recently read into each buffer.
-static pthread_mutex_t initializationLock = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER;
-static bool _Atomic readerHasInitialized = false;
-static pthread_rwlock_t buffer0Lock = PTHREAD_RWLOCK_INITIALIZER, buffer1Lock = PTHREAD_RWLOCK_INITIALIZER;
-//The generation counts—which, as you can see here, are per-buffer—are used to prevent each loop from getting too far ahead of the other. Reading will only proceed when the last write generation is equal to the last read generation; the new read will be the next read generation. Writing will only proceed when the last write generation is one behind the last read generation; the new write, being the next write generation, will catch up to the last read generation.
-static unsigned long _Atomic readGeneration0 = 0, readGeneration1 = 0;
-static unsigned long _Atomic writeGeneration0 = 0, writeGeneration1 = 0;
-static int _Atomic mostRecentlyReadBuffer = -1;
+//Zeros that were in the input but that we didn't have to write, because we skipped over them or punched a hole in the output. Included in totalAmountCopied.
+static unsigned long long _Atomic totalAmountSkipped = 0;
+//With --rescue, zeros the reader put in place of data it couldn't read. Included in totalAmountCopied, but not in totalAmountSkipped, even where they were skipped over.
+static unsigned long long _Atomic totalAmountUnread = 0;
+//When writes can complete out of order, a failure can leave gaps. This is how much of the output, from the start, is known to be complete; it's what we truncate the output to at the end. Backends that write out of order keep it up to date as they go (and set writesMayCompleteOutOfOrder); otherwise, it's the same as totalAmountCopied, and is only set at the end.
+static unsigned long long _Atomic completeOutputLength = 0;
+static bool _Atomic writesMayCompleteOutOfOrder = false;
+//When resuming from a journal, how far into the input and output we started. totalAmountCopied and completeOutputLength count from here.
+static unsigned long long resumeOffset = 0;
+static int inputFD;
+static unsigned int pipelineDepth = kDefaultPipelineDepth;
+//0 means don't use the striped backend.
+static unsigned int numStripedWorkers = 0;
+static bool useDirectIO = false;
+static bool allowKernelCopy = true;
+//With --mmap, when the input is a regular file, the reader hands the writers its data where it sits in a mapping of the file, rather than reading it into the ring's buffers (see mapped_input.h). It's not the default because a mapping doesn't report read errors the way read() does.
+static bool mapInput = false;
+static struct mapped_input *_Nullable mappedInput = NULL;
+static bool sparseMode = false;
+static bool diffMode = false;
+static char const *_Nullable manifestPath = NULL;
+static bool manifestIncludesSHA256 = false;
+static struct manifest *_Nullable manifest = NULL;
+//In diff mode, how much of the output we read back to compare against, and how much of the input matched it and so didn't need writing. The latter is included in totalAmountCopied.
+static unsigned long long _Atomic totalAmountCompared = 0;
+static unsigned long long _Atomic totalAmountUnchanged = 0;
+static char const *_Nullable journalPath = NULL;
+static bool resumeFromJournal = false;
+//In adaptive mode, the tuner tries different block sizes and depths as the copy goes, and the ring's buffers are big enough for the biggest.
+static bool adaptiveMode = false;
+static struct tuner *_Nullable tuner = NULL;
+//--max-rate holds the writer to a number of bytes per second; --max-rate auto lets the rate limiter work out a limit that keeps the output from overheating (see rate_limiter.h).
+static double maxRateBytesPerSecond = 0.0;
+static bool automaticMaxRate = false;
+static struct rate_limiter *_Nullable rateLimiter = NULL;
+//--compress writes the output as a compressed image (see compression.h). --decompress insists that the input be one, and decompresses it; it's the only way to decompress one from a pipe, which can't be peeked at. --detect-image decompresses a seekable input only if it turns out to be an image, and --raw (the default) copies it as it is, as dd would. Either way, the blocks are compressed or decompressed on a pool of threads between the reader and the writer.
+static bool compressOutput = false;
+static bool decompressInput = false;
+static bool detectImageInput = false;
+static struct compression *_Nullable compression = NULL;
+//When compressing, the index of the frames written so far, which goes at the end of the image (see image_index.h).
+static struct image_index *_Nullable imageIndex = NULL;
+//--restore-range restores just part of an image's original data, to the same place in the output, by way of the image's index.
+static bool restoreRange = false;
+static unsigned long long restoreOffset = 0, restoreLength = 0;
+//--store puts the input's blocks into a block store, writing only the ones it doesn't have yet, and writes a recipe for them as the output (see block_store.h). --from-store goes the other way: the input is a recipe, and its blocks come out of the store. Either way, the hashing and the store's files are handled by a pool of threads between the reader and the writer.
+static char const *_Nullable blockStorePath = NULL;
+static bool restoreFromStore = false;
+static struct block_store *_Nullable blockStore = NULL;
+//When restoring from a store, the recipe, which is read in full before copying starts, and the next block of it for the reader.
+static struct block_recipe *_Nullable blockRecipe = NULL;
+static unsigned long long nextRecipeBlock = 0;
+//How many threads compress, decompress, or work on the block store.
+static unsigned int numPoolThreads = 1;
+
+//With --rescue, blocks that can't be read are skipped and recorded in the map, and retried more carefully once everything else has been copied.
+static char const *_Nullable rescueMapPath = NULL;
+static struct rescue_map *_Nullable rescueMap = NULL;
+//How many times the second pass tries each sector before giving up on it.
+enum { kRescueMaxAttempts = 3 };
+//How far a run of failed reads can push the reader ahead: each failure in a row skips twice as far as the last, up to this many doublings of a block.
+enum { kRescueMaxSkipDoublings = 6 };
+
+//The reader and writer threads are kept on threadCPUs, and the ring's buffers come from those CPUs' node, if pinThreads is true. With --cpu auto (the default), that's when the input (or failing that, the first output) is on one NUMA node of several, and threadCPUs is that node's CPUs (see placement.h); with --cpu LIST, it's always, and threadCPUs is the list.
+static enum {
+	cpuPlacement_auto,
+	cpuPlacement_none,
+	cpuPlacement_list,
+} cpuPlacement = cpuPlacement_auto;
+static struct cpu_list threadCPUs;
+static bool pinThreads = false;
+static int threadsNode = -1;
+//Whether the reader and writer threads actually got pinned, for the final report.
+static bool threadsPinned = false;
+
+//--verify reads back the whole output after copying, and compares it against the input. --compare-only does that without copying anything first.
+static bool verifyAfterCopy = false;
+static bool compareOnly = false;
+static bool _Atomic verifying = false;
+static time_fractional_t verifyStartedTime, verifyFinishedTime;
+static unsigned long long _Atomic totalAmountVerified = 0;
+//Tracks how fast the copy (and then the verify) is going, and runs the thread that reports progress, both when asked by SIGINFO and, with --progress-interval, periodically. 0 means only when asked.
+static struct progress *_Nullable progress = NULL;
+static double progressIntervalSeconds = 0.0;
+//How long each read() takes in the reader/writer-thread backend, and how long the reader spends waiting for the writer to free a buffer. Each output has the same for its writer (see struct output). Each has only one thread recording into it.
+static struct latency_histogram readLatencies, readerWaits;
+//--progress-fd sends progress reports to a file descriptor other than standard output, and --progress-format json makes each one a line of JSON, for other programs to read. The final summary still goes to standard output.
+static FILE *_Nullable progressFile = NULL;
+static enum {
+	progressFormat_text,
+	progressFormat_json,
+} progressFormat = progressFormat_text;
+//How big the input is (asked of the device for a block device, or fstat for a file), so reports can say how much is left; 0 if there's no telling, as with a pipe.
+static unsigned long long progressTotalBytes = 0;
+//How often to sync the output and record how far we've got. Syncing too often would cost more than the work it might save.
+enum { kJournalCheckpointIntervalSeconds = 5 };
+//The size of the output before we started, if it's a regular file or device; otherwise, ULLONG_MAX. In sparse mode, zeros past this point can be skipped over, but zeros before it have to replace whatever was there.
+static unsigned long long outputOriginalSize = ULLONG_MAX;
+static bool outputIsSeekable = false;
+static void *_Nullable zeroBuffer = NULL;
+//In diff mode, what was in the output where the current buffer is going, and how much of it there was (less than the buffer's length if the output was shorter).
+static void *_Nullable compareBuffer = NULL;
+static size_t compareBufferLength = 0;
+//0 unless both files are open for direct I/O, in which case every read and write (except the last) has to be a multiple of this, into and out of buffers aligned to it.
+static size_t directIOAlignment = 0;
+static enum {
+	backend_auto,
+	backend_threads,
+	backend_io_uring,
+} backend = backend_auto;
+//The reader fills slots in the ring and the writer empties them, in order. The ring's read and write generations are the number of buffers each has gotten through.
+static struct buffer_ring *_Nullable ring = NULL;
+//Progress reports read the ring's generations while the copy is going on; this keeps the ring from being created or destroyed in the middle of that.
+static pthread_mutex_t ringLifetimeLock = PTHREAD_MUTEX_INITIALIZER;
 static enum {
 	state_beforeFirstRead = '0B4R',
 	state_readBegun = '1GO!',
@@ -49,12 +184,12 @@ static enum {
 	state_readFailed = '3RIP',
 	state_endOfFile = '4EOF',
 } _Atomic readerState = state_beforeFirstRead;
-static enum {
+enum writer_state {
 	state_beforeFirstWrite = '0B4W',
 	state_writeBegun = '1GO!',
 	state_writeFinished = '2END',
 	state_writeFailed = '3RIP',
-} _Atomic writerState = state_beforeFirstWrite;
+};
 
 static char const *reader_nameState(int const readerState) {
 	static union {
@@ -67,6 +202,26 @@ static char const *reader_nameState(int const readerState) {
 	nexus.pieces.readerState = htonl(readerState);
 	return nexus.string;
 }
+///For progress records: a name for the reader's state that doesn't need decoding.
+static char const *_Nonnull reader_stateKeyword(int const readerState) {
+	switch (readerState) {
+		case state_beforeFirstRead: return "not started";
+		case state_readBegun: return "reading";
+		case state_readFinished: return "read";
+		case state_readFailed: return "failed";
+		case state_endOfFile: return "end of file";
+		default: return "unknown";
+	}
+}
+static char const *_Nonnull writer_stateKeyword(int const writerState) {
+	switch (writerState) {
+		case state_beforeFirstWrite: return "not started";
+		case state_writeBegun: return "writing";
+		case state_writeFinished: return "written";
+		case state_writeFailed: return "failed";
+		default: return "unknown";
+	}
+}
 static char const *writer_nameState(int const writerState) {
 	static union {
 		struct {
@@ -86,44 +241,439 @@ enum {
 	writeErrorCapacity,
 };
 char readErrorBuffer[readErrorCapacity] = { 0 };
-char writeErrorBuffer[writeErrorCapacity] = { 0 };
 
-static void logProgress(bool const isFinal);
+//Each output has a writer thread of its own, which writes every block the reader puts in the ring to it. Usually there's only the one; with more, the ring hands every block to each writer and only gives it back to the reader once they've all written it, so the reader only reads everything once. A slow output can fall up to the pipeline depth behind the fastest before it holds the others up.
+//The other backends only ever write to outputs[0], and use its state.
+enum { kMaximumOutputs = kRingMaximumConsumers };
+struct output {
+	char const *_Nullable path;
+	int fd;
+	//Its index in outputs, and which of the ring's consumers its writer is.
+	unsigned int index;
+	enum writer_state _Atomic state;
+	//How much the writer has written to this output. With one output, totalAmountCopied also counts what was skipped or left unchanged; with more, it only counts blocks that every output (that hasn't failed) has.
+	unsigned long long _Atomic amountWritten;
+	time_fractional_t finishedTime;
+	//How long each write() takes, and how long the writer spends waiting for the reader to fill a buffer.
+	struct latency_histogram writeLatencies, waits;
+	char errorBuffer[writeErrorCapacity];
+	//Whether what failed was the mapped input, which a write() given a page of it that can't be read reports as EFAULT.
+	bool inputFailed;
+};
+static struct output outputs[kMaximumOutputs];
+static unsigned int numOutputs = 0;
+//How many outputs haven't had a write fail. Once there are none, the reader may as well stop.
+static unsigned int _Atomic numOutputsWriting = 0;
+
+static void logProgress(FILE *_Nonnull const file, bool const isFinal);
+static void logVerifyProgress(FILE *_Nonnull const file, bool const isFinal);
+static void logLatencies(FILE *_Nonnull const file);
+static void logProgressRecord(FILE *_Nonnull const file, bool const forVerify, bool const isFinal);
+static void reportProgress(bool const wasRequested);
 static void handleSIGINFO(int const signal);
+static void printUsage(FILE *const file, char const *const argv0);
+static bool parseSize(char const *_Nonnull const arg, unsigned long long *_Nonnull const outSize);
+static int copyWithThreads(void);
+static int verifyOutput(int const destinationFD);
+static int restoreImageRange(char const *_Nonnull const imagePath);
+static int rescueBadRanges(void);
+static unsigned long long durableOutputLength(void);
+static void sleepForSeconds(double const seconds);
+static ssize_t readFully(int const fd, void *_Nonnull const buffer, size_t const length);
+static bool writeFully(struct output *_Nonnull const output, void const *_Nonnull const buffer, size_t const length);
 static void *read_thread_main(void *restrict arg);
 static void *write_thread_main(void *restrict arg);
 
 int main(int argc, const char * argv[]) {
-	//TEMP FIXME Need actual argument handling here
-	inputFD = open(argv[1], O_RDONLY);
+	char const *inputPath = NULL;
+	for (int argIdx = 1; argIdx < argc; ++argIdx) {
+		char const *const arg = argv[argIdx];
+		if (strcmp(arg, "--help") == 0) {
+			printUsage(stdout, argv[0]);
+			return EXIT_SUCCESS;
+		} else if (strcmp(arg, "--depth") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			char *end = NULL;
+			unsigned long const depth = strtoul(argv[argIdx], &end, 10);
+			if (*end != '\0' || depth < 1 || depth > kMaximumPipelineDepth) {
+				fprintf(stderr, "dd-parallel: --depth must be a number from 1 to %u\n", kMaximumPipelineDepth);
+				return EX_USAGE;
+			}
+			pipelineDepth = (unsigned int)depth;
+		} else if (strcmp(arg, "--block-size") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			unsigned long long size = 0;
+			if (! parseSize(argv[argIdx], &size) || size < kMinimumBufferSize || size > kMaximumBufferSize || size % kMinimumBufferSize != 0) {
+				fprintf(stderr, "dd-parallel: --block-size must be a multiple of %zu bytes, from %zu bytes to %zu MiB\n", kMinimumBufferSize, kMinimumBufferSize, kMaximumBufferSize / MILLIONS(1,048,576));
+				return EX_USAGE;
+			}
+			bufferSize = (size_t)size;
+		} else if (strcmp(arg, "--workers") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			char *end = NULL;
+			unsigned long const workers = strtoul(argv[argIdx], &end, 10);
+			if (*end != '\0' || workers < 1 || workers > kMaximumStripedWorkers) {
+				fprintf(stderr, "dd-parallel: --workers must be a number from 1 to %u\n", kMaximumStripedWorkers);
+				return EX_USAGE;
+			}
+			numStripedWorkers = (unsigned int)workers;
+		} else if (strcmp(arg, "--direct") == 0) {
+			useDirectIO = true;
+		} else if (strcmp(arg, "--sparse") == 0) {
+			sparseMode = true;
+		} else if (strcmp(arg, "--diff") == 0) {
+			diffMode = true;
+		} else if (strcmp(arg, "--manifest") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			manifestPath = argv[argIdx];
+		} else if (strcmp(arg, "--manifest-sha256") == 0) {
+			manifestIncludesSHA256 = true;
+		} else if (strcmp(arg, "--journal") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			journalPath = argv[argIdx];
+		} else if (strcmp(arg, "--resume") == 0) {
+			resumeFromJournal = true;
+		} else if (strcmp(arg, "--adaptive") == 0) {
+			adaptiveMode = true;
+		} else if (strcmp(arg, "--max-rate") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			unsigned long long rate = 0;
+			if (strcmp(argv[argIdx], "auto") == 0) {
+				automaticMaxRate = true;
+			} else if (parseSize(argv[argIdx], &rate) && rate > 0) {
+				maxRateBytesPerSecond = rate;
+			} else {
+				fprintf(stderr, "dd-parallel: --max-rate must be a number of bytes per second, e.g. 200M, or auto\n");
+				return EX_USAGE;
+			}
+		} else if (strcmp(arg, "--compress") == 0) {
+			compressOutput = true;
+		} else if (strcmp(arg, "--decompress") == 0) {
+			decompressInput = true;
+			detectImageInput = false;
+		} else if (strcmp(arg, "--detect-image") == 0) {
+			detectImageInput = true;
+			decompressInput = false;
+		} else if (strcmp(arg, "--raw") == 0) {
+			detectImageInput = false;
+			decompressInput = false;
+		} else if (strcmp(arg, "--store") == 0 || strcmp(arg, "--from-store") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			if (blockStorePath != NULL) {
+				fprintf(stderr, "dd-parallel: only one of --store and --from-store can be used, once\n");
+				return EX_USAGE;
+			}
+			restoreFromStore = strcmp(arg, "--from-store") == 0;
+			blockStorePath = argv[argIdx];
+		} else if (strcmp(arg, "--restore-range") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			char offsetString[32] = { 0 };
+			char const *_Nullable const colon = strchr(argv[argIdx], ':');
+			bool parsed = colon != NULL && (size_t)(colon - argv[argIdx]) < sizeof(offsetString);
+			if (parsed) {
+				memcpy(offsetString, argv[argIdx], colon - argv[argIdx]);
+				parsed = parseSize(offsetString, &restoreOffset) && parseSize(colon + 1, &restoreLength) && restoreLength > 0;
+			}
+			if (! parsed) {
+				fprintf(stderr, "dd-parallel: --restore-range must be an offset and a length, e.g. 1G:512M\n");
+				return EX_USAGE;
+			}
+			restoreRange = true;
+		} else if (strcmp(arg, "--rescue") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			rescueMapPath = argv[argIdx];
+		} else if (strcmp(arg, "--verify") == 0) {
+			verifyAfterCopy = true;
+		} else if (strcmp(arg, "--compare-only") == 0) {
+			compareOnly = true;
+		} else if (strcmp(arg, "--progress-interval") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			char *end = NULL;
+			double const interval = strtod(argv[argIdx], &end);
+			if (*end != '\0' || end == argv[argIdx] || ! (interval > 0.0 && interval <= 86400.0)) {
+				fprintf(stderr, "dd-parallel: --progress-interval must be a number of seconds greater than 0\n");
+				return EX_USAGE;
+			}
+			progressIntervalSeconds = interval;
+		} else if (strcmp(arg, "--progress-fd") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			char *end = NULL;
+			long const fd = strtol(argv[argIdx], &end, 10);
+			if (*end != '\0' || end == argv[argIdx] || fd < 0 || fd > INT_MAX || fcntl((int)fd, F_GETFD) < 0) {
+				fprintf(stderr, "dd-parallel: --progress-fd must be the number of an open file descriptor\n");
+				return EX_USAGE;
+			}
+			progressFile = fdopen((int)fd, "w");
+			if (progressFile == NULL) {
+				fprintf(stderr, "dd-parallel: --progress-fd %ld isn't open for writing\n", fd);
+				return EX_USAGE;
+			}
+		} else if (strcmp(arg, "--progress-format") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			char const *const formatName = argv[argIdx];
+			if (strcmp(formatName, "text") == 0) {
+				progressFormat = progressFormat_text;
+			} else if (strcmp(formatName, "json") == 0) {
+				progressFormat = progressFormat_json;
+			} else {
+				fprintf(stderr, "dd-parallel: unknown progress format %s\n", formatName);
+				goto usageError;
+			}
+		} else if (strcmp(arg, "--no-kernel-copy") == 0) {
+			allowKernelCopy = false;
+		} else if (strcmp(arg, "--mmap") == 0) {
+			mapInput = true;
+		} else if (strcmp(arg, "--backend") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			char const *const backendName = argv[argIdx];
+			if (strcmp(backendName, "auto") == 0) {
+				backend = backend_auto;
+			} else if (strcmp(backendName, "threads") == 0) {
+				backend = backend_threads;
+			} else if (strcmp(backendName, "io_uring") == 0) {
+				backend = backend_io_uring;
+			} else {
+				fprintf(stderr, "dd-parallel: unknown backend %s\n", backendName);
+				goto usageError;
+			}
+		} else if (strcmp(arg, "--cpu") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			char const *const cpusString = argv[argIdx];
+			if (strcmp(cpusString, "auto") == 0) {
+				cpuPlacement = cpuPlacement_auto;
+			} else if (strcmp(cpusString, "none") == 0) {
+				cpuPlacement = cpuPlacement_none;
+			} else if (cpu_list_parse(cpusString, &threadCPUs)) {
+				cpuPlacement = cpuPlacement_list;
+			} else {
+				fprintf(stderr, "dd-parallel: can't parse CPU list %s (expected e.g. 0-7,16-23, auto, or none)\n", cpusString);
+				goto usageError;
+			}
+		} else if (strncmp(arg, "--", 2) == 0) {
+			fprintf(stderr, "dd-parallel: unrecognized option %s\n", arg);
+			goto usageError;
+		} else if (inputPath == NULL) {
+			inputPath = arg;
+		} else if (numOutputs < kMaximumOutputs) {
+			outputs[numOutputs].path = arg;
+			outputs[numOutputs].index = numOutputs;
+			++numOutputs;
+		} else {
+			fprintf(stderr, "dd-parallel: can't write to more than %u outputs at once\n", kMaximumOutputs);
+			return EX_USAGE;
+		}
+	}
+	if (numOutputs == 0) {
+	usageError:
+		printUsage(stderr, argv[0]);
+		return EX_USAGE;
+	}
+	if (manifestIncludesSHA256 && manifestPath == NULL) {
+		fprintf(stderr, "dd-parallel: --manifest-sha256 needs --manifest\n");
+		return EX_USAGE;
+	}
+	if (progressFile == NULL) {
+		progressFile = stdout;
+	} else if (progressIntervalSeconds == 0.0) {
+		//Nobody's going to send signals to get reports on another descriptor; that's for a program watching the copy, which wants them to keep coming.
+		progressIntervalSeconds = 1.0;
+	}
+	if (resumeFromJournal && journalPath == NULL) {
+		fprintf(stderr, "dd-parallel: --resume needs --journal\n");
+		return EX_USAGE;
+	}
+
+	bool const limitRate = maxRateBytesPerSecond > 0.0 || automaticMaxRate;
+	if (limitRate && adaptiveMode) {
+		fprintf(stderr, "dd-parallel: --adaptive can't measure anything while --max-rate holds the copy back\n");
+		return EX_USAGE;
+	}
+	if (numOutputs > 1 && (compareOnly || sparseMode || diffMode || journalPath != NULL || adaptiveMode || limitRate)) {
+		fprintf(stderr, "dd-parallel: --compare-only, --sparse, --diff, --journal, --adaptive, and --max-rate only work with one output\n");
+		return EX_USAGE;
+	}
+	if (compareOnly && (sparseMode || diffMode || manifestPath != NULL || journalPath != NULL)) {
+		fprintf(stderr, "dd-parallel: --compare-only doesn't copy anything, so it can't be used with --sparse, --diff, --manifest, or --journal\n");
+		return EX_USAGE;
+	}
+	if (restoreRange && (compressOutput || numOutputs > 1 || compareOnly || verifyAfterCopy || sparseMode || diffMode || manifestPath != NULL || journalPath != NULL || adaptiveMode || limitRate)) {
+		fprintf(stderr, "dd-parallel: --restore-range can only be used with --workers and the progress options\n");
+		return EX_USAGE;
+	}
+	if (blockStorePath != NULL && (compressOutput || decompressInput || restoreRange || numOutputs > 1 || compareOnly || verifyAfterCopy || journalPath != NULL || adaptiveMode)) {
+		fprintf(stderr, "dd-parallel: --store and --from-store can't be used with --compress, --decompress, --restore-range, more than one output, --compare-only, --verify, --journal, or --adaptive\n");
+		return EX_USAGE;
+	}
+	if (blockStorePath != NULL && ! restoreFromStore && (sparseMode || diffMode)) {
+		fprintf(stderr, "dd-parallel: --sparse and --diff can't be used with --store; the output is a recipe, and blocks of zeros aren't stored anyway\n");
+		return EX_USAGE;
+	}
+	if (restoreFromStore && manifestPath != NULL) {
+		fprintf(stderr, "dd-parallel: --manifest hashes the blocks as they're read, so it can't describe blocks coming out of a store\n");
+		return EX_USAGE;
+	}
+	if (rescueMapPath != NULL && (compressOutput || decompressInput || blockStorePath != NULL || restoreRange || numOutputs > 1 || compareOnly || verifyAfterCopy || manifestPath != NULL || journalPath != NULL || adaptiveMode)) {
+		fprintf(stderr, "dd-parallel: --rescue can't be used with --compress, --decompress, --store, --from-store, --restore-range, more than one output, --compare-only, --verify, --manifest, --journal, or --adaptive\n");
+		return EX_USAGE;
+	}
+	if (compressOutput && decompressInput) {
+		fprintf(stderr, "dd-parallel: --compress and --decompress can't be used together\n");
+		return EX_USAGE;
+	}
+	if (compressOutput && (sparseMode || diffMode)) {
+		fprintf(stderr, "dd-parallel: --sparse and --diff can't be used with --compress; a compressed image stores zeros in next to no space anyway\n");
+		return EX_USAGE;
+	}
+#if ! EXISTS_ZLIB
+	if (compressOutput) {
+		fprintf(stderr, "dd-parallel: this dd-parallel was built without zlib, so it can't --compress\n");
+		return EX_UNAVAILABLE;
+	}
+#endif
+
+	inputFD = open(inputPath, O_RDONLY);
 	if (inputFD < 0) return EX_NOINPUT;
-	outputFD = open(argv[2], O_WRONLY | O_CREAT, 0644);
-	if (outputFD < 0) return EX_CANTCREAT;
+	if ((verifyAfterCopy || compareOnly) && lseek(inputFD, 0, SEEK_CUR) < 0) {
+		fprintf(stderr, "dd-parallel: %s needs an input that can be read again, not a pipe\n", compareOnly ? "--compare-only" : "--verify");
+		return EX_USAGE;
+	}
+	//When decompressing, how much data the image stands for, if its end frame could be read ahead of time; 0 if not.
+	unsigned long long imageOriginalLength = 0;
+	if (restoreFromStore) {
+		char const *_Nullable recipeErrorStr = NULL;
+		blockRecipe = block_recipe_read(inputFD, &recipeErrorStr);
+		if (blockRecipe == NULL) {
+			fprintf(stderr, "dd-parallel: can't restore %s: %s\n", inputPath, recipeErrorStr);
+			return EX_DATAERR;
+		}
+		if (block_recipe_blockSize(blockRecipe) > kMaximumBufferSize) {
+			fprintf(stderr, "dd-parallel: %s has blocks bigger than %zu bytes, which this version can't handle\n", inputPath, (size_t)kMaximumBufferSize);
+			return EX_DATAERR;
+		}
+		if (bufferSize != kDefaultBufferSize && bufferSize != block_recipe_blockSize(blockRecipe)) {
+			fprintf(stderr, "dd-parallel: the recipe is for %zu-byte blocks; ignoring --block-size\n", block_recipe_blockSize(blockRecipe));
+		}
+		bufferSize = block_recipe_blockSize(blockRecipe);
+	}
+	//A rescue copies the input as it is, image or not.
+	if ((decompressInput || detectImageInput) && ! compareOnly && ! compressOutput && ! restoreRange && blockStorePath == NULL && rescueMapPath == NULL) {
+		unsigned char imageHeader[kCompressionImageHeaderSize];
+		bool const inputIsSeekable = lseek(inputFD, 0, SEEK_CUR) >= 0;
+		ssize_t headerLength = 0;
+		if (inputIsSeekable) {
+			headerLength = pread(inputFD, imageHeader, sizeof(imageHeader), 0);
+		} else if (decompressInput) {
+			//What's read from a pipe can't be put back, so only read it if it's supposed to be an image.
+			headerLength = readFully(inputFD, imageHeader, sizeof(imageHeader));
+		}
+		size_t imageBlockSize = 0;
+		if (headerLength == sizeof(imageHeader) && compression_parseImageHeader(imageHeader, &imageBlockSize) && imageBlockSize <= kMaximumBufferSize) {
+			decompressInput = true;
+			if (bufferSize != kDefaultBufferSize && bufferSize != imageBlockSize) {
+				fprintf(stderr, "dd-parallel: the image was compressed in %zu-byte blocks; ignoring --block-size\n", imageBlockSize);
+			}
+			bufferSize = imageBlockSize;
+			unsigned long long imageSize = 0;
+			if (inputIsSeekable) {
+				lseek(inputFD, sizeof(imageHeader), SEEK_SET);
+				//How long the data is is worth knowing for progress reports and preallocating the output. The index's trailer says; in an image without an index, the end frame is the last thing, and says the same.
+				unsigned char endFrame[kCompressionEndFrameSize];
+				size_t storedLength, frameOriginalLength;
+				bool isEnd = false;
+				char const *_Nullable indexErrorStr = NULL;
+				struct image_index *_Nullable const index = deviceSize(inputFD, &imageSize) ? image_index_open(inputFD, imageSize, &indexErrorStr) : NULL;
+				if (index != NULL) {
+					imageOriginalLength = image_index_totalLength(index);
+					image_index_destroy(index);
+				} else if (imageSize >= sizeof(imageHeader) + sizeof(endFrame) && pread(inputFD, endFrame, sizeof(endFrame), imageSize - sizeof(endFrame)) == sizeof(endFrame) && compression_parseFrameHeader(endFrame, imageBlockSize, &storedLength, &frameOriginalLength, &isEnd) && isEnd) {
+					imageOriginalLength = compression_endFrameTotalLength(endFrame + kCompressionFrameHeaderSize);
+				}
+			}
+		} else if (decompressInput) {
+			fprintf(stderr, "dd-parallel: %s isn't a compressed image\n", inputPath);
+			return EX_DATAERR;
+		}
+	}
+	if ((compressOutput || decompressInput) && (numOutputs > 1 || compareOnly || verifyAfterCopy || journalPath != NULL || adaptiveMode)) {
+		fprintf(stderr, "dd-parallel: %s can't be done with more than one output, --compare-only, --verify, --journal, or --adaptive\n", compressOutput ? "compressing" : "decompressing");
+		return EX_USAGE;
+	}
+	if (decompressInput && manifestPath != NULL) {
+		fprintf(stderr, "dd-parallel: --manifest hashes the blocks as they're read, so it can't describe an image being decompressed\n");
+		return EX_USAGE;
+	}
+	if (compareOnly) {
+		outputs[0].fd = open(outputs[0].path, O_RDONLY);
+		if (outputs[0].fd < 0) return EX_NOINPUT;
+	} else {
+		for (unsigned int i = 0; i < numOutputs; ++i) {
+			//In diff mode, we read the output to see what's already there.
+			outputs[i].fd = open(outputs[i].path, (diffMode ? O_RDWR : O_WRONLY) | O_CREAT, 0644);
+			if (outputs[i].fd < 0) return EX_CANTCREAT;
+		}
+	}
 
 #if EXISTS_F_RDAHEAD
 	fcntl(inputFD, F_RDAHEAD, 1);
 #endif
 #if EXISTS_F_NOCACHE
 	fcntl(inputFD, F_NOCACHE, 1);
-	fcntl(outputFD, F_NOCACHE, 1);
+	for (unsigned int i = 0; i < numOutputs; ++i) {
+		fcntl(outputs[i].fd, F_NOCACHE, 1);
+	}
 #endif
+	if (useDirectIO && (compressOutput || decompressInput || restoreRange)) {
+		//A compressed image's frames don't line up with sectors.
+		fprintf(stderr, "dd-parallel: direct I/O can't be used with compressed images; using the page cache\n");
+		useDirectIO = false;
+	}
+	if (useDirectIO && blockStorePath != NULL) {
+		//Neither does a recipe's digests.
+		fprintf(stderr, "dd-parallel: direct I/O can't be used with a block store; using the page cache\n");
+		useDirectIO = false;
+	}
+#if EXISTS_O_DIRECT
+	if (useDirectIO) {
+		//Going around the page cache means copying a huge device doesn't evict everything else on the system, and the data doesn't have to be copied through kernel memory. The price is that every transfer has to be aligned to the devices' logical sectors.
+		if (setDirectIO(inputFD, true)) {
+			directIOAlignment = deviceLogicalBlockSize(inputFD);
+			//Every output gets the same buffers, so they all have to be aligned for whichever needs the most.
+			for (unsigned int i = 0; i < numOutputs && directIOAlignment > 0; ++i) {
+				size_t const outputAlignment = deviceLogicalBlockSize(outputs[i].fd);
+				if (! setDirectIO(outputs[i].fd, true)) directIOAlignment = 0;
+				else if (outputAlignment > directIOAlignment) directIOAlignment = outputAlignment;
+			}
+			if (directIOAlignment > 0 && bufferSize % directIOAlignment != 0) {
+				directIOAlignment = 0;
+			}
+		}
+		if (directIOAlignment == 0) {
+			fprintf(stderr, "dd-parallel: direct I/O is not supported for these files; using the page cache\n");
+			setDirectIO(inputFD, false);
+			for (unsigned int i = 0; i < numOutputs; ++i) {
+				setDirectIO(outputs[i].fd, false);
+			}
+		}
+	}
+#endif
+	if (cpuPlacement == cpuPlacement_auto) {
+		//The input's controller is the one the buffers get DMAed into; the output's gets them afterward.
+		threadsNode = placement_nodeForFile(inputFD);
+		if (threadsNode < 0) threadsNode = placement_nodeForFile(outputs[0].fd);
+		pinThreads = threadsNode >= 0 && placement_cpusOnNode(threadsNode, &threadCPUs);
+	} else {
+		pinThreads = cpuPlacement == cpuPlacement_list;
+	}
 
 	readerState = state_beforeFirstRead;
-	writerState = state_beforeFirstWrite;
-	buffer0 = malloc(kBufferSize);
-	buffer1 = malloc(kBufferSize);
-	if (buffer0 == NULL || buffer1 == NULL) return EX_OSERR;
-
-	pthread_mutex_lock(&initializationLock);
-
-	pthread_t read_thread, write_thread;
-	pthread_create(&read_thread, /*attr*/ NULL, read_thread_main, /*user data*/ NULL);
-
-	pthread_mutex_unlock(&initializationLock);
-	sleep(0);
-
-	pthread_create(&write_thread, /*attr*/ NULL, write_thread_main, /*user data*/ NULL);
+	for (unsigned int i = 0; i < numOutputs; ++i) {
+		outputs[i].state = state_beforeFirstWrite;
+	}
 
+	progress = progress_create();
+	if (progress == NULL) {
+		fprintf(stderr, "dd-parallel: can't track progress; SIGINFO and --progress-interval won't report anything\n");
+	}
 	struct sigaction onSIGINFO = {
 		.sa_handler = handleSIGINFO,
 		.sa_mask = 0,
@@ -131,6 +681,652 @@ int main(int argc, const char * argv[]) {
 	};
 	sigaction(SIGINFO, &onSIGINFO, /*outPrevious*/ NULL);
 
+	unsigned long long inputSize = 0;
+	bool const inputSizeIsKnown = deviceSize(inputFD, &inputSize) && inputSize > 0;
+	if (inputSizeIsKnown) progressTotalBytes = inputSize;
+	//The image's size isn't what the progress reports count; the data's is.
+	if (decompressInput) progressTotalBytes = imageOriginalLength;
+	if (blockRecipe != NULL) progressTotalBytes = block_recipe_totalLength(blockRecipe);
+
+	if (compareOnly) {
+		return verifyOutput(outputs[0].fd);
+	}
+	if (restoreRange) {
+		return restoreImageRange(inputPath);
+	}
+	if (rescueMapPath != NULL) {
+		//The map's ranges are offsets into an input of a known size, and skipped blocks get filled in later by seeking back to them.
+		if (! inputSizeIsKnown) {
+			fprintf(stderr, "dd-parallel: --rescue needs an input whose size is known: a file or a device\n");
+			return EX_USAGE;
+		}
+		if (lseek(outputs[0].fd, 0, SEEK_CUR) < 0) {
+			fprintf(stderr, "dd-parallel: --rescue needs an output that can be seeked, to go back and fill in what it skipped\n");
+			return EX_USAGE;
+		}
+		bool mapExisted = false;
+		char const *_Nullable mapErrorStr = NULL;
+		rescueMap = rescue_map_open(rescueMapPath, inputSize, &mapExisted, &mapErrorStr);
+		if (rescueMap == NULL) {
+			fprintf(stderr, "dd-parallel: %s: %s\n", rescueMapPath, mapErrorStr);
+			return EX_CANTCREAT;
+		}
+		if (mapExisted) {
+			//An earlier rescue got everything else; only what it couldn't read needs another try.
+			return rescueBadRanges();
+		}
+	}
+
+	copyStartedTime = timeWithFraction();
+	if (progress != NULL) {
+		progress_begin(progress, &totalAmountCopied, copyStartedTime);
+		progress_startReporter(progress, progressIntervalSeconds, reportProgress);
+	}
+
+	int status = EXIT_SUCCESS;
+	bool copied = false;
+
+	struct journal *_Nullable journal = NULL;
+	if (journalPath != NULL) {
+		char const *_Nullable journalErrorStr = NULL;
+		journal = journal_open(journalPath, resumeFromJournal, inputSizeIsKnown ? inputSize : 0, bufferSize, &resumeOffset, &journalErrorStr);
+		if (journal == NULL) {
+			fprintf(stderr, "dd-parallel: %s: %s\n", journalPath, journalErrorStr);
+			return EX_CANTCREAT;
+		}
+		if (resumeOffset > 0) {
+			if (lseek(inputFD, resumeOffset, SEEK_SET) < 0 || lseek(outputs[0].fd, resumeOffset, SEEK_SET) < 0) {
+				fprintf(stderr, "dd-parallel: can't resume, because the input or output can't be seeked\n");
+				journal_close(journal, /*copyFinished*/ false);
+				return EX_USAGE;
+			}
+			char resumePhrase[64];
+			copyByteCountPhrase(resumePhrase, resumeOffset, sizeof(resumePhrase));
+			fprintf(stderr, "dd-parallel: resuming after the first %s\n", resumePhrase);
+		}
+		journal_startCheckpointing(journal, outputs[0].fd, kJournalCheckpointIntervalSeconds, durableOutputLength);
+	}
+	//Likewise, so that a first pass that dies partway doesn't leave everything it read since its last failure to be read again.
+	if (rescueMap != NULL) rescue_map_startSaving(rescueMap, outputs[0].fd, kJournalCheckpointIntervalSeconds, durableOutputLength);
+	//What's left to copy, if we know.
+	unsigned long long const remainingInputSize = inputSize > resumeOffset ? inputSize - resumeOffset : 0;
+	if (sparseMode || diffMode || manifestPath != NULL || rescueMap != NULL) {
+		//Skipping zeros, unchanged blocks, and blocks that can't be read, and hashing blocks for the manifest, happen in the reader and writer threads, so they need that backend.
+		if (numStripedWorkers > 0 || backend == backend_io_uring) {
+			fprintf(stderr, "dd-parallel: %s uses a single reader and writer; ignoring --workers and --backend\n", sparseMode ? "--sparse" : diffMode ? "--diff" : manifestPath != NULL ? "--manifest" : "--rescue");
+		}
+		allowKernelCopy = false;
+		numStripedWorkers = 0;
+		backend = backend_threads;
+		outputIsSeekable = lseek(outputs[0].fd, 0, SEEK_CUR) >= 0;
+		if (! deviceSize(outputs[0].fd, &outputOriginalSize)) outputOriginalSize = ULLONG_MAX;
+		if (diffMode && ! outputIsSeekable) {
+			fprintf(stderr, "dd-parallel: --diff needs an output that can be read back and seeked\n");
+			return EX_USAGE;
+		}
+	}
+	if (adaptiveMode) {
+		//The tuner works by changing how the reader reads, so it needs that backend. (The kernel copies, when they work, have nothing to tune.)
+		if (numStripedWorkers > 0 || backend == backend_io_uring) {
+			fprintf(stderr, "dd-parallel: --adaptive uses a single reader and writer; ignoring --workers and --backend\n");
+		}
+		if (bufferSize != kDefaultBufferSize) {
+			fprintf(stderr, "dd-parallel: --adaptive picks its own block size; ignoring --block-size\n");
+		}
+		numStripedWorkers = 0;
+		backend = backend_threads;
+	}
+	if (limitRate) {
+		//The limiter sits in front of the writer thread's writes. The kernel copies can't be held back at all.
+		if (numStripedWorkers > 0 || backend == backend_io_uring) {
+			fprintf(stderr, "dd-parallel: --max-rate uses a single reader and writer; ignoring --workers and --backend\n");
+		}
+		allowKernelCopy = false;
+		numStripedWorkers = 0;
+		backend = backend_threads;
+		rateLimiter = rate_limiter_create(maxRateBytesPerSecond, automaticMaxRate);
+		if (rateLimiter == NULL) {
+			fprintf(stderr, "dd-parallel: can't limit the rate; copying as fast as possible\n");
+		}
+	}
+	if (compressOutput || decompressInput || blockStorePath != NULL) {
+		//The blocks go from the reader to the compression or block store threads to the writer.
+		if (numStripedWorkers > 0 || backend == backend_io_uring) {
+			char const *_Nonnull const mode = compressOutput ? "--compress" : decompressInput ? "decompressing" : restoreFromStore ? "--from-store" : "--store";
+			fprintf(stderr, "dd-parallel: %s uses a single reader and writer; ignoring --workers and --backend\n", mode);
+		}
+		allowKernelCopy = false;
+		numStripedWorkers = 0;
+		backend = backend_threads;
+		//Leave a couple of cores for the reader and writer. Every thread needs a block to work on, on top of the ones the reader and writer have, or some of them sit idle.
+		long const numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+		numPoolThreads = numCPUs > 3 ? (unsigned int)(numCPUs - 2) : 1;
+		if (pipelineDepth < numPoolThreads + 2) {
+			pipelineDepth = numPoolThreads + 2 < kMaximumPipelineDepth ? numPoolThreads + 2 : kMaximumPipelineDepth;
+		}
+	}
+	if (numOutputs > 1) {
+		//Each output gets a writer thread of its own, all fed by the one reader.
+		if (numStripedWorkers > 0 || backend == backend_io_uring) {
+			fprintf(stderr, "dd-parallel: copying to more than one output uses a single reader and a writer for each output; ignoring --workers and --backend\n");
+		}
+		allowKernelCopy = false;
+		numStripedWorkers = 0;
+		backend = backend_threads;
+	}
+	if (sparseMode || diffMode) {
+		//Preallocating would defeat the point of sparse mode. In diff mode, the output should already be there, and any part that isn't would be compared against the preallocated zeros for nothing.
+	} else if (compressOutput || (blockStorePath != NULL && ! restoreFromStore)) {
+		//There's no telling how big the image will be, and a recipe is tiny.
+	} else if (blockRecipe != NULL) {
+		kernel_preallocate(outputs[0].fd, block_recipe_totalLength(blockRecipe));
+	} else if (decompressInput) {
+		if (imageOriginalLength > 0) kernel_preallocate(outputs[0].fd, imageOriginalLength);
+	} else if (inputSizeIsKnown) {
+		unsigned long long const inputPosition = lseek(inputFD, 0, SEEK_CUR);
+		if (inputPosition < inputSize) {
+			for (unsigned int i = 0; i < numOutputs; ++i) {
+				kernel_preallocate(outputs[i].fd, inputSize - inputPosition);
+			}
+		}
+	}
+	if (directIOAlignment > 0 && remainingInputSize % directIOAlignment != 0) {
+		//copy_file_range on files open for direct I/O fails on the last partial block, with nothing to fall back on for it; our own backends handle it.
+		allowKernelCopy = false;
+	}
+	if (allowKernelCopy && remainingInputSize > 0) {
+		readerState = state_readBegun;
+		outputs[0].state = state_writeBegun;
+		bool unsupported = false;
+		char const *_Nullable methodName = NULL;
+		char const *_Nullable const kernelErrorStr = kernel_copy(inputFD, outputs[0].fd, remainingInputSize, &totalAmountCopied, &methodName, &unsupported);
+		if (unsupported) {
+			readerState = state_beforeFirstRead;
+			outputs[0].state = state_beforeFirstWrite;
+		} else {
+			copied = true;
+			completeOutputLength = totalAmountCopied;
+			readerState = state_endOfFile;
+			outputs[0].state = state_writeFinished;
+			LOG("Kernel copied %llu bytes by %s\n", completeOutputLength, methodName);
+			if (kernelErrorStr != NULL) {
+				fprintf(stderr, "dd-parallel: error during %s: %s\n", methodName ?: "copy", kernelErrorStr);
+				status = EX_IOERR;
+			}
+		}
+	}
+	if (! copied && numStripedWorkers > 0) {
+		readerState = state_readBegun;
+		outputs[0].state = state_writeBegun;
+		bool unsupported = false;
+		writesMayCompleteOutOfOrder = true;
+		char const *_Nullable const stripedErrorStr = striped_copy(inputFD, outputs[0].fd, numStripedWorkers, bufferSize, directIOAlignment, &totalAmountCopied, &completeOutputLength, &unsupported);
+		if (unsupported) {
+			fprintf(stderr, "dd-parallel: --workers needs both files to be seekable; falling back to a single reader and writer\n");
+			writesMayCompleteOutOfOrder = false;
+			readerState = state_beforeFirstRead;
+			outputs[0].state = state_beforeFirstWrite;
+		} else {
+			copied = true;
+			readerState = state_endOfFile;
+			outputs[0].state = state_writeFinished;
+			if (stripedErrorStr != NULL) {
+				fprintf(stderr, "dd-parallel: error during copy: %s\n", stripedErrorStr);
+				status = EX_IOERR;
+			}
+		}
+	}
+	if (! copied && backend != backend_threads) {
+		readerState = state_readBegun;
+		outputs[0].state = state_writeBegun;
+		bool unsupported = false;
+		writesMayCompleteOutOfOrder = true;
+		char const *_Nullable const uringErrorStr = uring_copy(inputFD, outputs[0].fd, pipelineDepth, bufferSize, directIOAlignment, &totalAmountCopied, &completeOutputLength, &unsupported);
+		if (unsupported) {
+			writesMayCompleteOutOfOrder = false;
+			if (backend == backend_io_uring) {
+				fprintf(stderr, "dd-parallel: io_uring is not available for these files on this system; falling back to threads\n");
+			}
+			readerState = state_beforeFirstRead;
+			outputs[0].state = state_beforeFirstWrite;
+		} else {
+			copied = true;
+			readerState = state_endOfFile;
+			outputs[0].state = state_writeFinished;
+			if (uringErrorStr != NULL) {
+				fprintf(stderr, "dd-parallel: error during copy: %s\n", uringErrorStr);
+				status = EX_IOERR;
+			}
+		}
+	}
+	if (! copied) {
+		if (adaptiveMode) {
+			tuner = tuner_create(pipelineDepth, directIOAlignment);
+			if (tuner == NULL) {
+				fprintf(stderr, "dd-parallel: can't tune the block size for these files; using %zu-byte blocks\n", bufferSize);
+			}
+		}
+		status = copyWithThreads();
+		//When compressing, totalAmountCopied counts the data that went into the image, not the image.
+		completeOutputLength = compressOutput || (blockStorePath != NULL && ! restoreFromStore) ? outputs[0].amountWritten : totalAmountCopied;
+	}
+
+	if (journal != NULL) {
+		if (! journal_stopCheckpointing(journal)) {
+			fprintf(stderr, "dd-parallel: could not record progress in the journal; a resumed copy may repeat some work\n");
+		}
+		journal_close(journal, /*copyFinished*/ status == EXIT_SUCCESS);
+	}
+	if (rescueMap != NULL && ! rescue_map_stopSaving(rescueMap)) {
+		fprintf(stderr, "dd-parallel: could not record progress in the rescue map; a resumed rescue may repeat some work\n");
+	}
+
+	fflush(stderr);
+	if (numOutputs == 1) {
+		ftruncate(outputs[0].fd, resumeOffset + completeOutputLength);
+	} else {
+		//Each output only has what its writer got to.
+		for (unsigned int i = 0; i < numOutputs; ++i) {
+			ftruncate(outputs[i].fd, outputs[i].amountWritten);
+		}
+	}
+	if (blockStorePath != NULL && ! restoreFromStore && status == EXIT_SUCCESS && fsync(outputs[0].fd) != 0) {
+		//The blocks are all safely in the store, but a recipe that's lost with the drive's cache can't put them back together.
+		char errorDescription[256];
+		copyErrorDescription(errorDescription, errno, sizeof(errorDescription));
+		fprintf(stderr, "dd-parallel: error writing recipe: %s\n", errorDescription);
+		status = EX_IOERR;
+	}
+	copyFinishedTime = timeWithFraction();
+	//Make sure the reporter isn't in the middle of a report of its own.
+	if (progress != NULL) progress_stopReporter(progress);
+	logProgress(stdout, true);
+	logLatencies(stdout);
+	if (threadsPinned) {
+		char cpusDescription[256];
+		cpu_list_copyDescription(cpusDescription, &threadCPUs, sizeof(cpusDescription));
+		if (threadsNode >= 0) {
+			printf("The reader and writer ran on CPUs %s, on NUMA node %d\n", cpusDescription, threadsNode);
+		} else {
+			printf("The reader and writer ran on CPUs %s\n", cpusDescription);
+		}
+	}
+	if (progressFormat == progressFormat_json) logProgressRecord(progressFile, /*forVerify*/ false, true);
+	if (tuner != NULL) {
+		tuner_printReport(tuner, stdout);
+		tuner_destroy(tuner);
+		tuner = NULL;
+	}
+	if (rateLimiter != NULL) {
+		rate_limiter_printReport(rateLimiter, stdout);
+		rate_limiter_destroy(rateLimiter);
+		rateLimiter = NULL;
+	}
+	if (compression != NULL) {
+		compression_printReport(compression, stdout);
+		compression_destroy(compression);
+		compression = NULL;
+	}
+	if (blockStore != NULL) {
+		block_store_printReport(blockStore, stdout);
+		block_store_destroy(blockStore);
+		blockStore = NULL;
+	}
+	if (blockRecipe != NULL) {
+		block_recipe_destroy(blockRecipe);
+		blockRecipe = NULL;
+	}
+
+	if (rescueMap != NULL) {
+		if (status == EXIT_SUCCESS) {
+			status = rescueBadRanges();
+		} else {
+			//The copy stopped partway. Whatever it didn't get to stays pending, for the next run to pick up.
+			char const *_Nullable mapErrorStr = NULL;
+			if (! rescue_map_save(rescueMap, outputs[0].fd, completeOutputLength, &mapErrorStr)) {
+				fprintf(stderr, "dd-parallel: error writing rescue map: %s\n", mapErrorStr);
+			}
+			rescue_map_destroy(rescueMap);
+			rescueMap = NULL;
+		}
+	}
+
+	if (verifyAfterCopy && status == EXIT_SUCCESS) {
+		for (unsigned int i = 0; i < numOutputs; ++i) {
+			if (numOutputs > 1) printf("Verifying %s\n", outputs[i].path);
+			//The output may be open write-only, so read it back through a descriptor of its own.
+			int const verifyFD = open(outputs[i].path, O_RDONLY);
+			if (verifyFD < 0) {
+				char errorStr[256];
+				copyErrorDescription(errorStr, errno, sizeof(errorStr));
+				fprintf(stderr, "dd-parallel: can't open %s to verify it: %s\n", outputs[i].path, errorStr);
+				if (status == EXIT_SUCCESS) status = EX_IOERR;
+				continue;
+			}
+			int const verifyStatus = verifyOutput(verifyFD);
+			close(verifyFD);
+			if (status == EXIT_SUCCESS) status = verifyStatus;
+		}
+	}
+
+	return status;
+}
+
+static void printUsage(FILE *const file, char const *const argv0) {
+	fprintf(file,
+		"Usage: %s [options] in-file out-file [out-file…]\n"
+		"Options:\n"
+		"  --block-size SIZE    Read and write SIZE bytes at a time, e.g. 128K or 4M (default %zu)\n"
+		"  --depth N            Number of %zu-byte buffers the reader may fill ahead of the writer (default %u)\n"
+		"  --workers K          Copy with K threads, each reading and writing its own %zu-byte extents at once (both files must be seekable)\n"
+		"  --direct             Bypass the page cache (O_DIRECT). The final partial block, if any, still goes through it.\n"
+		"  --sparse             Don't write zeros: skip holes in a sparse input file and all-zero blocks in any input, and leave holes in the output (or punch them, where it had data)\n"
+		"  --diff               Read the output back and only write the blocks that differ from the input\n"
+		"  --manifest FILE      Write an XXH64 digest of every block, and of the whole image, to FILE. Hashing happens on its own pool of threads.\n"
+		"  --manifest-sha256    Also include a SHA-256 of the whole image in the manifest (slower; one thread)\n"
+		"  --journal FILE       Record how much of the output has been written and synced in FILE, every %u seconds, so an interrupted copy can be resumed. FILE is deleted once the copy finishes.\n"
+		"  --resume             Continue the copy recorded in the --journal file, starting after the last part it records as written\n"
+		"  --max-rate RATE      Write no more than RATE bytes per second, e.g. 200M. With auto, write flat out until the rate collapses (as an overheating SSD's does), then back off to a rate the output can keep up, and slowly probe upward. Uses a single reader and writer.\n"
+		"  --compress           Write the output as a compressed image: each block deflated on its own, on a pool of threads, or stored as is if it doesn't compress. Needs zlib.\n"
+		"  --decompress         Insist that the input be a compressed image, and decompress it\n"
+		"  --detect-image       Decompress the input if it's a compressed image, and copy it as it is if not. The input has to be seekable, to be looked at first.\n"
+		"  --raw                Copy the input as it is, even if it's a compressed image (the default)\n"
+		"  --restore-range OFF:LEN  Restore LEN bytes of a compressed image's data, starting at OFF (e.g. 40G:8G), to the same place in out-file, reading only the frames that hold them, with --workers threads (default: one per CPU)\n"
+		"  --store DIR          Put the input's blocks into the block store in DIR, writing only the ones it doesn't already have, and write a recipe for getting them back as out-file\n"
+		"  --from-store DIR     Restore the image whose recipe is in-file from the block store in DIR\n"
+		"  --adaptive           Try block sizes from %zu KiB to %zu MiB, and depths up to --depth, at the start of the copy; keep the fastest, and try its neighbors again every so often. Uses a single reader and writer.\n"
+		"  --rescue MAPFILE     Copy from a failing input: skip whatever can't be read (and more of the area around it), copy everything else at full speed, then go back and try the skipped parts a sector at a time, %u times each. What still can't be read is left as zeros and listed in MAPFILE; run again with the same MAPFILE to retry only that. MAPFILE is deleted once everything has been read.\n"
+		"  --verify             After copying, read back the output (from the device, not the cache) and compare it against the input, listing any ranges that differ. The input must be seekable.\n"
+		"  --compare-only       Don't copy anything; just compare the output against the input, as --verify does\n"
+		"  --progress-interval SECONDS  Report progress every SECONDS seconds, as well as on SIGINFO (SIGUSR1 on Linux)\n"
+		"  --progress-fd N      Write progress reports to file descriptor N instead of standard output, every second unless --progress-interval says otherwise\n"
+		"  --progress-format F  text (the default) or json: one JSON object per line, with bytes done, total, rates, ETA, and the state of the reader and writer\n"
+		"  --no-kernel-copy     Always copy through our own buffers, even when the kernel could copy between two regular files by itself (reflink or copy_file_range)\n"
+		"  --mmap               If the input is a regular file, map it and write straight from the mapping, rather than reading it into the reader's buffers\n"
+		"  --backend NAME       auto (the default), threads, or io_uring (Linux only). auto uses io_uring when the kernel supports it and both files are seekable.\n"
+		"  --cpu LIST           Run the reader and writer threads on the CPUs in LIST (e.g. 0-7,16-23), and take their buffers from those CPUs' NUMA node. auto (the default) picks the CPUs of the node the input's device is attached to, on a machine with more than one node (Linux only); none leaves it to the system.\n",
+		argv0 ?: "dd-parallel",
+		kDefaultBufferSize,
+		kDefaultBufferSize, kDefaultPipelineDepth,
+		kDefaultBufferSize,
+		kJournalCheckpointIntervalSeconds,
+		(size_t)kTunerMinimumBlockSize / 1024, (size_t)kTunerMaximumBlockSize / (1024 * 1024),
+		(unsigned int)kRescueMaxAttempts);
+}
+
+///Parses a byte count, optionally with a binary-unit suffix: 4096, 128K, 4M, 1G. Returns false if there's anything else in the string.
+static bool parseSize(char const *_Nonnull const arg, unsigned long long *_Nonnull const outSize) {
+	char *end = NULL;
+	unsigned long long const number = strtoull(arg, &end, 10);
+	if (end == arg) return false;
+	unsigned int shift = 0;
+	switch (*end) {
+		case 'g':
+		case 'G':
+			shift = 30;
+			break;
+		case 'm':
+		case 'M':
+			shift = 20;
+			break;
+		case 'k':
+		case 'K':
+			shift = 10;
+			break;
+		case '\0':
+			break;
+		default:
+			return false;
+	}
+	if (shift > 0) ++end;
+	if (*end != '\0' || number > (ULLONG_MAX >> shift)) return false;
+	*outSize = number << shift;
+	return true;
+}
+
+///For the journal and the rescue map: how much of the output, from its very start, has been written without gaps.
+static unsigned long long durableOutputLength(void) {
+	return resumeOffset + (writesMayCompleteOutOfOrder ? completeOutputLength : totalAmountCopied);
+}
+
+///Reads the input and destinationFD back from the start and compares them, listing any ranges that differ. Returns an exit status: EX_DATAERR if anything differed.
+static int verifyOutput(int const destinationFD) {
+	size_t alignment = 0;
+#if EXISTS_O_DIRECT
+	if (directIOAlignment > 0) {
+		//The reader may have turned direct I/O off on the input to read the last partial block.
+		if (setDirectIO(inputFD, true) && setDirectIO(destinationFD, true)) {
+			alignment = directIOAlignment;
+		} else {
+			setDirectIO(inputFD, false);
+			setDirectIO(destinationFD, false);
+		}
+	}
+#endif
+
+	verifyStartedTime = timeWithFraction();
+	totalAmountVerified = 0;
+	verifying = true;
+	if (progress != NULL) {
+		progress_begin(progress, &totalAmountVerified, verifyStartedTime);
+		progress_startReporter(progress, progressIntervalSeconds, reportProgress);
+	}
+	struct verify_result result;
+	char const *_Nullable const verifyErrorStr = verify_compare(inputFD, destinationFD, ULLONG_MAX, pipelineDepth, bufferSize, alignment, stdout, &totalAmountVerified, &result);
+	verifyFinishedTime = timeWithFraction();
+	if (progress != NULL) progress_stopReporter(progress);
+	verifying = false;
+	logVerifyProgress(stdout, true);
+	if (progressFormat == progressFormat_json) logProgressRecord(progressFile, /*forVerify*/ true, true);
+
+	if (verifyErrorStr != NULL) {
+		fprintf(stderr, "dd-parallel: error during verify: %s\n", verifyErrorStr);
+		return EX_IOERR;
+	}
+	if (result.numMismatchedRanges == 0) {
+		printf("No differences found\n");
+		return EXIT_SUCCESS;
+	}
+	char phrase[256];
+	copyByteCountPhrase(phrase, result.amountMismatched, sizeof(phrase));
+	printf("Found %llu %s, in which %s %s\n", result.numMismatchedRanges, result.numMismatchedRanges == 1 ? "range that differs" : "ranges that differ", phrase, result.amountMismatched == 1 ? "differs" : "differ");
+	return EX_DATAERR;
+}
+
+///Restores the range of the original data that --restore-range asked for from the image on inputFD to the output. Returns an exit status.
+static int restoreImageRange(char const *_Nonnull const imagePath) {
+	unsigned long long imageSize = 0;
+	char const *_Nullable indexErrorStr = "can't tell how big it is";
+	struct image_index *_Nullable const index = deviceSize(inputFD, &imageSize) ? image_index_open(inputFD, imageSize, &indexErrorStr) : NULL;
+	if (index == NULL) {
+		fprintf(stderr, "dd-parallel: can't restore part of %s: %s\n", imagePath, indexErrorStr);
+		return EX_DATAERR;
+	}
+	unsigned long long const totalLength = image_index_totalLength(index);
+	if (restoreOffset > totalLength || restoreLength > totalLength - restoreOffset) {
+		char phrase[64];
+		copyByteCountPhrase(phrase, totalLength, sizeof(phrase));
+		fprintf(stderr, "dd-parallel: %s only holds %s (%llu bytes) of data\n", imagePath, phrase, totalLength);
+		image_index_destroy(index);
+		return EX_USAGE;
+	}
+	long const numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int const numWorkers = numStripedWorkers > 0 ? numStripedWorkers : numCPUs > 1 ? (unsigned int)numCPUs : 1;
+	//Progress counts from the start of the range.
+	progressTotalBytes = restoreLength;
+
+	copyStartedTime = timeWithFraction();
+	if (progress != NULL) {
+		progress_begin(progress, &totalAmountCopied, copyStartedTime);
+		progress_startReporter(progress, progressIntervalSeconds, reportProgress);
+	}
+	readerState = state_readBegun;
+	outputs[0].state = state_writeBegun;
+	char const *_Nullable const restoreErrorStr = image_restoreRange(inputFD, index, outputs[0].fd, restoreOffset, restoreLength, numWorkers, &totalAmountCopied);
+	readerState = state_endOfFile;
+	outputs[0].state = restoreErrorStr != NULL ? state_writeFailed : state_writeFinished;
+	copyFinishedTime = timeWithFraction();
+	if (progress != NULL) progress_stopReporter(progress);
+	image_index_destroy(index);
+
+	if (restoreErrorStr != NULL) fprintf(stderr, "dd-parallel: error during restore: %s\n", restoreErrorStr);
+	logProgress(stdout, true);
+	if (progressFormat == progressFormat_json) logProgressRecord(progressFile, /*forVerify*/ false, true);
+	return restoreErrorStr != NULL ? EX_IOERR : EXIT_SUCCESS;
+}
+
+///The second pass of --rescue: reads everything in the map again, more carefully, and puts whatever it can read into the output. Returns an exit status: EX_IOERR if any of it still can't be read.
+static int rescueBadRanges(void) {
+	//The first pass's report, if any, should come out before this one's.
+	fflush(stdout);
+	int status = EXIT_SUCCESS;
+	//If this follows a first pass, that pass is done.
+	char const *_Nullable mapErrorStr = NULL;
+	if (! rescue_map_save(rescueMap, outputs[0].fd, rescue_map_inputSize(rescueMap), &mapErrorStr)) {
+		fprintf(stderr, "dd-parallel: error writing rescue map: %s\n", mapErrorStr);
+		status = EX_IOERR;
+	}
+	unsigned long long const amountToRetry = rescue_map_amountBad(rescueMap);
+	if (status == EXIT_SUCCESS && amountToRetry > 0) {
+		char phrase[256];
+		copyByteCountPhrase(phrase, amountToRetry, sizeof(phrase));
+		fprintf(stderr, "dd-parallel: retrying %s in %llu %s that couldn't be read\n", phrase, rescue_map_numBadRanges(rescueMap), rescue_map_numBadRanges(rescueMap) == 1 ? "range" : "ranges");
+		//Retries should go to the device, not be answered from the cache. The output gets written a sector at a time, which may not line up with its blocks.
+		size_t alignment = 0;
+#if EXISTS_O_DIRECT
+		if (directIOAlignment > 0 && setDirectIO(inputFD, true)) alignment = directIOAlignment;
+		setDirectIO(outputs[0].fd, false);
+#endif
+		size_t const logicalSectorSize = deviceLogicalBlockSize(inputFD);
+		size_t const sectorSize = logicalSectorSize > 0 && logicalSectorSize <= bufferSize ? logicalSectorSize : 512;
+		unsigned long long _Atomic amountRecovered = 0;
+		char const *_Nullable const retryErrorStr = rescue_map_retry(rescueMap, inputFD, outputs[0].fd, bufferSize, sectorSize, alignment, kRescueMaxAttempts, &amountRecovered);
+		if (retryErrorStr != NULL) {
+			fprintf(stderr, "dd-parallel: error while retrying: %s\n", retryErrorStr);
+			status = EX_IOERR;
+		}
+		copyByteCountPhrase(phrase, amountRecovered, sizeof(phrase));
+		printf("Recovered %s on the second pass\n", phrase);
+	}
+	rescue_map_printReport(rescueMap, stdout);
+	if (rescue_map_numBadRanges(rescueMap) > 0) {
+		if (status == EXIT_SUCCESS) status = EX_IOERR;
+	} else if (status == EXIT_SUCCESS) {
+		rescue_map_remove(rescueMap);
+	}
+	rescue_map_destroy(rescueMap);
+	rescueMap = NULL;
+	return status;
+}
+
+///The portable backend: one thread reading into the ring and another writing out of it. Returns an exit status.
+static int copyWithThreads(void) {
+	size_t const pageSize = sysconf(_SC_PAGESIZE);
+	size_t const bufferAlignment = directIOAlignment > pageSize ? directIOAlignment : pageSize;
+	//When decompressing, each slot holds a whole frame: a header and up to a block of data.
+	size_t const blockBufferSize = tuner != NULL ? kTunerMaximumBlockSize : decompressInput ? bufferSize + kCompressionFrameHeaderSize : bufferSize;
+	//Direct I/O is for staying out of the page cache, which is where a mapping's data is. An image's frames and a recipe's digests don't get passed along as they are, and the block store's threads and a rescue's retries want buffers they can fill.
+	if (mapInput && directIOAlignment == 0 && ! decompressInput && blockStorePath == NULL && rescueMap == NULL) {
+		//If the input isn't a regular file, or can't be mapped (e.g., it's too big for a 32-bit address space), it gets read as usual.
+		mappedInput = mapped_input_create(inputFD, lseek(inputFD, 0, SEEK_CUR));
+	}
+	//The reader doesn't need any buffers of its own when the data is already in memory.
+	size_t const ringBufferSize = mappedInput != NULL ? 0 : blockBufferSize;
+	pthread_mutex_lock(&ringLifetimeLock);
+	ring = ring_createOnCPUs(pipelineDepth, ringBufferSize, bufferAlignment, pinThreads ? &threadCPUs : NULL);
+	pthread_mutex_unlock(&ringLifetimeLock);
+	if (ring == NULL) {
+		if (mappedInput != NULL) {
+			mapped_input_destroy(mappedInput);
+			mappedInput = NULL;
+		}
+		return EX_OSERR;
+	}
+	ring_setNumConsumers(ring, numOutputs);
+	ring_setWaitHistograms(ring, &readerWaits, &outputs[0].waits);
+	for (unsigned int i = 1; i < numOutputs; ++i) {
+		ring_setConsumerWaitHistogram(ring, i, &outputs[i].waits);
+	}
+	numOutputsWriting = numOutputs;
+	int setupFailureStatus = EX_OSERR;
+	if (sparseMode || rescueMap != NULL) {
+		//For when we have to write zeros after all.
+		if (posix_memalign(&zeroBuffer, bufferAlignment, blockBufferSize) != 0) goto setupFailed;
+		memset(zeroBuffer, 0, blockBufferSize);
+	}
+	if (diffMode) {
+		if (posix_memalign(&compareBuffer, bufferAlignment, blockBufferSize) != 0) goto setupFailed;
+	}
+	if (manifestPath != NULL) {
+		//Leave a couple of cores for the reader and writer, and there's no point in more threads than blocks that can be in flight.
+		long const numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+		unsigned int numHashThreads = numCPUs > 3 ? (unsigned int)(numCPUs - 2) : 1;
+		if (numHashThreads > pipelineDepth) numHashThreads = pipelineDepth;
+		char const *_Nullable manifestErrorStr = NULL;
+		manifest = manifest_create(manifestPath, numHashThreads, pipelineDepth, manifestIncludesSHA256, resumeOffset, &manifestErrorStr);
+		if (manifest == NULL) {
+			fprintf(stderr, "dd-parallel: %s: %s\n", manifestPath, manifestErrorStr);
+			setupFailureStatus = EX_CANTCREAT;
+			goto setupFailed;
+		}
+	}
+	if (compressOutput || decompressInput) {
+		char const *_Nullable compressionErrorStr = NULL;
+		compression = compression_create(decompressInput, numPoolThreads, pipelineDepth, bufferSize, &compressionErrorStr);
+		if (compression == NULL) {
+			fprintf(stderr, "dd-parallel: %s\n", compressionErrorStr);
+			goto setupFailed;
+		}
+	}
+	if (blockStorePath != NULL) {
+		char const *_Nullable storeErrorStr = NULL;
+		blockStore = block_store_create(blockStorePath, restoreFromStore, numPoolThreads, pipelineDepth, &storeErrorStr);
+		if (blockStore == NULL) {
+			fprintf(stderr, "dd-parallel: %s: %s\n", blockStorePath, storeErrorStr);
+			setupFailureStatus = restoreFromStore ? EX_NOINPUT : EX_CANTCREAT;
+			goto setupFailed;
+		}
+	}
+	if (blockStorePath != NULL && ! restoreFromStore) {
+		unsigned char recipeHeader[kBlockRecipeHeaderSize];
+		block_recipe_makeHeader(recipeHeader, bufferSize);
+		if (! writeFully(&outputs[0], recipeHeader, sizeof(recipeHeader))) {
+			copyErrorDescription(outputs[0].errorBuffer, errno, writeErrorCapacity);
+			fprintf(stderr, "dd-parallel: error during write: %s\n", outputs[0].errorBuffer);
+			setupFailureStatus = EX_IOERR;
+			goto setupFailed;
+		}
+	}
+	if (compressOutput) {
+		imageIndex = image_index_create(bufferSize);
+		if (imageIndex == NULL) {
+			fprintf(stderr, "dd-parallel: can't keep an index of the image; it will only be readable from start to end\n");
+		}
+		unsigned char imageHeader[kCompressionImageHeaderSize];
+		compression_makeImageHeader(imageHeader, bufferSize);
+		if (! writeFully(&outputs[0], imageHeader, sizeof(imageHeader))) {
+			copyErrorDescription(outputs[0].errorBuffer, errno, writeErrorCapacity);
+			fprintf(stderr, "dd-parallel: error during write: %s\n", outputs[0].errorBuffer);
+			setupFailureStatus = EX_IOERR;
+			goto setupFailed;
+		}
+	}
+
+	pthread_t read_thread, write_threads[kMaximumOutputs];
+	pthread_create(&read_thread, /*attr*/ NULL, read_thread_main, /*user data*/ NULL);
+	for (unsigned int i = 0; i < numOutputs; ++i) {
+		pthread_create(&write_threads[i], /*attr*/ NULL, write_thread_main, /*user data*/ &outputs[i]);
+	}
+	if (pinThreads) {
+		threadsPinned = placement_pinThread(read_thread, &threadCPUs);
+		for (unsigned int i = 0; i < numOutputs; ++i) {
+			threadsPinned = placement_pinThread(write_threads[i], &threadCPUs) && threadsPinned;
+		}
+		if (! threadsPinned && cpuPlacement == cpuPlacement_list) {
+			fprintf(stderr, "dd-parallel: can't keep the reader and writer on the CPUs given to --cpu; they'll run wherever the system puts them\n");
+		}
+	}
+
 	int status = EXIT_SUCCESS;
 
 	void *_Nullable retval;
@@ -140,168 +1336,573 @@ int main(int argc, const char * argv[]) {
 		fprintf(stderr, "dd-parallel: error during read: %s\n", readErrorStr);
 		status = EX_NOINPUT;
 	}
-	pthread_join(write_thread, &retval);
-	if (retval != NULL) {
-		char const *_Nonnull const writeErrorStr = retval;
-		fprintf(stderr, "dd-parallel: error during write: %s\n", writeErrorStr);
-		if (status == EXIT_SUCCESS) status = EX_IOERR;
+	for (unsigned int i = 0; i < numOutputs; ++i) {
+		pthread_join(write_threads[i], &retval);
+		if (retval != NULL && outputs[i].inputFailed) {
+			//The reader would have reported this one, if it had come up while the data was being read.
+			if (status != EX_NOINPUT) fprintf(stderr, "dd-parallel: error during read: %s\n", (char const *)retval);
+			status = EX_NOINPUT;
+		} else if (retval != NULL) {
+			char const *_Nonnull const writeErrorStr = retval;
+			if (numOutputs > 1) {
+				fprintf(stderr, "dd-parallel: error during write to %s: %s\n", outputs[i].path, writeErrorStr);
+			} else {
+				fprintf(stderr, "dd-parallel: error during write: %s\n", writeErrorStr);
+			}
+			if (status == EXIT_SUCCESS) status = EX_IOERR;
+		}
 	}
-	free(buffer1);
-	free(buffer0);
-
-	fflush(stderr);
-	ftruncate(outputFD, totalAmountCopied);
-	copyFinishedTime = timeWithFraction();
-	logProgress(true);
+	if (manifest != NULL) {
+		//This has to happen before the ring goes away, because the hashing threads may still be looking at its buffers.
+		char const *_Nullable const manifestErrorStr = manifest_close(manifest, status == EXIT_SUCCESS);
+		manifest = NULL;
+		if (manifestErrorStr != NULL) {
+			fprintf(stderr, "dd-parallel: error writing manifest: %s\n", manifestErrorStr);
+			if (status == EXIT_SUCCESS) status = EX_IOERR;
+		}
+	}
+	//Same for the compression threads, if the writer gave up on blocks they were still working on. (The report comes after the rest of the summary.)
+	if (compression != NULL) compression_stop(compression);
+	if (blockStore != NULL) block_store_stop(blockStore);
+	if (imageIndex != NULL) {
+		image_index_destroy(imageIndex);
+		imageIndex = NULL;
+	}
+	pthread_mutex_lock(&ringLifetimeLock);
+	ring_destroy(ring);
+	ring = NULL;
+	pthread_mutex_unlock(&ringLifetimeLock);
+	if (mappedInput != NULL) {
+		mapped_input_destroy(mappedInput);
+		mappedInput = NULL;
+	}
+	free(zeroBuffer);
+	zeroBuffer = NULL;
+	free(compareBuffer);
+	compareBuffer = NULL;
 
 	return status;
+
+setupFailed:
+	if (compression != NULL) {
+		compression_destroy(compression);
+		compression = NULL;
+	}
+	if (blockStore != NULL) {
+		block_store_destroy(blockStore);
+		blockStore = NULL;
+	}
+	if (imageIndex != NULL) {
+		image_index_destroy(imageIndex);
+		imageIndex = NULL;
+	}
+	pthread_mutex_lock(&ringLifetimeLock);
+	ring_destroy(ring);
+	ring = NULL;
+	pthread_mutex_unlock(&ringLifetimeLock);
+	if (mappedInput != NULL) {
+		mapped_input_destroy(mappedInput);
+		mappedInput = NULL;
+	}
+	free(zeroBuffer);
+	zeroBuffer = NULL;
+	free(compareBuffer);
+	compareBuffer = NULL;
+	return setupFailureStatus;
+}
+
+///Reads until length bytes have been read or the input ends. Returns how many bytes were read (fewer than length only at the end of the input), or -1, with errno set, if a read fails.
+static ssize_t readFully(int const fd, void *_Nonnull const buffer, size_t const length) {
+	size_t offset = 0;
+	while (offset < length) {
+		ssize_t const amtRead = read(fd, buffer + offset, length - offset);
+		if (amtRead < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (amtRead == 0) break;
+		offset += amtRead;
+	}
+	return offset;
+}
+
+///For decompressing: reads the image's next frame into the slot and hands it to the decompression threads. Returns 1 if it did, 0 if that was the end frame, or -1 if the image couldn't be read or is damaged, with readErrorBuffer describing the problem. *inOutOriginalLength is how much data the frames so far stand for, to check against the end frame.
+static int readImageFrame(struct ring_slot *_Nonnull const slot, unsigned long long *_Nonnull const inOutOriginalLength) {
+	unsigned char *_Nonnull const frame = slot->buffer;
+	size_t storedLength = 0, originalLength = 0;
+	bool isEnd = false;
+	unsigned long long const readStartedTime = latency_now();
+	ssize_t amountRead = readFully(inputFD, frame, kCompressionFrameHeaderSize);
+	bool const headerIsValid = amountRead == kCompressionFrameHeaderSize && compression_parseFrameHeader(frame, bufferSize, &storedLength, &originalLength, &isEnd);
+	if (headerIsValid) amountRead = readFully(inputFD, frame + kCompressionFrameHeaderSize, storedLength);
+	latency_recordSince(&readLatencies, readStartedTime);
+	if (amountRead < 0) {
+		copyErrorDescription(readErrorBuffer, errno, readErrorCapacity);
+		return -1;
+	}
+	if (! headerIsValid && amountRead == kCompressionFrameHeaderSize) {
+		strlcpy(readErrorBuffer, "the compressed image is damaged (a frame header doesn't make sense)", readErrorCapacity);
+		return -1;
+	}
+	if (! headerIsValid || (size_t)amountRead < storedLength) {
+		strlcpy(readErrorBuffer, "the compressed image ends before its end frame; it was cut short", readErrorCapacity);
+		return -1;
+	}
+
+	if (isEnd) {
+		if (compression_endFrameTotalLength(frame + kCompressionFrameHeaderSize) != *inOutOriginalLength) {
+			strlcpy(readErrorBuffer, "the compressed image is damaged (its frames don't add up to the length its end frame says)", readErrorCapacity);
+			return -1;
+		}
+		return 0;
+	}
+	*inOutOriginalLength += originalLength;
+	slot->length = kCompressionFrameHeaderSize + storedLength;
+	compression_submitBlock(compression, frame, slot->length);
+	return 1;
+}
+
+///For restoring from a block store: sets the slot up for the recipe's next block and hands it to the block store threads, which read the block into it. Returns false if that was the last block.
+static bool readRecipeBlock(struct ring_slot *_Nonnull const slot) {
+	if (nextRecipeBlock >= block_recipe_numBlocks(blockRecipe)) return false;
+	unsigned long long const blockStart = nextRecipeBlock * bufferSize;
+	unsigned long long const remainingLength = block_recipe_totalLength(blockRecipe) - blockStart;
+	slot->length = remainingLength < bufferSize ? remainingLength : bufferSize;
+	block_store_submitBlock(blockStore, slot->buffer, slot->length, block_recipe_digest(blockRecipe, nextRecipeBlock));
+	++nextRecipeBlock;
+	return true;
 }
 
 static void *read_thread_main(void *restrict arg) {
 	pthread_setname_self("Reader thread");
 	if (readerState != state_beforeFirstRead) return "Reader starting in bad state";
 
-	if (pthread_mutex_lock(&initializationLock) == EDEADLK) return "Reader deadlocked on init lock";
+	//In sparse mode, if the input is a regular file, we ask the file-system where its data is and pass the holes along without reading them.
+#ifdef SEEK_DATA
+	bool walkInputExtents = sparseMode && isRegularFile(inputFD);
+#else
+	bool walkInputExtents = false;
+#endif
+	off_t inputPosition = lseek(inputFD, 0, SEEK_CUR);
+	off_t dataExtentEnd = 0;
+	//When decompressing, how much data the frames so far stand for.
+	unsigned long long imageLengthSoFar = 0;
+	//When rescuing, how many reads in a row have failed.
+	unsigned int numConsecutiveReadFailures = 0;
 
-	copyStartedTime = timeWithFraction();
-	pthread_rwlock_rdlock(&buffer0Lock);
-	LOG("R[C=%d] Beginning first read\n", 0);
-	readerState = state_readBegun;
-	ssize_t readResult = read(inputFD, buffer0, kBufferSize);
-	if (readResult >= 0) {
-		buffer0Len = readResult;
-		mostRecentlyReadBuffer = 0;
-		++readGeneration0;
-		readerState = state_readFinished;
-	} else {
-		readerState = state_readFailed;
-	}
-	LOG("R[C=%d, RG=%lu] Finished reading %ld bytes, creating read generation #%lu\n", 0, readGeneration0, readResult, readGeneration0);
-	pthread_rwlock_unlock(&buffer0Lock);
-	readerHasInitialized = true;
-	pthread_mutex_unlock(&initializationLock);
-
-	void *_Nonnull buffers[2] = { buffer0, buffer1 };
-	size_t _Atomic *lengths[2] = { &buffer0Len, &buffer1Len };
-	bool _Atomic *dirtyBits[2] = { &buffer0Dirty, &buffer1Dirty };
-	unsigned long _Atomic *readGenerations[2] = { &readGeneration0, &readGeneration1 };
-	unsigned long _Atomic *writeGenerations[2] = { &writeGeneration0, &writeGeneration1 };
-	pthread_rwlock_t *locks[2] = { &buffer0Lock, &buffer1Lock };
-	int nextBufferIdx = !mostRecentlyReadBuffer;
-
-	while (readResult > 0) {
-		LOG("R[C=%d] Waiting to read into buffer…\n", nextBufferIdx);
-		pthread_rwlock_rdlock(locks[nextBufferIdx]);
-		LOG("R[C=%d] Got read lock!\n", nextBufferIdx);
-		unsigned long const curReadGen = *readGenerations[nextBufferIdx];
-		unsigned long const curWriteGen = *writeGenerations[nextBufferIdx];
-		LOG("R[C=%d, RG=%lu, WG=%lu] Reader generation check\n", nextBufferIdx, curReadGen, curWriteGen);
-		if (curReadGen == curWriteGen + 1) {
-			//The write of our last read hasn't finished yet. Hold off.
-			LOG("Write generation has not advanced. Reader coming around again for another pass...\n");
-			pthread_rwlock_unlock(locks[nextBufferIdx]);
-			sleep(0);
-			continue;
+	while (true) {
+		LOG("R[RG=%lu, WG=%lu] Waiting for an empty buffer…\n", ring_readGeneration(ring), ring_writeGeneration(ring));
+		struct ring_slot *_Nullable const slot = ring_acquireEmptySlot(ring);
+		if (slot == NULL) {
+			//The writers have given up, so there's no point reading any further.
+			LOG("R Ring was cancelled; reader stopping\n");
+			break;
 		}
-		LOG("R[C=%d] Reading into buffer\n", nextBufferIdx);
+		slot->isHole = false;
+		slot->isUnread = false;
+		slot->externalData = NULL;
 
 		readerState = state_readBegun;
-		*dirtyBits[nextBufferIdx] = true;
-		readResult = read(inputFD, buffers[nextBufferIdx], kBufferSize);
-		if (readResult >= 0) {
-			*lengths[nextBufferIdx] = readResult;
-			++*(readGenerations[nextBufferIdx]);
-			mostRecentlyReadBuffer = nextBufferIdx;
+		if (decompressInput) {
+			int const frameResult = readImageFrame(slot, &imageLengthSoFar);
+			if (frameResult < 0) {
+				readerState = state_readFailed;
+				break;
+			} else if (frameResult == 0) {
+				LOG("R[RG=%lu] Read loop reached the image's end frame\n", ring_readGeneration(ring));
+				readerState = state_endOfFile;
+				break;
+			}
+			ring_publishFilledSlot(ring);
+			readerState = state_readFinished;
+			continue;
+		}
+		if (blockRecipe != NULL) {
+			if (! readRecipeBlock(slot)) {
+				LOG("R[RG=%lu] Read loop reached the end of the recipe\n", ring_readGeneration(ring));
+				readerState = state_endOfFile;
+				break;
+			}
+			ring_publishFilledSlot(ring);
 			readerState = state_readFinished;
+			continue;
+		}
+		size_t amountToRead = mappedInput != NULL ? bufferSize : ring_bufferSize(ring);
+#ifdef SEEK_DATA
+		if (walkInputExtents && inputPosition >= dataExtentEnd) {
+			off_t dataStart = lseek(inputFD, inputPosition, SEEK_DATA);
+			if (dataStart < 0 && errno == ENXIO) {
+				//There's no more data, so the rest of the file is a hole.
+				struct stat sb;
+				dataStart = fstat(inputFD, &sb) == 0 && sb.st_size > inputPosition ? sb.st_size : inputPosition;
+			}
+			if (dataStart < 0) {
+				//This file-system can't tell us. Just read everything.
+				walkInputExtents = false;
+			} else if (dataStart > inputPosition) {
+				//Holes can be enormous, so a slot only stands for up to 1 GiB of one, so its length fits in a size_t even on 32-bit systems.
+				enum { kMaximumHoleSlotLength = 1 << 30 };
+				unsigned long long const holeLength = dataStart - inputPosition;
+				slot->length = holeLength < kMaximumHoleSlotLength ? holeLength : kMaximumHoleSlotLength;
+				slot->isHole = true;
+				inputPosition += slot->length;
+				lseek(inputFD, inputPosition, SEEK_SET);
+				if (manifest != NULL) manifest_submitBlock(manifest, NULL, slot->length);
+				ring_publishFilledSlot(ring);
+				readerState = state_readFinished;
+				LOG("R[RG=%lu] Skipped a hole of %zu bytes\n", ring_readGeneration(ring), slot->length);
+				continue;
+			} else {
+				off_t const dataEnd = lseek(inputFD, dataStart, SEEK_HOLE);
+				//If there's no hole after this data, then we're at the end of the file, and just reading will find that out.
+				if (dataEnd > inputPosition) dataExtentEnd = dataEnd;
+				else walkInputExtents = false;
+			}
+			lseek(inputFD, inputPosition, SEEK_SET);
+		}
+#endif
+		if (tuner != NULL) {
+			struct tuner_setting const setting = tuner_settingForNextBlock(tuner);
+			amountToRead = setting.blockSize;
+			ring_setDepthLimit(ring, setting.depth);
+		}
+#ifdef SEEK_DATA
+		if (walkInputExtents && dataExtentEnd - inputPosition < amountToRead) {
+			amountToRead = dataExtentEnd - inputPosition;
+			if (directIOAlignment > 0) {
+				//Direct I/O can only read whole blocks. The data extent will end at the end of a block unless it's the end of the file, where the read will come up short on its own.
+				amountToRead = (amountToRead + directIOAlignment - 1) / directIOAlignment * directIOAlignment;
+			}
+		}
+#endif
+		ssize_t readResult;
+		if (mappedInput != NULL) {
+			size_t mappedLength = amountToRead;
+			slot->externalData = mapped_input_bytes(mappedInput, inputPosition, &mappedLength);
+			readResult = slot->externalData != NULL ? (ssize_t)mappedLength : 0;
+			//Faulting the block in is this backend's read: it's where the time goes if the kernel hasn't read it ahead, and where a read error turns up.
+			unsigned long long const readStartedTime = latency_now();
+			if (readResult > 0 && ! mapped_input_fault(mappedInput, slot->externalData, mappedLength)) readResult = -1;
+			latency_recordSince(&readLatencies, readStartedTime);
 		} else {
-			LOG("R[C=%d] Read failure\n", nextBufferIdx);
-			strerror_r(errno, readErrorBuffer, readErrorMaxLength);
-			readerState = state_readFailed;
+			unsigned long long const readStartedTime = latency_now();
+			//Every frame of an image, or block of a recipe, but the last has to be a whole block, so the data can be found by its offset. A pipe can hand over less than that at a time.
+			readResult = compressOutput || blockStore != NULL ? readFully(inputFD, slot->buffer, amountToRead) : read(inputFD, slot->buffer, amountToRead);
+			latency_recordSince(&readLatencies, readStartedTime);
 		}
-		LOG("R[C=%d, RG=%lu] Finished reading %ld bytes. Read generation increases: %lu → %lu\n", nextBufferIdx, *readGenerations[nextBufferIdx], readResult, curReadGen, *readGenerations[nextBufferIdx]);
-		if (readResult == 0) {
-			readerState = state_endOfFile;
-			LOG("R[C=%d, RG=%lu] Read loop reached end of input file\n", nextBufferIdx, *readGenerations[nextBufferIdx]);
+		if (readResult < 0 && rescueMap != NULL && (unsigned long long)inputPosition < rescue_map_inputSize(rescueMap)) {
+			//Rather than give up, pass along zeros in place of this block and some of what follows it, and come back for them once everything else is safe. Bad areas on a disk tend to go on for a while, and each failed read can take seconds, so every failure in a row skips further.
+			unsigned int const numDoublings = numConsecutiveReadFailures < kRescueMaxSkipDoublings ? numConsecutiveReadFailures : kRescueMaxSkipDoublings;
+			unsigned long long skipLength = (unsigned long long)amountToRead << numDoublings;
+			unsigned long long const remainingInputLength = rescue_map_inputSize(rescueMap) - inputPosition;
+			if (skipLength > remainingInputLength) skipLength = remainingInputLength;
+			//As for a hole, so its length fits in a size_t.
+			if (skipLength > (1 << 30)) skipLength = 1 << 30;
+			++numConsecutiveReadFailures;
+			LOG("R[RG=%lu] Read failure; skipping %llu bytes\n", ring_readGeneration(ring), skipLength);
+			//Saving the map means syncing the output, which would hold up the reader at every bad area. The saving thread writes it out soon enough, and the map is saved once more when the pass ends.
+			if (! rescue_map_addBadRange(rescueMap, inputPosition, skipLength)) {
+				strlcpy(readErrorBuffer, "ran out of memory for the rescue map", readErrorCapacity);
+				readerState = state_readFailed;
+				break;
+			}
+			slot->length = (size_t)skipLength;
+			slot->isHole = true;
+			slot->isUnread = true;
+			inputPosition += skipLength;
+			lseek(inputFD, inputPosition, SEEK_SET);
+			ring_publishFilledSlot(ring);
+			readerState = state_readFinished;
+			continue;
 		}
-		pthread_rwlock_unlock(locks[nextBufferIdx]);
-		if (readResult == 0) {
+		numConsecutiveReadFailures = 0;
+		if (readResult < 0) {
+			LOG("R[RG=%lu] Read failure\n", ring_readGeneration(ring));
+			copyErrorDescription(readErrorBuffer, errno, readErrorCapacity);
+			readerState = state_readFailed;
+			break;
+		} else if (readResult == 0) {
+			LOG("R[RG=%lu] Read loop reached end of input file\n", ring_readGeneration(ring));
+			readerState = state_endOfFile;
 			break;
 		}
+		inputPosition += readResult;
 
-		nextBufferIdx = !mostRecentlyReadBuffer;
+		if (directIOAlignment > 0 && readResult % directIOAlignment != 0) {
+			//With direct I/O, a read only comes up short at the end of the file. The next read would start from an unaligned position, so turn direct I/O off for it (it should just hit EOF).
+			setDirectIO(inputFD, false);
+		}
+
+		slot->length = readResult;
+		if (manifest != NULL) manifest_submitBlock(manifest, ring_slotData(slot), slot->length);
+		if (compression != NULL) compression_submitBlock(compression, ring_slotData(slot), slot->length);
+		if (blockStore != NULL) block_store_submitBlock(blockStore, slot->buffer, slot->length, /*digest*/ NULL);
+		ring_publishFilledSlot(ring);
+		readerState = state_readFinished;
+		LOG("R[RG=%lu] Finished reading %ld bytes\n", ring_readGeneration(ring), readResult);
 	}
-	LOG("R[RG0=%lu, RG1=%lu] Read loop exiting\n", *readGenerations[0], *readGenerations[1]);
+	//Leave the input where the reader got to, as reading it would have.
+	if (mappedInput != NULL) lseek(inputFD, inputPosition, SEEK_SET);
+	//Either way, the writer should finish what's been read and then stop.
+	ring_close(ring);
+	LOG("R[RG=%lu] Read loop exiting\n", ring_readGeneration(ring));
 	return readerState == state_readFailed ? readErrorBuffer : NULL;
 }
 
+///Writes all of a buffer at the output's current position. Returns false, with errno set, if a write fails.
+static bool writeFully(struct output *_Nonnull const output, void const *_Nonnull const buffer, size_t const length) {
+	if (directIOAlignment > 0 && length % directIOAlignment != 0) {
+		//This is the unaligned tail of the input. Direct I/O can't write it, so this one goes through the page cache.
+		setDirectIO(output->fd, false);
+	}
+	size_t offset = 0;
+	while (offset < length) {
+		unsigned long long writeStartedTime = latency_now();
+		ssize_t amtWritten = write(output->fd, buffer + offset, length - offset);
+		if (amtWritten < 0 && errno == EINVAL && directIOAlignment > 0) {
+			//A short write left us unaligned. Finish the rest through the page cache.
+			setDirectIO(output->fd, false);
+			writeStartedTime = latency_now();
+			amtWritten = write(output->fd, buffer + offset, length - offset);
+		}
+		latency_recordSince(&output->writeLatencies, writeStartedTime);
+		if (amtWritten < 0) {
+			return false;
+		}
+		offset += amtWritten;
+		output->amountWritten += amtWritten;
+		//With more than one output, the writer counts whole blocks instead, once every output has them. When compressing or storing, it counts the data that went into each frame or block.
+		if (numOutputs == 1 && ! compressOutput && (blockStore == NULL || restoreFromStore)) totalAmountCopied += amtWritten;
+	}
+	return true;
+}
+///Moves the output position past a run of zeros without writing them. Where the output already had data, punches a hole so it reads back as zeros. countAsSkipped is false for zeros that weren't in the input, which are counted elsewhere. Returns false if that can't be done, in which case the zeros need to be written after all.
+static bool skipZerosInOutput(struct output *_Nonnull const output, unsigned long long const length, bool const countAsSkipped) {
+	if (! outputIsSeekable) return false;
+	off_t const position = lseek(output->fd, 0, SEEK_CUR);
+	if (position < 0) return false;
+	if (position < outputOriginalSize) {
+		unsigned long long const remainingOriginalSize = outputOriginalSize - position;
+		unsigned long long const lengthToPunch = length < remainingOriginalSize ? length : remainingOriginalSize;
+#if EXISTS_FALLOCATE
+		if (fallocate(output->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, position, lengthToPunch) != 0) return false;
+#else
+		return false;
+#endif
+	}
+	if (lseek(output->fd, position + length, SEEK_SET) < 0) return false;
+	totalAmountCopied += length;
+	if (countAsSkipped) totalAmountSkipped += length;
+	return true;
+}
+///Splits the rest of a buffer, from runStart, into granules, and finds where the run of granules that get the same answer from test as the first one ends. *outResult is that answer.
+//Finer granularity finds more to skip but costs more seeks and smaller writes.
+static size_t endOfRun(void const *_Nonnull const buffer, size_t const runStart, size_t const length, bool (*_Nonnull const test)(void const *_Nonnull const buffer, size_t const start, size_t const end), bool *_Nonnull const outResult) {
+	enum { kRunGranularity = 64 * 1024 };
+	size_t const granularity = directIOAlignment > kRunGranularity ? directIOAlignment : kRunGranularity;
+
+	size_t runEnd = runStart + granularity < length ? runStart + granularity : length;
+	bool const result = test(buffer, runStart, runEnd);
+	while (runEnd < length) {
+		size_t const nextEnd = runEnd + granularity < length ? runEnd + granularity : length;
+		if (test(buffer, runEnd, nextEnd) != result) break;
+		runEnd = nextEnd;
+	}
+	*outResult = result;
+	return runEnd;
+}
+
+static bool rangeIsAllZero(void const *_Nonnull const buffer, size_t const start, size_t const end) {
+	return blockIsAllZero(buffer + start, end - start);
+}
+///Writes a buffer, skipping over any runs of zeros in it.
+static bool writeSparsely(struct output *_Nonnull const output, void const *_Nonnull const buffer, size_t const length) {
+	size_t runStart = 0;
+	while (runStart < length) {
+		bool runIsZero;
+		size_t const runEnd = endOfRun(buffer, runStart, length, rangeIsAllZero, &runIsZero);
+		bool const skipped = runIsZero && skipZerosInOutput(output, runEnd - runStart, /*countAsSkipped*/ true);
+		if (! skipped && ! writeFully(output, buffer + runStart, runEnd - runStart)) return false;
+		runStart = runEnd;
+	}
+	return true;
+}
+
+static bool rangeIsUnchanged(void const *_Nonnull const buffer, size_t const start, size_t const end) {
+	return end <= compareBufferLength && blockFirstDifference(buffer + start, compareBuffer + start, end - start) == end - start;
+}
+///Writes a buffer over the same range of the output, skipping any part of it that already matches what's there.
+static bool writeDifferences(struct output *_Nonnull const output, void const *_Nonnull const buffer, size_t const length) {
+	off_t const position = lseek(output->fd, 0, SEEK_CUR);
+	if (position < 0) return false;
+
+	//Direct I/O can only read whole blocks. Past the end of the output, there's nothing to match, so a short read is fine.
+	size_t const amountToRead = directIOAlignment > 0 ? (length + directIOAlignment - 1) / directIOAlignment * directIOAlignment : length;
+	compareBufferLength = 0;
+	while (compareBufferLength < amountToRead) {
+		ssize_t const amtRead = pread(output->fd, compareBuffer + compareBufferLength, amountToRead - compareBufferLength, position + compareBufferLength);
+		if (amtRead < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		if (amtRead == 0) break;
+		compareBufferLength += amtRead;
+		if (directIOAlignment > 0 && compareBufferLength % directIOAlignment != 0) break;
+	}
+	totalAmountCompared += compareBufferLength < length ? compareBufferLength : length;
+
+	size_t runStart = 0;
+	while (runStart < length) {
+		bool runIsUnchanged;
+		size_t const runEnd = endOfRun(buffer, runStart, length, rangeIsUnchanged, &runIsUnchanged);
+		if (runIsUnchanged) {
+			if (lseek(output->fd, position + runEnd, SEEK_SET) < 0) return false;
+			totalAmountCopied += runEnd - runStart;
+			totalAmountUnchanged += runEnd - runStart;
+		} else {
+			bool const written = sparseMode ? writeSparsely(output, buffer + runStart, runEnd - runStart) : writeFully(output, buffer + runStart, runEnd - runStart);
+			if (! written) return false;
+		}
+		runStart = runEnd;
+	}
+	return true;
+}
+
+///Writes a hole from the input, or zeros in place of data that couldn't be read: length bytes of zeros.
+static bool writeHole(struct output *_Nonnull const output, unsigned long long length, bool const isUnread) {
+	//Data that couldn't be read isn't zeros that were skipped or left unchanged, so it's counted on its own, however the zeros got there.
+	if (isUnread) totalAmountUnread += length;
+	bool const compare = diffMode && ! isUnread;
+	//In diff mode, the zeros only need to go where the output doesn't already have them.
+	if (! compare && skipZerosInOutput(output, length, /*countAsSkipped*/ ! isUnread)) return true;
+	while (length > 0) {
+		size_t const thisLength = length < bufferSize ? length : bufferSize;
+		bool const written = compare ? writeDifferences(output, zeroBuffer, thisLength) : writeFully(output, zeroBuffer, thisLength);
+		if (! written) return false;
+		length -= thisLength;
+	}
+	return true;
+}
+
+///Writes a block of data to the output, skipping zeros or unchanged parts if the options say to.
+static bool writeBlock(struct output *_Nonnull const output, void const *_Nonnull const buffer, size_t const length) {
+	if (diffMode) return writeDifferences(output, buffer, length);
+	if (sparseMode) return writeSparsely(output, buffer, length);
+	return writeFully(output, buffer, length);
+}
+
 static void *write_thread_main(void *restrict arg) {
 	pthread_setname_self("Writer thread");
-	if (writerState != state_beforeFirstWrite) return "Writer starting in bad state";
-
-	while (! readerHasInitialized ) {
-		if (pthread_mutex_lock(&initializationLock) == EDEADLK) return "Writer deadlocked on init lock";
-		pthread_mutex_unlock(&initializationLock);
-		sleep(0);
-	}
-
-	int curBufferIdx = 0;
-	void *_Nonnull buffers[2] = { buffer0, buffer1 };
-	size_t _Atomic *lengths[2] = { &buffer0Len, &buffer1Len };
-	bool _Atomic *dirtyBits[2] = { &buffer0Dirty, &buffer1Dirty };
-	unsigned long _Atomic *readGenerations[2] = { &readGeneration0, &readGeneration1 };
-	unsigned long _Atomic *writeGenerations[2] = { &writeGeneration0, &writeGeneration1 };
-	pthread_rwlock_t *locks[2] = { &buffer0Lock, &buffer1Lock };
-
-	unsigned long capturedRG0 = *readGenerations[0], capturedRG1 = *readGenerations[1];
-	unsigned long capturedWG0 = *writeGenerations[0], capturedWG1 = *writeGenerations[1];
-	while (readerState != state_endOfFile || capturedWG0 < capturedRG0 || capturedWG1 < capturedRG1) {
-		LOG("W[C=%u, RG=%lu, WG=%lu] Waiting for lock to write buffer %d (reader state is %s)…\n",
-			curBufferIdx, curBufferIdx == 0 ? capturedRG0 : capturedRG1, curBufferIdx == 0 ? capturedWG0 : capturedWG1,
-			curBufferIdx, reader_nameState(capturedReaderState));
-		pthread_rwlock_wrlock(locks[curBufferIdx]);
-		unsigned long const curReadGen = *readGenerations[curBufferIdx];
-		unsigned long const curWriteGen = *writeGenerations[curBufferIdx];
-		LOG("W[C=%u, RG=%lu, WG=%lu] Got lock!\n",
-			curBufferIdx, curReadGen, curWriteGen);
-		if (curReadGen == curWriteGen) {
-			//We lapped the read loop. Wait for it to catch up.
-			LOG("W[C=%u] Read generation has not advanced. Writer coming around again for another pass...\n", curBufferIdx);
-			pthread_rwlock_unlock(locks[curBufferIdx]);
-			sleep(0);
-			continue;
-		}
+	struct output *_Nonnull const output = arg;
+	if (output->state != state_beforeFirstWrite) return "Writer starting in bad state";
 
-		writerState = state_writeBegun;
-		LOG("W[C=%u] Writing buffer\n", curBufferIdx);
-		ssize_t offset = 0;
-		size_t const amtToWrite = *lengths[curBufferIdx];
-		while (offset < amtToWrite) {
-			ssize_t const amtWritten = write(outputFD, buffers[curBufferIdx] + offset, amtToWrite - offset);
-			if (amtWritten < 0) {
-				writerState = state_writeFailed;
-				LOG("W[C=%u] Write failure", curBufferIdx);
-				pthread_rwlock_unlock(locks[curBufferIdx]);
-				strerror_r(errno, writeErrorBuffer, writeErrorMaxLength);
-				return writeErrorBuffer;
+	struct ring_slot *_Nullable slot;
+	while ((slot = ring_acquireFilledSlotForConsumer(ring, output->index)) != NULL) {
+		size_t const slotLength = slot->length;
+		//The slot can't be reused until its block has been hashed. The first output's writer waits for that, and only it, so each block is waited for once.
+		bool mustFinishHashing = output->index == 0 && manifest != NULL;
+		if (output->state != state_writeFailed) {
+			output->state = state_writeBegun;
+			if (rateLimiter != NULL && ! slot->isHole) {
+				sleepForSeconds(rate_limiter_delayForWrite(rateLimiter, slot->length, timeWithFraction()));
+			}
+			LOG("W%u[WG=%lu] Writing buffer\n", output->index, ring_consumerGeneration(ring, output->index));
+			bool succeeded;
+			//For failures that aren't a system call's, which errno wouldn't describe.
+			char const *_Nullable failureDescription = NULL;
+			if (slot->isHole) {
+				succeeded = writeHole(output, slot->length, slot->isUnread);
+			} else if (compression != NULL) {
+				struct compression_output converted;
+				unsigned long long const frameOffset = output->amountWritten;
+				succeeded = compression_finishBlock(compression, &converted, &failureDescription)
+					&& writeBlock(output, converted.bytes, converted.length)
+					&& (converted.moreLength == 0 || writeBlock(output, converted.moreBytes, converted.moreLength));
+				if (succeeded && compressOutput) {
+					totalAmountCopied += converted.originalLength;
+					//When compressing, the output starts with the frame's header.
+					if (imageIndex != NULL && ! image_index_addFrame(imageIndex, frameOffset, converted.bytes)) {
+						fprintf(stderr, "dd-parallel: ran out of memory for the image's index; it will only be readable from start to end\n");
+						image_index_destroy(imageIndex);
+						imageIndex = NULL;
+					}
+				}
+			} else if (blockStore != NULL && ! restoreFromStore) {
+				//The block's data went into the store; what goes in the output is its digest.
+				unsigned char digest[kBlockStoreDigestLength];
+				succeeded = block_store_finishBlock(blockStore, digest, &failureDescription)
+					&& writeFully(output, digest, sizeof(digest));
+				if (succeeded) totalAmountCopied += slot->length;
+			} else if (blockStore != NULL) {
+				succeeded = block_store_finishBlock(blockStore, /*outDigest*/ NULL, &failureDescription)
+					&& writeBlock(output, ring_slotData(slot), slot->length);
+			} else {
+				succeeded = writeBlock(output, ring_slotData(slot), slot->length);
+			}
+			if (succeeded && mustFinishHashing) {
+				succeeded = manifest_finishBlock(manifest);
+				mustFinishHashing = false;
+			}
+			if (! succeeded) {
+				output->state = state_writeFailed;
+				LOG("W%u[WG=%lu] Write failure\n", output->index, ring_consumerGeneration(ring, output->index));
+				//A mapped block was faulted in when it was read, but may have been evicted since, and not been able to be read back in.
+				output->inputFailed = failureDescription == NULL && errno == EFAULT && mappedInput != NULL;
+				if (failureDescription != NULL && blockStore != NULL) snprintf(output->errorBuffer, writeErrorCapacity, "%s", failureDescription);
+				else if (failureDescription != NULL) snprintf(output->errorBuffer, writeErrorCapacity, "couldn't %s a block: %s", compressOutput ? "compress" : "decompress", failureDescription);
+				else if (output->inputFailed) strlcpy(output->errorBuffer, "the input couldn't be read, or got shorter, while it was mapped", writeErrorCapacity);
+				else copyErrorDescription(output->errorBuffer, errno, writeErrorCapacity);
+				//With no outputs left, there's no point reading any further.
+				if (--numOutputsWriting == 0) ring_cancel(ring);
+				if (numOutputs == 1) return output->errorBuffer;
+				//The other outputs are still going. From here on, this writer only hands blocks back, so as not to hold them up.
 			}
-			offset += amtWritten;
-			totalAmountCopied += amtWritten;
 		}
-		*dirtyBits[curBufferIdx] = false;
-		++*writeGenerations[curBufferIdx];
-		LOG("W[C=%u, WG=%lu] Finished writing buffer. Write generation increases: %lu → %lu\n", curBufferIdx, *writeGenerations[curBufferIdx], curWriteGen, *writeGenerations[curBufferIdx]);
-		int const nextBufferIdx = !curBufferIdx;
-		writerState = state_writeFinished;
-		pthread_rwlock_unlock(locks[curBufferIdx]);
-		curBufferIdx = nextBufferIdx;
+		if (mustFinishHashing) manifest_finishBlock(manifest);
 
-		capturedRG0 = *readGenerations[0];
-		capturedRG1 = *readGenerations[1];
-		capturedWG0 = *writeGenerations[0];
-		capturedWG1 = *writeGenerations[1];
+		time_fractional_t const now = timeWithFraction();
+		if (tuner != NULL && ! slot->isHole) {
+			tuner_blockWritten(tuner, slot->length, now);
+		}
+		bool const wasLastHolder = ring_releaseSlotForConsumer(ring, output->index);
+		//Every output that hasn't failed has this block now.
+		if (wasLastHolder && numOutputs > 1 && numOutputsWriting > 0) totalAmountCopied += slotLength;
+		if (wasLastHolder && mappedInput != NULL) mapped_input_release(mappedInput, slotLength);
+		if (progress != NULL) {
+			progress_recordSample(progress, now, totalAmountCopied);
+		}
+		if (output->state != state_writeFailed) output->state = state_writeFinished;
+		LOG("W%u[WG=%lu] Finished writing buffer\n", output->index, ring_consumerGeneration(ring, output->index));
 	}
-	LOG("W[WG0=%lu, WG1=%lu] Write loop exiting because reader state is %s and buffer 0 generations are R#%lu, W#%lu, buffer 1 generations are R#%lu, W#%lu\n", capturedWG0, capturedWG1, reader_nameState(capturedReaderState), capturedRG0, capturedWG0, capturedRG1, capturedWG1);
-	return NULL;
+	if (compressOutput && output->state != state_writeFailed && readerState == state_endOfFile) {
+		//Only once all of the input has been read and written can the image say how long it was. An image without an end frame was cut short.
+		unsigned char endFrame[kCompressionEndFrameSize];
+		compression_makeEndFrame(endFrame, totalAmountCopied);
+		bool written = writeFully(output, endFrame, sizeof(endFrame));
+		//The index goes after the end frame, so anything reading the image from the start stops before it.
+		if (written && imageIndex != NULL) {
+			size_t indexLength = 0;
+			void const *_Nullable const indexBytes = image_index_finish(imageIndex, output->amountWritten, totalAmountCopied, &indexLength);
+			if (indexBytes != NULL) written = writeFully(output, indexBytes, indexLength);
+			else fprintf(stderr, "dd-parallel: ran out of memory for the image's index; it will only be readable from start to end\n");
+		}
+		if (! written) {
+			output->state = state_writeFailed;
+			copyErrorDescription(output->errorBuffer, errno, writeErrorCapacity);
+		}
+	}
+	if (blockStore != NULL && ! restoreFromStore && output->state != state_writeFailed && readerState == state_endOfFile) {
+		//Same for a recipe: without its trailer, it was cut short.
+		unsigned char trailer[kBlockRecipeTrailerSize];
+		block_recipe_makeTrailer(trailer, totalAmountCopied);
+		if (! writeFully(output, trailer, sizeof(trailer))) {
+			output->state = state_writeFailed;
+			copyErrorDescription(output->errorBuffer, errno, writeErrorCapacity);
+		}
+	}
+	output->finishedTime = timeWithFraction();
+	LOG("W%u[RG=%lu, WG=%lu] Write loop exiting because reader state is %s\n", output->index, ring_readGeneration(ring), ring_consumerGeneration(ring, output->index), reader_nameState(readerState));
+	return output->state == state_writeFailed ? output->errorBuffer : NULL;
 }
 
 #pragma mark -
@@ -311,44 +1912,217 @@ static time_fractional_t timeWithFraction(void) {
 	clock_gettime(CLOCK_THEGOODONE, &now);
 	return now.tv_sec + now.tv_nsec / 1e9;
 }
+static void sleepForSeconds(double const seconds) {
+	if (seconds <= 0.0) return;
+	struct timespec remaining = {
+		.tv_sec = (time_t)seconds,
+		.tv_nsec = (long)((seconds - (time_t)seconds) * 1e9),
+	};
+	//SIGINFO interrupts the sleep; keep going.
+	while (nanosleep(&remaining, &remaining) != 0 && errno == EINTR);
+}
 
-static void logProgress(bool const isFinal) {
-	if (readerState == state_beforeFirstRead) {
-		printf("Copy has not started yet.");
-	} else {
-		time_fractional_t const now = isFinal ? copyFinishedTime : timeWithFraction();
-		time_fractional_t const numSecs = now - copyStartedTime;
-		unsigned long long const bytesCopiedSoFar = totalAmountCopied;
-		double const bytesPerSec = bytesCopiedSoFar / numSecs;
+///Prints a line like “Copied 1 GB in 10 seconds (overall avg 100 MB/sec)”, with verb being the part up to the byte count. With rates, also includes the current and windowed rates: “(overall avg 100 MB/sec; currently 90 MB/sec, 95 MB/sec over the last 30 sec)”.
+static void printAmountAndRate(FILE *_Nonnull const file, char const *_Nonnull const verb, unsigned long long const amount, time_fractional_t const numSecs, struct progress_rates const *_Nullable const rates) {
+	double const bytesPerSec = amount / numSecs;
 
-		enum { maxMessageLen = 255, maxMessageCapacity };
-		char message[maxMessageCapacity] = { 0 };
-		size_t messageLen = strlcpy(message, isFinal ? "Copied " : "Have copied ", maxMessageCapacity);
-		char *_Nonnull dst = message + messageLen;
-		messageLen += copyByteCountPhrase(dst, bytesCopiedSoFar, maxMessageCapacity - messageLen);
+	enum { maxMessageLen = 255, maxMessageCapacity };
+	char message[maxMessageCapacity] = { 0 };
+	size_t messageLen = strlcpy(message, verb, maxMessageCapacity);
+	char *_Nonnull dst = message + messageLen;
+	messageLen += copyByteCountPhrase(dst, amount, maxMessageCapacity - messageLen);
+	if (messageLen >= maxMessageLen) goto printMessage;
+	dst = message + messageLen;
+	messageLen += strlcat(dst, " in ", maxMessageCapacity - messageLen);
+	if (messageLen >= maxMessageLen) goto printMessage;
+	dst = message + messageLen;
+//	messageLen += snprintf(dst, maxMessageCapacity - messageLen, "%f seconds = ", numSecs);
+//	dst = message + messageLen;
+	messageLen += copyIntervalPhrase(dst, numSecs, maxMessageCapacity - messageLen);
+	if (messageLen >= maxMessageLen) goto printMessage;
+	dst = message + messageLen;
+	messageLen += strlcat(dst, " (overall avg ", maxMessageCapacity - messageLen);
+	if (messageLen >= maxMessageLen) goto printMessage;
+	dst = message + messageLen;
+	messageLen += copyByteCountPhrase(dst, bytesPerSec, maxMessageCapacity - messageLen);
+	if (messageLen >= maxMessageLen) goto printMessage;
+	dst = message + messageLen;
+	messageLen += strlcat(dst, "/sec", maxMessageCapacity - messageLen);
+	if (messageLen >= maxMessageLen) goto printMessage;
+	if (rates != NULL) {
+		dst = message + messageLen;
+		messageLen += strlcat(dst, "; currently ", maxMessageCapacity - messageLen);
 		if (messageLen >= maxMessageLen) goto printMessage;
 		dst = message + messageLen;
-		messageLen += strlcat(dst, " in ", maxMessageCapacity - messageLen);
+		messageLen += copyByteCountPhrase(dst, rates->current, maxMessageCapacity - messageLen);
 		if (messageLen >= maxMessageLen) goto printMessage;
 		dst = message + messageLen;
-//		messageLen += snprintf(dst, maxMessageCapacity - messageLen, "%f seconds = ", numSecs);
-//		dst = message + messageLen;
-		messageLen += copyIntervalPhrase(dst, numSecs, maxMessageCapacity - messageLen);
+		messageLen += strlcat(dst, "/sec, ", maxMessageCapacity - messageLen);
 		if (messageLen >= maxMessageLen) goto printMessage;
 		dst = message + messageLen;
-		messageLen += strlcat(dst, " (overall avg ", maxMessageCapacity - messageLen);
+		messageLen += copyByteCountPhrase(dst, rates->windowed, maxMessageCapacity - messageLen);
 		if (messageLen >= maxMessageLen) goto printMessage;
 		dst = message + messageLen;
-		messageLen += copyByteCountPhrase(dst, bytesPerSec, maxMessageCapacity - messageLen);
+		messageLen += strlcat(dst, "/sec over the last ", maxMessageCapacity - messageLen);
 		if (messageLen >= maxMessageLen) goto printMessage;
 		dst = message + messageLen;
-		messageLen += strlcat(dst, "/sec)", maxMessageCapacity - messageLen);
+		messageLen += copyIntervalPhrase(dst, rates->windowSeconds < 1.0 ? rates->windowSeconds : round(rates->windowSeconds), maxMessageCapacity - messageLen);
 		if (messageLen >= maxMessageLen) goto printMessage;
+	}
+	dst = message + messageLen;
+	messageLen += strlcat(dst, ")", maxMessageCapacity - messageLen);
+	if (messageLen >= maxMessageLen) goto printMessage;
+
+printMessage:
+	fprintf(file, "%s\n", message);
+}
+
+static void logProgress(FILE *_Nonnull const file, bool const isFinal) {
+	if (readerState == state_beforeFirstRead) {
+		fprintf(file, "Copy has not started yet.\n");
+	} else {
+		time_fractional_t const now = isFinal ? copyFinishedTime : timeWithFraction();
+		unsigned long long const bytesCopiedSoFar = totalAmountCopied;
+		bool const includeRates = ! isFinal && progress != NULL;
+		struct progress_rates const rates = includeRates ? progress_rates(progress, now, bytesCopiedSoFar) : (struct progress_rates){ 0 };
+		printAmountAndRate(file, isFinal ? "Copied " : "Have copied ", bytesCopiedSoFar, now - copyStartedTime, includeRates ? &rates : NULL);
+		enum { maxMessageLen = 255, maxMessageCapacity };
 
-	printMessage:
-		printf("%s\n", message);
+		unsigned long long const bytesSkippedSoFar = totalAmountSkipped;
+		unsigned long long const bytesUnchangedSoFar = totalAmountUnchanged;
+		unsigned long long const bytesUnreadSoFar = totalAmountUnread;
+		if (bytesSkippedSoFar > 0 || diffMode || bytesUnreadSoFar > 0) {
+			char phrase[maxMessageCapacity] = { 0 };
+			copyByteCountPhrase(phrase, bytesCopiedSoFar - bytesSkippedSoFar - bytesUnchangedSoFar - bytesUnreadSoFar, maxMessageCapacity);
+			fprintf(file, "Of that, wrote %s", phrase);
+			if (bytesSkippedSoFar > 0) {
+				copyByteCountPhrase(phrase, bytesSkippedSoFar, maxMessageCapacity);
+				fprintf(file, "%s skipped %s of zeros", diffMode ? "," : " and", phrase);
+			}
+			if (diffMode) {
+				copyByteCountPhrase(phrase, bytesUnchangedSoFar, maxMessageCapacity);
+				fprintf(file, "%s left %s unchanged", bytesSkippedSoFar > 0 ? ", and" : " and", phrase);
+				copyByteCountPhrase(phrase, totalAmountCompared, maxMessageCapacity);
+				fprintf(file, " (compared %s against the output)", phrase);
+			}
+			fprintf(file, "\n");
+		}
+		if (bytesUnreadSoFar > 0) {
+			char phrase[maxMessageCapacity] = { 0 };
+			copyByteCountPhrase(phrase, bytesUnreadSoFar, maxMessageCapacity);
+			fprintf(file, "Could not read %s; the output has zeros in its place\n", phrase);
+		}
+		if (numOutputs > 1) {
+			for (unsigned int i = 0; i < numOutputs; ++i) {
+				struct output const *_Nonnull const output = &outputs[i];
+				bool const failed = output->state == state_writeFailed;
+				//A writer that's done (or given up) stops the clock on its own output.
+				time_fractional_t const outputNow = output->finishedTime > 0.0 ? output->finishedTime : now;
+				char verb[maxMessageCapacity];
+				snprintf(verb, maxMessageCapacity, "  %s: %s", output->path, failed ? "failed after writing " : isFinal ? "wrote " : "has written ");
+				printAmountAndRate(file, verb, output->amountWritten, outputNow - copyStartedTime, NULL);
+			}
+		}
+	}
+}
+static void logVerifyProgress(FILE *_Nonnull const file, bool const isFinal) {
+	time_fractional_t const now = isFinal ? verifyFinishedTime : timeWithFraction();
+	unsigned long long const bytesVerifiedSoFar = totalAmountVerified;
+	bool const includeRates = ! isFinal && progress != NULL;
+	struct progress_rates const rates = includeRates ? progress_rates(progress, now, bytesVerifiedSoFar) : (struct progress_rates){ 0 };
+	printAmountAndRate(file, isFinal ? "Verified " : "Have verified ", bytesVerifiedSoFar, now - verifyStartedTime, includeRates ? &rates : NULL);
+}
+///Prints percentiles of how long reads, writes, and waits for the other thread have taken, if the reader and writer threads have done any. With more than one output, each writer gets rows of its own, numbered in the order the outputs were given.
+static void logLatencies(FILE *_Nonnull const file) {
+	if (latency_count(&readLatencies) == 0 && latency_count(&outputs[0].writeLatencies) == 0) return;
+	latency_printHeader(file);
+	latency_printRow(file, "read()", &readLatencies);
+	if (numOutputs == 1) {
+		latency_printRow(file, "write()", &outputs[0].writeLatencies);
+		latency_printRow(file, "reader waiting", &readerWaits);
+		latency_printRow(file, "writer waiting", &outputs[0].waits);
+		return;
+	}
+	latency_printRow(file, "reader waiting", &readerWaits);
+	for (unsigned int i = 0; i < numOutputs; ++i) {
+		char name[32];
+		snprintf(name, sizeof(name), "out %u write()", i + 1);
+		latency_printRow(file, name, &outputs[i].writeLatencies);
+		snprintf(name, sizeof(name), "out %u waiting", i + 1);
+		latency_printRow(file, name, &outputs[i].waits);
+	}
+}
+///Called on the progress reporter's thread, when SIGINFO asks for a report or --progress-interval is due one. Only the reports asked for include the latencies, so periodic reports stay one line each.
+static void reportProgress(bool const wasRequested) {
+	if (progressFormat == progressFormat_json) {
+		logProgressRecord(progressFile, verifying, /*isFinal*/ false);
+	} else if (verifying) {
+		logVerifyProgress(progressFile, false);
+	} else {
+		logProgress(progressFile, false);
+		if (wasRequested) logLatencies(progressFile);
+	}
+	//The reports may be going to a pipe or a file, and they aren't much use if they sit in a buffer.
+	fflush(progressFile);
+}
+///Prints a progress report as one line of JSON, like:
+///	{"phase": "copy", "final": false, "elapsed_seconds": 12.000, "bytes_done": 1258291200, "bytes_total": 4000787030016, "rate_current": 104857600, "rate_windowed": 100663296, "rate_overall": 104857600, "eta_seconds": 39731.6, "reader_state": "reading", "writer_state": "writing", "read_generation": 1208, "write_generation": 1200}
+///Byte counts are from the start of the input, even when resuming. bytes_total and eta_seconds are null when the input's size isn't known; the generations are null when the copy isn't going through the ring. The last record of each phase has final true, and only the overall rate.
+///With more than one output, bytes_done only counts what every output has, writer_state is the first output's, and the copy's records also have output_bytes_written and output_states: arrays with an element for each output, in the order they were given.
+static void logProgressRecord(FILE *_Nonnull const file, bool const forVerify, bool const isFinal) {
+	time_fractional_t const startedTime = forVerify ? verifyStartedTime : copyStartedTime;
+	time_fractional_t const now = isFinal ? (forVerify ? verifyFinishedTime : copyFinishedTime) : timeWithFraction();
+	//The rates are only about what this run has done.
+	unsigned long long const doneThisRun = forVerify ? totalAmountVerified : totalAmountCopied;
+	unsigned long long const done = (forVerify ? 0 : resumeOffset) + doneThisRun;
+	struct progress_rates rates = { .overall = now > startedTime ? doneThisRun / (now - startedTime) : 0.0 };
+	if (progress != NULL && ! isFinal) rates = progress_rates(progress, now, doneThisRun);
+
+	fprintf(file, "{\"phase\": \"%s\", \"final\": %s, \"elapsed_seconds\": %.3f, \"bytes_done\": %llu, \"bytes_total\": ", forVerify ? "verify" : "copy", isFinal ? "true" : "false", now - startedTime, done);
+	if (progressTotalBytes > 0) {
+		fprintf(file, "%llu", progressTotalBytes);
+	} else {
+		fprintf(file, "null");
+	}
+	if (isFinal) {
+		//Once it's over, there's only the overall rate.
+		fprintf(file, ", \"rate_current\": null, \"rate_windowed\": null");
+	} else {
+		fprintf(file, ", \"rate_current\": %.0f, \"rate_windowed\": %.0f", rates.current, rates.windowed);
+	}
+	fprintf(file, ", \"rate_overall\": %.0f, \"eta_seconds\": ", rates.overall);
+	//The windowed rate is steadier than the current one, and more up to date than the overall one.
+	double const etaRate = rates.windowed > 0.0 ? rates.windowed : rates.overall;
+	if (isFinal) {
+		fprintf(file, "0");
+	} else if (progressTotalBytes > 0 && etaRate > 0.0) {
+		fprintf(file, "%.1f", progressTotalBytes > done ? (progressTotalBytes - done) / etaRate : 0.0);
+	} else {
+		fprintf(file, "null");
+	}
+
+	fprintf(file, ", \"reader_state\": \"%s\", \"writer_state\": \"%s\"", reader_stateKeyword(readerState), writer_stateKeyword(outputs[0].state));
+	if (numOutputs > 1 && ! forVerify) {
+		fprintf(file, ", \"output_bytes_written\": [");
+		for (unsigned int i = 0; i < numOutputs; ++i) {
+			fprintf(file, "%s%llu", i > 0 ? ", " : "", outputs[i].amountWritten);
+		}
+		fprintf(file, "], \"output_states\": [");
+		for (unsigned int i = 0; i < numOutputs; ++i) {
+			fprintf(file, "%s\"%s\"", i > 0 ? ", " : "", writer_stateKeyword(outputs[i].state));
+		}
+		fprintf(file, "]");
+	}
+	pthread_mutex_lock(&ringLifetimeLock);
+	if (ring != NULL && ! forVerify) {
+		fprintf(file, ", \"read_generation\": %lu, \"write_generation\": %lu}\n", ring_readGeneration(ring), ring_writeGeneration(ring));
+	} else {
+		fprintf(file, ", \"read_generation\": null, \"write_generation\": null}\n");
 	}
+	pthread_mutex_unlock(&ringLifetimeLock);
+	fflush(file);
 }
 static void handleSIGINFO(int const signal) {
-	logProgress(false);
+	//Formatting and printing aren't async-signal-safe, so all the handler does is wake up the reporter thread to do them.
+	if (progress != NULL) progress_requestReport(progress);
 }
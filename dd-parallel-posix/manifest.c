@@ -0,0 +1,179 @@
+//
+//  manifest.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "manifest.h"
+#include "digests.h"
+#include "formatting_utils.h"
+#include "byte_order.h"
+#include "worker_pool.h"
+
+#include <inttypes.h>
+
+enum {
+	errorMaxLength = 255,
+	errorCapacity,
+};
+static char errorBuffer[errorCapacity] = { 0 };
+
+//Holes get hashed as this many zeros at a time.
+enum { kZeroChunkSize = 64 * 1024 };
+static unsigned char const zeroChunk[kZeroChunkSize] = { 0 };
+
+struct manifest_block {
+	void const *_Nullable bytes;
+	size_t length;
+	unsigned long long offset;
+	uint64_t digest;
+};
+
+struct manifest {
+	FILE *_Nonnull file;
+	struct manifest_block *_Nonnull blocks;
+	unsigned long long startOffset;
+	unsigned long long nextOffset;
+	//The pool's threads hash each block, and its in-order thread, if any, adds them to the SHA-256.
+	struct worker_pool *_Nullable pool;
+
+	struct xxh64_state imageState;
+	bool includeSHA256;
+	struct sha256_state sha256State;
+};
+
+static uint64_t hashBlock(struct manifest_block const *_Nonnull const block) {
+	if (block->bytes != NULL) return xxh64(block->bytes, block->length, 0);
+	struct xxh64_state state;
+	xxh64_init(&state, 0);
+	for (size_t remaining = block->length; remaining > 0; ) {
+		size_t const thisLength = remaining < kZeroChunkSize ? remaining : kZeroChunkSize;
+		xxh64_update(&state, zeroChunk, thisLength);
+		remaining -= thisLength;
+	}
+	return xxh64_digest(&state);
+}
+
+static void manifest_hash(void *_Nonnull const context, unsigned int const threadIndex, unsigned int const blockIndex) {
+	struct manifest *_Nonnull const manifest = context;
+	struct manifest_block *_Nonnull const block = &manifest->blocks[blockIndex];
+	block->digest = hashBlock(block);
+}
+static void manifest_updateSHA256(void *_Nonnull const context, unsigned int const blockIndex) {
+	struct manifest *_Nonnull const manifest = context;
+	struct manifest_block const *_Nonnull const block = &manifest->blocks[blockIndex];
+	if (block->bytes != NULL) {
+		sha256_update(&manifest->sha256State, block->bytes, block->length);
+	} else {
+		for (size_t remaining = block->length; remaining > 0; ) {
+			size_t const thisLength = remaining < kZeroChunkSize ? remaining : kZeroChunkSize;
+			sha256_update(&manifest->sha256State, zeroChunk, thisLength);
+			remaining -= thisLength;
+		}
+	}
+}
+
+static void manifest_free(struct manifest *_Nonnull const manifest) {
+	if (manifest->pool != NULL) worker_pool_destroy(manifest->pool);
+	free(manifest->blocks);
+	free(manifest);
+}
+
+struct manifest *_Nullable manifest_create(char const *_Nonnull const path, unsigned int const numThreads, unsigned int const maxBlocksInFlight, bool const includeSHA256, unsigned long long const startOffset, char const *_Nullable *_Nonnull const outError) {
+	*outError = NULL;
+	struct manifest *_Nullable const manifest = calloc(1, sizeof(struct manifest));
+	if (manifest == NULL) {
+		*outError = "Could not allocate manifest";
+		return NULL;
+	}
+	manifest->startOffset = startOffset;
+	manifest->nextOffset = startOffset;
+	manifest->includeSHA256 = includeSHA256;
+	xxh64_init(&manifest->imageState, 0);
+	sha256_init(&manifest->sha256State);
+	manifest->blocks = calloc(maxBlocksInFlight, sizeof(struct manifest_block));
+	if (manifest->blocks == NULL) {
+		*outError = "Could not allocate manifest";
+		manifest_free(manifest);
+		return NULL;
+	}
+
+	manifest->file = fopen(path, "w");
+	if (manifest->file == NULL) {
+		copyErrorDescription(errorBuffer, errno, errorCapacity);
+		*outError = errorBuffer;
+		manifest_free(manifest);
+		return NULL;
+	}
+	fprintf(manifest->file, "dd-parallel manifest 1\n");
+
+	//SHA-256 can't be split across threads, so it gets one of its own, which goes through the blocks in order.
+	manifest->pool = worker_pool_create(numThreads, maxBlocksInFlight, manifest, manifest_hash, "Block hashing thread", includeSHA256 ? manifest_updateSHA256 : NULL, "Image SHA-256 thread");
+	if (manifest->pool == NULL) {
+		*outError = "Could not start hashing threads";
+		fclose(manifest->file);
+		manifest_free(manifest);
+		return NULL;
+	}
+	return manifest;
+}
+
+void manifest_submitBlock(struct manifest *_Nonnull const manifest, void const *_Nullable const bytes, size_t const length) {
+	struct manifest_block *_Nonnull const block = &manifest->blocks[worker_pool_reserve(manifest->pool)];
+	*block = (struct manifest_block){
+		.bytes = bytes,
+		.length = length,
+		.offset = manifest->nextOffset,
+	};
+	manifest->nextOffset += length;
+	worker_pool_submit(manifest->pool);
+}
+bool manifest_finishBlock(struct manifest *_Nonnull const manifest) {
+	unsigned int blockIndex = 0;
+	if (! worker_pool_waitForNext(manifest->pool, &blockIndex)) {
+		errno = EINVAL;
+		return false;
+	}
+	struct manifest_block const *_Nonnull const block = &manifest->blocks[blockIndex];
+
+	unsigned char digestBytes[sizeof(uint64_t)];
+	putBigEndian64(digestBytes, block->digest);
+	xxh64_update(&manifest->imageState, digestBytes, sizeof(digestBytes));
+	bool const written = fprintf(manifest->file, "block %llu %zu %016" PRIx64 "\n", block->offset, block->length, block->digest) > 0;
+	worker_pool_finish(manifest->pool);
+	return written;
+}
+
+char const *_Nullable manifest_close(struct manifest *_Nonnull const manifest, bool const copyFinished) {
+	worker_pool_stop(manifest->pool);
+
+	if (manifest->startOffset > 0) {
+		//We only saw part of the image, so we can't give digests for the whole thing.
+		fprintf(manifest->file, "%s %llu\n", copyFinished ? "resumed-at" : "incomplete resumed-at", manifest->startOffset);
+	} else if (copyFinished && worker_pool_numUnfinished(manifest->pool) == 0) {
+		unsigned long long const imageLength = manifest->nextOffset;
+		fprintf(manifest->file, "image %llu xxh64-of-blocks %016" PRIx64 "\n", imageLength, xxh64_digest(&manifest->imageState));
+		if (manifest->includeSHA256) {
+			unsigned char sha256Digest[sha256_digestLength];
+			sha256_final(&manifest->sha256State, sha256Digest);
+			fprintf(manifest->file, "image %llu sha256 ", imageLength);
+			for (unsigned int i = 0; i < sha256_digestLength; ++i) {
+				fprintf(manifest->file, "%02x", sha256Digest[i]);
+			}
+			fprintf(manifest->file, "\n");
+		}
+	} else {
+		fprintf(manifest->file, "incomplete\n");
+	}
+
+	char const *_Nullable failure = NULL;
+	bool const hadError = ferror(manifest->file);
+	if (fclose(manifest->file) != 0 || hadError) {
+		copyErrorDescription(errorBuffer, errno, errorCapacity);
+		failure = errorBuffer;
+	}
+	manifest_free(manifest);
+	return failure;
+}
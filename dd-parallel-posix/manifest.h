@@ -0,0 +1,40 @@
+//
+//  manifest.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef manifest_h
+#define manifest_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+//A manifest is a text file listing a digest of every block copied, plus digests of the whole image, so a copy can be checked later (or compared against another copy) a block at a time:
+//	dd-parallel manifest 1
+//	block 0 1048576 1a2b3c4d5e6f7081
+//	block 1048576 1048576 …
+//	image 67108864 xxh64-of-blocks 9f8e7d6c5b4a3928
+//	image 67108864 sha256 ba7816bf…
+//Block digests are XXH64 (seed 0) of the block's contents. The xxh64-of-blocks image digest is XXH64 of the block digests, each as 8 big-endian bytes, in order; unlike a digest of the data itself, it can be computed from the blocks in parallel. The sha256 line is only there if asked for, and is of the data itself, so it can be checked with other tools.
+//If the copy didn't finish, the last line is “incomplete” instead of the image digests. If it was resumed from a journal, the blocks only cover the part copied this time, and the last line is “resumed-at” and the offset of the first block.
+
+//The hashing happens on a pool of threads, so it keeps up with the copy rather than slowing it down. Blocks are submitted by one thread (the reader) and finished, in the same order, by another (the writer); finishing a block waits for its digests, then writes its line.
+
+struct manifest;
+
+///Creates the manifest file. Blocks' offsets start from startOffset. Up to maxBlocksInFlight blocks may have been submitted and not yet finished. includeSHA256 adds a streaming SHA-256 of the whole image, which runs on one more thread of its own (it can't be split up), and is far slower than XXH64.
+///Returns NULL on failure, with *outError set to a description of the problem.
+struct manifest *_Nullable manifest_create(char const *_Nonnull const path, unsigned int const numThreads, unsigned int const maxBlocksInFlight, bool const includeSHA256, unsigned long long const startOffset, char const *_Nullable *_Nonnull const outError);
+
+///Hands a block to the hashing threads. bytes is NULL for a hole, which counts as length bytes of zeros. The bytes must not change until manifest_finishBlock has returned for this block.
+void manifest_submitBlock(struct manifest *_Nonnull const manifest, void const *_Nullable const bytes, size_t const length);
+///Waits for the oldest unfinished block to be hashed, then writes its line. Returns false, with errno set, if the line couldn't be written.
+bool manifest_finishBlock(struct manifest *_Nonnull const manifest);
+
+///Stops the hashing threads and closes the manifest file, after writing the image digests if copyFinished is true (and every submitted block was finished). Any blocks submitted and not finished are abandoned, so this must be called before their memory goes away. Returns NULL on success, or a description of the error.
+char const *_Nullable manifest_close(struct manifest *_Nonnull const manifest, bool const copyFinished);
+
+#endif /* manifest_h */
@@ -0,0 +1,138 @@
+//
+//  mapped_input.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "mapped_input.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct mapped_input {
+	unsigned char const *_Nonnull bytes;
+	//Where the mapping starts in the file (startOffset, rounded down to a page), and how long it is. Windows are counted from the start of the mapping.
+	unsigned long long mapStart;
+	size_t mappedLength;
+	size_t pageSize;
+	//How much of the mapping, from the start, the kernel has been asked to read ahead. Only the reader uses this.
+	size_t prefetchedLength;
+	//How much of the mapping, from the start, the writers are done with.
+	unsigned long long _Atomic releasedLength;
+	//What SIGBUS did before the input was mapped, to put back afterward.
+	struct sigaction previousSIGBUSAction;
+};
+
+//Where mapped_input_fault is to pick up if the page it's touching can't be read. Only set while it's touching them, and only on the thread doing so. Volatile because only the signal handler reads it, so otherwise the compiler sees nothing reading it between setting it and clearing it, and drops the setting.
+static _Thread_local sigjmp_buf *_Nullable volatile faultRecovery = NULL;
+
+static void handleSIGBUS(int const signal) {
+	if (faultRecovery != NULL) siglongjmp(*faultRecovery, 1);
+	//Some other thread, looking at the data after the reader faulted it in, found that it's been evicted and can't be read back. There's nowhere to return to, so report it the way the reader would have.
+	static char const message[] = "dd-parallel: error during read: the input couldn't be read, or got shorter, while it was mapped\n";
+	write(STDERR_FILENO, message, sizeof(message) - 1);
+	_exit(EX_NOINPUT);
+}
+
+static void prefetchWindow(struct mapped_input *_Nonnull const input) {
+	if (input->prefetchedLength >= input->mappedLength) return;
+	size_t const remainingLength = input->mappedLength - input->prefetchedLength;
+	size_t const windowLength = remainingLength < kMappedInputWindowSize ? remainingLength : kMappedInputWindowSize;
+	madvise((void *)(input->bytes + input->prefetchedLength), windowLength, MADV_WILLNEED);
+	input->prefetchedLength += windowLength;
+}
+
+struct mapped_input *_Nullable mapped_input_create(int const fd, unsigned long long const startOffset) {
+	struct stat sb;
+	if (fstat(fd, &sb) != 0 || ! S_ISREG(sb.st_mode) || (unsigned long long)sb.st_size <= startOffset) return NULL;
+	unsigned long long const pageSize = (unsigned long long)sysconf(_SC_PAGESIZE);
+	unsigned long long const mapStart = startOffset / pageSize * pageSize;
+	unsigned long long const lengthToMap = (unsigned long long)sb.st_size - mapStart;
+	if (lengthToMap > SIZE_MAX) return NULL;
+
+	struct mapped_input *_Nullable const input = calloc(1, sizeof(struct mapped_input));
+	if (input == NULL) return NULL;
+	void *const bytes = mmap(NULL, (size_t)lengthToMap, PROT_READ, MAP_SHARED, fd, (off_t)mapStart);
+	if (bytes == MAP_FAILED) {
+		free(input);
+		return NULL;
+	}
+	input->bytes = bytes;
+	input->mapStart = mapStart;
+	input->mappedLength = (size_t)lengthToMap;
+	input->pageSize = (size_t)pageSize;
+	struct sigaction const onSIGBUS = {
+		.sa_handler = handleSIGBUS,
+	};
+	sigaction(SIGBUS, &onSIGBUS, &input->previousSIGBUSAction);
+	//The part of the first page before startOffset never gets read, so it never gets released either. Count it as released from the start.
+	input->releasedLength = startOffset - mapStart;
+	//Sequential access makes the kernel read further ahead when it faults a page in, and drop pages behind sooner.
+	madvise(bytes, input->mappedLength, MADV_SEQUENTIAL);
+	//Always keep one window ahead of the one being read from.
+	prefetchWindow(input);
+	prefetchWindow(input);
+	return input;
+}
+
+void mapped_input_destroy(struct mapped_input *_Nonnull const input) {
+	munmap((void *)input->bytes, input->mappedLength);
+	sigaction(SIGBUS, &input->previousSIGBUSAction, /*outPrevious*/ NULL);
+	free(input);
+}
+
+void const *_Nullable mapped_input_bytes(struct mapped_input *_Nonnull const input, unsigned long long const offset, size_t *_Nonnull const ioLength) {
+	if (offset < input->mapStart || offset - input->mapStart >= input->mappedLength) return NULL;
+	size_t const position = (size_t)(offset - input->mapStart);
+	size_t const remainingLength = input->mappedLength - position;
+	if (*ioLength > remainingLength) *ioLength = remainingLength;
+	while (input->prefetchedLength < input->mappedLength && input->prefetchedLength < position + *ioLength + kMappedInputWindowSize) {
+		prefetchWindow(input);
+	}
+	return input->bytes + position;
+}
+
+bool mapped_input_fault(struct mapped_input *_Nonnull const input, void const *_Nonnull const bytes, size_t const length) {
+	sigjmp_buf recovery;
+	//Save the signal mask, so jumping out of the handler unblocks SIGBUS again.
+	if (sigsetjmp(recovery, /*savemask*/ 1) != 0) {
+		faultRecovery = NULL;
+		errno = EIO;
+		return false;
+	}
+	faultRecovery = &recovery;
+	//One byte from each page, and the last byte, since bytes may not start at the start of a page.
+	unsigned char const volatile *const pages = bytes;
+	for (size_t offset = 0; offset < length; offset += input->pageSize) {
+		(void)pages[offset];
+	}
+	if (length > 0) (void)pages[length - 1];
+	faultRecovery = NULL;
+	return true;
+}
+
+void mapped_input_release(struct mapped_input *_Nonnull const input, unsigned long long const length) {
+	unsigned long long const previousLength = atomic_fetch_add(&input->releasedLength, length);
+	if (previousLength >= input->mappedLength) return;
+	unsigned long long const firstWindow = previousLength / kMappedInputWindowSize;
+	unsigned long long releasedLength = previousLength + length;
+	if (releasedLength > input->mappedLength) releasedLength = input->mappedLength;
+	//The last window ends at the end of the mapping, whether or not it's a whole one.
+	unsigned long long const endWindow = releasedLength == input->mappedLength ? (releasedLength + kMappedInputWindowSize - 1) / kMappedInputWindowSize : releasedLength / kMappedInputWindowSize;
+	//Each caller drops the windows it finished, so no two drop the same one.
+	for (unsigned long long window = firstWindow; window < endWindow; ++window) {
+		size_t const windowStart = (size_t)(window * kMappedInputWindowSize);
+		size_t const windowLength = input->mappedLength - windowStart < kMappedInputWindowSize ? input->mappedLength - windowStart : kMappedInputWindowSize;
+		madvise((void *)(input->bytes + windowStart), windowLength, MADV_DONTNEED);
+	}
+}
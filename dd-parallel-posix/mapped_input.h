@@ -0,0 +1,34 @@
+//
+//  mapped_input.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef mapped_input_h
+#define mapped_input_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+//A mapped input lets the reader hand the writers a regular file's data where it already is, in the page cache, instead of copying it into one of the ring's buffers for them to copy out of again.
+//The file is mapped all at once, and the kernel told to expect it to be read in order. From then on, it's dealt with a window at a time: when the reader gets to a window, the kernel is asked to start reading the one after it; when the writers are done with a window, it's dropped from our address space, so the copy doesn't pile up mapped pages as it goes. (The file's pages stay in the page cache, just as they would after read().)
+//A mapping has no way to report a read error. If the file can't be read, or gets shorter while it's mapped, a system call given the missing part (such as the writer's write()) fails with EFAULT, and anything else that touches it gets SIGBUS. So the reader faults each block in before handing it on (see mapped_input_fault), which catches the SIGBUS and turns it into an error it can report, as read() would have. After that, the pages can still be evicted, and fail to be read back in, before the writers get to them; a write() that fails with EFAULT is an input error, and a SIGBUS anywhere but in mapped_input_fault ends the process with a message saying so and EX_NOINPUT, rather than a crash.
+
+enum { kMappedInputWindowSize = 64 * 1024 * 1024 };
+
+struct mapped_input;
+
+///Maps the regular file open on fd, from startOffset to its current end. Returns NULL if it can't be mapped: if there's nothing after startOffset, say, or it's too big for this process's address space.
+struct mapped_input *_Nullable mapped_input_create(int const fd, unsigned long long const startOffset);
+void mapped_input_destroy(struct mapped_input *_Nonnull const input);
+
+///Returns where the file's data at offset is, and cuts *ioLength down to how much of the file there is from there, if it's less. Returns NULL at or past the end of the file. Only the reader should call this. The window after the one offset is in gets read ahead.
+void const *_Nullable mapped_input_bytes(struct mapped_input *_Nonnull const input, unsigned long long const offset, size_t *_Nonnull const ioLength);
+///Faults in all of the pages holding length bytes at bytes (which mapped_input_bytes returned), so the data is in memory before the writers get it, and the time spent reading it is spent here. Returns false, with errno set to EIO, if some of it couldn't be read. Only the reader should call this.
+bool mapped_input_fault(struct mapped_input *_Nonnull const input, void const *_Nonnull const bytes, size_t const length);
+///Records that the next length bytes of the file, after everything released before, are no longer needed. Any window that's now been released in full gets dropped. Safe to call from any thread, as long as the calls are made in the order the data was read.
+void mapped_input_release(struct mapped_input *_Nonnull const input, unsigned long long const length);
+
+#endif /* mapped_input_h */
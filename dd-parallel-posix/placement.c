@@ -0,0 +1,230 @@
+//
+//  placement.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "placement.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if EXISTS_SYSFS
+#	include <sys/sysmacros.h>
+#endif
+
+//The size of the huge pages that transparent huge pages use on x86-64 and (with 4 KiB small pages) ARM64, and the default size of explicit ones.
+enum { kHugePageSize = 2 * 1024 * 1024 };
+
+static void cpu_list_add(struct cpu_list *_Nonnull const list, unsigned int const cpu) {
+	list->bits[cpu / 64] |= 1ULL << (cpu % 64);
+}
+static bool cpu_list_contains(struct cpu_list const *_Nonnull const list, unsigned int const cpu) {
+	return (list->bits[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+bool cpu_list_parse(char const *_Nonnull const string, struct cpu_list *_Nonnull const outList) {
+	*outList = (struct cpu_list){ 0 };
+	bool foundAny = false;
+	char const *cursor = string;
+	//sysfs's lists end with a newline.
+	while (*cursor != '\0' && *cursor != '\n') {
+		if (! isdigit((unsigned char)*cursor)) return false;
+		char *end = NULL;
+		unsigned long const first = strtoul(cursor, &end, 10);
+		unsigned long last = first;
+		if (*end == '-') {
+			cursor = end + 1;
+			if (! isdigit((unsigned char)*cursor)) return false;
+			last = strtoul(cursor, &end, 10);
+		}
+		if (last < first || last >= kPlacementMaximumCPUs) return false;
+		for (unsigned long cpu = first; cpu <= last; ++cpu) {
+			cpu_list_add(outList, (unsigned int)cpu);
+		}
+		foundAny = true;
+		cursor = end;
+		if (*cursor == ',') {
+			++cursor;
+			if (*cursor == '\0' || *cursor == '\n') return false;
+		} else if (*cursor != '\0' && *cursor != '\n') {
+			return false;
+		}
+	}
+	return foundAny;
+}
+
+unsigned int cpu_list_count(struct cpu_list const *_Nonnull const list) {
+	unsigned int count = 0;
+	for (unsigned int i = 0; i < sizeof(list->bits) / sizeof(*list->bits); ++i) {
+		count += (unsigned int)__builtin_popcountll(list->bits[i]);
+	}
+	return count;
+}
+
+void cpu_list_copyDescription(char *_Nonnull const buf, struct cpu_list const *_Nonnull const list, size_t const capacity) {
+	if (capacity == 0) return;
+	buf[0] = '\0';
+	size_t length = 0;
+	for (unsigned int cpu = 0; cpu < kPlacementMaximumCPUs && length < capacity; ++cpu) {
+		if (! cpu_list_contains(list, cpu)) continue;
+		unsigned int last = cpu;
+		while (last + 1 < kPlacementMaximumCPUs && cpu_list_contains(list, last + 1)) ++last;
+		int const written = last > cpu
+			? snprintf(buf + length, capacity - length, "%s%u-%u", length > 0 ? "," : "", cpu, last)
+			: snprintf(buf + length, capacity - length, "%s%u", length > 0 ? "," : "", cpu);
+		if (written < 0) break;
+		length += (size_t)written;
+		cpu = last;
+	}
+}
+
+#if EXISTS_SYSFS
+///Reads the first line of a small file, such as one of sysfs's. Returns false if there's no such file.
+static bool readSysfsFile(char const *_Nonnull const path, char *_Nonnull const buf, size_t const capacity) {
+	int const fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	ssize_t const amountRead = read(fd, buf, capacity - 1);
+	close(fd);
+	if (amountRead < 0) return false;
+	buf[amountRead] = '\0';
+	return true;
+}
+
+static unsigned int numNodes(void) {
+	//This is a list of node numbers, in the same format as a list of CPUs.
+	char nodesString[256];
+	struct cpu_list nodes;
+	if (! readSysfsFile("/sys/devices/system/node/online", nodesString, sizeof(nodesString)) || ! cpu_list_parse(nodesString, &nodes)) return 1;
+	return cpu_list_count(&nodes);
+}
+#endif
+
+int placement_nodeForFile(int const fd) {
+#if EXISTS_SYSFS
+	if (numNodes() < 2) return -1;
+	struct stat sb;
+	if (fstat(fd, &sb) != 0) return -1;
+	dev_t const device = S_ISBLK(sb.st_mode) ? sb.st_rdev : sb.st_dev;
+	char linkPath[64];
+	snprintf(linkPath, sizeof(linkPath), "/sys/dev/block/%u:%u", major(device), minor(device));
+	//This resolves to the device's place in the tree of everything in the system, e.g. /sys/devices/pci0000:80/0000:80:01.0/0000:81:00.0/nvme/nvme0/nvme0n1/nvme0n1p2. The PCI device it hangs off of, somewhere above it, knows which node it's on. A virtual device, under /sys/devices/virtual, has nothing above it that does.
+	char path[PATH_MAX];
+	if (realpath(linkPath, path) == NULL) return -1;
+	size_t pathLength = strlen(path);
+	while (pathLength > strlen("/sys/devices")) {
+		char nodePath[PATH_MAX + 16];
+		snprintf(nodePath, sizeof(nodePath), "%.*s/numa_node", (int)pathLength, path);
+		char nodeString[32];
+		if (readSysfsFile(nodePath, nodeString, sizeof(nodeString))) {
+			//-1 means the platform didn't say.
+			return atoi(nodeString);
+		}
+		while (pathLength > 0 && path[pathLength - 1] != '/') --pathLength;
+		if (pathLength > 0) --pathLength;
+	}
+#else
+	(void)fd;
+#endif
+	return -1;
+}
+
+bool placement_cpusOnNode(int const node, struct cpu_list *_Nonnull const outList) {
+#if EXISTS_SYSFS
+	if (node < 0) return false;
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	char cpusString[4096];
+	//A node with only memory on it has an empty list.
+	if (! readSysfsFile(path, cpusString, sizeof(cpusString)) || ! cpu_list_parse(cpusString, outList)) return false;
+#	if EXISTS_PTHREAD_AFFINITY
+	//Leave out any the process has been kept off of (by taskset, cgroups, etc.).
+	cpu_set_t allowed;
+	if (pthread_getaffinity_np(pthread_self(), sizeof(allowed), &allowed) == 0) {
+		for (unsigned int cpu = 0; cpu < kPlacementMaximumCPUs && cpu < CPU_SETSIZE; ++cpu) {
+			if (! CPU_ISSET(cpu, &allowed)) outList->bits[cpu / 64] &= ~(1ULL << (cpu % 64));
+		}
+	}
+#	endif
+	return cpu_list_count(outList) > 0;
+#else
+	(void)node;
+	(void)outList;
+	return false;
+#endif
+}
+
+bool placement_pinThread(pthread_t const thread, struct cpu_list const *_Nonnull const cpus) {
+#if EXISTS_PTHREAD_AFFINITY
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (unsigned int cpu = 0; cpu < kPlacementMaximumCPUs && cpu < CPU_SETSIZE; ++cpu) {
+		if (cpu_list_contains(cpus, cpu)) CPU_SET(cpu, &set);
+	}
+	return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+#else
+	(void)thread;
+	(void)cpus;
+	return false;
+#endif
+}
+
+void *_Nullable placement_allocate(size_t const length, struct cpu_list const *_Nullable const cpus, size_t *_Nonnull const outMappedLength) {
+	*outMappedLength = 0;
+	//A ring whose slots get their data from somewhere else has no buffers to put anywhere.
+	if (length == 0) return NULL;
+	size_t const mappedLength = (length + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+	unsigned char *memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	//This only works if the administrator has set some huge pages aside (vm.nr_hugepages), and enough of them are free.
+	memory = mmap(NULL, mappedLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if (memory == MAP_FAILED) {
+		//A transparent huge page can only go where a whole one fits, so map a huge page more than we need, and trim it to start on a boundary between them.
+		unsigned char *const oversized = mmap(NULL, mappedLength + kHugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (oversized == MAP_FAILED) return NULL;
+		size_t const leadingLength = (kHugePageSize - (uintptr_t)oversized % kHugePageSize) % kHugePageSize;
+		if (leadingLength > 0) munmap(oversized, leadingLength);
+		munmap(oversized + leadingLength + mappedLength, kHugePageSize - leadingLength);
+		memory = oversized + leadingLength;
+#ifdef MADV_HUGEPAGE
+		//Where transparent huge pages are only used when asked for (the usual setting), this asks.
+		madvise(memory, mappedLength, MADV_HUGEPAGE);
+#endif
+	}
+
+	//Linux puts each page on the node of whichever CPU first touches it, so touch them all now, from the node they should be on.
+	bool repinned = false;
+#if EXISTS_PTHREAD_AFFINITY
+	cpu_set_t originalCPUs;
+	repinned = cpus != NULL && pthread_getaffinity_np(pthread_self(), sizeof(originalCPUs), &originalCPUs) == 0 && placement_pinThread(pthread_self(), cpus);
+#else
+	(void)cpus;
+#endif
+	//Locking the memory faults all of it in. If we're over the limit on locked memory, it'll be faulted in as it's used instead, unless it has to go on a particular node.
+	if (mlock(memory, mappedLength) != 0 && repinned) {
+		size_t const pageSize = (size_t)sysconf(_SC_PAGESIZE);
+		for (size_t offset = 0; offset < mappedLength; offset += pageSize) {
+			((unsigned char volatile *)memory)[offset] = 0;
+		}
+	}
+#if EXISTS_PTHREAD_AFFINITY
+	if (repinned) pthread_setaffinity_np(pthread_self(), sizeof(originalCPUs), &originalCPUs);
+#endif
+
+	*outMappedLength = mappedLength;
+	return memory;
+}
+
+void placement_free(void *_Nonnull const memory, size_t const mappedLength) {
+	//Unmapping the memory unlocks it, too.
+	munmap(memory, mappedLength);
+}
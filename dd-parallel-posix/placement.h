@@ -0,0 +1,44 @@
+//
+//  placement.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef placement_h
+#define placement_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+//Where the copy's threads run, and where its buffers' memory comes from.
+//On a machine with more than one NUMA node (e.g., two sockets), each storage controller hangs off of one node. Memory on another node is slower to get to, both for the CPUs copying data through it and for the controller's DMA, and every byte that goes between nodes takes up room on the link between them. So the reader and writer, and the buffers they pass between them, are best kept on the node the device is attached to.
+//Which device is on which node comes from Linux's sysfs. Elsewhere, no device is known to be on any node, and threads can't be pinned.
+
+enum { kPlacementMaximumCPUs = 1024 };
+
+struct cpu_list {
+	uint64_t bits[kPlacementMaximumCPUs / 64];
+};
+
+///Parses a list of CPU numbers and ranges of them, like 0-7,16-23 (the format sysfs and taskset use). Returns false if it's malformed or empty, or names a CPU numbered kPlacementMaximumCPUs or higher.
+bool cpu_list_parse(char const *_Nonnull const string, struct cpu_list *_Nonnull const outList);
+unsigned int cpu_list_count(struct cpu_list const *_Nonnull const list);
+///Writes the list out in the same format, e.g. 0-7,16-23, truncating it if need be.
+void cpu_list_copyDescription(char *_Nonnull const buf, struct cpu_list const *_Nonnull const list, size_t const capacity);
+
+///The NUMA node that the device holding fd hangs off of: the device itself, or, for a regular file, the device its file-system is on. Returns -1 if that can't be known, which includes virtual devices (RAID, LVM, loop devices), and any device on a machine with only one node.
+int placement_nodeForFile(int const fd);
+///Gets the CPUs on the node that this process is allowed to run on. Returns false if there aren't any, or they can't be found out.
+bool placement_cpusOnNode(int const node, struct cpu_list *_Nonnull const outList);
+///Limits the thread to running on the CPUs in the list. Returns false if it can't be (or there's no such thing on this platform).
+bool placement_pinThread(pthread_t const thread, struct cpu_list const *_Nonnull const cpus);
+
+///Maps at least length bytes of memory for buffers, aligned to 2 MiB. The memory is on huge pages if possible (explicit ones, if enough have been reserved, or transparent ones), which takes hundreds of times fewer TLB entries to cover than small pages, and locked into RAM, if the limit on locked memory allows it, so that touching it never faults. If cpus isn't NULL, the memory is faulted in from those CPUs, so it comes from their node. *outMappedLength is set to how much was actually mapped, which is what placement_free needs. Returns NULL if no memory could be mapped, or length is 0, in which case nothing is.
+void *_Nullable placement_allocate(size_t const length, struct cpu_list const *_Nullable const cpus, size_t *_Nonnull const outMappedLength);
+void placement_free(void *_Nonnull const memory, size_t const mappedLength);
+
+#endif /* placement_h */
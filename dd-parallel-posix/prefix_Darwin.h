@@ -28,6 +28,15 @@
 #define pthread_setname_self(name) pthread_setname_np((name))
 
 #define EXISTS_F_RDAHEAD 1
+#define EXISTS_O_DIRECT 0
 #define EXISTS_F_NOCACHE 1
+#define EXISTS_COPY_FILE_RANGE 0
+#define EXISTS_FICLONE 0
+#define EXISTS_FALLOCATE 0
+#define EXISTS_POSIX_FADVISE 0
+#define EXISTS_SYSFS 0
+#define EXISTS_PTHREAD_AFFINITY 0
+#define EXISTS_IO_URING 0
+#define EXISTS_ZLIB 1
 
 #endif /* prefix_Darwin_h */
@@ -42,7 +42,22 @@
 #define pthread_setname_self(name) pthread_setname_np(pthread_self(), (name))
 
 #define EXISTS_F_RDAHEAD 0
+#define EXISTS_O_DIRECT 1
 #define EXISTS_F_NOCACHE 0
+#define EXISTS_COPY_FILE_RANGE 1
+#define EXISTS_FICLONE 1
+#define EXISTS_FALLOCATE 1
+#define EXISTS_POSIX_FADVISE 1
+#define EXISTS_SYSFS 1
+#define EXISTS_PTHREAD_AFFINITY 1
+//configure defines this to 1 if <linux/io_uring.h> is new enough. Whether the running kernel supports io_uring is checked at run time.
+#ifndef EXISTS_IO_URING
+#	define EXISTS_IO_URING 0
+#endif
+//configure defines this to 1 if zlib is installed. Without it, --compress isn't available, and only images with no deflated frames can be decompressed.
+#ifndef EXISTS_ZLIB
+#	define EXISTS_ZLIB 0
+#endif
 
 //Clang predefines __nonnull to _Nonnull and __nullable to _Nullable. GCC doesn't define __nullable at all, but defines __nonnull as a function-like macro, which it uses in its stock headers.
 //So, for Clang compatibility, we use _Nonnull and _Nullable (which are the favored forms anyway), and for GCC compatibility, we define those here whenever __nullable is not defined.
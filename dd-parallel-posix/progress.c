@@ -0,0 +1,223 @@
+//
+//  progress.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "progress.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <math.h>
+
+//A power of two, so the sample index wraps cleanly. With samples at least kMinimumSampleSpacingSeconds apart, the ring holds at least 40 seconds' worth, which is more than the window needs.
+enum { kNumSamples = 4096 };
+static double const kMinimumSampleSpacingSeconds = 0.01;
+//How often the reporter thread samples the total itself.
+static double const kReporterSampleIntervalSeconds = 0.25;
+
+//Bytes written to the wake pipe. A stop that the reporter didn't get around to reading is ignored the next time it starts; a report request isn't.
+enum {
+	wake_report = 'r',
+	wake_stop = 's',
+};
+
+//Each sample has a sequence number, so someone reading the ring can tell a complete sample from one that's being written or has been overwritten: it's 2n+1 while sample number n is being written into it and 2n+2 once it's done.
+struct progress_sample {
+	unsigned long long _Atomic sequence;
+	double _Atomic time;
+	unsigned long long _Atomic total;
+};
+
+struct progress {
+	struct progress_sample samples[kNumSamples];
+	//How many samples have ever been claimed; the next one goes in samples[numSamples % kNumSamples].
+	unsigned long long _Atomic numSamples;
+	double _Atomic lastSampleTime;
+	double startTime;
+	unsigned long long _Atomic const *_Nullable totalBytes;
+
+	//The reporter sleeps in poll on the read end; anyone who wants it awake writes a byte to the write end.
+	int wakeFDs[2];
+	double intervalSeconds;
+	void (*_Nullable report)(bool const wasRequested);
+	pthread_t reporterThread;
+	bool reporterRunning;
+	bool _Atomic stopRequested;
+};
+
+static double progress_now(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_THEGOODONE, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+struct progress *_Nullable progress_create(void) {
+	struct progress *_Nullable const progress = calloc(1, sizeof(struct progress));
+	if (progress == NULL) return NULL;
+	if (pipe(progress->wakeFDs) != 0) {
+		free(progress);
+		return NULL;
+	}
+	//Neither end may block: the signal handler can't wait for room in the pipe (if it's full, a report is already on its way), and the reporter drains it until there's nothing left.
+	fcntl(progress->wakeFDs[0], F_SETFL, O_NONBLOCK);
+	fcntl(progress->wakeFDs[1], F_SETFL, O_NONBLOCK);
+	return progress;
+}
+void progress_destroy(struct progress *_Nonnull const progress) {
+	if (progress->reporterRunning) progress_stopReporter(progress);
+	close(progress->wakeFDs[0]);
+	close(progress->wakeFDs[1]);
+	free(progress);
+}
+
+void progress_begin(struct progress *_Nonnull const progress, unsigned long long _Atomic const *_Nonnull const totalBytes, double const startTime) {
+	for (size_t i = 0; i < kNumSamples; ++i) {
+		progress->samples[i].sequence = 0;
+	}
+	progress->numSamples = 0;
+	progress->lastSampleTime = -INFINITY;
+	progress->startTime = startTime;
+	progress->totalBytes = totalBytes;
+}
+
+void progress_recordSample(struct progress *_Nonnull const progress, double const now, unsigned long long const total) {
+	if (now - atomic_load_explicit(&progress->lastSampleTime, memory_order_relaxed) < kMinimumSampleSpacingSeconds) return;
+	atomic_store_explicit(&progress->lastSampleTime, now, memory_order_relaxed);
+
+	unsigned long long const sampleNumber = atomic_fetch_add_explicit(&progress->numSamples, 1, memory_order_relaxed);
+	struct progress_sample *_Nonnull const sample = &progress->samples[sampleNumber % kNumSamples];
+	atomic_store_explicit(&sample->sequence, sampleNumber * 2 + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&sample->time, now, memory_order_relaxed);
+	atomic_store_explicit(&sample->total, total, memory_order_relaxed);
+	atomic_store_explicit(&sample->sequence, sampleNumber * 2 + 2, memory_order_release);
+}
+
+///Reads sample number sampleNumber, if it's still in the ring and finished being written.
+static bool progress_readSample(struct progress *_Nonnull const progress, unsigned long long const sampleNumber, double *_Nonnull const outTime, unsigned long long *_Nonnull const outTotal) {
+	struct progress_sample *_Nonnull const sample = &progress->samples[sampleNumber % kNumSamples];
+	unsigned long long const sequence = atomic_load_explicit(&sample->sequence, memory_order_acquire);
+	if (sequence != sampleNumber * 2 + 2) return false;
+	*outTime = atomic_load_explicit(&sample->time, memory_order_relaxed);
+	*outTotal = atomic_load_explicit(&sample->total, memory_order_relaxed);
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&sample->sequence, memory_order_relaxed) == sequence;
+}
+
+static double progress_rateBetween(double const startTime, unsigned long long const startTotal, double const endTime, unsigned long long const endTotal) {
+	if (endTime <= startTime || endTotal < startTotal) return 0.0;
+	return (endTotal - startTotal) / (endTime - startTime);
+}
+
+struct progress_rates progress_rates(struct progress *_Nonnull const progress, double const now, unsigned long long const total) {
+	//Walk back from the newest sample, remembering the newest one from far enough back for each rate. The start counts as a sample of 0 bytes, for when the ring doesn't go back that far.
+	double currentBaseTime = progress->startTime, windowBaseTime = progress->startTime;
+	unsigned long long currentBaseTotal = 0, windowBaseTotal = 0;
+	bool foundCurrentBase = false;
+
+	unsigned long long const numSamples = atomic_load_explicit(&progress->numSamples, memory_order_acquire);
+	unsigned long long const oldestSampleNumber = numSamples > kNumSamples ? numSamples - kNumSamples : 0;
+	bool foundWindowBase = false;
+	for (unsigned long long sampleNumber = numSamples; sampleNumber > oldestSampleNumber && ! foundWindowBase; --sampleNumber) {
+		double sampleTime;
+		unsigned long long sampleTotal;
+		if (! progress_readSample(progress, sampleNumber - 1, &sampleTime, &sampleTotal)) continue;
+		if (sampleTime > now) continue;
+		if (! foundCurrentBase && now - sampleTime >= kProgressCurrentRateSeconds) {
+			currentBaseTime = sampleTime;
+			currentBaseTotal = sampleTotal;
+			foundCurrentBase = true;
+		}
+		if (now - sampleTime >= kProgressWindowSeconds) {
+			windowBaseTime = sampleTime;
+			windowBaseTotal = sampleTotal;
+			foundWindowBase = true;
+		} else if (oldestSampleNumber > 0) {
+			//The ring doesn't go back to the start, so the oldest sample in it is the best we have.
+			windowBaseTime = sampleTime;
+			windowBaseTotal = sampleTotal;
+		}
+	}
+
+	return (struct progress_rates){
+		.current = progress_rateBetween(currentBaseTime, currentBaseTotal, now, total),
+		.windowed = progress_rateBetween(windowBaseTime, windowBaseTotal, now, total),
+		.overall = progress_rateBetween(progress->startTime, 0, now, total),
+		.windowSeconds = now - windowBaseTime,
+	};
+}
+
+///Reads everything waiting in the wake pipe. Returns true if any of it was a report request.
+static bool progress_drainWakePipe(struct progress *_Nonnull const progress) {
+	bool reportRequested = false;
+	char bytes[64];
+	ssize_t amountRead;
+	while ((amountRead = read(progress->wakeFDs[0], bytes, sizeof(bytes))) > 0 || (amountRead < 0 && errno == EINTR)) {
+		for (ssize_t i = 0; i < amountRead; ++i) {
+			if (bytes[i] == wake_report) reportRequested = true;
+		}
+	}
+	return reportRequested;
+}
+
+static void *_Nullable progress_reporter_main(void *_Nonnull const arg) {
+	pthread_setname_self("Progress reporter thread");
+	struct progress *_Nonnull const progress = arg;
+	double const startedTime = progress_now();
+	double nextSampleTime = startedTime;
+	double nextReportTime = progress->intervalSeconds > 0.0 ? startedTime + progress->intervalSeconds : INFINITY;
+
+	while (! progress->stopRequested) {
+		double now = progress_now();
+		double const wakeTime = nextSampleTime < nextReportTime ? nextSampleTime : nextReportTime;
+		int const timeoutMS = wakeTime > now ? (int)ceil((wakeTime - now) * 1000.0) : 0;
+		struct pollfd wakePoll = { .fd = progress->wakeFDs[0], .events = POLLIN };
+		int const numReady = poll(&wakePoll, 1, timeoutMS);
+		if (progress->stopRequested) break;
+		bool const reportRequested = numReady > 0 && progress_drainWakePipe(progress);
+		bool reportDue = false;
+
+		now = progress_now();
+		if (now >= nextSampleTime) {
+			progress_recordSample(progress, now, *progress->totalBytes);
+			nextSampleTime = now + kReporterSampleIntervalSeconds;
+		}
+		if (now >= nextReportTime) {
+			reportDue = true;
+			nextReportTime += progress->intervalSeconds;
+			//If a report took longer than the interval, don't try to catch up.
+			if (nextReportTime <= now) nextReportTime = now + progress->intervalSeconds;
+		}
+		if (reportRequested || reportDue) progress->report(reportRequested);
+	}
+	return NULL;
+}
+
+bool progress_startReporter(struct progress *_Nonnull const progress, double const intervalSeconds, void (*_Nonnull const report)(bool const wasRequested)) {
+	if (progress->reporterRunning || progress->totalBytes == NULL) return false;
+	progress->intervalSeconds = intervalSeconds;
+	progress->report = report;
+	progress->stopRequested = false;
+	progress->reporterRunning = pthread_create(&progress->reporterThread, /*attr*/ NULL, progress_reporter_main, progress) == 0;
+	return progress->reporterRunning;
+}
+void progress_stopReporter(struct progress *_Nonnull const progress) {
+	if (! progress->reporterRunning) return;
+	progress->stopRequested = true;
+	char const byte = wake_stop;
+	write(progress->wakeFDs[1], &byte, 1);
+	pthread_join(progress->reporterThread, /*retval*/ NULL);
+	progress->reporterRunning = false;
+}
+
+void progress_requestReport(struct progress *_Nonnull const progress) {
+	//This gets called from signal handlers, which mustn't disturb errno for whatever they interrupted.
+	int const savedErrno = errno;
+	char const byte = wake_report;
+	write(progress->wakeFDs[1], &byte, 1);
+	errno = savedErrno;
+}
@@ -0,0 +1,53 @@
+//
+//  progress.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef progress_h
+#define progress_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+//A progress tracker keeps a fixed-size ring of samples—a time, and how many bytes had been done by then—from which it works out how fast things are going right now, over the last little while, and overall. Samples are added without taking any locks, and the ring never grows; once it's full, each new sample replaces the oldest.
+//It can also run a reporter thread, which reports progress when asked (by a signal handler, say, which can't safely do any of the formatting and printing itself) and, optionally, every so often.
+
+//How far back the current rate and the windowed rate look, in seconds.
+#define kProgressCurrentRateSeconds 1.0
+#define kProgressWindowSeconds 30.0
+
+struct progress_rates {
+	//All in bytes per second.
+	double current;
+	double windowed;
+	double overall;
+	//How much time the windowed rate actually covers; less than kProgressWindowSeconds early on.
+	double windowSeconds;
+};
+
+struct progress;
+
+///Returns NULL if the tracker can't be allocated.
+struct progress *_Nullable progress_create(void);
+///Stops the reporter thread, if it's running.
+void progress_destroy(struct progress *_Nonnull const progress);
+
+///Forgets all samples and starts tracking something new, which started at startTime (in seconds, from whatever CLOCK_THEGOODONE counts from) and is counted by *totalBytes. Don't call this while the reporter thread is running.
+void progress_begin(struct progress *_Nonnull const progress, unsigned long long _Atomic const *_Nonnull const totalBytes, double const startTime);
+
+///Records that total bytes had been done as of now. Safe to call from any number of threads at once. Samples closer together than a few milliseconds are dropped, so it's cheap enough to call for every block.
+void progress_recordSample(struct progress *_Nonnull const progress, double const now, unsigned long long const total);
+///Works out the rates, up to now, when total bytes have been done.
+struct progress_rates progress_rates(struct progress *_Nonnull const progress, double const now, unsigned long long const total);
+
+///Starts a thread that samples *totalBytes a few times a second (so the rates don't depend on how often anything else records samples), and calls report whenever progress_requestReport is called (with wasRequested true) and, if intervalSeconds is greater than 0, every intervalSeconds (with wasRequested false, unless a request came in at the same time).
+bool progress_startReporter(struct progress *_Nonnull const progress, double const intervalSeconds, void (*_Nonnull const report)(bool const wasRequested));
+///Stops the reporter thread and waits for it to exit, including from any report it's in the middle of.
+void progress_stopReporter(struct progress *_Nonnull const progress);
+///Wakes the reporter thread to call its report function. This is async-signal-safe; it's all a signal handler should do. If the reporter isn't running, the report happens as soon as it starts.
+void progress_requestReport(struct progress *_Nonnull const progress);
+
+#endif /* progress_h */
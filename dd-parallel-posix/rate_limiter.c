@@ -0,0 +1,166 @@
+//
+//  rate_limiter.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "rate_limiter.h"
+#include "formatting_utils.h"
+
+#include <stdlib.h>
+
+//The bucket holds this much time's worth of tokens, so a write can go out right away after a pause, but not so many that the limit stops meaning anything.
+static double const kBurstSeconds = 0.25;
+
+//The automatic limiter measures the rate over windows this long.
+static double const kWindowSeconds = 2.0;
+//The rate has collapsed if it stays under this fraction of what it should be (the best rate seen, or the limit) for this many windows in a row. One slow window could be anything; several in a row is the drive.
+static double const kCollapseFraction = 0.5;
+enum { kCollapseWindows = 3 };
+//The first limit, as a fraction of the best rate seen, and how much each later collapse cuts the limit by.
+static double const kFirstLimitFraction = 0.5;
+static double const kBackOffFactor = 0.75;
+//After backing off, the drive is still hot and still throttled. Give it this long to cool down before judging the new limit.
+static double const kCooldownSeconds = 30.0;
+//Once the rate has held at (nearly) the limit for this long, raise the limit by this fraction of the best rate seen.
+static double const kProbeSeconds = 30.0;
+static double const kHeldFraction = 0.9;
+static double const kProbeStepFraction = 0.05;
+//Never limit to less than this, whatever happens.
+static double const kMinimumLimit = 1024.0 * 1024.0;
+
+struct rate_limiter {
+	//0 means no limit.
+	double bytesPerSecond;
+	double tokens;
+	double lastRefillTime;
+	bool hasStarted;
+
+	bool automatic;
+	double windowStartTime;
+	unsigned long long windowBytes;
+	double peakBytesPerSecond;
+	unsigned int numSlowWindows;
+	double cooldownEndTime;
+	double heldSeconds;
+	unsigned int numBackOffs;
+	unsigned int numProbes;
+	double lowestLimit;
+};
+
+struct rate_limiter *_Nullable rate_limiter_create(double const bytesPerSecond, bool const automatic) {
+	struct rate_limiter *_Nullable const limiter = calloc(1, sizeof(struct rate_limiter));
+	if (limiter == NULL) return NULL;
+	limiter->automatic = automatic;
+	limiter->bytesPerSecond = automatic ? 0.0 : bytesPerSecond;
+	return limiter;
+}
+void rate_limiter_destroy(struct rate_limiter *_Nonnull const limiter) {
+	free(limiter);
+}
+
+double rate_limiter_currentLimit(struct rate_limiter const *_Nonnull const limiter) {
+	return limiter->bytesPerSecond;
+}
+
+static void rate_limiter_setLimit(struct rate_limiter *_Nonnull const limiter, double const bytesPerSecond) {
+	limiter->bytesPerSecond = bytesPerSecond > kMinimumLimit ? bytesPerSecond : kMinimumLimit;
+	if (limiter->lowestLimit == 0.0 || limiter->bytesPerSecond < limiter->lowestLimit) limiter->lowestLimit = limiter->bytesPerSecond;
+	//Start the new limit with an empty bucket, so it takes effect right away.
+	limiter->tokens = 0.0;
+}
+
+///Called at the end of each window with the rate over it, to decide whether to change the limit.
+static void rate_limiter_windowEnded(struct rate_limiter *_Nonnull const limiter, double const bytesPerSecond, double const now) {
+	if (limiter->bytesPerSecond == 0.0) {
+		//No limit yet. Watch for the rate to fall off a cliff.
+		if (bytesPerSecond > limiter->peakBytesPerSecond) limiter->peakBytesPerSecond = bytesPerSecond;
+		limiter->numSlowWindows = bytesPerSecond < limiter->peakBytesPerSecond * kCollapseFraction ? limiter->numSlowWindows + 1 : 0;
+		if (limiter->numSlowWindows >= kCollapseWindows) {
+			rate_limiter_setLimit(limiter, limiter->peakBytesPerSecond * kFirstLimitFraction);
+			++limiter->numBackOffs;
+			limiter->numSlowWindows = 0;
+			limiter->cooldownEndTime = now + kCooldownSeconds;
+			limiter->heldSeconds = 0.0;
+		}
+		return;
+	}
+
+	if (now < limiter->cooldownEndTime) return;
+	if (bytesPerSecond < limiter->bytesPerSecond * kCollapseFraction) {
+		//Still collapsing, even at this limit: it's too high.
+		if (++limiter->numSlowWindows >= kCollapseWindows) {
+			rate_limiter_setLimit(limiter, limiter->bytesPerSecond * kBackOffFactor);
+			++limiter->numBackOffs;
+			limiter->numSlowWindows = 0;
+			limiter->cooldownEndTime = now + kCooldownSeconds;
+		}
+		limiter->heldSeconds = 0.0;
+	} else if (bytesPerSecond >= limiter->bytesPerSecond * kHeldFraction) {
+		limiter->numSlowWindows = 0;
+		limiter->heldSeconds += kWindowSeconds;
+		if (limiter->heldSeconds >= kProbeSeconds && limiter->bytesPerSecond < limiter->peakBytesPerSecond) {
+			double const raisedLimit = limiter->bytesPerSecond + limiter->peakBytesPerSecond * kProbeStepFraction;
+			limiter->bytesPerSecond = raisedLimit < limiter->peakBytesPerSecond ? raisedLimit : limiter->peakBytesPerSecond;
+			++limiter->numProbes;
+			limiter->heldSeconds = 0.0;
+		}
+	} else {
+		//Somewhere in between: maybe the input is the slow one. Neither raise nor lower the limit.
+		limiter->numSlowWindows = 0;
+		limiter->heldSeconds = 0.0;
+	}
+}
+
+double rate_limiter_delayForWrite(struct rate_limiter *_Nonnull const limiter, size_t const length, double const now) {
+	if (! limiter->hasStarted) {
+		limiter->hasStarted = true;
+		limiter->lastRefillTime = now;
+		limiter->windowStartTime = now;
+		limiter->tokens = limiter->bytesPerSecond * kBurstSeconds;
+	}
+
+	if (limiter->automatic) {
+		limiter->windowBytes += length;
+		if (now - limiter->windowStartTime >= kWindowSeconds) {
+			rate_limiter_windowEnded(limiter, limiter->windowBytes / (now - limiter->windowStartTime), now);
+			limiter->windowStartTime = now;
+			limiter->windowBytes = 0;
+		}
+	}
+	if (limiter->bytesPerSecond == 0.0) {
+		limiter->lastRefillTime = now;
+		return 0.0;
+	}
+
+	double const bucketCapacity = limiter->bytesPerSecond * kBurstSeconds;
+	limiter->tokens += (now - limiter->lastRefillTime) * limiter->bytesPerSecond;
+	if (limiter->tokens > bucketCapacity) limiter->tokens = bucketCapacity;
+	limiter->lastRefillTime = now;
+	//A write bigger than the bucket can hold would never find enough tokens, so it goes into debt instead, and the wait is however long it takes to pay that off.
+	limiter->tokens -= length;
+	return limiter->tokens < 0.0 ? -limiter->tokens / limiter->bytesPerSecond : 0.0;
+}
+
+void rate_limiter_printReport(struct rate_limiter const *_Nonnull const limiter, FILE *_Nonnull const file) {
+	if (! limiter->automatic) return;
+	enum { phraseCapacity = 64 };
+	char phrase[phraseCapacity];
+	if (limiter->peakBytesPerSecond == 0.0) {
+		fprintf(file, "The copy finished before the write rate could be measured, so it was never limited\n");
+		return;
+	}
+	if (limiter->numBackOffs == 0) {
+		copyByteCountPhrase(phrase, limiter->peakBytesPerSecond, phraseCapacity);
+		fprintf(file, "The write rate never collapsed (best %s/sec), so it was never limited\n", phrase);
+		return;
+	}
+	copyByteCountPhrase(phrase, limiter->peakBytesPerSecond, phraseCapacity);
+	fprintf(file, "The write rate collapsed from a best of %s/sec, so it was limited", phrase);
+	copyByteCountPhrase(phrase, limiter->lowestLimit, phraseCapacity);
+	fprintf(file, " (backed off %u time%s, to as low as %s/sec; raised %u time%s);", limiter->numBackOffs, limiter->numBackOffs == 1 ? "" : "s", phrase, limiter->numProbes, limiter->numProbes == 1 ? "" : "s");
+	copyByteCountPhrase(phrase, limiter->bytesPerSecond, phraseCapacity);
+	fprintf(file, " the limit ended at %s/sec\n", phrase);
+}
@@ -0,0 +1,33 @@
+//
+//  rate_limiter.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef rate_limiter_h
+#define rate_limiter_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+//A rate limiter holds writes to a number of bytes per second, with a token bucket: each write spends as many tokens as it has bytes, tokens come back at the limit rate, and a write that finds too few waits until there are enough.
+//In automatic mode, there's no limit at first; instead, the limiter watches how fast writes are going. Some SSDs, written to flat out, overheat and throttle themselves to a fraction of their speed until they cool off, which can take minutes. When the rate collapses like that, the limiter sets a limit well under the fastest rate it saw, to give the drive a chance to cool and then keep it from overheating again. After the rate has held at the limit for a while, it raises the limit a little, in case the drive can take it; if the rate collapses again, it backs the limit off further.
+
+struct rate_limiter;
+
+///Creates a rate limiter with a fixed limit of bytesPerSecond, or, if automatic is true, one that works out its own limit (bytesPerSecond is then ignored). Returns NULL if it can't be allocated.
+struct rate_limiter *_Nullable rate_limiter_create(double const bytesPerSecond, bool const automatic);
+void rate_limiter_destroy(struct rate_limiter *_Nonnull const limiter);
+
+///For the writer: about to write length bytes, as of now (in seconds, from any fixed starting point). Returns how many seconds to wait before writing them; the caller does the waiting. Only one thread may call this.
+double rate_limiter_delayForWrite(struct rate_limiter *_Nonnull const limiter, size_t const length, double const now);
+
+///The limit in effect, in bytes per second; 0 if there isn't one (yet).
+double rate_limiter_currentLimit(struct rate_limiter const *_Nonnull const limiter);
+///Writes a description of what an automatic limiter did: how fast writes went at best, how many times it backed off, and where the limit ended up. Only call this once the writer is done.
+void rate_limiter_printReport(struct rate_limiter const *_Nonnull const limiter, FILE *_Nonnull const file);
+
+#endif /* rate_limiter_h */
@@ -0,0 +1,436 @@
+//
+//  rescue_map.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "rescue_map.h"
+#include "formatting_utils.h"
+
+#include <sys/stat.h>
+
+static char const *const kRescueMapSignature = "dd-parallel rescue map 1\n";
+//How many blocks the second pass reads successfully between saves of the map. (It's saved after every failure regardless.)
+enum { kBlocksBetweenSaves = 1024 };
+
+enum {
+	errorMaxLength = 255,
+	errorCapacity,
+};
+static char errorBuffer[errorCapacity] = { 0 };
+
+struct rescue_range {
+	unsigned long long offset, length;
+};
+
+struct rescue_map {
+	char *_Nonnull path;
+	//The map is written here, then renamed over path, so there's always a whole map at path.
+	char *_Nonnull temporaryPath;
+	unsigned long long inputSize;
+	unsigned long long pendingOffset;
+	//Sorted, and never overlapping or touching.
+	struct rescue_range *_Nullable ranges;
+	size_t numRanges, rangesCapacity;
+
+	//The thread that saves the map every so often during the first pass, as the journal's does its checkpoints. The lock keeps it from saving while the reader is changing the ranges.
+	pthread_mutex_t lock;
+	int outputFD;
+	unsigned int intervalSeconds;
+	unsigned long long (*_Nullable firstPassProgress)(void);
+	pthread_t saveThread;
+	bool saving;
+	bool stopRequested;
+	bool saveFailed;
+	pthread_cond_t stopCondition;
+};
+
+///Makes sure everything written to fd so far is on the disk itself, not just in the drive's cache.
+static bool syncToDisk(int const fd) {
+#ifdef F_FULLFSYNC
+	//On macOS, fsync only gets the data as far as the drive.
+	if (fcntl(fd, F_FULLFSYNC) == 0) return true;
+#endif
+	return fsync(fd) == 0;
+}
+
+static bool rescue_map_addBadRangeUnlocked(struct rescue_map *_Nonnull const map, unsigned long long const offset, unsigned long long const length) {
+	if (length == 0) return true;
+	unsigned long long start = offset, end = offset + length;
+	//Find the first range that ends at or after the new one's start. It, and every one after it that starts at or before the new one's end, become part of the new one.
+	size_t low = 0, high = map->numRanges;
+	while (low < high) {
+		size_t const middle = low + (high - low) / 2;
+		if (map->ranges[middle].offset + map->ranges[middle].length < start) low = middle + 1;
+		else high = middle;
+	}
+	size_t afterAbsorbed = low;
+	while (afterAbsorbed < map->numRanges && map->ranges[afterAbsorbed].offset <= end) {
+		struct rescue_range const absorbed = map->ranges[afterAbsorbed];
+		if (absorbed.offset < start) start = absorbed.offset;
+		if (absorbed.offset + absorbed.length > end) end = absorbed.offset + absorbed.length;
+		++afterAbsorbed;
+	}
+	size_t const numAbsorbed = afterAbsorbed - low;
+	if (numAbsorbed == 0) {
+		if (map->numRanges == map->rangesCapacity) {
+			size_t const newCapacity = map->rangesCapacity > 0 ? map->rangesCapacity * 2 : 64;
+			struct rescue_range *_Nullable const newRanges = realloc(map->ranges, newCapacity * sizeof(struct rescue_range));
+			if (newRanges == NULL) return false;
+			map->ranges = newRanges;
+			map->rangesCapacity = newCapacity;
+		}
+		memmove(map->ranges + low + 1, map->ranges + low, (map->numRanges - low) * sizeof(struct rescue_range));
+		++map->numRanges;
+	} else {
+		memmove(map->ranges + low + 1, map->ranges + afterAbsorbed, (map->numRanges - afterAbsorbed) * sizeof(struct rescue_range));
+		map->numRanges -= numAbsorbed - 1;
+	}
+	map->ranges[low] = (struct rescue_range){ .offset = start, .length = end - start };
+	return true;
+}
+bool rescue_map_addBadRange(struct rescue_map *_Nonnull const map, unsigned long long const offset, unsigned long long const length) {
+	pthread_mutex_lock(&map->lock);
+	bool const added = rescue_map_addBadRangeUnlocked(map, offset, length);
+	pthread_mutex_unlock(&map->lock);
+	return added;
+}
+
+///Reads an existing map. Returns false, with errorBuffer filled in, if it isn't a map or it's for a different input.
+static bool rescue_map_read(struct rescue_map *_Nonnull const map, FILE *_Nonnull const file) {
+	char line[256];
+	if (fgets(line, sizeof(line), file) == NULL || strcmp(line, kRescueMapSignature) != 0) {
+		strlcpy(errorBuffer, "not a dd-parallel rescue map", errorCapacity);
+		return false;
+	}
+	unsigned long long mappedInputSize = 0;
+	if (fgets(line, sizeof(line), file) == NULL || sscanf(line, "input-size %llu", &mappedInputSize) != 1) {
+		strlcpy(errorBuffer, "rescue map has no header", errorCapacity);
+		return false;
+	}
+	if (mappedInputSize != map->inputSize) {
+		snprintf(errorBuffer, errorCapacity, "rescue map is for a different input (of %llu bytes)", mappedInputSize);
+		return false;
+	}
+	while (fgets(line, sizeof(line), file) != NULL) {
+		unsigned long long offset = 0, length = 0;
+		if (sscanf(line, "pending %llu", &offset) == 1) {
+			length = map->inputSize - (offset < map->inputSize ? offset : map->inputSize);
+		} else if (sscanf(line, "bad %llu %llu", &offset, &length) != 2 || offset > map->inputSize || length > map->inputSize - offset) {
+			snprintf(errorBuffer, errorCapacity, "rescue map is damaged (it has a line that doesn't make sense: %.*s)", (int)strcspn(line, "\n"), line);
+			return false;
+		}
+		//Whatever the first pass hadn't gotten to is as good as bad: the second pass has to read it.
+		if (! rescue_map_addBadRangeUnlocked(map, offset, length)) {
+			strlcpy(errorBuffer, "Could not allocate rescue map", errorCapacity);
+			return false;
+		}
+	}
+	map->pendingOffset = map->inputSize;
+	return true;
+}
+
+///Syncs outputFD, if it's not -1, so that what the map is about to say has been rescued really is on the disk; then rewrites the map's file with its ranges, and then remainder and the numRest ranges in rest (which the second pass hasn't gotten to yet, and are after all of the map's ranges).
+static bool rescue_map_write(struct rescue_map *_Nonnull const map, int const outputFD, struct rescue_range const *_Nullable const remainder, struct rescue_range const *_Nullable const rest, size_t const numRest) {
+	if (outputFD >= 0 && ! syncToDisk(outputFD)) goto fail;
+	int const fd = open(map->temporaryPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) goto fail;
+	FILE *_Nullable const file = fdopen(fd, "w");
+	if (file == NULL) {
+		close(fd);
+		goto fail;
+	}
+	fprintf(file, "%sinput-size %llu\n", kRescueMapSignature, map->inputSize);
+	if (map->pendingOffset < map->inputSize) fprintf(file, "pending %llu\n", map->pendingOffset);
+	for (size_t i = 0; i < map->numRanges; ++i) {
+		fprintf(file, "bad %llu %llu\n", map->ranges[i].offset, map->ranges[i].length);
+	}
+	if (remainder != NULL && remainder->length > 0) fprintf(file, "bad %llu %llu\n", remainder->offset, remainder->length);
+	for (size_t i = 0; i < numRest; ++i) {
+		fprintf(file, "bad %llu %llu\n", rest[i].offset, rest[i].length);
+	}
+	bool const written = fflush(file) == 0 && ! ferror(file) && syncToDisk(fd);
+	int const writeError = errno;
+	fclose(file);
+	if (! written) {
+		errno = writeError;
+		goto fail;
+	}
+	if (rename(map->temporaryPath, map->path) != 0) goto fail;
+	return true;
+
+fail:
+	copyErrorDescription(errorBuffer, errno, errorCapacity);
+	return false;
+}
+
+struct rescue_map *_Nullable rescue_map_open(char const *_Nonnull const path, unsigned long long const inputSize, bool *_Nonnull const outExisted, char const *_Nullable *_Nonnull const outError) {
+	*outExisted = false;
+	*outError = NULL;
+	struct rescue_map *_Nullable const map = calloc(1, sizeof(struct rescue_map));
+	if (map == NULL) {
+		*outError = "Could not allocate rescue map";
+		return NULL;
+	}
+	map->inputSize = inputSize;
+	map->outputFD = -1;
+	pthread_mutex_init(&map->lock, /*attr*/ NULL);
+	pthread_cond_init(&map->stopCondition, /*attr*/ NULL);
+	map->path = strdup(path);
+	size_t const temporaryPathLength = strlen(path) + sizeof(".new");
+	map->temporaryPath = malloc(temporaryPathLength);
+	if (map->path == NULL || map->temporaryPath == NULL) {
+		strlcpy(errorBuffer, "Could not allocate rescue map", errorCapacity);
+		goto fail;
+	}
+	snprintf(map->temporaryPath, temporaryPathLength, "%s.new", path);
+
+	FILE *_Nullable const file = fopen(path, "r");
+	if (file != NULL) {
+		bool const readOK = rescue_map_read(map, file);
+		fclose(file);
+		if (! readOK) goto fail;
+		*outExisted = true;
+	} else if (errno == ENOENT) {
+		//Write it out now, so that if this run gets no further, the next one knows to read everything.
+		map->pendingOffset = 0;
+		if (! rescue_map_write(map, -1, NULL, NULL, 0)) goto fail;
+	} else {
+		copyErrorDescription(errorBuffer, errno, errorCapacity);
+		goto fail;
+	}
+	return map;
+
+fail:
+	*outError = errorBuffer;
+	rescue_map_destroy(map);
+	return NULL;
+}
+void rescue_map_destroy(struct rescue_map *_Nonnull const map) {
+	if (map->saving) rescue_map_stopSaving(map);
+	pthread_cond_destroy(&map->stopCondition);
+	pthread_mutex_destroy(&map->lock);
+	free(map->ranges);
+	free(map->temporaryPath);
+	free(map->path);
+	free(map);
+}
+
+bool rescue_map_save(struct rescue_map *_Nonnull const map, int const outputFD, unsigned long long const pendingOffset, char const *_Nullable *_Nonnull const outError) {
+	pthread_mutex_lock(&map->lock);
+	//It never goes backward: the saving thread may have already recorded more than the caller knew about.
+	if (pendingOffset > map->pendingOffset) map->pendingOffset = pendingOffset < map->inputSize ? pendingOffset : map->inputSize;
+	bool const saved = rescue_map_write(map, outputFD, NULL, NULL, 0);
+	pthread_mutex_unlock(&map->lock);
+	if (! saved) *outError = errorBuffer;
+	return saved;
+}
+
+static void *_Nullable rescue_map_save_thread_main(void *_Nonnull const arg) {
+	pthread_setname_self("Rescue map thread");
+	struct rescue_map *_Nonnull const map = arg;
+	pthread_mutex_lock(&map->lock);
+	while (! map->stopRequested) {
+		struct timespec wakeTime;
+		clock_gettime(CLOCK_REALTIME, &wakeTime);
+		wakeTime.tv_sec += map->intervalSeconds;
+		while (! map->stopRequested && pthread_cond_timedwait(&map->stopCondition, &map->lock, &wakeTime) != ETIMEDOUT);
+		if (map->stopRequested) break;
+		//Take the progress first: everything written before this point will be covered by the sync. The sync can take a while, so do it without the lock, so the reader can go on adding ranges meanwhile.
+		unsigned long long const pendingOffset = map->firstPassProgress();
+		pthread_mutex_unlock(&map->lock);
+		bool const synced = syncToDisk(map->outputFD);
+		pthread_mutex_lock(&map->lock);
+		if (! synced) {
+			map->saveFailed = true;
+			continue;
+		}
+		if (pendingOffset > map->pendingOffset) map->pendingOffset = pendingOffset < map->inputSize ? pendingOffset : map->inputSize;
+		if (! rescue_map_write(map, /*outputFD*/ -1, NULL, NULL, 0)) map->saveFailed = true;
+	}
+	pthread_mutex_unlock(&map->lock);
+	return NULL;
+}
+
+bool rescue_map_startSaving(struct rescue_map *_Nonnull const map, int const outputFD, unsigned int const intervalSeconds, unsigned long long (*_Nonnull const firstPassProgress)(void)) {
+	map->outputFD = outputFD;
+	map->intervalSeconds = intervalSeconds;
+	map->firstPassProgress = firstPassProgress;
+	map->stopRequested = false;
+	map->saving = pthread_create(&map->saveThread, /*attr*/ NULL, rescue_map_save_thread_main, map) == 0;
+	return map->saving;
+}
+bool rescue_map_stopSaving(struct rescue_map *_Nonnull const map) {
+	if (! map->saving) return false;
+	pthread_mutex_lock(&map->lock);
+	map->stopRequested = true;
+	pthread_cond_signal(&map->stopCondition);
+	pthread_mutex_unlock(&map->lock);
+	pthread_join(map->saveThread, /*retval*/ NULL);
+	map->saving = false;
+	return ! map->saveFailed;
+}
+
+unsigned long long rescue_map_inputSize(struct rescue_map const *_Nonnull const map) {
+	return map->inputSize;
+}
+unsigned long long rescue_map_amountBad(struct rescue_map const *_Nonnull const map) {
+	unsigned long long amount = 0;
+	for (size_t i = 0; i < map->numRanges; ++i) {
+		amount += map->ranges[i].length;
+	}
+	return amount;
+}
+unsigned long long rescue_map_numBadRanges(struct rescue_map const *_Nonnull const map) {
+	return map->numRanges;
+}
+
+#pragma mark The second pass
+
+///Reads length bytes at offset, rounding the length up to alignment (the buffer has room). Returns how many of the bytes asked for were read (fewer only at the end of the input), or -1 if a read failed.
+static ssize_t preadAligned(int const fd, void *_Nonnull const buffer, size_t const length, unsigned long long const offset, size_t const alignment) {
+	size_t const lengthToRead = alignment > 0 ? (length + alignment - 1) / alignment * alignment : length;
+	size_t amtRead = 0;
+	while (amtRead < lengthToRead) {
+		ssize_t const thisRead = pread(fd, (unsigned char *)buffer + amtRead, lengthToRead - amtRead, offset + amtRead);
+		if (thisRead < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (thisRead == 0) break;
+		amtRead += thisRead;
+		if (alignment > 0 && amtRead % alignment != 0) break;
+	}
+	return amtRead < length ? amtRead : length;
+}
+static bool pwriteFully(int const fd, void const *_Nonnull const buffer, size_t const length, unsigned long long const offset) {
+	size_t amtWritten = 0;
+	while (amtWritten < length) {
+		ssize_t const thisWrite = pwrite(fd, (unsigned char const *)buffer + amtWritten, length - amtWritten, offset + amtWritten);
+		if (thisWrite < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		amtWritten += thisWrite;
+	}
+	return true;
+}
+
+char const *_Nullable rescue_map_retry(struct rescue_map *_Nonnull const map, int const inputFD, int const outputFD, size_t const blockSize, size_t const sectorSize, size_t const alignment, unsigned int const maxAttempts, unsigned long long _Atomic *_Nonnull const totalAmountRecovered) {
+	size_t const pageSize = sysconf(_SC_PAGESIZE);
+	size_t const bufferAlignment = alignment > pageSize ? alignment : pageSize;
+	void *_Nullable buffer = NULL, *_Nullable zeros = NULL;
+	if (posix_memalign(&buffer, bufferAlignment, blockSize) != 0 || posix_memalign(&zeros, bufferAlignment, sectorSize) != 0) {
+		free(buffer);
+		return "Could not allocate rescue buffers";
+	}
+	memset(zeros, 0, sectorSize);
+
+	//The map's ranges get rebuilt from whatever still fails; until the pass gets to them, the old ones are still bad.
+	struct rescue_range *_Nullable const oldRanges = map->ranges;
+	size_t const numOldRanges = map->numRanges;
+	map->ranges = NULL;
+	map->numRanges = map->rangesCapacity = 0;
+	map->pendingOffset = map->inputSize;
+
+	char const *_Nullable failure = NULL;
+	unsigned int numBlocksSinceSave = 0;
+	//If the pass fails, the range it was in the middle of, and how far into it it got.
+	size_t rangeIdx = 0;
+	unsigned long long position = 0;
+	for (; rangeIdx < numOldRanges; ++rangeIdx) {
+		unsigned long long const rangeEnd = oldRanges[rangeIdx].offset + oldRanges[rangeIdx].length;
+		position = oldRanges[rangeIdx].offset;
+		while (position < rangeEnd) {
+			size_t const chunkLength = rangeEnd - position < blockSize ? rangeEnd - position : blockSize;
+			ssize_t const amtRead = preadAligned(inputFD, buffer, chunkLength, position, alignment);
+			if (amtRead > 0) {
+				if (! pwriteFully(outputFD, buffer, amtRead, position)) {
+					copyErrorDescription(errorBuffer, errno, errorCapacity);
+					failure = errorBuffer;
+					break;
+				}
+				*totalAmountRecovered += amtRead;
+				position += amtRead;
+				if (++numBlocksSinceSave < kBlocksBetweenSaves) continue;
+			} else if (amtRead == 0) {
+				//The input is shorter than it was. Nothing past its end can be read, however many tries it gets.
+				if (! rescue_map_addBadRange(map, position, rangeEnd - position)) {
+					failure = "Could not allocate rescue map";
+					break;
+				}
+				position = rangeEnd;
+			} else {
+				//Somewhere in this block is at least one bad sector. Try each sector on its own, so that only the bad ones are lost.
+				unsigned long long const chunkEnd = position + chunkLength;
+				while (position < chunkEnd && failure == NULL) {
+					unsigned long long const sectorEnd = (position / sectorSize + 1) * sectorSize < chunkEnd ? (position / sectorSize + 1) * sectorSize : chunkEnd;
+					size_t const thisLength = sectorEnd - position;
+					ssize_t sectorRead = -1;
+					for (unsigned int attempt = 0; attempt < maxAttempts && sectorRead < 0; ++attempt) {
+						sectorRead = preadAligned(inputFD, buffer, thisLength, position, alignment);
+					}
+					if (sectorRead > 0) {
+						if (! pwriteFully(outputFD, buffer, sectorRead, position)) {
+							copyErrorDescription(errorBuffer, errno, errorCapacity);
+							failure = errorBuffer;
+							break;
+						}
+						*totalAmountRecovered += sectorRead;
+						position += sectorRead;
+					} else {
+						//This one's gone. Whatever was in the output here before, it should read back as zeros, not as something that looks like data.
+						if (! pwriteFully(outputFD, zeros, thisLength, position)) {
+							copyErrorDescription(errorBuffer, errno, errorCapacity);
+							failure = errorBuffer;
+							break;
+						}
+						if (! rescue_map_addBadRange(map, position, thisLength)) {
+							failure = "Could not allocate rescue map";
+							break;
+						}
+						position += thisLength;
+					}
+				}
+				if (failure != NULL) break;
+			}
+			numBlocksSinceSave = 0;
+			struct rescue_range const remainder = { .offset = position, .length = rangeEnd - position };
+			if (! rescue_map_write(map, outputFD, &remainder, oldRanges + rangeIdx + 1, numOldRanges - rangeIdx - 1)) {
+				failure = errorBuffer;
+				break;
+			}
+		}
+		if (failure != NULL) break;
+	}
+	if (failure != NULL && rangeIdx < numOldRanges) {
+		//Put back what's left of the range the pass was in the middle of, and the ones it didn't get to, so the map doesn't claim they've been rescued. (Anything before position in that range has been dealt with: either read, or already put back in the map as bad.)
+		unsigned long long const rangeEnd = oldRanges[rangeIdx].offset + oldRanges[rangeIdx].length;
+		rescue_map_addBadRange(map, position, rangeEnd - position);
+		for (size_t i = rangeIdx + 1; i < numOldRanges; ++i) {
+			rescue_map_addBadRange(map, oldRanges[i].offset, oldRanges[i].length);
+		}
+	}
+	//If the last write of the map fails, the map in memory is still right; only the file is behind.
+	if (failure == NULL && ! rescue_map_write(map, outputFD, NULL, NULL, 0)) failure = errorBuffer;
+	free(oldRanges);
+	free(buffer);
+	free(zeros);
+	return failure;
+}
+
+void rescue_map_remove(struct rescue_map *_Nonnull const map) {
+	unlink(map->path);
+}
+
+void rescue_map_printReport(struct rescue_map const *_Nonnull const map, FILE *_Nonnull const file) {
+	if (map->numRanges == 0) {
+		fprintf(file, "Everything was rescued\n");
+		return;
+	}
+	char phrase[256];
+	copyByteCountPhrase(phrase, rescue_map_amountBad(map), sizeof(phrase));
+	fprintf(file, "Could not read %llu %s, totalling %s; %s zeros in the output, and listed in %s for another try\n", (unsigned long long)map->numRanges, map->numRanges == 1 ? "range" : "ranges", phrase, map->numRanges == 1 ? "it's" : "they're", map->path);
+}
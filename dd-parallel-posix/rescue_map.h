@@ -0,0 +1,56 @@
+//
+//  rescue_map.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef rescue_map_h
+#define rescue_map_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+//A rescue map records which parts of a failing input couldn't be read, so they can be tried again later, and only they. Each range in it has been written to the output as zeros.
+//Rescuing goes in two passes. The first copies everything it can at full speed, and every block it can't read goes into the map, and gets skipped (along with some of what comes after it, since bad areas tend to go on for a while). The second goes back over the map, reading each range a block at a time, and each block that still fails a sector at a time, a few times over; whatever's still bad after that stays in the map.
+//It's a text file, rewritten (after syncing the output) every few seconds during the first pass, at the end of it, and as the second pass goes. It looks like this:
+//	dd-parallel rescue map 1
+//	input-size 4000787030016
+//	pending 1073741824
+//	bad 52428800 1048576
+//	bad 104857600 4096
+//pending, if it's there, is where the first pass had gotten to when the map was last written: a run that didn't finish. Everything from there on counts as bad.
+
+struct rescue_map;
+
+///Opens the map at path, for an input of inputSize bytes. If it exists, it must be for an input of that size, and *outExisted is set to true; otherwise it's created, with everything pending. Returns NULL on failure, with *outError set to a description of the problem.
+struct rescue_map *_Nullable rescue_map_open(char const *_Nonnull const path, unsigned long long const inputSize, bool *_Nonnull const outExisted, char const *_Nullable *_Nonnull const outError);
+void rescue_map_destroy(struct rescue_map *_Nonnull const map);
+
+///Adds a range that couldn't be read. Overlapping and neighboring ranges are combined. Returns false if there isn't enough memory.
+bool rescue_map_addBadRange(struct rescue_map *_Nonnull const map, unsigned long long const offset, unsigned long long const length);
+///Records that the first pass has gotten as far as pendingOffset (or the input size, once it's done), and rewrites the file. outputFD is synced first, so the map never says more has been rescued than is on the disk; it may be -1 if nothing's been written yet. Returns false, with *outError set, if either couldn't be done.
+bool rescue_map_save(struct rescue_map *_Nonnull const map, int const outputFD, unsigned long long const pendingOffset, char const *_Nullable *_Nonnull const outError);
+///Starts a thread that, every intervalSeconds, syncs outputFD and then saves the map with whatever firstPassProgress returned before the sync as the pending offset, so that a first pass that dies during a long stretch of good reads doesn't leave all of it to be retried. firstPassProgress must return an offset that only ever increases.
+bool rescue_map_startSaving(struct rescue_map *_Nonnull const map, int const outputFD, unsigned int const intervalSeconds, unsigned long long (*_Nonnull const firstPassProgress)(void));
+///Stops the saving thread. Returns false if any of its saves failed.
+bool rescue_map_stopSaving(struct rescue_map *_Nonnull const map);
+
+unsigned long long rescue_map_inputSize(struct rescue_map const *_Nonnull const map);
+///How many bytes are in the map's ranges, and how many ranges there are.
+unsigned long long rescue_map_amountBad(struct rescue_map const *_Nonnull const map);
+unsigned long long rescue_map_numBadRanges(struct rescue_map const *_Nonnull const map);
+
+///The second pass: reads every range in the map (and everything pending) from inputFD again, a block of blockSize bytes at a time, splitting any block that fails into sectors of sectorSize bytes and trying each one up to maxAttempts times. What's read gets written at the same offset in outputFD; sectors that can't be read get zeros. The map is saved (after syncing outputFD) every so often and after each failure, and afterward only holds what's still bad. Buffers are aligned to alignment, for direct I/O.
+///*totalAmountRecovered counts the bytes that were read this time. Returns NULL, or a description of what went wrong if the output couldn't be written or the map couldn't be saved.
+char const *_Nullable rescue_map_retry(struct rescue_map *_Nonnull const map, int const inputFD, int const outputFD, size_t const blockSize, size_t const sectorSize, size_t const alignment, unsigned int const maxAttempts, unsigned long long _Atomic *_Nonnull const totalAmountRecovered);
+
+///Deletes the map's file, once there's nothing left in it to retry.
+void rescue_map_remove(struct rescue_map *_Nonnull const map);
+
+///Writes a description of what's still bad.
+void rescue_map_printReport(struct rescue_map const *_Nonnull const map, FILE *_Nonnull const file);
+
+#endif /* rescue_map_h */
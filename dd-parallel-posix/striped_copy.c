@@ -0,0 +1,184 @@
+//
+//  striped_copy.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "striped_copy.h"
+#include "extent_tracker.h"
+#include "device_info.h"
+#include "formatting_utils.h"
+
+#include <stdatomic.h>
+
+//How many extents past the first unfinished one the workers may get. This bounds how far out of order the output can be at any moment, at the cost of stalling the fast workers if one of them gets stuck.
+enum { kWindowExtentsPerWorker = 64 };
+
+enum {
+	errorMaxLength = 255,
+	errorCapacity,
+};
+static char errorBuffer[errorCapacity] = { 0 };
+
+struct striped_job {
+	int inputFD, outputFD;
+	off_t inputStart, outputStart;
+	size_t extentSize;
+	size_t directIOAlignment;
+	size_t bufferAlignment;
+
+	unsigned long long _Atomic nextExtent;
+	unsigned long long _Atomic endOfInput;
+	unsigned long long _Atomic *_Nonnull totalAmountCopied;
+	unsigned long long _Atomic *_Nonnull contiguousLength;
+	bool _Atomic outputDirectIODisabled;
+	struct extent_tracker *_Nonnull tracker;
+
+	pthread_mutex_t failureLock;
+	char const *_Nullable failure;
+};
+
+static void job_fail(struct striped_job *_Nonnull const job, int const errorNumber) {
+	pthread_mutex_lock(&job->failureLock);
+	if (job->failure == NULL) {
+		copyErrorDescription(errorBuffer, errorNumber, errorCapacity);
+		job->failure = errorBuffer;
+	}
+	pthread_mutex_unlock(&job->failureLock);
+	tracker_cancel(job->tracker);
+}
+static bool job_hasFailed(struct striped_job *_Nonnull const job) {
+	pthread_mutex_lock(&job->failureLock);
+	bool const hasFailed = job->failure != NULL;
+	pthread_mutex_unlock(&job->failureLock);
+	return hasFailed;
+}
+static void job_noteEndOfInput(struct striped_job *_Nonnull const job, unsigned long long const end) {
+	unsigned long long previousEnd = job->endOfInput;
+	while (end < previousEnd && ! atomic_compare_exchange_weak(&job->endOfInput, &previousEnd, end));
+}
+
+///Workers finish extents in any order, and can get here in any order too, so only ever move the contiguous length forward.
+static void job_updateContiguousLength(struct striped_job *_Nonnull const job) {
+	unsigned long long length = tracker_contiguousCount(job->tracker) * job->extentSize;
+	if (length > job->endOfInput) length = job->endOfInput;
+	unsigned long long previousLength = *job->contiguousLength;
+	while (length > previousLength && ! atomic_compare_exchange_weak(job->contiguousLength, &previousLength, length));
+}
+
+static void *striped_worker_main(void *_Nonnull const arg) {
+	pthread_setname_self("Striped copy worker");
+	struct striped_job *_Nonnull const job = arg;
+	void *buffer = NULL;
+	if (posix_memalign(&buffer, job->bufferAlignment, job->extentSize) != 0) {
+		job_fail(job, ENOMEM);
+		return NULL;
+	}
+
+	while (! job_hasFailed(job)) {
+		unsigned long long const extentIdx = job->nextExtent++;
+		unsigned long long const offset = extentIdx * job->extentSize;
+		if (offset >= job->endOfInput) break;
+		if (! tracker_waitForRoom(job->tracker, extentIdx)) break;
+
+		size_t amtRead = 0;
+		while (amtRead < job->extentSize) {
+			ssize_t const thisRead = pread(job->inputFD, buffer + amtRead, job->extentSize - amtRead, job->inputStart + offset + amtRead);
+			if (thisRead < 0) {
+				if (errno == EINTR) continue;
+				job_fail(job, errno);
+				goto done;
+			}
+			if (thisRead == 0) break;
+			amtRead += thisRead;
+			//With direct I/O, a read only comes up short at the end of the file, and reading on from an unaligned position would fail.
+			if (job->directIOAlignment > 0 && amtRead % job->directIOAlignment != 0) break;
+		}
+		if (amtRead < job->extentSize) {
+			job_noteEndOfInput(job, offset + amtRead);
+		}
+
+		if (job->directIOAlignment > 0 && amtRead % job->directIOAlignment != 0 && ! job->outputDirectIODisabled) {
+			//The unaligned tail can't be written with direct I/O. This affects the other workers' writes too, but they're all nearly done by now.
+			setDirectIO(job->outputFD, false);
+			job->outputDirectIODisabled = true;
+		}
+		size_t amtWritten = 0;
+		while (amtWritten < amtRead) {
+			ssize_t const thisWrite = pwrite(job->outputFD, buffer + amtWritten, amtRead - amtWritten, job->outputStart + offset + amtWritten);
+			if (thisWrite < 0) {
+				if (errno == EINTR) continue;
+				job_fail(job, errno);
+				goto done;
+			}
+			amtWritten += thisWrite;
+			*job->totalAmountCopied += thisWrite;
+		}
+		tracker_markComplete(job->tracker, extentIdx);
+		job_updateContiguousLength(job);
+	}
+
+done:
+	free(buffer);
+	return NULL;
+}
+
+char const *_Nullable striped_copy(int const inputFD, int const outputFD, unsigned int const numWorkers, size_t const extentSize, size_t const directIOAlignment, unsigned long long _Atomic *_Nonnull const totalAmountCopied, unsigned long long _Atomic *_Nonnull const contiguousLength, bool *_Nonnull const outUnsupported) {
+	*outUnsupported = false;
+	*contiguousLength = 0;
+	off_t const inputStart = lseek(inputFD, 0, SEEK_CUR);
+	off_t const outputStart = lseek(outputFD, 0, SEEK_CUR);
+	if (inputStart < 0 || outputStart < 0) {
+		*outUnsupported = true;
+		return NULL;
+	}
+
+	size_t const pageSize = sysconf(_SC_PAGESIZE);
+	struct striped_job job = {
+		.inputFD = inputFD,
+		.outputFD = outputFD,
+		.inputStart = inputStart,
+		.outputStart = outputStart,
+		.extentSize = extentSize,
+		.directIOAlignment = directIOAlignment,
+		.bufferAlignment = directIOAlignment > pageSize ? directIOAlignment : pageSize,
+		.nextExtent = 0,
+		.endOfInput = ULLONG_MAX,
+		.totalAmountCopied = totalAmountCopied,
+		.contiguousLength = contiguousLength,
+		.tracker = tracker_create(0, numWorkers * kWindowExtentsPerWorker),
+	};
+	if (job.tracker == NULL) return "Could not allocate extent tracker";
+	pthread_mutex_init(&job.failureLock, /*attr*/ NULL);
+
+	pthread_t *_Nullable const workers = calloc(numWorkers, sizeof(pthread_t));
+	if (workers == NULL) {
+		job.failure = "Could not allocate worker threads";
+		goto cleanup;
+	}
+	unsigned int numWorkersStarted = 0;
+	for (; numWorkersStarted < numWorkers; ++numWorkersStarted) {
+		if (pthread_create(&workers[numWorkersStarted], /*attr*/ NULL, striped_worker_main, &job) != 0) {
+			job_fail(&job, errno);
+			break;
+		}
+	}
+	for (unsigned int i = 0; i < numWorkersStarted; ++i) {
+		pthread_join(workers[i], /*retval*/ NULL);
+	}
+	free(workers);
+
+	job_updateContiguousLength(&job);
+	if (job.failure == NULL) {
+		//Leave the file positions where a read/write loop would have left them.
+		lseek(inputFD, inputStart + *contiguousLength, SEEK_SET);
+		lseek(outputFD, outputStart + *contiguousLength, SEEK_SET);
+	}
+
+cleanup:
+	pthread_mutex_destroy(&job.failureLock);
+	tracker_destroy(job.tracker);
+	return job.failure;
+}
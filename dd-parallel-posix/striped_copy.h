@@ -0,0 +1,24 @@
+//
+//  striped_copy.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef striped_copy_h
+#define striped_copy_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+//The striped backend splits the input into extents and has several worker threads each copy one extent at a time, with pread and pwrite at the extent's own offset. Flash and RAID devices often only reach full speed with several independent streams of requests.
+//Since writes finish out of order, the workers also keep track of how much of the output has been written without any gaps.
+
+///Copies from inputFD to outputFD until end of input using numWorkers threads. Returns NULL on success, or a description of the first error.
+///*totalAmountCopied counts every byte written. *contiguousLength is kept up to date, as extents finish, with the length of the output, from the start, that has been written with no gaps; after a successful copy, that's the whole thing.
+///directIOAlignment works as for uring_copy.
+///If either file can't be seeked, sets *outUnsupported and returns NULL without having read or written anything.
+char const *_Nullable striped_copy(int const inputFD, int const outputFD, unsigned int const numWorkers, size_t const extentSize, size_t const directIOAlignment, unsigned long long _Atomic *_Nonnull const totalAmountCopied, unsigned long long _Atomic *_Nonnull const contiguousLength, bool *_Nonnull const outUnsupported);
+
+#endif /* striped_copy_h */
@@ -0,0 +1,285 @@
+//
+//  tuner.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "tuner.h"
+#include "formatting_utils.h"
+
+#include <stdlib.h>
+
+enum {
+	kMaximumBlockSizes = 8,
+	kMaximumDepths = 12,
+	kMaximumPlanLength = kMaximumBlockSizes > kMaximumDepths ? kMaximumBlockSizes : kMaximumDepths,
+};
+//A trial lasts at least this long, and at least this many blocks, so the pipeline has time to fill up and the measurement isn't just noise.
+static double const kTrialSeconds = 0.5;
+enum { kMinimumBlocksPerTrial = 4 };
+static double const kReevaluationIntervalSeconds = 30.0;
+//A re-evaluation only moves away from the current setting if another one is at least this much faster, so noise doesn't make it flip back and forth.
+static double const kSwitchingThreshold = 1.05;
+
+struct tuner_measurement {
+	double bytesPerSecond;
+	unsigned int numTrials;
+};
+struct tuner_trial {
+	unsigned int blockSizeIndex;
+	unsigned int depthIndex;
+};
+
+struct tuner {
+	size_t blockSizes[kMaximumBlockSizes];
+	unsigned int numBlockSizes;
+	unsigned int depths[kMaximumDepths];
+	unsigned int numDepths;
+	//The most recent measurement of each combination; numTrials is 0 for those never tried.
+	struct tuner_measurement measurements[kMaximumBlockSizes][kMaximumDepths];
+
+	//Everything from here to the handoff is only touched by the writer.
+	enum {
+		phase_probingBlockSizes,
+		phase_probingDepths,
+		phase_settled,
+		phase_reevaluating,
+	} phase;
+	struct tuner_trial plan[kMaximumPlanLength];
+	unsigned int planLength, planPosition;
+	//The setting we last settled on.
+	struct tuner_trial current;
+	bool everSettled;
+
+	unsigned long long numBlocksWritten;
+	bool haveLastBlockTime;
+	double lastBlockTime;
+	bool trialStarted;
+	double trialStartTime;
+	unsigned long long trialBytes;
+	unsigned int trialBlocks;
+	double nextReevaluationTime;
+	unsigned int numReevaluations, numChanges;
+
+	//The handoff from the writer to the reader. The writer sets the requested block size and depth, then bumps requestedSequence. The reader, when it sees the bump, switches to the new setting, and notes which block it switched at in adoptedAtBlock before making adoptedSequence match, so the writer knows where the trial starts.
+	size_t _Atomic requestedBlockSize;
+	unsigned int _Atomic requestedDepth;
+	unsigned long _Atomic requestedSequence;
+	unsigned long _Atomic adoptedSequence;
+	unsigned long long _Atomic adoptedAtBlock;
+
+	//Only touched by the reader.
+	struct tuner_setting readerSetting;
+	unsigned long long numBlocksRead;
+};
+
+static void tuner_requestTrial(struct tuner *_Nonnull const tuner, struct tuner_trial const trial) {
+	tuner->requestedBlockSize = tuner->blockSizes[trial.blockSizeIndex];
+	tuner->requestedDepth = tuner->depths[trial.depthIndex];
+	tuner->trialStarted = false;
+	++tuner->requestedSequence;
+}
+static struct tuner_measurement const *_Nonnull tuner_measurementForTrial(struct tuner const *_Nonnull const tuner, struct tuner_trial const trial) {
+	return &tuner->measurements[trial.blockSizeIndex][trial.depthIndex];
+}
+///The fastest trial in the plan just finished.
+static struct tuner_trial tuner_bestTrialInPlan(struct tuner const *_Nonnull const tuner) {
+	struct tuner_trial best = tuner->plan[0];
+	for (unsigned int i = 1; i < tuner->planLength; ++i) {
+		if (tuner_measurementForTrial(tuner, tuner->plan[i])->bytesPerSecond > tuner_measurementForTrial(tuner, best)->bytesPerSecond) {
+			best = tuner->plan[i];
+		}
+	}
+	return best;
+}
+
+static void tuner_settle(struct tuner *_Nonnull const tuner, struct tuner_trial const trial) {
+	if (tuner->everSettled && (trial.blockSizeIndex != tuner->current.blockSizeIndex || trial.depthIndex != tuner->current.depthIndex)) {
+		++tuner->numChanges;
+	}
+	tuner->current = trial;
+	tuner->everSettled = true;
+	tuner->phase = phase_settled;
+	tuner->nextReevaluationTime = tuner->lastBlockTime + kReevaluationIntervalSeconds;
+	tuner_requestTrial(tuner, trial);
+}
+static void tuner_startReevaluation(struct tuner *_Nonnull const tuner) {
+	++tuner->numReevaluations;
+	tuner->phase = phase_reevaluating;
+	tuner->planLength = tuner->planPosition = 0;
+	unsigned int const blockSizeIndex = tuner->current.blockSizeIndex;
+	unsigned int const firstIndex = blockSizeIndex > 0 ? blockSizeIndex - 1 : 0;
+	unsigned int const lastIndex = blockSizeIndex + 1 < tuner->numBlockSizes ? blockSizeIndex + 1 : blockSizeIndex;
+	for (unsigned int i = firstIndex; i <= lastIndex; ++i) {
+		tuner->plan[tuner->planLength++] = (struct tuner_trial){ i, tuner->current.depthIndex };
+	}
+	tuner_requestTrial(tuner, tuner->plan[0]);
+}
+///Moves on from a plan once all its trials are done.
+static void tuner_finishPlan(struct tuner *_Nonnull const tuner) {
+	switch (tuner->phase) {
+		case phase_probingBlockSizes: {
+			//The block sizes were all tried at the greatest depth. Try the best of them at each smaller depth.
+			unsigned int const blockSizeIndex = tuner_bestTrialInPlan(tuner).blockSizeIndex;
+			unsigned int const greatestDepthIndex = tuner->numDepths - 1;
+			tuner->planLength = tuner->planPosition = 0;
+			for (unsigned int i = 0; i < greatestDepthIndex; ++i) {
+				tuner->plan[tuner->planLength++] = (struct tuner_trial){ blockSizeIndex, i };
+			}
+			if (tuner->planLength == 0) {
+				tuner_settle(tuner, (struct tuner_trial){ blockSizeIndex, greatestDepthIndex });
+			} else {
+				tuner->phase = phase_probingDepths;
+				tuner_requestTrial(tuner, tuner->plan[0]);
+			}
+			break;
+		}
+		case phase_probingDepths: {
+			//The greatest depth isn't in this plan, because it was measured along with the block sizes.
+			struct tuner_trial const greatestDepth = { tuner->plan[0].blockSizeIndex, tuner->numDepths - 1 };
+			struct tuner_trial const best = tuner_bestTrialInPlan(tuner);
+			bool const smallerIsFaster = tuner_measurementForTrial(tuner, best)->bytesPerSecond > tuner_measurementForTrial(tuner, greatestDepth)->bytesPerSecond;
+			tuner_settle(tuner, smallerIsFaster ? best : greatestDepth);
+			break;
+		}
+		case phase_reevaluating: {
+			struct tuner_trial const best = tuner_bestTrialInPlan(tuner);
+			double const currentRate = tuner_measurementForTrial(tuner, tuner->current)->bytesPerSecond;
+			bool const worthSwitching = tuner_measurementForTrial(tuner, best)->bytesPerSecond > currentRate * kSwitchingThreshold;
+			tuner_settle(tuner, worthSwitching ? best : tuner->current);
+			break;
+		}
+		case phase_settled:
+			break;
+	}
+}
+static void tuner_finishTrial(struct tuner *_Nonnull const tuner, double const bytesPerSecond) {
+	struct tuner_trial const trial = tuner->plan[tuner->planPosition];
+	struct tuner_measurement *_Nonnull const measurement = &tuner->measurements[trial.blockSizeIndex][trial.depthIndex];
+	measurement->bytesPerSecond = bytesPerSecond;
+	++measurement->numTrials;
+
+	if (++tuner->planPosition < tuner->planLength) {
+		tuner_requestTrial(tuner, tuner->plan[tuner->planPosition]);
+	} else {
+		tuner_finishPlan(tuner);
+	}
+}
+
+struct tuner *_Nullable tuner_create(unsigned int const maximumDepth, size_t const alignment) {
+	struct tuner *_Nullable const tuner = calloc(1, sizeof(struct tuner));
+	if (tuner == NULL) return NULL;
+
+	for (size_t blockSize = kTunerMinimumBlockSize; blockSize <= kTunerMaximumBlockSize && tuner->numBlockSizes < kMaximumBlockSizes; blockSize *= 2) {
+		if (alignment == 0 || blockSize % alignment == 0) {
+			tuner->blockSizes[tuner->numBlockSizes++] = blockSize;
+		}
+	}
+	//Depths go up in powers of two from 2 (1 means the reader and writer take turns, which is never going to win), always ending with the greatest allowed.
+	for (unsigned int depth = 2; depth < maximumDepth && tuner->numDepths < kMaximumDepths - 1; depth *= 2) {
+		tuner->depths[tuner->numDepths++] = depth;
+	}
+	tuner->depths[tuner->numDepths++] = maximumDepth > 0 ? maximumDepth : 1;
+	if (tuner->numBlockSizes == 0) {
+		free(tuner);
+		return NULL;
+	}
+
+	tuner->phase = phase_probingBlockSizes;
+	for (unsigned int i = 0; i < tuner->numBlockSizes; ++i) {
+		tuner->plan[tuner->planLength++] = (struct tuner_trial){ i, tuner->numDepths - 1 };
+	}
+	tuner_requestTrial(tuner, tuner->plan[0]);
+	return tuner;
+}
+void tuner_destroy(struct tuner *_Nonnull const tuner) {
+	free(tuner);
+}
+
+struct tuner_setting tuner_settingForNextBlock(struct tuner *_Nonnull const tuner) {
+	unsigned long requested = tuner->requestedSequence;
+	if (requested != tuner->adoptedSequence) {
+		//If the writer asks for something else while we're picking this up, pick that up instead.
+		struct tuner_setting setting;
+		do {
+			requested = tuner->requestedSequence;
+			setting = (struct tuner_setting){ tuner->requestedBlockSize, tuner->requestedDepth };
+		} while (requested != tuner->requestedSequence);
+		tuner->readerSetting = setting;
+		tuner->adoptedAtBlock = tuner->numBlocksRead;
+		tuner->adoptedSequence = requested;
+	}
+	++tuner->numBlocksRead;
+	return tuner->readerSetting;
+}
+
+void tuner_blockWritten(struct tuner *_Nonnull const tuner, size_t const length, double const now) {
+	unsigned long long const blockIndex = tuner->numBlocksWritten++;
+	//A block's time starts when the writer finished the one before it, so any time spent waiting for the reader counts against the setting being tried.
+	double const blockStartTime = tuner->lastBlockTime;
+	bool const haveBlockStartTime = tuner->haveLastBlockTime;
+	tuner->lastBlockTime = now;
+	tuner->haveLastBlockTime = true;
+	if (! haveBlockStartTime) return;
+
+	if (tuner->phase == phase_settled) {
+		if (now >= tuner->nextReevaluationTime) tuner_startReevaluation(tuner);
+		return;
+	}
+	if (! tuner->trialStarted) {
+		if (tuner->adoptedSequence != tuner->requestedSequence || blockIndex < tuner->adoptedAtBlock) {
+			//This block was read before the reader switched to the setting being tried.
+			return;
+		}
+		tuner->trialStarted = true;
+		tuner->trialStartTime = blockStartTime;
+		tuner->trialBytes = 0;
+		tuner->trialBlocks = 0;
+	}
+	tuner->trialBytes += length;
+	++tuner->trialBlocks;
+	double const elapsed = now - tuner->trialStartTime;
+	if (elapsed >= kTrialSeconds && tuner->trialBlocks >= kMinimumBlocksPerTrial) {
+		tuner_finishTrial(tuner, tuner->trialBytes / elapsed);
+	}
+}
+
+struct tuner_setting tuner_currentSetting(struct tuner const *_Nonnull const tuner) {
+	return (struct tuner_setting){ tuner->requestedBlockSize, tuner->requestedDepth };
+}
+
+void tuner_printReport(struct tuner const *_Nonnull const tuner, FILE *_Nonnull const file) {
+	enum { phraseCapacity = 64 };
+	char phrase[phraseCapacity];
+	if (tuner->everSettled) {
+		copyByteCountPhrase(phrase, tuner->blockSizes[tuner->current.blockSizeIndex], phraseCapacity);
+		fprintf(file, "Tuning settled on %s blocks, %u deep", phrase, tuner->depths[tuner->current.depthIndex]);
+		if (tuner->numReevaluations > 0) {
+			fprintf(file, " (re-evaluated %u time%s, changed %u time%s)", tuner->numReevaluations, tuner->numReevaluations == 1 ? "" : "s", tuner->numChanges, tuner->numChanges == 1 ? "" : "s");
+		}
+		fprintf(file, "\n");
+	} else {
+		fprintf(file, "The copy finished before tuning did\n");
+	}
+
+	bool printedHeading = false;
+	for (unsigned int b = 0; b < tuner->numBlockSizes; ++b) {
+		for (unsigned int d = 0; d < tuner->numDepths; ++d) {
+			struct tuner_measurement const *_Nonnull const measurement = &tuner->measurements[b][d];
+			if (measurement->numTrials == 0) continue;
+			if (! printedHeading) {
+				fprintf(file, "Measured:\n");
+				printedHeading = true;
+			}
+			copyByteCountPhrase(phrase, tuner->blockSizes[b], phraseCapacity);
+			fprintf(file, "  %s blocks, %u deep: ", phrase, tuner->depths[d]);
+			copyByteCountPhrase(phrase, measurement->bytesPerSecond, phraseCapacity);
+			fprintf(file, "%s/sec", phrase);
+			if (measurement->numTrials > 1) fprintf(file, " (latest of %u trials)", measurement->numTrials);
+			bool const isCurrent = tuner->everSettled && b == tuner->current.blockSizeIndex && d == tuner->current.depthIndex;
+			fprintf(file, "%s\n", isCurrent ? " ← chosen" : "");
+		}
+	}
+}
@@ -0,0 +1,46 @@
+//
+//  tuner.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef tuner_h
+#define tuner_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+//The tuner picks a block size and pipeline depth for the threads backend by trying them. It starts by trying each block size at the full depth, then the fastest block size at each smaller depth, and locks in the fastest setting. Every so often after that, it tries the block sizes either side of the current one again, since what's fastest can change partway through a copy (e.g., as a hard disk's heads move toward the slower inner tracks).
+//A trial measures how fast blocks get written: from when the writer starts on the first block read with that setting, until it has been going for long enough. So it covers reading, writing, and everything in between, as the copy actually experiences them.
+
+//The smallest and largest block sizes tried. The ring's buffers need to be the largest size.
+enum {
+	kTunerMinimumBlockSize = 128 * 1024,
+	kTunerMaximumBlockSize = 8 * 1024 * 1024,
+};
+
+struct tuner_setting {
+	size_t blockSize;
+	unsigned int depth;
+};
+
+struct tuner;
+
+///Creates a tuner that will try depths up to maximumDepth, and block sizes that are multiples of alignment (if it's not 0). Returns NULL if it can't be allocated, or none of the block sizes it would try are multiples of alignment.
+struct tuner *_Nullable tuner_create(unsigned int const maximumDepth, size_t const alignment);
+void tuner_destroy(struct tuner *_Nonnull const tuner);
+
+///For the reader: the setting to read the next block with. Call once for every block read (and not for holes, which the writer doesn't report).
+struct tuner_setting tuner_settingForNextBlock(struct tuner *_Nonnull const tuner);
+///For the writer: reports that a block of length bytes has been written, as of now (in seconds, from any fixed starting point). Blocks must be reported in the same order the reader asked for settings for them.
+void tuner_blockWritten(struct tuner *_Nonnull const tuner, size_t const length, double const now);
+
+///Writes a description of the setting the tuner has settled on and the measurements behind it. Only call this once the reader and writer are done.
+void tuner_printReport(struct tuner const *_Nonnull const tuner, FILE *_Nonnull const file);
+///The setting in use now. Only call this once the reader and writer are done.
+struct tuner_setting tuner_currentSetting(struct tuner const *_Nonnull const tuner);
+
+#endif /* tuner_h */
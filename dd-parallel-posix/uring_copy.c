@@ -0,0 +1,344 @@
+//
+//  uring_copy.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "uring_copy.h"
+#include "formatting_utils.h"
+#include "device_info.h"
+
+#if EXISTS_IO_URING
+
+//We talk to the kernel directly rather than through liburing, so there's nothing extra to install.
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <stdatomic.h>
+
+enum {
+	errorMaxLength = 255,
+	errorCapacity,
+};
+static char errorBuffer[errorCapacity] = { 0 };
+
+enum {
+	//Indexes into our registered file table.
+	inputFileIdx = 0,
+	outputFileIdx = 1,
+};
+
+struct uring {
+	int fd;
+	void *_Nullable sqRingPtr, *_Nullable cqRingPtr;
+	size_t sqRingSize, cqRingSize;
+	struct io_uring_sqe *_Nullable sqes;
+	size_t sqesSize;
+
+	unsigned *_Nonnull sqHead, *_Nonnull sqTail, *_Nonnull sqMask, *_Nonnull sqArray;
+	unsigned *_Nonnull cqHead, *_Nonnull cqTail, *_Nonnull cqMask;
+	struct io_uring_cqe *_Nonnull cqes;
+	unsigned numUnsubmitted;
+
+	size_t bufferSize;
+	off_t inputStart, outputStart;
+	bool usingFixedBuffers;
+	bool usingFixedFiles;
+};
+
+struct uring_buffer {
+	void *_Nonnull buffer;
+	//Used only when the buffers couldn't be registered.
+	struct iovec iov;
+	///Relative to where each file was positioned when we started.
+	unsigned long long offset;
+	///How much of the buffer has been filled by reading.
+	size_t length;
+	///How much of length has been written.
+	size_t amountWritten;
+	enum {
+		uring_buffer_idle,
+		uring_buffer_reading,
+		uring_buffer_writing,
+	} state;
+};
+
+static int uring_setup(unsigned const entries, struct io_uring_params *_Nonnull const params) {
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+static int uring_enter(int const fd, unsigned const toSubmit, unsigned const minComplete, unsigned const flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+static int uring_register(int const fd, unsigned const opcode, void const *_Nullable const arg, unsigned const numArgs) {
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, numArgs);
+}
+
+static void uring_destroy(struct uring *_Nonnull const ring) {
+	if (ring->sqes != NULL) munmap(ring->sqes, ring->sqesSize);
+	if (ring->cqRingPtr != NULL && ring->cqRingPtr != ring->sqRingPtr) munmap(ring->cqRingPtr, ring->cqRingSize);
+	if (ring->sqRingPtr != NULL) munmap(ring->sqRingPtr, ring->sqRingSize);
+	if (ring->fd >= 0) close(ring->fd);
+}
+///Returns false if the kernel doesn't support io_uring (or won't let us use it).
+static bool uring_init(struct uring *_Nonnull const ring, unsigned const entries) {
+	struct io_uring_params params = { 0 };
+	*ring = (struct uring){ .fd = uring_setup(entries, &params) };
+	if (ring->fd < 0) return false;
+
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	bool const singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (singleMmap) {
+		if (ring->cqRingSize > ring->sqRingSize) ring->sqRingSize = ring->cqRingSize;
+		ring->cqRingSize = ring->sqRingSize;
+	}
+	ring->sqRingPtr = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sqRingPtr == MAP_FAILED) {
+		ring->sqRingPtr = NULL;
+		goto fail;
+	}
+	if (singleMmap) {
+		ring->cqRingPtr = ring->sqRingPtr;
+	} else {
+		ring->cqRingPtr = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cqRingPtr == MAP_FAILED) {
+			ring->cqRingPtr = NULL;
+			goto fail;
+		}
+	}
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto fail;
+	}
+
+	ring->sqHead = ring->sqRingPtr + params.sq_off.head;
+	ring->sqTail = ring->sqRingPtr + params.sq_off.tail;
+	ring->sqMask = ring->sqRingPtr + params.sq_off.ring_mask;
+	ring->sqArray = ring->sqRingPtr + params.sq_off.array;
+	ring->cqHead = ring->cqRingPtr + params.cq_off.head;
+	ring->cqTail = ring->cqRingPtr + params.cq_off.tail;
+	ring->cqMask = ring->cqRingPtr + params.cq_off.ring_mask;
+	ring->cqes = ring->cqRingPtr + params.cq_off.cqes;
+	return true;
+
+fail:
+	uring_destroy(ring);
+	return false;
+}
+
+///Queues a read or write of the unfinished part of a buffer. Nothing reaches the kernel until uring_submitAndWait.
+static void uring_queue(struct uring *_Nonnull const ring, struct uring_buffer *_Nonnull const buffers, unsigned const bufferIdx, int const inputFD, int const outputFD) {
+	struct uring_buffer *_Nonnull const buf = &buffers[bufferIdx];
+	bool const isWrite = buf->state == uring_buffer_writing;
+	size_t const doneSoFar = isWrite ? buf->amountWritten : buf->length;
+	size_t const remaining = isWrite ? buf->length - buf->amountWritten : ring->bufferSize - buf->length;
+
+	unsigned const tail = *ring->sqTail;
+	unsigned const sqeIdx = tail & *ring->sqMask;
+	struct io_uring_sqe *_Nonnull const sqe = &ring->sqes[sqeIdx];
+	memset(sqe, 0, sizeof(*sqe));
+	if (ring->usingFixedFiles) {
+		sqe->fd = isWrite ? outputFileIdx : inputFileIdx;
+		sqe->flags |= IOSQE_FIXED_FILE;
+	} else {
+		sqe->fd = isWrite ? outputFD : inputFD;
+	}
+	sqe->off = (isWrite ? ring->outputStart : ring->inputStart) + buf->offset + doneSoFar;
+	if (ring->usingFixedBuffers) {
+		sqe->opcode = isWrite ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+		sqe->addr = (unsigned long)(buf->buffer + doneSoFar);
+		sqe->len = (unsigned)remaining;
+		sqe->buf_index = bufferIdx;
+	} else {
+		//Without registered buffers, fall back to the vectored ops, which have been around as long as io_uring has. The iovec has to stay put until the op completes, so it lives in the buffer record.
+		buf->iov.iov_base = buf->buffer + doneSoFar;
+		buf->iov.iov_len = remaining;
+		sqe->opcode = isWrite ? IORING_OP_WRITEV : IORING_OP_READV;
+		sqe->addr = (unsigned long)&buf->iov;
+		sqe->len = 1;
+	}
+	sqe->user_data = bufferIdx;
+	ring->sqArray[sqeIdx] = sqeIdx;
+	atomic_store_explicit((unsigned _Atomic *)ring->sqTail, tail + 1, memory_order_release);
+	++ring->numUnsubmitted;
+}
+static int uring_submitAndWait(struct uring *_Nonnull const ring, unsigned const minComplete) {
+	int result;
+	do {
+		result = uring_enter(ring->fd, ring->numUnsubmitted, minComplete, minComplete > 0 ? IORING_ENTER_GETEVENTS : 0);
+	} while (result < 0 && errno == EINTR); //e.g., SIGINFO
+	if (result >= 0) ring->numUnsubmitted -= result;
+	return result;
+}
+
+char const *_Nullable uring_copy(int const inputFD, int const outputFD, unsigned int const depth, size_t const bufferSize, size_t const directIOAlignment, unsigned long long _Atomic *_Nonnull const totalAmountCopied, unsigned long long _Atomic *_Nonnull const contiguousLength, bool *_Nonnull const outUnsupported) {
+	*outUnsupported = false;
+	*contiguousLength = 0;
+	off_t const inputStart = lseek(inputFD, 0, SEEK_CUR);
+	off_t const outputStart = lseek(outputFD, 0, SEEK_CUR);
+	if (inputStart < 0 || outputStart < 0) {
+		*outUnsupported = true;
+		return NULL;
+	}
+
+	struct uring ring;
+	if (! uring_init(&ring, depth)) {
+		*outUnsupported = true;
+		return NULL;
+	}
+	ring.bufferSize = bufferSize;
+	ring.inputStart = inputStart;
+	ring.outputStart = outputStart;
+
+	struct uring_buffer *_Nullable const buffers = calloc(depth, sizeof(struct uring_buffer));
+	struct iovec *_Nullable const iovecs = calloc(depth, sizeof(struct iovec));
+	char const *_Nullable failure = NULL;
+	unsigned numInFlight = 0;
+	if (buffers == NULL || iovecs == NULL) {
+		failure = "Could not allocate io_uring buffers";
+		goto cleanup;
+	}
+	size_t const pageSize = sysconf(_SC_PAGESIZE);
+	size_t const bufferAlignment = directIOAlignment > pageSize ? directIOAlignment : pageSize;
+	for (unsigned i = 0; i < depth; ++i) {
+		if (posix_memalign(&buffers[i].buffer, bufferAlignment, bufferSize) != 0) {
+			buffers[i].buffer = NULL;
+			failure = "Could not allocate io_uring buffers";
+			goto cleanup;
+		}
+		iovecs[i] = (struct iovec){ .iov_base = buffers[i].buffer, .iov_len = bufferSize };
+	}
+
+	//Registering the buffers saves the kernel from mapping them on every request; registering the files saves it from looking up the file descriptors on every request. Both are optional, because either can fail (registered buffers count against RLIMIT_MEMLOCK on older kernels).
+	ring.usingFixedBuffers = uring_register(ring.fd, IORING_REGISTER_BUFFERS, iovecs, depth) == 0;
+	int const fds[2] = { [inputFileIdx] = inputFD, [outputFileIdx] = outputFD };
+	ring.usingFixedFiles = uring_register(ring.fd, IORING_REGISTER_FILES, fds, 2) == 0;
+
+	//Each buffer covers the bufferSize bytes at its offset. A buffer goes idle → reading → writing → idle, and is then reused for the next offset not yet claimed.
+	//The write for an offset goes out as soon as its read completes, so the output sees writes out of order, but every byte lands at the same position relative to the start as it was read from.
+	unsigned long long nextReadOffset = 0;
+	unsigned long long endOfInput = ULLONG_MAX;
+	//A buffer whose read or write failed goes idle without finishing its piece of the output, so the contiguous length can't go past it.
+	unsigned long long firstFailedOffset = ULLONG_MAX;
+	bool outputDirectIODisabled = false;
+
+	for (unsigned i = 0; i < depth; ++i) {
+		buffers[i] = (struct uring_buffer){
+			.buffer = buffers[i].buffer,
+			.offset = nextReadOffset,
+			.state = uring_buffer_reading,
+		};
+		nextReadOffset += bufferSize;
+		uring_queue(&ring, buffers, i, inputFD, outputFD);
+		++numInFlight;
+	}
+
+	while (numInFlight > 0) {
+		if (uring_submitAndWait(&ring, 1) < 0) {
+			copyErrorDescription(errorBuffer, errno, errorCapacity);
+			failure = errorBuffer;
+			//We can't safely free buffers the kernel may still be using, so don't try to drain; just bail.
+			goto cleanup;
+		}
+
+		unsigned head = *ring.cqHead;
+		unsigned const tail = atomic_load_explicit((unsigned _Atomic *)ring.cqTail, memory_order_acquire);
+		for (; head != tail; ++head) {
+			struct io_uring_cqe const *_Nonnull const cqe = &ring.cqes[head & *ring.cqMask];
+			unsigned const bufferIdx = (unsigned)cqe->user_data;
+			int const result = cqe->res;
+			struct uring_buffer *_Nonnull const buf = &buffers[bufferIdx];
+			--numInFlight;
+
+			if (result == -EINTR || result == -EAGAIN) {
+				//Try that again.
+			} else if (result < 0 || (result == 0 && buf->state == uring_buffer_writing)) {
+				if (failure == NULL) {
+					copyErrorDescription(errorBuffer, result < 0 ? -result : EIO, errorCapacity);
+					failure = errorBuffer;
+				}
+				if (buf->offset < firstFailedOffset) firstFailedOffset = buf->offset;
+				buf->state = uring_buffer_idle;
+			} else if (buf->state == uring_buffer_reading) {
+				buf->length += result;
+				//With direct I/O, a read can only come up short at the end of the file. Reading on from an unaligned position would fail, so don't try.
+				bool const isUnalignedTail = directIOAlignment > 0 && buf->length % directIOAlignment != 0;
+				if (result == 0 || isUnalignedTail) {
+					//End of input. Any other reads out past this point will come back empty too.
+					unsigned long long const thisEnd = buf->offset + buf->length;
+					if (thisEnd < endOfInput) endOfInput = thisEnd;
+					buf->state = buf->length > 0 ? uring_buffer_writing : uring_buffer_idle;
+					if (isUnalignedTail && ! outputDirectIODisabled) {
+						//Nor can we write an unaligned length with direct I/O. Any writes already in flight are unaffected; later ones go through the page cache, which is only the tail and whatever's queued with it.
+						setDirectIO(outputFD, false);
+						outputDirectIODisabled = true;
+					}
+				} else if (buf->length == bufferSize) {
+					buf->state = uring_buffer_writing;
+				}
+				//Otherwise, it was a short read. Go back for the rest (or to find out that this is the end).
+			} else {
+				buf->amountWritten += result;
+				*totalAmountCopied += result;
+				if (buf->amountWritten == buf->length) {
+					buf->state = uring_buffer_idle;
+				}
+			}
+
+			if (buf->state == uring_buffer_idle && failure == NULL && nextReadOffset < endOfInput) {
+				buf->offset = nextReadOffset;
+				buf->length = 0;
+				buf->amountWritten = 0;
+				buf->state = uring_buffer_reading;
+				nextReadOffset += bufferSize;
+			}
+			if (buf->state != uring_buffer_idle && (failure == NULL || buf->state == uring_buffer_writing)) {
+				uring_queue(&ring, buffers, bufferIdx, inputFD, outputFD);
+				++numInFlight;
+			}
+		}
+		atomic_store_explicit((unsigned _Atomic *)ring.cqHead, head, memory_order_release);
+
+		//Everything before the lowest offset that's still being read or written (or that failed) is done.
+		unsigned long long lowestUnfinishedOffset = nextReadOffset < endOfInput ? nextReadOffset : endOfInput;
+		if (firstFailedOffset < lowestUnfinishedOffset) lowestUnfinishedOffset = firstFailedOffset;
+		for (unsigned i = 0; i < depth; ++i) {
+			if (buffers[i].state != uring_buffer_idle && buffers[i].offset < lowestUnfinishedOffset) {
+				lowestUnfinishedOffset = buffers[i].offset;
+			}
+		}
+		*contiguousLength = lowestUnfinishedOffset;
+	}
+
+	//Leave the file positions where a read/write loop would have left them.
+	if (failure == NULL) {
+		lseek(inputFD, inputStart + *contiguousLength, SEEK_SET);
+		lseek(outputFD, outputStart + *contiguousLength, SEEK_SET);
+	}
+
+cleanup:
+	uring_destroy(&ring);
+	//If we bailed with requests still in flight, the kernel may yet write into these buffers, so leak them rather than risk that.
+	if (buffers != NULL && numInFlight == 0) {
+		for (unsigned i = 0; i < depth; ++i) {
+			free(buffers[i].buffer);
+		}
+		free(buffers);
+	}
+	free(iovecs);
+	return failure;
+}
+
+#else
+
+char const *_Nullable uring_copy(int const inputFD, int const outputFD, unsigned int const depth, size_t const bufferSize, size_t const directIOAlignment, unsigned long long _Atomic *_Nonnull const totalAmountCopied, unsigned long long _Atomic *_Nonnull const contiguousLength, bool *_Nonnull const outUnsupported) {
+	*outUnsupported = true;
+	return NULL;
+}
+
+#endif
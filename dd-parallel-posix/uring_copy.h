@@ -0,0 +1,24 @@
+//
+//  uring_copy.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef uring_copy_h
+#define uring_copy_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+//The io_uring backend keeps up to depth reads and writes in flight at once, rather than one of each, so that devices that need a deep queue (like NVMe) can reach their rated throughput.
+//Because requests complete out of order, it uses explicit offsets, so both files must be seekable.
+
+///Copies from inputFD to outputFD until end of input, adding each write's byte count to *totalAmountCopied as it completes. Returns NULL on success, or a description of the error.
+///Since writes complete out of order, *contiguousLength is kept up to date with the length of the output, from the start, that has been written with no gaps.
+///directIOAlignment is 0 normally. If the files are open for direct I/O, it's the alignment their reads and writes need; the buffers will be aligned to it, and an unaligned tail at the end of the input will be written with direct I/O turned off.
+///If io_uring can't be used here (no kernel support, or a file that can't be seeked), sets *outUnsupported to true and returns NULL without having read or written anything, so the caller can fall back to the threads backend.
+char const *_Nullable uring_copy(int const inputFD, int const outputFD, unsigned int const depth, size_t const bufferSize, size_t const directIOAlignment, unsigned long long _Atomic *_Nonnull const totalAmountCopied, unsigned long long _Atomic *_Nonnull const contiguousLength, bool *_Nonnull const outUnsupported);
+
+#endif /* uring_copy_h */
@@ -0,0 +1,223 @@
+//
+//  verify.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "verify.h"
+#include "buffer_ring.h"
+#include "block_utils.h"
+#include "device_info.h"
+#include "formatting_utils.h"
+
+//Mismatches are found to the byte where they start, then followed a sector at a time for as long as each sector has a difference in it. A range runs from its first differing byte to its last, so it may have some matching bytes in between, but not at either end.
+enum { kMismatchGranularity = 512 };
+//Past this many, ranges are still counted, but not listed.
+enum { kMaximumReportedRanges = 100 };
+
+enum {
+	errorMaxLength = 255,
+	errorCapacity,
+};
+static char errorBuffer[errorCapacity] = { 0 };
+
+struct verify_reader {
+	int fd;
+	unsigned long long length;
+	size_t alignment;
+	struct buffer_ring *_Nonnull ring;
+	char const *_Nullable failure;
+	char errorBuffer[errorCapacity];
+};
+
+static void *_Nullable verify_reader_main(void *_Nonnull const arg) {
+	pthread_setname_self("Verify reader thread");
+	struct verify_reader *_Nonnull const reader = arg;
+	size_t const bufferSize = ring_bufferSize(reader->ring);
+
+	unsigned long long offset = 0;
+	while (offset < reader->length) {
+		struct ring_slot *_Nullable const slot = ring_acquireEmptySlot(reader->ring);
+		if (slot == NULL) break;
+
+		unsigned long long const remaining = reader->length - offset;
+		size_t amountToRead = remaining < bufferSize ? remaining : bufferSize;
+		if (reader->alignment > 0) {
+			//Direct I/O only reads whole blocks. Anything past the end we were asked for gets ignored.
+			amountToRead = (amountToRead + reader->alignment - 1) / reader->alignment * reader->alignment;
+		}
+		size_t amountRead = 0;
+		while (amountRead < amountToRead) {
+			ssize_t const thisRead = pread(reader->fd, slot->buffer + amountRead, amountToRead - amountRead, offset + amountRead);
+			if (thisRead < 0) {
+				if (errno == EINTR) continue;
+				copyErrorDescription(reader->errorBuffer, errno, errorCapacity);
+				reader->failure = reader->errorBuffer;
+				goto done;
+			}
+			if (thisRead == 0) break;
+			amountRead += thisRead;
+			if (reader->alignment > 0 && amountRead % reader->alignment != 0) break;
+		}
+		if (amountRead > remaining) amountRead = remaining;
+
+		slot->length = amountRead;
+		slot->isHole = false;
+		ring_publishFilledSlot(reader->ring);
+		offset += amountRead;
+		if (amountRead < amountToRead && amountRead < remaining) {
+			//End of file.
+			break;
+		}
+	}
+done:
+	ring_close(reader->ring);
+	return NULL;
+}
+
+struct verify_comparison {
+	FILE *_Nonnull report;
+	struct verify_result result;
+	//The mismatched range that's still growing, if any (start < end), and how many of the bytes in it differ.
+	unsigned long long openRangeStart, openRangeEnd;
+	unsigned long long openRangeAmountDiffering;
+};
+
+static void verify_flushRange(struct verify_comparison *_Nonnull const comparison) {
+	if (comparison->openRangeStart == comparison->openRangeEnd) return;
+	unsigned long long const length = comparison->openRangeEnd - comparison->openRangeStart;
+	unsigned long long const amountDiffering = comparison->openRangeAmountDiffering;
+	comparison->result.amountMismatched += amountDiffering;
+	if (comparison->result.numMismatchedRanges < kMaximumReportedRanges) {
+		if (amountDiffering == length) {
+			fprintf(comparison->report, "Mismatch: bytes %llu through %llu (%llu %s)\n", comparison->openRangeStart, comparison->openRangeEnd - 1, length, length == 1 ? "byte" : "bytes");
+		} else {
+			fprintf(comparison->report, "Mismatch: bytes %llu through %llu (%llu bytes, of which %llu differ)\n", comparison->openRangeStart, comparison->openRangeEnd - 1, length, amountDiffering);
+		}
+	} else if (comparison->result.numMismatchedRanges == kMaximumReportedRanges) {
+		fprintf(comparison->report, "(Too many mismatches; not listing any more)\n");
+	}
+	++comparison->result.numMismatchedRanges;
+	comparison->openRangeStart = comparison->openRangeEnd = 0;
+	comparison->openRangeAmountDiffering = 0;
+}
+///Notes that the bytes from start to end, amountDiffering of which differ, don't match. They're added to the open range if they carry straight on from it.
+static void verify_noteMismatch(struct verify_comparison *_Nonnull const comparison, unsigned long long const start, unsigned long long const end, unsigned long long const amountDiffering) {
+	if (comparison->openRangeStart == comparison->openRangeEnd || comparison->openRangeEnd != start) {
+		verify_flushRange(comparison);
+		comparison->openRangeStart = start;
+	}
+	comparison->openRangeEnd = end;
+	comparison->openRangeAmountDiffering += amountDiffering;
+}
+static size_t countDifferences(unsigned char const *_Nonnull const source, unsigned char const *_Nonnull const destination, size_t const length) {
+	size_t count = 0;
+	for (size_t i = 0; i < length; ++i) {
+		count += source[i] != destination[i];
+	}
+	return count;
+}
+static void verify_compareBuffers(struct verify_comparison *_Nonnull const comparison, unsigned char const *_Nonnull const source, unsigned char const *_Nonnull const destination, size_t const length, unsigned long long const baseOffset) {
+	size_t position = 0;
+	while (position < length) {
+		size_t const differenceStart = position + blockFirstDifference(source + position, destination + position, length - position);
+		if (differenceStart == length) break;
+
+		size_t differenceEnd = (differenceStart / kMismatchGranularity + 1) * kMismatchGranularity;
+		if (differenceEnd > length) differenceEnd = length;
+		//Counting goes a byte at a time, but only through sectors that have differences in them.
+		size_t amountDiffering = countDifferences(source + differenceStart, destination + differenceStart, differenceEnd - differenceStart);
+		while (differenceEnd < length) {
+			size_t const granuleEnd = differenceEnd + kMismatchGranularity < length ? differenceEnd + kMismatchGranularity : length;
+			if (blockFirstDifference(source + differenceEnd, destination + differenceEnd, granuleEnd - differenceEnd) == granuleEnd - differenceEnd) break;
+			amountDiffering += countDifferences(source + differenceEnd, destination + differenceEnd, granuleEnd - differenceEnd);
+			differenceEnd = granuleEnd;
+		}
+		//The last sector may end with matching bytes; the range doesn't. This stops at the latest at differenceStart, which differs.
+		size_t lastDifferenceEnd = differenceEnd;
+		while (source[lastDifferenceEnd - 1] == destination[lastDifferenceEnd - 1]) --lastDifferenceEnd;
+		verify_noteMismatch(comparison, baseOffset + differenceStart, baseOffset + lastDifferenceEnd, amountDiffering);
+		position = differenceEnd;
+	}
+}
+
+char const *_Nullable verify_compare(int const sourceFD, int const destinationFD, unsigned long long const length, unsigned int const depth, size_t const bufferSize, size_t const alignment, FILE *_Nonnull const report, unsigned long long _Atomic *_Nonnull const totalAmountVerified, struct verify_result *_Nonnull const outResult) {
+	*outResult = (struct verify_result){ 0 };
+	if (! dropCachedPages(destinationFD)) {
+		fprintf(report, "Couldn't drop the destination's cached pages; some of it may be read from memory rather than the device\n");
+	}
+
+	size_t const pageSize = sysconf(_SC_PAGESIZE);
+	size_t const bufferAlignment = alignment > pageSize ? alignment : pageSize;
+	struct verify_reader source = {
+		.fd = sourceFD,
+		.length = length,
+		.alignment = alignment,
+		.ring = ring_create(depth, bufferSize, bufferAlignment),
+	};
+	struct verify_reader destination = {
+		.fd = destinationFD,
+		.length = length,
+		.alignment = alignment,
+		.ring = ring_create(depth, bufferSize, bufferAlignment),
+	};
+	char const *_Nullable failure = NULL;
+	if (source.ring == NULL || destination.ring == NULL) {
+		failure = "Could not allocate buffers";
+		goto cleanup;
+	}
+
+	pthread_t sourceThread, destinationThread;
+	if (pthread_create(&sourceThread, /*attr*/ NULL, verify_reader_main, &source) != 0) {
+		failure = "Could not start reader thread";
+		goto cleanup;
+	}
+	if (pthread_create(&destinationThread, /*attr*/ NULL, verify_reader_main, &destination) != 0) {
+		ring_cancel(source.ring);
+		pthread_join(sourceThread, /*retval*/ NULL);
+		failure = "Could not start reader thread";
+		goto cleanup;
+	}
+
+	struct verify_comparison comparison = { .report = report };
+	unsigned long long offset = 0;
+	struct ring_slot *_Nullable sourceSlot;
+	while ((sourceSlot = ring_acquireFilledSlot(source.ring)) != NULL) {
+		//Both readers read the same ranges in the same order, so each source slot lines up with the next destination slot, unless the destination has run out.
+		struct ring_slot *_Nullable const destinationSlot = ring_acquireFilledSlot(destination.ring);
+		size_t const destinationLength = destinationSlot != NULL ? destinationSlot->length : 0;
+		size_t const commonLength = destinationLength < sourceSlot->length ? destinationLength : sourceSlot->length;
+		if (commonLength > 0) {
+			verify_compareBuffers(&comparison, sourceSlot->buffer, destinationSlot->buffer, commonLength, offset);
+		}
+		if (commonLength < sourceSlot->length) {
+			//The destination ended before the source did (or couldn't be read). Everything past its end is a mismatch.
+			verify_noteMismatch(&comparison, offset + commonLength, offset + sourceSlot->length, sourceSlot->length - commonLength);
+		}
+		offset += sourceSlot->length;
+		*totalAmountVerified += sourceSlot->length;
+		ring_releaseSlot(source.ring);
+		if (destinationSlot != NULL) ring_releaseSlot(destination.ring);
+	}
+	verify_flushRange(&comparison);
+	comparison.result.amountCompared = offset;
+	*outResult = comparison.result;
+
+	//The destination may be longer than the source; we don't care about the rest of it.
+	ring_cancel(destination.ring);
+	pthread_join(sourceThread, /*retval*/ NULL);
+	pthread_join(destinationThread, /*retval*/ NULL);
+	failure = source.failure ?: destination.failure;
+
+cleanup:
+	if (source.ring != NULL) ring_destroy(source.ring);
+	if (destination.ring != NULL) ring_destroy(destination.ring);
+	//The readers' error buffers go away with this stack frame, so hand back a copy.
+	if (failure == source.errorBuffer || failure == destination.errorBuffer) {
+		strlcpy(errorBuffer, failure, errorCapacity);
+		failure = errorBuffer;
+	}
+	return failure;
+}
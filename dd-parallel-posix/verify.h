@@ -0,0 +1,29 @@
+//
+//  verify.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef verify_h
+#define verify_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+//Verification reads the source and the destination at the same time, each on its own thread filling its own buffer ring, and compares them on the calling thread as the buffers come in. So it takes about as long as reading the slower of the two, rather than the sum of both.
+
+struct verify_result {
+	unsigned long long amountCompared;
+	///How many bytes differ. Each range runs from its first differing byte to its last, but may have matching bytes in between, which aren't counted here.
+	unsigned long long amountMismatched;
+	unsigned long long numMismatchedRanges;
+};
+
+///Compares length bytes of sourceFD and destinationFD, both starting at offset 0, or everything up to the end of the source if length is ULLONG_MAX. The destination's cached pages are dropped first, so its data comes from the device. Each range that doesn't match is written to report as it's found (up to a limit), and *totalAmountVerified is added to as the comparison goes.
+///Both files are read with pread, so they must be seekable. alignment is the direct I/O alignment the buffers need (or 0). Returns NULL if the comparison ran to the end (matching or not; see outResult), or a description of the error that stopped it.
+char const *_Nullable verify_compare(int const sourceFD, int const destinationFD, unsigned long long const length, unsigned int const depth, size_t const bufferSize, size_t const alignment, FILE *_Nonnull const report, unsigned long long _Atomic *_Nonnull const totalAmountVerified, struct verify_result *_Nonnull const outResult);
+
+#endif /* verify_h */
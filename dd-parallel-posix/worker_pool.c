@@ -0,0 +1,187 @@
+//
+//  worker_pool.c
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "worker_pool.h"
+
+#include <stdlib.h>
+
+struct worker_pool {
+	void *_Nonnull context;
+	worker_pool_work_function _Nonnull work;
+	worker_pool_in_order_function _Nullable inOrderWork;
+	char const *_Nonnull threadName;
+	char const *_Nullable inOrderThreadName;
+	unsigned int maxBlocksInFlight;
+	//Whether the threads (not the in-order one) are done with each block.
+	bool *_Nonnull blocksDone;
+
+	//Each of these counts blocks from the first one. A block is at index number % maxBlocksInFlight. finished ≤ claimed ≤ submitted, and finished ≤ inOrderNext ≤ submitted.
+	unsigned long long numSubmitted;
+	unsigned long long numClaimed;
+	unsigned long long numFinished;
+	unsigned long long inOrderNext;
+
+	pthread_mutex_t lock;
+	pthread_cond_t workAvailable;
+	pthread_cond_t blockDone;
+	bool stopping;
+
+	unsigned int numThreads;
+	pthread_t *_Nonnull threads;
+	//Each thread takes the next of these as its own threadIndex.
+	unsigned int numThreadsStarted;
+	bool inOrderThreadStarted;
+	pthread_t inOrderThread;
+};
+
+static void *_Nullable worker_pool_thread_main(void *_Nonnull const arg) {
+	struct worker_pool *_Nonnull const pool = arg;
+	pthread_setname_self(pool->threadName);
+	pthread_mutex_lock(&pool->lock);
+	unsigned int const threadIndex = pool->numThreadsStarted++;
+	while (! pool->stopping) {
+		if (pool->numClaimed == pool->numSubmitted) {
+			pthread_cond_wait(&pool->workAvailable, &pool->lock);
+			continue;
+		}
+		unsigned int const blockIndex = (unsigned int)(pool->numClaimed++ % pool->maxBlocksInFlight);
+		pthread_mutex_unlock(&pool->lock);
+		pool->work(pool->context, threadIndex, blockIndex);
+		pthread_mutex_lock(&pool->lock);
+		pool->blocksDone[blockIndex] = true;
+		pthread_cond_broadcast(&pool->blockDone);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+static void *_Nullable worker_pool_in_order_thread_main(void *_Nonnull const arg) {
+	struct worker_pool *_Nonnull const pool = arg;
+	pthread_setname_self(pool->inOrderThreadName);
+	pthread_mutex_lock(&pool->lock);
+	while (! pool->stopping) {
+		if (pool->inOrderNext == pool->numSubmitted) {
+			pthread_cond_wait(&pool->workAvailable, &pool->lock);
+			continue;
+		}
+		unsigned int const blockIndex = (unsigned int)(pool->inOrderNext % pool->maxBlocksInFlight);
+		pthread_mutex_unlock(&pool->lock);
+		pool->inOrderWork(pool->context, blockIndex);
+		pthread_mutex_lock(&pool->lock);
+		++pool->inOrderNext;
+		pthread_cond_broadcast(&pool->blockDone);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+static void worker_pool_free(struct worker_pool *_Nonnull const pool) {
+	free(pool->blocksDone);
+	free(pool->threads);
+	pthread_cond_destroy(&pool->blockDone);
+	pthread_cond_destroy(&pool->workAvailable);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+void worker_pool_stop(struct worker_pool *_Nonnull const pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->workAvailable);
+	pthread_cond_broadcast(&pool->blockDone);
+	pthread_mutex_unlock(&pool->lock);
+	for (unsigned int i = 0; i < pool->numThreads; ++i) {
+		pthread_join(pool->threads[i], /*retval*/ NULL);
+	}
+	pool->numThreads = 0;
+	if (pool->inOrderThreadStarted) {
+		pthread_join(pool->inOrderThread, /*retval*/ NULL);
+		pool->inOrderThreadStarted = false;
+	}
+}
+void worker_pool_destroy(struct worker_pool *_Nonnull const pool) {
+	worker_pool_stop(pool);
+	worker_pool_free(pool);
+}
+
+struct worker_pool *_Nullable worker_pool_create(unsigned int const numThreads, unsigned int const maxBlocksInFlight, void *_Nonnull const context, worker_pool_work_function _Nonnull const work, char const *_Nonnull const threadName, worker_pool_in_order_function _Nullable const inOrderWork, char const *_Nullable const inOrderThreadName) {
+	struct worker_pool *_Nullable const pool = calloc(1, sizeof(struct worker_pool));
+	if (pool == NULL) return NULL;
+	pool->context = context;
+	pool->work = work;
+	pool->inOrderWork = inOrderWork;
+	pool->threadName = threadName;
+	pool->inOrderThreadName = inOrderThreadName != NULL ? inOrderThreadName : threadName;
+	pool->maxBlocksInFlight = maxBlocksInFlight;
+	pthread_mutex_init(&pool->lock, /*attr*/ NULL);
+	pthread_cond_init(&pool->workAvailable, /*attr*/ NULL);
+	pthread_cond_init(&pool->blockDone, /*attr*/ NULL);
+	pool->blocksDone = calloc(maxBlocksInFlight, sizeof(bool));
+	pool->threads = calloc(numThreads, sizeof(pthread_t));
+	if (pool->blocksDone == NULL || pool->threads == NULL) {
+		worker_pool_free(pool);
+		return NULL;
+	}
+
+	for (; pool->numThreads < numThreads; ++pool->numThreads) {
+		if (pthread_create(&pool->threads[pool->numThreads], /*attr*/ NULL, worker_pool_thread_main, pool) != 0) break;
+	}
+	if (inOrderWork != NULL) {
+		pool->inOrderThreadStarted = pthread_create(&pool->inOrderThread, /*attr*/ NULL, worker_pool_in_order_thread_main, pool) == 0;
+	}
+	if (pool->numThreads == 0 || (inOrderWork != NULL && ! pool->inOrderThreadStarted)) {
+		worker_pool_destroy(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+unsigned int worker_pool_reserve(struct worker_pool *_Nonnull const pool) {
+	pthread_mutex_lock(&pool->lock);
+	//The ring the blocks come from shouldn't let this happen, but if it does, wait for the writer to make room.
+	while (pool->numSubmitted - pool->numFinished >= pool->maxBlocksInFlight && ! pool->stopping) {
+		pthread_cond_wait(&pool->blockDone, &pool->lock);
+	}
+	unsigned int const blockIndex = (unsigned int)(pool->numSubmitted % pool->maxBlocksInFlight);
+	pthread_mutex_unlock(&pool->lock);
+	return blockIndex;
+}
+void worker_pool_submit(struct worker_pool *_Nonnull const pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->blocksDone[pool->numSubmitted % pool->maxBlocksInFlight] = false;
+	++pool->numSubmitted;
+	pthread_cond_broadcast(&pool->workAvailable);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+bool worker_pool_waitForNext(struct worker_pool *_Nonnull const pool, unsigned int *_Nonnull const outBlockIndex) {
+	pthread_mutex_lock(&pool->lock);
+	if (pool->numFinished == pool->numSubmitted) {
+		pthread_mutex_unlock(&pool->lock);
+		return false;
+	}
+	unsigned int const blockIndex = (unsigned int)(pool->numFinished % pool->maxBlocksInFlight);
+	bool isDone = false;
+	while (! (isDone = pool->blocksDone[blockIndex] && (pool->inOrderWork == NULL || pool->inOrderNext > pool->numFinished)) && ! pool->stopping) {
+		pthread_cond_wait(&pool->blockDone, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	*outBlockIndex = blockIndex;
+	return isDone;
+}
+void worker_pool_finish(struct worker_pool *_Nonnull const pool) {
+	pthread_mutex_lock(&pool->lock);
+	++pool->numFinished;
+	pthread_cond_broadcast(&pool->blockDone);
+	pthread_mutex_unlock(&pool->lock);
+}
+unsigned long long worker_pool_numUnfinished(struct worker_pool *_Nonnull const pool) {
+	pthread_mutex_lock(&pool->lock);
+	unsigned long long const numUnfinished = pool->numSubmitted - pool->numFinished;
+	pthread_mutex_unlock(&pool->lock);
+	return numUnfinished;
+}
@@ -0,0 +1,45 @@
+//
+//  worker_pool.h
+//  dd-parallel-posix
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#ifndef worker_pool_h
+#define worker_pool_h
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+//A worker pool does something to each block that passes between the reader and the writer (hash it, compress it, store it), on several threads at once, and hands the blocks back in the order they came in.
+//The pool doesn't hold the blocks itself. Its owner keeps an array of maxBlocksInFlight of whatever it needs to know about each one, and the pool says which element to fill in, work on, or take the result from. One thread submits blocks and one thread finishes them, in order; any number of blocks in between may be in the works.
+//A pool can also have an in-order stage: one more thread that goes through every block in the order they were submitted, alongside the others (such as for a digest of the whole image, which can't be split up). A block isn't ready to be finished until both have done it.
+
+struct worker_pool;
+
+///Called on a pool thread to work on the block at blockIndex. threadIndex says which of the pool's threads this is, from 0 to numThreads - 1, so each can have things of its own to work with.
+typedef void (*worker_pool_work_function)(void *_Nonnull const context, unsigned int const threadIndex, unsigned int const blockIndex);
+///Called on the in-order thread for each block at blockIndex, one at a time, in order.
+typedef void (*worker_pool_in_order_function)(void *_Nonnull const context, unsigned int const blockIndex);
+
+///Starts up to numThreads threads that call work for each block, named threadName, and, if inOrderWork isn't NULL, one more that calls it, named inOrderThreadName. Returns NULL if none of the first kind, or the in-order one, could be started.
+struct worker_pool *_Nullable worker_pool_create(unsigned int const numThreads, unsigned int const maxBlocksInFlight, void *_Nonnull const context, worker_pool_work_function _Nonnull const work, char const *_Nonnull const threadName, worker_pool_in_order_function _Nullable const inOrderWork, char const *_Nullable const inOrderThreadName);
+///Tells the threads to stop and waits for them. Each one finishes whatever block it's in the middle of first. Anyone waiting for room to submit a block, or for a block to finish, stops waiting.
+void worker_pool_stop(struct worker_pool *_Nonnull const pool);
+///Stops the pool if it hasn't been, and frees it.
+void worker_pool_destroy(struct worker_pool *_Nonnull const pool);
+
+///Waits until there's room for another block, and returns the index in the owner's array that it goes at. The owner fills that element in, and then calls worker_pool_submit.
+unsigned int worker_pool_reserve(struct worker_pool *_Nonnull const pool);
+///Hands the block at the index worker_pool_reserve returned to the threads.
+void worker_pool_submit(struct worker_pool *_Nonnull const pool);
+
+///Waits until the oldest block that hasn't been finished is done, and sets *outBlockIndex to its index. Returns false if every block submitted has been finished, or the pool was stopped before this one was done. The owner takes what it needs from that element, and then calls worker_pool_finish.
+bool worker_pool_waitForNext(struct worker_pool *_Nonnull const pool, unsigned int *_Nonnull const outBlockIndex);
+///Lets the element of the block worker_pool_waitForNext returned be used for another.
+void worker_pool_finish(struct worker_pool *_Nonnull const pool);
+///How many blocks have been submitted and not yet finished.
+unsigned long long worker_pool_numUnfinished(struct worker_pool *_Nonnull const pool);
+
+#endif /* worker_pool_h */
@@ -7,11 +7,13 @@
 //
 
 //This tool generates a test file in which each mebibyte is serially numbered. The first 16 bytes are allocated to an ASCII representation of the number; after that, the number is splatted down the rest of the chunk as a 32-bit number.
+//Other profiles fill the rest of each mebibyte with something else (zeros, text, noise), to exercise the copier's fast paths. Whatever the profile, each mebibyte still starts with the ASCII number and ends with the 32-bit number, which is what cktest checks.
+//The mebibytes are generated on a pool of threads, while the main thread writes them out in order, so mktest can keep up with the devices it's making test files for.
 
 #include "formatting_utils.h"
+#include "test_patterns.h"
 
-//For htonl
-#include <arpa/inet.h>
+#include <sys/stat.h>
 
 #if SHOW_DEBUG_LOGGING
 #	define LOG(...) fprintf(stderr, __VA_ARGS__)
@@ -26,28 +28,87 @@ static const size_t kBufferSize = MILLIONS(1,048,576);
 typedef double time_fractional_t;
 typedef unsigned int UnsignedInt32;
 
+//Buffers are page-aligned, which is more than the vector code in test_patterns.c needs.
+enum { kBufferAlignment = 4096 };
+
+static enum test_profile profile = profile_serial;
+//In a sparse file, how much at each end of each mebibyte gets written; the rest is a hole. This is at least a block on any file-system likely to be making holes.
+enum { kSparseDataSize = 64 * 1024 };
+
 static time_fractional_t timeWithFraction(void);
 
 static time_fractional_t copyStartedTime, copyFinishedTime;
 static unsigned long long _Atomic totalAmountCopied = 0;
 static UnsignedInt32 _Atomic serialNumber = 0; //By definition, is equal to totalAmountCopied / kBufferSize.
 static int outputFD;
-static void *buffer;
+
+//Each mebibyte is generated into the slot numbered its serial number modulo numSlots, which is free once the mebibyte numSlots before it has been written.
+struct generator_slot {
+	void *_Nonnull buffer;
+	UnsignedInt32 serialNumber;
+	bool isFull;
+};
+static struct generator_slot *_Nullable slots = NULL;
+static unsigned int numSlots = 0;
+static unsigned long long numBlocks = 0;
+static unsigned long long nextSerialToGenerate = 0;
+static unsigned long long numBlocksWritten = 0;
+static bool stopping = false;
+static pthread_mutex_t slotsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slotFilled = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t slotEmptied = PTHREAD_COND_INITIALIZER;
 
 static void logProgress(bool const isFinal);
 static void handleSIGINFO(int const signal);
 static bool pathIsHyphen(char const *const arg);
 static unsigned long long parseSize(char const *arg);
-static void fillBuffer(void *buf, UnsignedInt32 serialNumber);
+static void printUsage(FILE *_Nonnull const file, char const *_Nonnull const argv0);
+static void *_Nullable generator_main(void *_Nullable const arg);
+static bool writeFully(void const *_Nonnull const buf, size_t const length);
 
 int main(int argc, const char * argv[]) {
-	//TEMP FIXME Need actual argument handling here
-	unsigned long long desiredSize = parseSize(argv[1]);
-	outputFD = pathIsHyphen(argv[2]) ? STDOUT_FILENO : open(argv[2], O_WRONLY | O_CREAT, 0644);
+	unsigned int numThreads = 0;
+	int argIdx = 1;
+	for (; argIdx < argc && argv[argIdx][0] == '-' && argv[argIdx][1] == '-'; ++argIdx) {
+		char const *_Nonnull const arg = argv[argIdx];
+		if (strcmp(arg, "--help") == 0) {
+			printUsage(stdout, argv[0]);
+			return EXIT_SUCCESS;
+		} else if (strcmp(arg, "--profile") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			if (! test_patterns_profileNamed(argv[argIdx], &profile)) {
+				fprintf(stderr, "mktest: unknown profile %s\n", argv[argIdx]);
+				goto usageError;
+			}
+		} else if (strcmp(arg, "--threads") == 0) {
+			if (++argIdx >= argc) goto usageError;
+			numThreads = (unsigned int)strtoul(argv[argIdx], NULL, 10);
+			if (numThreads == 0) goto usageError;
+		} else {
+			goto usageError;
+		}
+	}
+	if (argc - argIdx != 2) goto usageError;
+
+	unsigned long long desiredSize = parseSize(argv[argIdx]);
+	outputFD = pathIsHyphen(argv[argIdx + 1]) ? STDOUT_FILENO : open(argv[argIdx + 1], O_WRONLY | O_CREAT, 0644);
 	if (outputFD < 0) return EX_CANTCREAT;
+	//Holes can only be left in a regular file. Anything already in it would show through them, so start it empty.
+	struct stat sb;
+	bool const makeHoles = (profile == profile_sparse) && fstat(outputFD, &sb) == 0 && S_ISREG(sb.st_mode) && ftruncate(outputFD, 0) == 0;
 
-	buffer = malloc(kBufferSize);
-	if (buffer == NULL) return EX_OSERR;
+	if (numThreads == 0) {
+		long const numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+		numThreads = numCPUs > 1 ? (unsigned int)numCPUs : 1;
+	}
+	//Enough slots that every thread can be generating one while the main thread writes another and the next one is waiting.
+	numSlots = numThreads * 2 + 1;
+	slots = calloc(numSlots, sizeof(struct generator_slot));
+	if (slots == NULL) return EX_OSERR;
+	for (unsigned int i = 0; i < numSlots; ++i) {
+		if (posix_memalign(&slots[i].buffer, kBufferAlignment, kBufferSize) != 0) return EX_OSERR;
+	}
+	if (! test_patterns_prepare(profile)) return EX_OSERR;
 
 	struct sigaction onSIGINFO = {
 		.sa_handler = handleSIGINFO,
@@ -60,25 +121,76 @@ int main(int argc, const char * argv[]) {
 
 	copyStartedTime = timeWithFraction();
 
-	while (totalAmountCopied < desiredSize) {
-		fillBuffer(buffer, serialNumber);
-		ssize_t thisAmountCopied = write(outputFD, buffer, kBufferSize);
-		if (thisAmountCopied < 0) {
+	numBlocks = (desiredSize + kBufferSize - 1) / kBufferSize;
+	pthread_t *_Nullable const threads = calloc(numThreads, sizeof(pthread_t));
+	if (threads == NULL) return EX_OSERR;
+	unsigned int numThreadsStarted = 0;
+	for (; numThreadsStarted < numThreads; ++numThreadsStarted) {
+		if (pthread_create(&threads[numThreadsStarted], /*attr*/ NULL, generator_main, /*arg*/ NULL) != 0) break;
+	}
+	if (numThreadsStarted == 0) return EX_OSERR;
+
+	for (; serialNumber < numBlocks; ++serialNumber) {
+		struct generator_slot *_Nonnull const slot = &slots[serialNumber % numSlots];
+		pthread_mutex_lock(&slotsLock);
+		while (! (slot->isFull && slot->serialNumber == serialNumber)) {
+			pthread_cond_wait(&slotFilled, &slotsLock);
+		}
+		pthread_mutex_unlock(&slotsLock);
+
+		bool written;
+		if (makeHoles) {
+			written = writeFully(slot->buffer, kSparseDataSize)
+				&& lseek(outputFD, kBufferSize - kSparseDataSize * 2, SEEK_CUR) >= 0
+				&& writeFully(slot->buffer + kBufferSize - kSparseDataSize, kSparseDataSize);
+		} else {
+			written = writeFully(slot->buffer, kBufferSize);
+		}
+
+		pthread_mutex_lock(&slotsLock);
+		slot->isFull = false;
+		++numBlocksWritten;
+		if (! written) stopping = true;
+		pthread_cond_broadcast(&slotEmptied);
+		pthread_mutex_unlock(&slotsLock);
+		if (! written) {
 			fprintf(stderr, "Write of block #%u failed: %s\n", serialNumber, strerror(errno));
 			status = EX_IOERR;
 			break;
 		}
-		++serialNumber;
-		totalAmountCopied += thisAmountCopied;
+		totalAmountCopied += kBufferSize;
 	}
 
-	free(buffer);
+	for (unsigned int i = 0; i < numThreadsStarted; ++i) {
+		pthread_join(threads[i], /*retval*/ NULL);
+	}
+	free(threads);
+	for (unsigned int i = 0; i < numSlots; ++i) {
+		free(slots[i].buffer);
+	}
+	free(slots);
 
 	ftruncate(outputFD, totalAmountCopied);
 	copyFinishedTime = timeWithFraction();
 	logProgress(true);
 
 	return status;
+
+usageError:
+	printUsage(stderr, argv[0]);
+	return EX_USAGE;
+}
+
+static void printUsage(FILE *_Nonnull const file, char const *_Nonnull const argv0) {
+	fprintf(file,
+		"Usage: %s [options] size out-file\n"
+		"Writes size bytes (rounded up to a whole mebibyte) of test data, for cktest to check, to out-file, or - for standard output.\n"
+		"Options:\n"
+		"  --profile NAME   What to fill each mebibyte with, after its serial number:\n",
+		argv0);
+	test_patterns_printProfiles(file);
+	fprintf(file,
+		"  --threads N      Generate with N threads (default: one per CPU)\n");
 }
 
 static bool pathIsHyphen(char const *const arg) {
@@ -115,14 +227,40 @@ static unsigned long long parseSize(char const *arg) {
 	return wholePart;
 }
 
-static void fillBuffer(void *buf, UnsignedInt32 serialNumber) {
-	enum { maxIdx = kBufferSize / sizeof(UnsignedInt32) };
-	register UnsignedInt32 *buf32 = buf;
-	register UnsignedInt32 value = htonl(serialNumber);
-	for (register unsigned int i = 0U; i < maxIdx; ++i) {
-		buf32[i] = value;
+#pragma mark Generating
+
+static void *_Nullable generator_main(void *_Nullable const arg) {
+	pthread_setname_self("Generator thread");
+	pthread_mutex_lock(&slotsLock);
+	while (! stopping && nextSerialToGenerate < numBlocks) {
+		UnsignedInt32 const serialNumber = (UnsignedInt32)nextSerialToGenerate++;
+		struct generator_slot *_Nonnull const slot = &slots[serialNumber % numSlots];
+		while (! stopping && serialNumber >= numBlocksWritten + numSlots) {
+			pthread_cond_wait(&slotEmptied, &slotsLock);
+		}
+		if (stopping) break;
+		pthread_mutex_unlock(&slotsLock);
+		test_patterns_fillBlock(slot->buffer, kBufferSize, serialNumber, profile);
+		pthread_mutex_lock(&slotsLock);
+		slot->serialNumber = serialNumber;
+		slot->isFull = true;
+		pthread_cond_broadcast(&slotFilled);
+	}
+	pthread_mutex_unlock(&slotsLock);
+	return NULL;
+}
+
+static bool writeFully(void const *_Nonnull const buf, size_t const length) {
+	size_t offset = 0;
+	while (offset < length) {
+		ssize_t const amtWritten = write(outputFD, (unsigned char const *)buf + offset, length - offset);
+		if (amtWritten < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		offset += amtWritten;
 	}
-	sprintf(buf, "%'-12u%c%c%c\n", serialNumber, 0, 0, 0);
+	return true;
 }
 
 #pragma mark -
@@ -0,0 +1,164 @@
+//
+//  test_patterns.c
+//  dd-parallel-posix/mktest
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+#include "test_patterns.h"
+
+//For htonl
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Same as in dd-parallel-posix/block_utils.c: Clang and GCC lower these to whatever vector registers the target has.
+typedef uint64_t vector_u64 __attribute__((vector_size(16)));
+typedef uint32_t vector_u32 __attribute__((vector_size(16)));
+enum {
+	kVectorSize = sizeof(vector_u64),
+	kVectorsPerStride = 8,
+	kStrideSize = kVectorSize * kVectorsPerStride,
+};
+
+static struct {
+	char const *_Nonnull name;
+	char const *_Nonnull description;
+} const kProfiles[] = {
+	[profile_serial] = { "serial", "the serial number, over and over (the default)" },
+	[profile_zeros] = { "zeros", "zeros" },
+	[profile_sparse] = { "sparse", "zeros, which mktest leaves as holes in the file where it can have them (all but the first and last 64 KiB)" },
+	[profile_text] = { "text", "log-like text, which compresses well" },
+	[profile_random] = { "random", "pseudo-random noise, which doesn't compress at all" },
+	[profile_duplicates] = { "duplicates", "one of eight patterns of noise, so that at block sizes under 1 MiB, most blocks are duplicates" },
+	[profile_mixed] = { "mixed", "each of the above but sparse in turn, a mebibyte at a time" },
+};
+enum { kNumProfiles = sizeof(kProfiles) / sizeof(*kProfiles) };
+enum { kNumDuplicatePatterns = 8 };
+//The text profile copies from this much text, made once at the start.
+enum { kTextTemplateSize = 256 * 1024 };
+static char *_Nullable textTemplate = NULL;
+
+bool test_patterns_profileNamed(char const *_Nonnull const name, enum test_profile *_Nonnull const outProfile) {
+	for (unsigned int i = 0; i < kNumProfiles; ++i) {
+		if (strcmp(name, kProfiles[i].name) == 0) {
+			*outProfile = i;
+			return true;
+		}
+	}
+	return false;
+}
+void test_patterns_printProfiles(FILE *_Nonnull const file) {
+	for (unsigned int i = 0; i < kNumProfiles; ++i) {
+		fprintf(file, "    %-12s %s\n", kProfiles[i].name, kProfiles[i].description);
+	}
+}
+
+//splitmix64, for seeding the noise generators from a serial number.
+static uint64_t nextSeed(uint64_t *_Nonnull const state) {
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static void makeTextTemplate(char *_Nonnull const text) {
+	static char const *_Nonnull const kMessages[] = {
+		"sd 0:0:0:0: [sda] Synchronizing SCSI cache",
+		"EXT4-fs (sda1): mounted filesystem with ordered data mode",
+		"usb 1-1: new high-speed USB device number 2 using xhci_hcd",
+		"systemd[1]: Started Daily Cleanup of Temporary Directories.",
+		"nvme nvme0: 8/0/0 default/read/poll queues",
+		"audit: type=1400 apparmor=\"STATUS\" operation=\"profile_load\"",
+	};
+	enum { kNumMessages = sizeof(kMessages) / sizeof(*kMessages) };
+	uint64_t seed = 1;
+	size_t length = 0;
+	for (unsigned int line = 0; length < kTextTemplateSize; ++line) {
+		uint64_t const choice = nextSeed(&seed);
+		char lineBuffer[160];
+		int const lineLength = snprintf(lineBuffer, sizeof(lineBuffer), "Oct 17 %02u:%02u:%02u host%u kernel: [%6u.%06u] %s\n",
+			(line / 3600) % 24, (line / 60) % 60, line % 60, (unsigned int)(choice % 4), line, (unsigned int)(choice >> 40) % 1000000, kMessages[(choice >> 8) % kNumMessages]);
+		size_t const amountToCopy = (size_t)lineLength < kTextTemplateSize - length ? (size_t)lineLength : kTextTemplateSize - length;
+		memcpy(text + length, lineBuffer, amountToCopy);
+		length += amountToCopy;
+	}
+}
+
+bool test_patterns_prepare(enum test_profile const profile) {
+	if ((profile == profile_text || profile == profile_mixed) && textTemplate == NULL) {
+		textTemplate = malloc(kTextTemplateSize);
+		if (textTemplate == NULL) return false;
+		makeTextTemplate(textTemplate);
+	}
+	return true;
+}
+
+///Fills the buffer with the 32-bit value, a whole stride of vectors at a time. length must be a multiple of kStrideSize.
+static void fillSplat(unsigned char *_Nonnull const buf, size_t const length, uint32_t const value) {
+	vector_u32 const vector = { value, value, value, value };
+	for (size_t offset = 0; offset < length; offset += kStrideSize) {
+		for (unsigned int i = 0; i < kVectorsPerStride; ++i) {
+			memcpy(buf + offset + i * kVectorSize, &vector, kVectorSize);
+		}
+	}
+}
+///Fills the buffer with noise that depends only on seed. Each vector in a stride has its own xorshift generators, one per lane, so they all run at once. length must be a multiple of kStrideSize.
+static void fillRandom(unsigned char *_Nonnull const buf, size_t const length, uint64_t seed) {
+	vector_u64 state[kVectorsPerStride];
+	for (unsigned int i = 0; i < kVectorsPerStride; ++i) {
+		state[i] = (vector_u64){ nextSeed(&seed) | 1, nextSeed(&seed) | 1 };
+	}
+	for (size_t offset = 0; offset < length; offset += kStrideSize) {
+		for (unsigned int i = 0; i < kVectorsPerStride; ++i) {
+			vector_u64 x = state[i];
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			state[i] = x;
+			memcpy(buf + offset + i * kVectorSize, &x, kVectorSize);
+		}
+	}
+}
+///Copies the text template into the buffer, starting from a place that depends on the serial number so no two mebibytes are quite the same.
+static void fillText(unsigned char *_Nonnull const buf, size_t const length, unsigned int const serialNumber) {
+	size_t templateOffset = (serialNumber * 4099ULL) % kTextTemplateSize;
+	for (size_t offset = 0; offset < length; ) {
+		size_t const chunkLength = length - offset < kTextTemplateSize - templateOffset ? length - offset : kTextTemplateSize - templateOffset;
+		memcpy(buf + offset, textTemplate + templateOffset, chunkLength);
+		offset += chunkLength;
+		templateOffset = 0;
+	}
+}
+
+void test_patterns_fillBlock(void *_Nonnull const buf, size_t const length, unsigned int const serialNumber, enum test_profile const profile) {
+	enum test_profile thisProfile = profile;
+	if (thisProfile == profile_mixed) {
+		static enum test_profile const kMixedProfiles[] = { profile_serial, profile_zeros, profile_text, profile_random, profile_duplicates };
+		thisProfile = kMixedProfiles[serialNumber % (sizeof(kMixedProfiles) / sizeof(*kMixedProfiles))];
+	}
+	switch (thisProfile) {
+		case profile_serial:
+		case profile_mixed:
+			fillSplat(buf, length, htonl(serialNumber));
+			break;
+		case profile_zeros:
+		case profile_sparse:
+			memset(buf, 0, length);
+			break;
+		case profile_text:
+			fillText(buf, length, serialNumber);
+			break;
+		case profile_random:
+			fillRandom(buf, length, serialNumber);
+			break;
+		case profile_duplicates:
+			fillRandom(buf, length, ~(uint64_t)(serialNumber % kNumDuplicatePatterns));
+			break;
+	}
+	sprintf(buf, "%'-12u%c%c%c\n", serialNumber, 0, 0, 0);
+	unsigned int const tail = htonl(serialNumber);
+	memcpy((unsigned char *)buf + length - sizeof(tail), &tail, sizeof(tail));
+}
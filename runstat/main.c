@@ -0,0 +1,76 @@
+//
+//  main.c
+//  dd-parallel-posix/runstat
+//
+//  Created by Peter Hosey on 2026-10-17.
+//  Copyright © 2026 Peter Hosey. All rights reserved.
+//
+
+//This tool runs a command and records how long it took, how much CPU time it used, and how much memory it used at its peak, for bench.sh. (Not every system's time(1) can report all of those, and the ones that can don't agree on how.)
+//Usage: runstat stats-file command [arguments…]
+//The command's output goes where runstat's does. stats-file gets one line: wall-clock seconds, user CPU seconds, system CPU seconds, peak resident set size in bytes, and the command's exit status (or 128 plus the signal that killed it).
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+typedef double time_fractional_t;
+
+static time_fractional_t timeWithFraction(void);
+static time_fractional_t secondsFromTimeval(struct timeval const tv);
+
+int main(int argc, const char * argv[]) {
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s stats-file command [arguments…]\n", argv[0]);
+		return EX_USAGE;
+	}
+	FILE *_Nullable const statsFile = fopen(argv[1], "w");
+	if (statsFile == NULL) {
+		perror(argv[1]);
+		return EX_CANTCREAT;
+	}
+
+	time_fractional_t const startedTime = timeWithFraction();
+	pid_t const child = fork();
+	if (child < 0) {
+		perror("fork");
+		return EX_OSERR;
+	}
+	if (child == 0) {
+		execvp(argv[2], (char *const *)(argv + 2));
+		perror(argv[2]);
+		_exit(EX_UNAVAILABLE);
+	}
+
+	int waitStatus = 0;
+	struct rusage usage = { 0 };
+	while (wait4(child, &waitStatus, /*options*/ 0, &usage) < 0) {
+		if (errno != EINTR) {
+			perror("wait4");
+			return EX_OSERR;
+		}
+	}
+	time_fractional_t const finishedTime = timeWithFraction();
+
+	//Linux counts ru_maxrss in kibibytes; macOS counts it in bytes.
+#if __APPLE__
+	unsigned long long const peakRSSBytes = usage.ru_maxrss;
+#else
+	unsigned long long const peakRSSBytes = usage.ru_maxrss * 1024ULL;
+#endif
+	int const exitStatus = WIFEXITED(waitStatus) ? WEXITSTATUS(waitStatus) : 128 + WTERMSIG(waitStatus);
+	fprintf(statsFile, "%.6f %.6f %.6f %llu %d\n", finishedTime - startedTime, secondsFromTimeval(usage.ru_utime), secondsFromTimeval(usage.ru_stime), peakRSSBytes, exitStatus);
+	if (fclose(statsFile) != 0) {
+		perror(argv[1]);
+		return EX_IOERR;
+	}
+	return exitStatus;
+}
+
+static time_fractional_t timeWithFraction(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_THEGOODONE, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+static time_fractional_t secondsFromTimeval(struct timeval const tv) {
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}